@@ -19,81 +19,323 @@
 
 #define LOG_LOCAL_LEVEL ESP_LOG_VERBOSE
 
+#include <math.h>
 #include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
 #include "esp_log.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "esp_system.h"
+#include "esp_timer.h"
 #include "driver/gpio.h"
+#include "driver/rmt.h"
+#include "freertos/ringbuf.h"
 
 #include "DHT22.h"
+#include "DHT22_sched.h"
+#include "http_server.h"
+#include "sample_log.h"
+#include "sensor_history.h"
 #include "tasks_common.h"
+#include "trace.h"
 
 // == global defines =============================================
 
 static const char* TAG = "DHT";
 
-int DHTgpio = 4;				// my default DHT pin = 4
-float humidity = 0.;
-float temperature = 0.;
+/**
+ * Sequence locked sample slot. The DHT22 task is the only writer; seq is odd while it
+ * updates sample, so readers on any core retry instead of copying a torn sample.
+ */
+typedef struct
+{
+	atomic_uint seq;
+	volatile dht22_sample_t sample;
+} dht22_sample_slot_t;
+
+static dht22_sensor_t dhtSensors[ DHT_MAX_SENSORS ];
+static dht22_sample_slot_t dhtSamples[ DHT_MAX_SENSORS ];
+static dht22_sched_t dhtSchedules[ DHT_MAX_SENSORS ];
+static sensor_filter_t dhtFilters[ DHT_MAX_SENSORS ];
+static sensor_filter_config_t dhtFilterConfigs[ DHT_MAX_SENSORS ];
+static uint32_t dhtMinPeriodMs = DHT_MIN_PERIOD_MS;
+static uint32_t dhtMaxPeriodMs = DHT_MAX_PERIOD_MS;
+static int dhtSensorCount = 0;
+static atomic_uint dhtVersion;						// bumped whenever anything DHT22_get_* reports changes
+static TaskHandle_t dhtTask = NULL;
+
+// Settings changed from other tasks wait here until the DHT22 task applies them between
+// two reads, so a read never sees them change halfway
+static portMUX_TYPE dhtPendingLock = portMUX_INITIALIZER_UNLOCKED;
+static sensor_filter_config_t dhtPendingFilterConfigs[ DHT_MAX_SENSORS ];
+static uint32_t dhtPendingFilters;					// bit per sensor with a new filter config
+static uint32_t dhtPendingMinPeriodMs;
+static uint32_t dhtPendingMaxPeriodMs;
+static bool dhtPendingLimits;						// new period limits waiting
+
+static RingbufHandle_t dhtRmtRingbuf = NULL;	// RMT receive buffer, NULL until first read
+static int dhtRmtGpio = -1;						// pin currently routed to the RMT input
+
+// == sensor table ================================================
+
+static void setOpenDrain( int gpio )
+{
+	// open drain: the same pin sends the start signal and feeds the RMT input
+	gpio_set_direction( gpio, GPIO_MODE_INPUT_OUTPUT_OD );
+	gpio_set_pull_mode( gpio, GPIO_PULLUP_ONLY );
+	gpio_set_level( gpio, 1 );
+}
+
+static void configureSensorPin( int gpio )
+{
+	gpio_reset_pin( gpio );
+	setOpenDrain( gpio );
+}
+
+int DHT22_add_sensor( int gpio )
+{
+	for( int k = 0; k < dhtSensorCount; k++ )
+		if( dhtSensors[k].gpio == gpio ) return k;
+
+	if( dhtSensorCount >= DHT_MAX_SENSORS ) {
+		ESP_LOGE( TAG, "Sensor table full, GPIO %d not added\n", gpio );
+		return -1;
+	}
+
+	dht22_sensor_t *sensor = &dhtSensors[ dhtSensorCount ];
+	memset( sensor, 0, sizeof(*sensor) );
+	sensor->gpio = gpio;
+	dhtSamples[ dhtSensorCount ].sample.status = DHT_TIMEOUT_ERROR;	// nothing read yet
+	dhtFilterConfigs[ dhtSensorCount ] = (sensor_filter_config_t) SENSOR_FILTER_CONFIG_DEFAULT();
+	sensor_filter_reset( &dhtFilters[ dhtSensorCount ] );
+	DHT22_sched_init( &dhtSchedules[ dhtSensorCount ], esp_timer_get_time() / 1000, 0,
+			DHT_SAMPLE_PERIOD_MS, dhtMinPeriodMs, dhtMaxPeriodMs, DHT_MIN_INTERVAL_MS );
+	configureSensorPin( gpio );
+	atomic_fetch_add( &dhtVersion, 1 );
+
+	return dhtSensorCount++;
+}
+
+int DHT22_sensor_count(void) { return dhtSensorCount; }
+
+void DHT22_set_period_limits( uint32_t min_ms, uint32_t max_ms )
+{
+	portENTER_CRITICAL( &dhtPendingLock );
+	dhtPendingMinPeriodMs = min_ms;
+	dhtPendingMaxPeriodMs = max_ms;
+	dhtPendingLimits = true;
+	portEXIT_CRITICAL( &dhtPendingLock );
+
+	if( dhtTask ) xTaskNotifyGive( dhtTask );
+}
+
+void DHT22_set_filter_config( int index, const sensor_filter_config_t *config )
+{
+	if( index < 0 || index >= dhtSensorCount ) return;
+
+	portENTER_CRITICAL( &dhtPendingLock );
+	dhtPendingFilterConfigs[ index ] = *config;
+	dhtPendingFilters |= 1u << index;
+	portEXIT_CRITICAL( &dhtPendingLock );
+
+	if( dhtTask ) xTaskNotifyGive( dhtTask );
+}
+
+/**
+ * Applies the settings other tasks changed since the last call; runs on the DHT22 task.
+ */
+static void applyPendingSettings( void )
+{
+	sensor_filter_config_t configs[ DHT_MAX_SENSORS ];
+	uint32_t filters, min_ms, max_ms;
+	bool limits;
+
+	portENTER_CRITICAL( &dhtPendingLock );
+	filters = dhtPendingFilters;
+	dhtPendingFilters = 0;
+	memcpy( configs, dhtPendingFilterConfigs, sizeof(configs) );
+	limits = dhtPendingLimits;
+	dhtPendingLimits = false;
+	min_ms = dhtPendingMinPeriodMs;
+	max_ms = dhtPendingMaxPeriodMs;
+	portEXIT_CRITICAL( &dhtPendingLock );
+
+	for( int k = 0; k < dhtSensorCount; k++ ) {
+		if( filters & (1u << k) ) {
+			dhtFilterConfigs[k] = configs[k];
+			sensor_filter_reset( &dhtFilters[k] );
+		}
+	}
+
+	if( limits ) {
+		dhtMinPeriodMs = min_ms;
+		dhtMaxPeriodMs = max_ms;
+		for( int k = 0; k < dhtSensorCount; k++ )
+			DHT22_sched_set_limits( &dhtSchedules[k], min_ms, max_ms );
+		atomic_fetch_add( &dhtVersion, 1 );
+	}
+}
+
+uint32_t DHT22_get_period( int index )
+{
+	if( index < 0 || index >= dhtSensorCount ) return 0;
+	return dhtSchedules[ index ].period_ms;
+}
+
+unsigned DHT22_get_version(void)
+{
+	return atomic_load( &dhtVersion );
+}
+
+const dht22_sensor_t *DHT22_get_sensor( int index )
+{
+	if( index < 0 || index >= dhtSensorCount ) return NULL;
+	return &dhtSensors[ index ];
+}
+
+// == sample publication =========================================
+
+static void publishSample( dht22_sample_slot_t *slot, const dht22_sample_t *sample )
+{
+	unsigned seq = atomic_load_explicit( &slot->seq, memory_order_relaxed );
+
+	atomic_store_explicit( &slot->seq, seq + 1, memory_order_relaxed );
+	atomic_thread_fence( memory_order_release );
+
+	slot->sample = *sample;
+
+	atomic_store_explicit( &slot->seq, seq + 2, memory_order_release );
+}
+
+bool DHT22_get_sample( int index, dht22_sample_t *sample )
+{
+	if( index < 0 || index >= dhtSensorCount ) return false;
+
+	dht22_sample_slot_t *slot = &dhtSamples[ index ];
+
+	for( int tries = 1; ; tries++ ) {
+
+		unsigned before = atomic_load_explicit( &slot->seq, memory_order_acquire );
+
+		if( (before & 1) == 0 ) {
+			*sample = slot->sample;
+			atomic_thread_fence( memory_order_acquire );
+
+			if( atomic_load_explicit( &slot->seq, memory_order_relaxed ) == before )
+				return true;
+		}
+
+		// a reader preempting the writer on its own core must let it finish
+		if( tries % 16 == 0 )
+			vTaskDelay( 1 );
+	}
+}
 
 // == set the DHT used pin=========================================
 
 void setDHTgpio( int gpio )
 {
-	DHTgpio = gpio;
+	// keeps the single sensor API: the pin of sensor 0
+	if( dhtSensorCount == 0 )
+		DHT22_add_sensor( gpio );
+	else if( dhtSensors[0].gpio != gpio ) {
+		dhtSensors[0].gpio = gpio;
+		configureSensorPin( gpio );
+	}
 }
 
-// == get temp & hum =============================================
+// == get temp & hum of sensor 0 ==================================
 
-float getHumidity() { return humidity; }
-float getTemperature() { return temperature; }
+float getHumidity()
+{
+	dht22_sample_t sample;
+	return DHT22_get_sample( 0, &sample ) ? sample.humidity : 0.;
+}
+
+float getTemperature()
+{
+	dht22_sample_t sample;
+	return DHT22_get_sample( 0, &sample ) ? sample.temperature : 0.;
+}
 
 // == error handler ===============================================
 
-void errorHandler(int response)
+void errorHandler(int gpio, int response)
 {
 	switch(response) {
 
 		case DHT_TIMEOUT_ERROR :
-			ESP_LOGE( TAG, "Sensor Timeout\n" );
+			ESP_LOGE( TAG, "GPIO %d: Sensor Timeout\n", gpio );
 			break;
 
 		case DHT_CHECKSUM_ERROR:
-			ESP_LOGE( TAG, "CheckSum error\n" );
+			ESP_LOGE( TAG, "GPIO %d: CheckSum error\n", gpio );
 			break;
 
 		case DHT_OK:
 			break;
 
 		default :
-			ESP_LOGE( TAG, "Unknown error\n" );
+			ESP_LOGE( TAG, "GPIO %d: Unknown error\n", gpio );
 	}
 }
 
 /*-------------------------------------------------------------------------------
 ;
-;	get next state
+;	capture the sensor answer with the RMT receiver
 ;
-;	I don't like this logic. It needs some interrupt blocking / priority
-;	to ensure it runs in realtime.
+;	The RMT peripheral timestamps every edge in hardware (1 tick = 1 us) and
+;	hands the finished trace over through its ring buffer, so the task sleeps
+;	while the ~5 ms frame is on the wire and Wi-Fi interrupts cannot stretch
+;	the measured pulses.
 ;
 ;--------------------------------------------------------------------------------*/
 
-int getSignalLevel( int usTimeOut, bool state )
+static void rmtInit( int gpio )
+{
+	rmt_config_t rmt_rx = RMT_DEFAULT_CONFIG_RX( gpio, DHT_RMT_CHANNEL );
+	rmt_rx.clk_div = 80;									// 80 MHz APB clock -> 1 us ticks
+	rmt_rx.rx_config.filter_en = true;
+	rmt_rx.rx_config.filter_ticks_thresh = DHT_RMT_FILTER_TICKS;
+	rmt_rx.rx_config.idle_threshold = DHT_RMT_IDLE_US;		// end of frame
+
+	ESP_ERROR_CHECK( rmt_config( &rmt_rx ) );
+	ESP_ERROR_CHECK( rmt_driver_install( DHT_RMT_CHANNEL, 1000, 0 ) );
+	ESP_ERROR_CHECK( rmt_get_ringbuf_handle( DHT_RMT_CHANNEL, &dhtRmtRingbuf ) );
+
+	dhtRmtGpio = gpio;
+}
+
+/**
+ * Flattens received RMT items into alternating pulse widths starting at the first low level.
+ * @return number of pulse widths written to pulses.
+ */
+static size_t rmtItemsToPulses( const rmt_item32_t *items, size_t numItems, uint16_t *pulses, size_t maxPulses )
 {
+size_t count = 0;
+int lastLevel = 1;
+
+	for( size_t k = 0; k < numItems * 2; k++ ) {
 
-	int uSec = 0;
-	while( gpio_get_level(DHTgpio)==state ) {
+		int level = (k & 1) ? items[k / 2].level1 : items[k / 2].level0;
+		uint16_t duration = (k & 1) ? items[k / 2].duration1 : items[k / 2].duration0;
 
-		if( uSec > usTimeOut )
-			return -1;
+		if( duration == 0 ) break;							// end marker
 
-		++uSec;
-		ets_delay_us(1);		// uSec delay
+		if( count == 0 && level != 0 ) continue;			// idle high before the response
+
+		if( count > 0 && level == lastLevel )
+			pulses[ count - 1 ] += duration;				// glitch split one level in two
+		else if( count < maxPulses )
+			pulses[ count++ ] = duration;
+		else
+			break;
+
+		lastLevel = level;
 	}
 
-	return uSec;
+	return count;
 }
 
 /*----------------------------------------------------------------------------
@@ -136,126 +378,170 @@ To request data from DHT:
 
 ;----------------------------------------------------------------------------*/
 
-#define MAXdhtData 5	// to complete 40 = 5*8 Bits
-
-int readDHT()
+int readDHT( int gpio, float *hum, float *temp, dht22_diag_t *diag )
 {
-int uSec = 0;
+uint16_t pulses[ DHT_FRAME_PULSES + 2 ];
+uint8_t dhtData[ DHT_FRAME_BYTES ];
+size_t numPulses = 0;
+size_t rxSize = 0;
 
-uint8_t dhtData[MAXdhtData];
-uint8_t byteInx = 0;
-uint8_t bitInx = 7;
+	// one receiver serves every sensor, sensors are read one at a time
 
-	for (int k = 0; k<MAXdhtData; k++)
-		dhtData[k] = 0;
+	// routing the pin to the RMT input makes it input only, which would keep the start pulse off the line
+	if( dhtRmtRingbuf == NULL ) {
+		rmtInit( gpio );
+		setOpenDrain( gpio );
+	}
+	else if( dhtRmtGpio != gpio ) {
+		ESP_ERROR_CHECK( rmt_set_gpio( DHT_RMT_CHANNEL, RMT_MODE_RX, gpio, false ) );
+		setOpenDrain( gpio );
+		dhtRmtGpio = gpio;
+	}
 
 	// == Send start signal to DHT sensor ===========
 
-	gpio_set_direction( DHTgpio, GPIO_MODE_OUTPUT );
-
 	// pull down for 3 ms for a smooth and nice wake up
-	gpio_set_level( DHTgpio, 0 );
+	gpio_set_level( gpio, 0 );
 	ets_delay_us( 3000 );
 
-	// pull up for 25 us for a gentile asking for data
-	gpio_set_level( DHTgpio, 1 );
-	ets_delay_us( 25 );
-
-	gpio_set_direction( DHTgpio, GPIO_MODE_INPUT );		// change to input mode
-
-	// == DHT will keep the line low for 80 us and then high for 80us ====
-
-	uSec = getSignalLevel( 85, 0 );
-//	ESP_LOGI( TAG, "Response = %d", uSec );
-	if( uSec<0 ) return DHT_TIMEOUT_ERROR;
+	// release the line and let the RMT record the answer
+	ESP_ERROR_CHECK( rmt_rx_start( DHT_RMT_CHANNEL, true ) );
+	gpio_set_level( gpio, 1 );
 
-	// -- 80us up ------------------------
+	// == block until the receiver reports an idle line ===========
 
-	uSec = getSignalLevel( 85, 1 );
-//	ESP_LOGI( TAG, "Response = %d", uSec );
-	if( uSec<0 ) return DHT_TIMEOUT_ERROR;
+	rmt_item32_t *items = (rmt_item32_t *) xRingbufferReceive( dhtRmtRingbuf, &rxSize, pdMS_TO_TICKS( DHT_RMT_RX_TIMEOUT_MS ) );
+	rmt_rx_stop( DHT_RMT_CHANNEL );
 
-	// == No errors, read the 40 data bits ================
-
-	for( int k = 0; k < 40; k++ ) {
+	if( items == NULL ) {
+		DHT22_diag_timeout( diag, DHT_PHASE_PREAMBLE );		// no answer at all
+		return DHT_TIMEOUT_ERROR;
+	}
 
-		// -- starts new data transmission with >50us low signal
+	numPulses = rmtItemsToPulses( items, rxSize / sizeof(rmt_item32_t), pulses, sizeof(pulses) / sizeof(pulses[0]) );
+	vRingbufferReturnItem( dhtRmtRingbuf, (void *) items );
 
-		uSec = getSignalLevel( 56, 0 );
-		if( uSec<0 ) return DHT_TIMEOUT_ERROR;
+	// == decode the 40 data bits ================
 
-		// -- check to see if after >70us rx data is a 0 or a 1
+	int ret = DHT22_decode_diag( pulses, numPulses, dhtData, diag );
+	if( ret != DHT_OK ) return ret;
 
-		uSec = getSignalLevel( 75, 1 );
-		if( uSec<0 ) return DHT_TIMEOUT_ERROR;
+	*hum = DHT22_frame_humidity( dhtData );
+	*temp = DHT22_frame_temperature( dhtData );
 
-		// add the current read to the output data
-		// since all dhtData array where set to 0 at the start,
-		// only look for "1" (>28us us)
+	return ret;
+}
 
-		if (uSec > 40) {
-			dhtData[ byteInx ] |= (1 << bitInx);
-			}
+/**
+ * Reads one sensor, filters and publishes the result and updates its error counters.
+ * Values are only replaced by a read that passed its checksum; a failed read
+ * publishes its status next to the last good values.
+ * @return the read status; on DHT_OK the filtered values in tenths are stored in temp_tenths and hum_tenths.
+ */
+static int DHT22_read_sensor(int index, int64_t now, int16_t *temp_tenths, uint16_t *hum_tenths)
+{
+	dht22_sensor_t *sensor = &dhtSensors[index];
+	dht22_sample_t sample = dhtSamples[index].sample;		// only this task writes it
+	float hum, temp;
+	int ret = readDHT(sensor->gpio, &hum, &temp, &sensor->diag);
 
-		// index to next byte
+	int16_t raw_temp = 0;
+	uint16_t raw_hum = 0;
 
-		if (bitInx == 0) { bitInx = 7; ++byteInx; }
-		else bitInx--;
+	if (ret == DHT_OK)
+	{
+		raw_temp = lroundf(temp * SENSOR_HISTORY_SCALE);
+		raw_hum = lroundf(hum * SENSOR_HISTORY_SCALE);
+
+		sample.rejected = !sensor_filter_update(&dhtFilters[index], &dhtFilterConfigs[index], now / 1000,
+				raw_temp, raw_hum, temp_tenths, hum_tenths);
+		if (sample.rejected)
+		{
+			sensor->filter_rejects++;
+		}
+
+		sample.humidity = hum;
+		sample.temperature = temp;
+		sample.humidity_filtered = (float)*hum_tenths / SENSOR_HISTORY_SCALE;
+		sample.temperature_filtered = (float)*temp_tenths / SENSOR_HISTORY_SCALE;
+		sample.timestamp_us = now;
+		sample.sequence++;
 	}
+	sample.status = ret;
+	publishSample(&dhtSamples[index], &sample);
+	http_server_notify_sample(index);
 
-	// == get humidity from Data[0] and Data[1] ==========================
-
-	humidity = dhtData[0];
-	humidity *= 0x100;					// >> 8
-	humidity += dhtData[1];
-	humidity /= 10;						// get the decimal
-
-	// == get temp from Data[2] and Data[3]
-
-	temperature = dhtData[2] & 0x7F;
-	temperature *= 0x100;				// >> 8
-	temperature += dhtData[3];
-	temperature /= 10;
-
-	if( dhtData[2] & 0x80 ) 			// negative temp, brrr it's freezing
-		temperature *= -1;
-
-
-	// == verify if checksum is ok ===========================================
-	// Checksum is the sum of Data 8 bits masked out 0xFF
+	if (ret == DHT_OK)
+	{
+		sensor_history_add(index, now / 1000000, raw_temp, raw_hum);
+		sample_log_append(index, now / 1000000, raw_temp, raw_hum);
+	}
 
-	if (dhtData[4] == ((dhtData[0] + dhtData[1] + dhtData[2] + dhtData[3]) & 0xFF))
-		return DHT_OK;
+	errorHandler(sensor->gpio, ret);
 
-	else
-		return DHT_CHECKSUM_ERROR;
+	return ret;
 }
 
 /**
  * DHT22 Sensor task
+ * Every sensor has its own schedule with absolute deadlines (see DHT22_sched.c); the task
+ * sleeps until the earliest one is due. The first reads are staggered over one period so
+ * more sensors give more samples per second while each keeps its minimum interval.
  */
 static void DHT22_task(void *pvParameter)
 {
-	setDHTgpio(DHT_GPIO);
-	printf("Starting DHT task\n\n");
+	static const int gpios[] = DHT_SENSOR_GPIOS;
+
+	sensor_history_init();
+
+	for (int k = 0; k < sizeof(gpios) / sizeof(gpios[0]); k++)
+		DHT22_add_sensor(gpios[k]);
+
+	for (int k = 0; k < dhtSensorCount; k++)
+		DHT22_sched_init(&dhtSchedules[k], esp_timer_get_time() / 1000, k * DHT_SAMPLE_PERIOD_MS / dhtSensorCount,
+				DHT_SAMPLE_PERIOD_MS, dhtMinPeriodMs, dhtMaxPeriodMs, DHT_MIN_INTERVAL_MS);
+
+	printf("Starting DHT task with %d sensor(s)\n\n", dhtSensorCount);
 
 	for (;;)
 	{
-		// printf("=== Reading DHT ===\n");
-		int ret = readDHT();
+		applyPendingSettings();
+
+		uint32_t now_ms = esp_timer_get_time() / 1000;
+		int32_t due_ms = DHT_SAMPLE_PERIOD_MS;
+		int next = -1;
+
+		for (int k = 0; k < dhtSensorCount; k++)
+		{
+			int32_t due = DHT22_sched_due_in(&dhtSchedules[k], now_ms);
+			if (next < 0 || due < due_ms)
+			{
+				next = k;
+				due_ms = due;
+			}
+		}
+
+		if (next < 0 || due_ms > 0)
+		{
+			// round up so the task never wakes before the deadline; a settings change wakes it early
+			ulTaskNotifyTake(pdTRUE, (due_ms + portTICK_RATE_MS - 1) / portTICK_RATE_MS);
+			continue;
+		}
 
-		errorHandler(ret);
+		int64_t start = esp_timer_get_time();
+		int16_t temp_tenths = 0;
+		uint16_t hum_tenths = 0;
+		int ret = DHT22_read_sensor(next, start, &temp_tenths, &hum_tenths);
 
-		// printf("Hum %.1f\n", getHumidity());
-		// printf("Tmp %.1f\n", getTemperature());
+		int64_t end = esp_timer_get_time();
 
-		// Wait at least 2 seconds before reading again
-		// The interval of the whole process must be more than 2 seconds
-		vTaskDelay(4000 / portTICK_RATE_MS);
+		trace_event(TRACE_DHT_READ, next, ret, end - start);
+		DHT22_sched_done(&dhtSchedules[next], start / 1000, end / 1000, ret, temp_tenths, hum_tenths);
+		atomic_fetch_add(&dhtVersion, 1);
 	}
 }
 
 void DHT22_task_start(void)
 {
-	xTaskCreatePinnedToCore(&DHT22_task, "DHT22_task", DHT22_TASK_STACK_SIZE, NULL, DHT22_TASK_PRIORITY, NULL, DHT22_TASK_CORE_ID);
+	xTaskCreatePinnedToCore(&DHT22_task, "DHT22_task", DHT22_TASK_STACK_SIZE, NULL, DHT22_TASK_PRIORITY, &dhtTask, DHT22_TASK_CORE_ID);
 }
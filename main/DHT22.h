@@ -7,24 +7,120 @@
 #ifndef DHT22_H_
 #define DHT22_H_
 
-#define DHT_OK 0
-#define DHT_CHECKSUM_ERROR -1
-#define DHT_TIMEOUT_ERROR -2
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "DHT22_decode.h"
+#include "sensor_filter.h"
 
 #define DHT_GPIO 18
 
+// Sensor table
+#define DHT_MAX_SENSORS			8				// size of the sensor table
+#define DHT_SENSOR_GPIOS		{ DHT_GPIO }	// sensors added when the task starts
+#define DHT_MIN_INTERVAL_MS		2000			// datasheet minimum between two reads of one sensor
+#define DHT_SAMPLE_PERIOD_MS	4000			// initial read period of each sensor, >= DHT_MIN_INTERVAL_MS
+#define DHT_MIN_PERIOD_MS		DHT_MIN_INTERVAL_MS	// shortest period while readings change fast
+#define DHT_MAX_PERIOD_MS		60000			// longest period while readings are stable
+
+// RMT receiver used to capture the sensor answer
+#define DHT_RMT_CHANNEL			0		// rmt_channel_t
+#define DHT_RMT_IDLE_US			200		// line idle this long ends the frame
+#define DHT_RMT_FILTER_TICKS	100		// ignore glitches shorter than 100 APB ticks (1.25 us)
+#define DHT_RMT_RX_TIMEOUT_MS	20		// a full frame takes ~5 ms
+
+#if DHT_SAMPLE_PERIOD_MS < DHT_MIN_INTERVAL_MS
+#error "DHT_SAMPLE_PERIOD_MS must not be shorter than the sensor's minimum interval"
+#endif
+
+/**
+ * Consistent snapshot of the latest sensor reading
+ */
+typedef struct dht22_sample
+{
+	float humidity;				// raw values of the latest valid read
+	float temperature;
+	float humidity_filtered;	// after the outlier gate, median and EWMA
+	float temperature_filtered;
+	bool rejected;				// the outlier gate held back the latest valid read
+	int64_t timestamp_us;		// esp_timer time the values were captured
+	uint32_t sequence;			// number of valid samples so far, 0 before the first one
+	int status;					// result of the latest read: DHT_OK, DHT_CHECKSUM_ERROR or DHT_TIMEOUT_ERROR
+} dht22_sample_t;
+
+/**
+ * State of one DHT22 sensor in the sensor table
+ */
+typedef struct dht22_sensor
+{
+	int gpio;
+	uint32_t filter_rejects;	// valid reads held back by the outlier gate
+	dht22_diag_t diag;			// read results, timeouts by protocol phase and bit timing histograms
+} dht22_sensor_t;
+
 /**
  * Starts DHT22 sensor task
  */
 void DHT22_task_start(void);
 
+/**
+ * Adds a sensor to the table read by the DHT22 task.
+ * @param gpio data pin of the sensor.
+ * @return index of the sensor, or -1 if the table is full.
+ */
+int DHT22_add_sensor(int gpio);
+
+/**
+ * @return number of sensors in the table.
+ */
+int DHT22_sensor_count(void);
+
+/**
+ * Sets the range the adaptive sample period of every sensor moves in.
+ * The minimum is raised to DHT_MIN_INTERVAL_MS if needed. May be called from any task;
+ * the DHT22 task applies it before its next read.
+ */
+void DHT22_set_period_limits(uint32_t min_ms, uint32_t max_ms);
+
+/**
+ * Replaces the filter parameters of a sensor and restarts its filter. May be called from
+ * any task; the DHT22 task applies it before its next read.
+ * @param index sensor index from DHT22_add_sensor.
+ */
+void DHT22_set_filter_config(int index, const sensor_filter_config_t *config);
+
+/**
+ * @return current sample period of a sensor in milliseconds, 0 if index is out of range.
+ */
+uint32_t DHT22_get_period(int index);
+
+/**
+ * @return a number that changes whenever a sample, counter or period of any sensor
+ *         changes, so readers can tell when data derived from them is stale.
+ */
+unsigned DHT22_get_version(void);
+
+/**
+ * @param index sensor index from DHT22_add_sensor.
+ * @return the sensor state, or NULL if index is out of range.
+ */
+const dht22_sensor_t *DHT22_get_sensor(int index);
+
+/**
+ * Copies the latest published sample of a sensor without taking a lock.
+ * Humidity and temperature always come from a read that passed its checksum.
+ * @param index sensor index from DHT22_add_sensor.
+ * @param sample receives the snapshot.
+ * @return false if index is out of range.
+ */
+bool DHT22_get_sample(int index, dht22_sample_t *sample);
+
 // == function prototypes =======================================
 
 void 	setDHTgpio(int gpio);
-void 	errorHandler(int response);
-int 	readDHT();
+void 	errorHandler(int gpio, int response);
+int 	readDHT(int gpio, float *hum, float *temp, dht22_diag_t *diag);
 float 	getHumidity();
 float 	getTemperature();
-int 	getSignalLevel( int usTimeOut, bool state );
 
 #endif
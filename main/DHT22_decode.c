@@ -0,0 +1,124 @@
+/*------------------------------------------------------------------------------
+
+	DHT22 protocol decoder
+
+	Turns a captured trace of pulse widths into the 40-bit DHT22 frame. Kept
+	free of any hardware access so it can run on a host against recorded traces.
+
+---------------------------------------------------------------------------------*/
+
+#include "DHT22_decode.h"
+
+void DHT22_diag_timeout(dht22_diag_t *diag, dht22_phase_e phase)
+{
+	if( diag ) diag->timeouts[ phase ]++;
+}
+
+uint32_t DHT22_diag_timeouts(const dht22_diag_t *diag)
+{
+uint32_t total = 0;
+
+	for( int k = 0; k < DHT_PHASE_COUNT; k++ )
+		total += diag->timeouts[ k ];
+
+	return total;
+}
+
+static void histAdd(uint32_t *hist, uint16_t us)
+{
+	unsigned bin = us / DHT_HIST_BIN_US;
+	hist[ bin < DHT_HIST_BINS ? bin : DHT_HIST_BINS - 1 ]++;
+}
+
+int DHT22_decode(const uint16_t *pulses, size_t count, uint8_t data[DHT_FRAME_BYTES])
+{
+	return DHT22_decode_diag( pulses, count, data, NULL );
+}
+
+int DHT22_decode_diag(const uint16_t *pulses, size_t count, uint8_t data[DHT_FRAME_BYTES], dht22_diag_t *diag)
+{
+uint8_t byteInx = 0;
+uint8_t bitInx = 7;
+
+	for (int k = 0; k < DHT_FRAME_BYTES; k++)
+		data[k] = 0;
+
+	// == a missing edge shows up as a short trace, the phase is where it ends
+
+	if( count < DHT_FRAME_PULSES ) {
+		if( count < 2 ) DHT22_diag_timeout( diag, DHT_PHASE_PREAMBLE );
+		else DHT22_diag_timeout( diag, (count & 1) ? DHT_PHASE_BIT_HIGH : DHT_PHASE_BIT_LOW );
+		return DHT_TIMEOUT_ERROR;
+	}
+
+	// == DHT keeps the line low for 80 us and then high for 80 us ==========
+
+	if( pulses[0] > DHT_RESPONSE_TIMEOUT_US || pulses[1] > DHT_RESPONSE_TIMEOUT_US ) {
+		DHT22_diag_timeout( diag, DHT_PHASE_PREAMBLE );
+		return DHT_TIMEOUT_ERROR;
+	}
+
+	// == read the 40 data bits ==============================================
+
+	for( int k = 0; k < DHT_FRAME_BITS; k++ ) {
+
+		uint16_t low = pulses[2 + 2 * k];
+		uint16_t high = pulses[3 + 2 * k];
+
+		// -- every bit starts with a ~50 us low signal
+
+		if( low > DHT_BIT_LOW_TIMEOUT_US ) {
+			DHT22_diag_timeout( diag, DHT_PHASE_BIT_LOW );
+			return DHT_TIMEOUT_ERROR;
+		}
+
+		// -- the length of the following high signal is the bit value
+
+		if( high > DHT_BIT_HIGH_TIMEOUT_US ) {
+			DHT22_diag_timeout( diag, DHT_PHASE_BIT_HIGH );
+			return DHT_TIMEOUT_ERROR;
+		}
+
+		if( high > DHT_BIT_THRESHOLD_US ) {
+			data[ byteInx ] |= (1 << bitInx);
+			if( diag ) histAdd( diag->one_high_hist, high );
+		}
+		else if( diag )
+			histAdd( diag->zero_high_hist, high );
+
+		// index to next byte
+
+		if (bitInx == 0) { bitInx = 7; ++byteInx; }
+		else bitInx--;
+	}
+
+	// == verify if checksum is ok ===========================================
+	// Checksum is the sum of Data 8 bits masked out 0xFF
+
+	if (data[4] == ((data[0] + data[1] + data[2] + data[3]) & 0xFF)) {
+		if( diag ) diag->ok++;
+		return DHT_OK;
+	}
+
+	if( diag ) diag->checksum_errors++;
+	return DHT_CHECKSUM_ERROR;
+}
+
+float DHT22_frame_humidity(const uint8_t data[DHT_FRAME_BYTES])
+{
+	// == get humidity from Data[0] and Data[1] ==========================
+
+	return ((data[0] << 8) | data[1]) / 10.0f;
+}
+
+float DHT22_frame_temperature(const uint8_t data[DHT_FRAME_BYTES])
+{
+	// == get temp from Data[2] and Data[3]
+
+	float temperature = (((data[2] & 0x7F) << 8) | data[3]) / 10.0f;
+
+	if( data[2] & 0x80 ) 			// negative temp, brrr it's freezing
+		temperature *= -1;
+
+	return temperature;
+}
@@ -0,0 +1,97 @@
+/*
+
+	DHT22 protocol decoder
+
+	Pure functions only: no ESP-IDF or FreeRTOS dependencies, so the
+	decoder can be built and exercised on a host with recorded traces.
+
+*/
+
+#ifndef DHT22_DECODE_H_
+#define DHT22_DECODE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define DHT_OK 0
+#define DHT_CHECKSUM_ERROR -1
+#define DHT_TIMEOUT_ERROR -2
+
+#define DHT_FRAME_BITS				40								// 16 bits RH + 16 bits T + 8 bits checksum
+#define DHT_FRAME_BYTES				(DHT_FRAME_BITS / 8)
+#define DHT_FRAME_PULSES			(2 + 2 * DHT_FRAME_BITS)		// response low/high + low/high per bit
+
+// Pulse width limits in microseconds. These are true microseconds measured
+// by the capture hardware, not busy-wait loop counts.
+#define DHT_RESPONSE_TIMEOUT_US		100		// 80 us response low and 80 us preparation high
+#define DHT_BIT_LOW_TIMEOUT_US		75		// 50 us low that starts every bit
+#define DHT_BIT_HIGH_TIMEOUT_US		100		// 26~28 us for a "0", 70 us for a "1"
+#define DHT_BIT_THRESHOLD_US		40		// high pulses longer than this are a "1"
+
+// High pulse width histograms
+#define DHT_HIST_BIN_US				4
+#define DHT_HIST_BINS				(DHT_BIT_HIGH_TIMEOUT_US / DHT_HIST_BIN_US + 1)
+
+/**
+ * Protocol phase in which a timeout was detected
+ */
+typedef enum dht22_phase
+{
+	DHT_PHASE_PREAMBLE = 0,		// no response, or the 80 us response low/high
+	DHT_PHASE_BIT_LOW,			// the 50 us low that starts a bit
+	DHT_PHASE_BIT_HIGH,			// the high pulse that carries the bit value
+	DHT_PHASE_COUNT,
+} dht22_phase_e;
+
+/**
+ * Decode counters and bit timing histograms, accumulated over many frames. Every read
+ * ends up in exactly one of ok, checksum_errors or a timeouts phase, so these are also
+ * the read totals of the sensor.
+ */
+typedef struct dht22_diag
+{
+	uint32_t ok;
+	uint32_t checksum_errors;
+	uint32_t timeouts[DHT_PHASE_COUNT];
+	uint32_t zero_high_hist[DHT_HIST_BINS];		// high pulse widths decoded as "0"
+	uint32_t one_high_hist[DHT_HIST_BINS];		// high pulse widths decoded as "1"
+} dht22_diag_t;
+
+/**
+ * Decodes one DHT22 frame from a trace of pulse widths.
+ * @param pulses pulse widths in microseconds with alternating levels, starting with the
+ *        sensor's 80 us response low: low, high, then a low/high pair for each of the 40 bits.
+ * @param count number of entries in pulses; anything after DHT_FRAME_PULSES is ignored.
+ * @param data receives the 5 frame bytes (humidity, temperature, checksum).
+ * @return DHT_OK, DHT_TIMEOUT_ERROR if a pulse is missing or too long, or DHT_CHECKSUM_ERROR.
+ * @note data is filled in even when the checksum does not match.
+ */
+int DHT22_decode(const uint16_t *pulses, size_t count, uint8_t data[DHT_FRAME_BYTES]);
+
+/**
+ * DHT22_decode that also adds the result to diagnostics.
+ * @param diag counters and histograms to update, may be NULL.
+ */
+int DHT22_decode_diag(const uint16_t *pulses, size_t count, uint8_t data[DHT_FRAME_BYTES], dht22_diag_t *diag);
+
+/**
+ * Counts a timeout in a phase, for failures detected before decoding (e.g. no response at all).
+ */
+void DHT22_diag_timeout(dht22_diag_t *diag, dht22_phase_e phase);
+
+/**
+ * @return timeouts over all phases.
+ */
+uint32_t DHT22_diag_timeouts(const dht22_diag_t *diag);
+
+/**
+ * Converts decoded frame bytes to relative humidity in %RH.
+ */
+float DHT22_frame_humidity(const uint8_t data[DHT_FRAME_BYTES]);
+
+/**
+ * Converts decoded frame bytes to temperature in degrees Celsius.
+ */
+float DHT22_frame_temperature(const uint8_t data[DHT_FRAME_BYTES]);
+
+#endif /* DHT22_DECODE_H_ */
@@ -0,0 +1,145 @@
+/*------------------------------------------------------------------------------
+
+	DHT22 sampling scheduler
+
+	Deadlines sit on a grid that advances by whole periods, so the read time
+	never adds up to drift. A failed read is retried as soon as the sensor's
+	minimum interval allows instead of waiting for the next grid slot. The
+	period halves when readings move fast and grows slowly while they are
+	calm, within the configured limits.
+
+---------------------------------------------------------------------------------*/
+
+#include "DHT22_sched.h"
+#include "DHT22_decode.h"
+
+static bool after(uint32_t a, uint32_t b)
+{
+	return (int32_t)(a - b) > 0;
+}
+
+static uint32_t clamp_period(const dht22_sched_t *s, uint32_t period_ms)
+{
+	if (period_ms < s->min_period_ms) period_ms = s->min_period_ms;
+	if (period_ms > s->max_period_ms) period_ms = s->max_period_ms;
+	return period_ms;
+}
+
+void DHT22_sched_init(dht22_sched_t *s, uint32_t now_ms, uint32_t offset_ms,
+		uint32_t period_ms, uint32_t min_period_ms, uint32_t max_period_ms, uint32_t min_interval_ms)
+{
+	*s = (dht22_sched_t) { 0 };
+	s->min_interval_ms = min_interval_ms;
+	DHT22_sched_set_limits(s, min_period_ms, max_period_ms);
+	s->period_ms = clamp_period(s, period_ms);
+	s->grid_ms = now_ms + offset_ms;
+	s->next_ms = s->grid_ms;
+}
+
+void DHT22_sched_set_limits(dht22_sched_t *s, uint32_t min_period_ms, uint32_t max_period_ms)
+{
+	if (min_period_ms < s->min_interval_ms) min_period_ms = s->min_interval_ms;
+	if (max_period_ms < min_period_ms) max_period_ms = min_period_ms;
+
+	s->min_period_ms = min_period_ms;
+	s->max_period_ms = max_period_ms;
+	s->period_ms = clamp_period(s, s->period_ms);
+}
+
+int32_t DHT22_sched_due_in(const dht22_sched_t *s, uint32_t now_ms)
+{
+	uint32_t due = s->next_ms;
+
+	// never read a sensor again before its minimum interval
+	if (s->has_last_start && after(s->last_start_ms + s->min_interval_ms, due))
+	{
+		due = s->last_start_ms + s->min_interval_ms;
+	}
+
+	return (int32_t)(due - now_ms);
+}
+
+/**
+ * Adjusts the period to how much the reading moved since the previous one.
+ * @return true if the period changed.
+ */
+static bool adapt_period(dht22_sched_t *s, int16_t temp, uint16_t hum)
+{
+	uint32_t period = s->period_ms;
+
+	if (s->has_last_value)
+	{
+		int dt = temp - s->last_temp;
+		int dh = (int)hum - (int)s->last_hum;
+		if (dt < 0) dt = -dt;
+		if (dh < 0) dh = -dh;
+
+		if (dt >= DHT_FAST_TEMP_DELTA || dh >= DHT_FAST_HUM_DELTA)
+		{
+			period /= 2;
+			s->stable = 0;
+		}
+		else if (dt <= DHT_CALM_TEMP_DELTA && dh <= DHT_CALM_HUM_DELTA)
+		{
+			if (++s->stable >= DHT_STABLE_SAMPLES)
+			{
+				period += period / 4;
+				s->stable = 0;
+			}
+		}
+		else
+		{
+			s->stable = 0;
+		}
+	}
+
+	s->has_last_value = true;
+	s->last_temp = temp;
+	s->last_hum = hum;
+
+	period = clamp_period(s, period);
+	if (period == s->period_ms)
+	{
+		return false;
+	}
+
+	s->period_ms = period;
+	return true;
+}
+
+void DHT22_sched_done(dht22_sched_t *s, uint32_t start_ms, uint32_t now_ms, int status,
+		int16_t temp_tenths, uint16_t hum_tenths)
+{
+	s->last_start_ms = start_ms;
+	s->has_last_start = true;
+
+	if (status == DHT_OK)
+	{
+		s->retries = 0;
+
+		// a new period starts a new grid at this read
+		if (adapt_period(s, temp_tenths, hum_tenths))
+		{
+			s->grid_ms = start_ms;
+		}
+	}
+
+	// next grid slot after now; slots missed while the task was busy are skipped
+	while (!after(s->grid_ms, now_ms))
+	{
+		s->grid_ms += s->period_ms;
+	}
+
+	s->next_ms = s->grid_ms;
+
+	if (status != DHT_OK && s->retries < DHT_RETRY_MAX)
+	{
+		uint32_t retry_ms = start_ms + s->min_interval_ms;
+
+		s->retries++;
+		if (after(s->grid_ms, retry_ms))
+		{
+			s->next_ms = retry_ms;
+		}
+	}
+}
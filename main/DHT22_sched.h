@@ -0,0 +1,72 @@
+/*
+
+	DHT22 sampling scheduler
+
+	Pure functions only, like the protocol decoder: time is passed in, so the
+	policy can be exercised on a host with simulated time.
+
+*/
+
+#ifndef DHT22_SCHED_H_
+#define DHT22_SCHED_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define DHT_RETRY_MAX				3		// early retries after consecutive failed reads
+#define DHT_STABLE_SAMPLES			5		// calm samples in a row before the period grows
+
+// Change between two samples, in tenths, that counts as fast or as calm
+#define DHT_FAST_TEMP_DELTA			3		// 0.3 C
+#define DHT_FAST_HUM_DELTA			10		// 1.0 %RH
+#define DHT_CALM_TEMP_DELTA			1		// 0.1 C
+#define DHT_CALM_HUM_DELTA			3		// 0.3 %RH
+
+/**
+ * Schedule state of one sensor. Times are milliseconds of a free running clock
+ * and may wrap.
+ */
+typedef struct dht22_sched
+{
+	uint32_t period_ms;			// current sample period
+	uint32_t min_period_ms;
+	uint32_t max_period_ms;
+	uint32_t min_interval_ms;	// sensor limit between two reads
+	uint32_t grid_ms;			// nominal deadline, advances by whole periods
+	uint32_t next_ms;			// when the next read is due: grid_ms or an earlier retry
+	uint32_t last_start_ms;
+	bool has_last_start;
+	bool has_last_value;
+	int16_t last_temp;			// tenths of a degree Celsius
+	uint16_t last_hum;			// tenths of %RH
+	uint8_t retries;
+	uint8_t stable;
+} dht22_sched_t;
+
+/**
+ * Initializes a schedule.
+ * @param now_ms current time.
+ * @param offset_ms delay of the first read, used to stagger sensors.
+ */
+void DHT22_sched_init(dht22_sched_t *s, uint32_t now_ms, uint32_t offset_ms,
+		uint32_t period_ms, uint32_t min_period_ms, uint32_t max_period_ms, uint32_t min_interval_ms);
+
+/**
+ * Changes the period limits; the current period is clamped into them.
+ */
+void DHT22_sched_set_limits(dht22_sched_t *s, uint32_t min_period_ms, uint32_t max_period_ms);
+
+/**
+ * @return milliseconds until the next read is due, <= 0 if it is due now.
+ */
+int32_t DHT22_sched_due_in(const dht22_sched_t *s, uint32_t now_ms);
+
+/**
+ * Plans the next read after a read that started at start_ms.
+ * @param status DHT_OK, DHT_CHECKSUM_ERROR or DHT_TIMEOUT_ERROR.
+ * @param temp_tenths,hum_tenths the values read, used when status is DHT_OK.
+ */
+void DHT22_sched_done(dht22_sched_t *s, uint32_t start_ms, uint32_t now_ms, int status,
+		int16_t temp_tenths, uint16_t hum_tenths);
+
+#endif /* DHT22_SCHED_H_ */
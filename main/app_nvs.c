@@ -0,0 +1,151 @@
+#include <string.h>
+
+#include "esp_log.h"
+#include "nvs.h"
+
+#include "app_nvs.h"
+
+// Tag used for ESP serial console messages
+static const char TAG[] = "app_nvs";
+
+// NVS keys
+static const char KEY_SSID[] = "ssid";
+static const char KEY_PASSWORD[] = "password";
+static const char KEY_BSSID[] = "bssid";
+static const char KEY_CHANNEL[] = "channel";
+
+esp_err_t app_nvs_save_sta_creds(const wifi_sta_config_t *sta)
+{
+	nvs_handle_t handle;
+	esp_err_t err = nvs_open(APP_NVS_STA_NAMESPACE, NVS_READWRITE, &handle);
+
+	if (err != ESP_OK)
+	{
+		ESP_LOGI(TAG, "app_nvs_save_sta_creds: error (%s) opening NVS", esp_err_to_name(err));
+		return err;
+	}
+
+	// the cached access point belongs to the previous network
+	nvs_erase_key(handle, KEY_BSSID);
+	nvs_erase_key(handle, KEY_CHANNEL);
+
+	err = nvs_set_blob(handle, KEY_SSID, sta->ssid, sizeof(sta->ssid));
+	if (err == ESP_OK)
+	{
+		err = nvs_set_blob(handle, KEY_PASSWORD, sta->password, sizeof(sta->password));
+	}
+	if (err == ESP_OK)
+	{
+		err = nvs_commit(handle);
+	}
+
+	nvs_close(handle);
+
+	ESP_LOGI(TAG, "app_nvs_save_sta_creds: %s", err == ESP_OK ? "saved" : esp_err_to_name(err));
+
+	return err;
+}
+
+esp_err_t app_nvs_save_sta_ap(const uint8_t bssid[6], uint8_t channel)
+{
+	nvs_handle_t handle;
+	uint8_t saved_bssid[6];
+	size_t len = sizeof(saved_bssid);
+	uint8_t saved_channel;
+	esp_err_t err = nvs_open(APP_NVS_STA_NAMESPACE, NVS_READWRITE, &handle);
+
+	if (err != ESP_OK)
+	{
+		return err;
+	}
+
+	// every reconnect lands here, only write when the access point changed
+	if (nvs_get_blob(handle, KEY_BSSID, saved_bssid, &len) == ESP_OK && len == sizeof(saved_bssid)
+			&& memcmp(saved_bssid, bssid, sizeof(saved_bssid)) == 0
+			&& nvs_get_u8(handle, KEY_CHANNEL, &saved_channel) == ESP_OK && saved_channel == channel)
+	{
+		nvs_close(handle);
+		return ESP_OK;
+	}
+
+	err = nvs_set_blob(handle, KEY_BSSID, bssid, sizeof(saved_bssid));
+	if (err == ESP_OK)
+	{
+		err = nvs_set_u8(handle, KEY_CHANNEL, channel);
+	}
+	if (err == ESP_OK)
+	{
+		err = nvs_commit(handle);
+	}
+
+	nvs_close(handle);
+
+	ESP_LOGI(TAG, "app_nvs_save_sta_ap: channel %d, %s", channel, err == ESP_OK ? "saved" : esp_err_to_name(err));
+
+	return err;
+}
+
+bool app_nvs_load_sta_creds(wifi_sta_config_t *sta)
+{
+	nvs_handle_t handle;
+	uint8_t ssid[sizeof(sta->ssid)];
+	uint8_t password[sizeof(sta->password)];
+	uint8_t bssid[sizeof(sta->bssid)];
+	uint8_t channel;
+	size_t len;
+
+	if (nvs_open(APP_NVS_STA_NAMESPACE, NVS_READONLY, &handle) != ESP_OK)
+	{
+		// the namespace is created by the first save
+		return false;
+	}
+
+	len = sizeof(ssid);
+	bool found = nvs_get_blob(handle, KEY_SSID, ssid, &len) == ESP_OK && len == sizeof(ssid);
+	len = sizeof(password);
+	found = found && nvs_get_blob(handle, KEY_PASSWORD, password, &len) == ESP_OK && len == sizeof(password);
+
+	if (found)
+	{
+		memcpy(sta->ssid, ssid, sizeof(ssid));
+		memcpy(sta->password, password, sizeof(password));
+		sta->bssid_set = false;
+		sta->channel = 0;
+
+		len = sizeof(bssid);
+		if (nvs_get_blob(handle, KEY_BSSID, bssid, &len) == ESP_OK && len == sizeof(bssid)
+				&& nvs_get_u8(handle, KEY_CHANNEL, &channel) == ESP_OK)
+		{
+			memcpy(sta->bssid, bssid, sizeof(bssid));
+			sta->bssid_set = true;
+			sta->channel = channel;
+		}
+	}
+
+	nvs_close(handle);
+
+	return found;
+}
+
+esp_err_t app_nvs_clear_sta_creds(void)
+{
+	nvs_handle_t handle;
+	esp_err_t err = nvs_open(APP_NVS_STA_NAMESPACE, NVS_READWRITE, &handle);
+
+	if (err != ESP_OK)
+	{
+		return err;
+	}
+
+	err = nvs_erase_all(handle);
+	if (err == ESP_OK)
+	{
+		err = nvs_commit(handle);
+	}
+
+	nvs_close(handle);
+
+	ESP_LOGI(TAG, "app_nvs_clear_sta_creds: %s", err == ESP_OK ? "cleared" : esp_err_to_name(err));
+
+	return err;
+}
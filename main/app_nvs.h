@@ -0,0 +1,41 @@
+#ifndef MAIN_APP_NVS_H_
+#define MAIN_APP_NVS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_wifi.h"
+
+#define APP_NVS_STA_NAMESPACE			"stacreds"		// NVS namespace of the station settings
+
+/**
+ * Saves the station SSID and password so they survive a reboot. The cached
+ * access point of the previous network is forgotten.
+ * @param sta station configuration holding the credentials.
+ * @return ESP_OK if successful.
+ */
+esp_err_t app_nvs_save_sta_creds(const wifi_sta_config_t *sta);
+
+/**
+ * Remembers the BSSID and channel of the access point the station got an IP from,
+ * so the next boot can connect without a full scan. Unchanged values are not rewritten.
+ * @return ESP_OK if successful.
+ */
+esp_err_t app_nvs_save_sta_ap(const uint8_t bssid[6], uint8_t channel);
+
+/**
+ * Loads the saved station settings into a station configuration: SSID and password
+ * and, once a connection succeeded with them, bssid/bssid_set and channel.
+ * @param sta station configuration to fill in, other fields are left as they are.
+ * @return true if credentials were saved.
+ */
+bool app_nvs_load_sta_creds(wifi_sta_config_t *sta);
+
+/**
+ * Erases the saved station settings.
+ * @return ESP_OK if successful.
+ */
+esp_err_t app_nvs_clear_sta_creds(void);
+
+#endif /* MAIN_APP_NVS_H_ */
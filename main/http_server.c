@@ -1,35 +1,157 @@
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_heap_caps.h"
 #include "esp_http_server.h"
 #include "esp_log.h"
 #include "esp_ota_ops.h"
+#include "esp_system.h"
+#include "esp_timer.h"
 #include "esp_wifi.h"
+#include "freertos/semphr.h"
+#include "mbedtls/sha256.h"
+#include "lwip/sockets.h"
 #include "sys/param.h"
 
 #include "http_server.h"
+#include "multipart.h"
+#include "ota_inflate.h"
+#include "ota_writer.h"
 #include "tasks_common.h"
 #include "wifi_app.h"
 #include "DHT22.h"
+#include "sample_log.h"
+#include "sensor_history.h"
+#include "trace.h"
+#include "web_assets.h"
 
 // Tag used for ESP serial console messages
 static const char TAG[] = "http_server";
 
 // Wifi connect status
-//static http_server_wifi_connect_status g_wifi_connect_status = NONE;
+static http_server_wifi_connect_status_e g_wifi_connect_status = NONE;
 
 // Firmware update status
 static int g_fw_update_status = OTA_UPDATE_PENDING;
 
+// Size of the last uploaded image as received and as written to flash (after decompression)
+static size_t g_ota_received;
+static size_t g_ota_written;
+static unsigned g_ota_updates;
+
 // Local Time status
 //static bool g_is_local_time_set = false;
 
 // HTTP server task handle
 static httpd_handle_t http_server_handle = NULL;
 
+// HTTP bulk server handle, runs the slow routes
+static httpd_handle_t http_server_bulk_handle = NULL;
+
 // HTTP server monitor task handle
 static TaskHandle_t task_http_server_monitor = NULL;
 
 // Queue handle used to manipulate the main queue of events
 static QueueHandle_t http_server_monitor_queue_handle;
 
+// /events subscriber sockets, -1 if free; only touched on the httpd task
+static int sse_clients[HTTP_SSE_MAX_CLIENTS];
+static atomic_int sse_client_count;
+
+// Sensors with a sample not yet pushed (bit per sensor), and whether a push is queued
+static atomic_uint sse_pending;
+static atomic_bool sse_push_queued;
+
+// Events not sent because the subscriber's socket buffer was full
+static uint32_t sse_dropped;
+
+// Monitor messages lost to a full queue
+static atomic_uint monitor_dropped;
+
+/**
+ * Rate limit classes, each with its own token bucket per client
+ */
+typedef enum http_server_rate_class
+{
+	HTTP_RATE_CLASS_NONE = -1,		// not limited: page assets, event stream
+	HTTP_RATE_CLASS_API = 0,		// polled JSON and other short requests
+	HTTP_RATE_CLASS_BULK,			// uploads and exports
+	HTTP_RATE_CLASS_COUNT,
+} http_server_rate_class_e;
+
+/**
+ * Refill rate and size of the buckets of a rate class
+ */
+static const struct
+{
+	uint16_t per_s;
+	uint16_t burst;
+} http_server_rate_limits[HTTP_RATE_CLASS_COUNT] = {
+	[HTTP_RATE_CLASS_API] = { HTTP_RATE_API_PER_S, HTTP_RATE_API_BURST },
+	[HTTP_RATE_CLASS_BULK] = { HTTP_RATE_BULK_PER_S, HTTP_RATE_BULK_BURST },
+};
+
+/**
+ * Token buckets of one client, shared by both server tasks under http_server_rate_lock
+ */
+typedef struct http_server_rate_client
+{
+	uint32_t ip;									// IPv4 address, 0 for a free slot
+	uint32_t last_ms;								// time of the last refill
+	uint32_t tokens[HTTP_RATE_CLASS_COUNT];			// thousandths of a request
+} http_server_rate_client_t;
+
+static http_server_rate_client_t rate_clients[HTTP_RATE_MAX_CLIENTS];
+static SemaphoreHandle_t http_server_rate_lock;
+
+/**
+ * Request counters and latency histogram of one registered URI, updated with relaxed
+ * atomics by http_server_metered_handler and only read when /metrics is scraped.
+ */
+typedef struct http_server_route_metrics
+{
+	const char *uri;
+	httpd_method_t method;
+	esp_err_t (*handler)(httpd_req_t *req);
+	atomic_uint requests;
+	atomic_uint errors;								// handler did not return ESP_OK
+	atomic_uint shed;								// turned away, client over its rate
+	http_server_rate_class_e rate_class;
+	bool bulk;										// registered on the bulk server
+	atomic_uint latency_ms_sum;
+	atomic_uint latency_hist[HTTP_METRICS_LATENCY_BUCKETS + 1];	// per bucket, last one is +Inf
+} http_server_route_metrics_t;
+
+static http_server_route_metrics_t route_metrics[HTTP_METRICS_MAX_ROUTES];
+
+static int route_metrics_count;
+static const uint32_t latency_buckets_ms[HTTP_METRICS_LATENCY_BUCKETS] = HTTP_METRICS_LATENCY_BUCKETS_MS;
+
+/**
+ * Pre-rendered JSON response, rebuilt only when the data version it was built from changes.
+ * Only used on the httpd task, so it needs no lock.
+ */
+typedef struct http_server_json_cache
+{
+	bool valid;
+	unsigned version;
+	int len;
+	char etag[24];
+	char *body;
+} http_server_json_cache_t;
+
+// Random per boot, part of every cached ETag so versions restarting at 0 never match old ones
+static uint32_t g_etag_boot;
+
+static char dht_sensor_json_body[64 + DHT_MAX_SENSORS * 256];
+static http_server_json_cache_t dht_sensor_json_cache = { .body = dht_sensor_json_body };
+
+static char ota_status_json_body[160];
+static http_server_json_cache_t ota_status_json_cache = { .body = ota_status_json_body };
+
 /**
  * ESP32 timer configuration passed to esp_timer_create.
  */
@@ -41,18 +163,6 @@ const esp_timer_create_args_t fw_update_reset_args = {
 };
 esp_timer_handle_t fw_update_reset;
 
-// Embedded files: JQuery, index.html, app.css, app.js and favicon.ico files
-extern const uint8_t jquery_min_js_start[]	asm("_binary_jquery_min_js_start");
-extern const uint8_t jquery_min_js_end[]		asm("_binary_jquery_min_js_end");
-extern const uint8_t index_html_start[]				asm("_binary_index_html_start");
-extern const uint8_t index_html_end[]				asm("_binary_index_html_end");
-extern const uint8_t app_css_start[]				asm("_binary_app_css_start");
-extern const uint8_t app_css_end[]					asm("_binary_app_css_end");
-extern const uint8_t app_js_start[]					asm("_binary_app_js_start");
-extern const uint8_t app_js_end[]					asm("_binary_app_js_end");
-extern const uint8_t favicon_ico_start[]			asm("_binary_favicon_ico_start");
-extern const uint8_t favicon_ico_end[]				asm("_binary_favicon_ico_end");
-
 /**
  * Checks the g_fw_update_status and creates the fw_update_reset timer if g_fw_update_status is true.
  */
@@ -80,6 +190,8 @@ static void http_server_monitor(void *parameter)
 {
 	http_server_queue_message_t msg;
 
+	(void)parameter;
+
 	for (;;)
 	{
 		if (xQueueReceive(http_server_monitor_queue_handle, &msg, portMAX_DELAY))
@@ -89,28 +201,28 @@ static void http_server_monitor(void *parameter)
 				case HTTP_MSG_WIFI_CONNECT_INIT:
 					ESP_LOGI(TAG, "HTTP_MSG_WIFI_CONNECT_INIT");
 
-					// g_wifi_connect_status = HTTP_WIFI_STATUS_CONNECTING;
+					g_wifi_connect_status = HTTP_WIFI_STATUS_CONNECTING;
 
 					break;
 
 				case HTTP_MSG_WIFI_CONNECT_SUCCESS:
 					ESP_LOGI(TAG, "HTTP_MSG_WIFI_CONNECT_SUCCESS");
 
-					// g_wifi_connect_status = HTTP_WIFI_STATUS_CONNECT_SUCCESS;
+					g_wifi_connect_status = HTTP_WIFI_STATUS_CONNECT_SUCCESS;
 
 					break;
 
 				case HTTP_MSG_WIFI_CONNECT_FAIL:
 					ESP_LOGI(TAG, "HTTP_MSG_WIFI_CONNECT_FAIL");
 
-					// g_wifi_connect_status = HTTP_WIFI_STATUS_CONNECT_FAILED;
+					g_wifi_connect_status = HTTP_WIFI_STATUS_CONNECT_FAILED;
 
 					break;
 
 				case HTTP_MSG_WIFI_USER_DISCONNECT:
 					ESP_LOGI(TAG, "HTTP_MSG_WIFI_USER_DISCONNECT");
 
-					// g_wifi_connect_status = HTTP_WIFI_STATUS_DISCONNECTED;
+					g_wifi_connect_status = HTTP_WIFI_STATUS_DISCONNECTED;
 
 					break;
 
@@ -141,336 +253,2204 @@ static void http_server_monitor(void *parameter)
 }
 
 /**
- * Jquery get handler is requested when accessing the web page.
- * @param req HTTP request for which the uri needs to be handled.
- * @return ESP_OK
+ * Checks if a request header contains a token, e.g. "gzip" in Accept-Encoding.
+ * @param req HTTP request.
+ * @param field header name.
+ * @param token value to look for.
+ * @return true if the header is present and contains the token.
  */
-static esp_err_t http_server_jquery_handler(httpd_req_t *req)
+static bool http_server_header_has(httpd_req_t *req, const char *field, const char *token)
 {
-	ESP_LOGI(TAG, "Jquery requested");
+	char value[128];
+	size_t len = httpd_req_get_hdr_value_len(req, field);
 
-	httpd_resp_set_type(req, "application/javascript");
-	httpd_resp_send(req, (const char *)jquery_min_js_start, jquery_min_js_end - jquery_min_js_start);
+	if (len == 0 || len >= sizeof(value) || httpd_req_get_hdr_value_str(req, field, value, sizeof(value)) != ESP_OK)
+	{
+		return false;
+	}
 
-	return ESP_OK;
+	return strstr(value, token) != NULL;
 }
 
 /**
- * Sends the index.html page.
- * @param req HTTP request for which the uri needs to be handled.
- * @return ESP_OK
+ * Turns a request away without reading its body. httpd would drain an unread body on
+ * the server task, CONFIG_HTTPD_PURGE_BUF_LEN bytes per recv, and the client sends it
+ * again anyway; so when there is one the connection is closed instead.
+ * @param req HTTP request.
+ * @param status e.g. "429 Too Many Requests".
+ * @param retry_after value of the Retry-After header in seconds.
+ * @param message response body, or NULL for none.
+ * @return ESP_FAIL to close the connection if the request has a body, otherwise ESP_OK.
  */
-static esp_err_t http_server_index_html_handler(httpd_req_t *req)
+static esp_err_t http_server_send_rejection(httpd_req_t *req, const char *status, const char *retry_after, const char *message)
 {
-	ESP_LOGI(TAG, "index.html requested");
+	bool has_body = req->content_len > 0;
 
-	httpd_resp_set_type(req, "text/html");
-	httpd_resp_send(req, (const char *)index_html_start, index_html_end - index_html_start);
+	httpd_resp_set_status(req, status);
+	httpd_resp_set_hdr(req, "Retry-After", retry_after);
+	if (has_body)
+	{
+		httpd_resp_set_hdr(req, "Connection", "close");
+	}
+	httpd_resp_send(req, message, message ? HTTPD_RESP_USE_STRLEN : 0);
 
-	return ESP_OK;
+	return has_body ? ESP_FAIL : ESP_OK;
 }
 
 /**
- * app.css get handler is requested when accessing the web page.
+ * Serves every embedded web page file: looks the path up in the generated asset table
+ * and sends it gzip compressed when the client accepts it, or 304 Not Modified when
+ * the client already has the representation it would get.
  * @param req HTTP request for which the uri needs to be handled.
  * @return ESP_OK
  */
-static esp_err_t http_server_app_css_handler(httpd_req_t *req)
+static esp_err_t http_server_asset_handler(httpd_req_t *req)
 {
-	ESP_LOGI(TAG, "app.css requested");
+	const web_asset_t *asset = web_assets_find(req->uri);
+
+	if (asset == NULL)
+	{
+		trace_event(TRACE_HTTP_NOT_FOUND, 0, 0, 0);
+		httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, NULL);
+
+		return ESP_OK;
+	}
 
-	httpd_resp_set_type(req, "text/css");
-	httpd_resp_send(req, (const char *)app_css_start, app_css_end - app_css_start);
+	bool gzip = http_server_header_has(req, "Accept-Encoding", "gzip");
+	const char *etag = gzip ? asset->gz_etag : asset->etag;
+	bool not_modified = http_server_header_has(req, "If-None-Match", etag);
+
+	trace_event(TRACE_HTTP_ASSET, (uintptr_t)asset->path, gzip, not_modified);
+
+	httpd_resp_set_hdr(req, "ETag", etag);
+	httpd_resp_set_hdr(req, "Cache-Control", asset->cache_control);
+	httpd_resp_set_hdr(req, "Vary", "Accept-Encoding");
+
+	if (not_modified)
+	{
+		httpd_resp_set_status(req, "304 Not Modified");
+		httpd_resp_send(req, NULL, 0);
+
+		return ESP_OK;
+	}
+
+	httpd_resp_set_type(req, asset->type);
+	if (gzip)
+	{
+		httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+		httpd_resp_send(req, (const char *)asset->gz_data, asset->gz_len);
+	}
+	else
+	{
+		httpd_resp_send(req, (const char *)asset->data, asset->len);
+	}
 
 	return ESP_OK;
 }
 
 /**
- * app.js get handler is requested when accessing the web page.
+ * Sends a cached JSON response, rebuilding it first if its data changed, or 304 Not
+ * Modified for a GET whose If-None-Match has the current ETag.
  * @param req HTTP request for which the uri needs to be handled.
+ * @param cache the cached response.
+ * @param version current version of the data the response is built from.
+ * @param build renders the body into the cache buffer and returns its length.
  * @return ESP_OK
  */
-static esp_err_t http_server_app_js_handler(httpd_req_t *req)
+static esp_err_t http_server_send_cached_json(httpd_req_t *req, http_server_json_cache_t *cache,
+		unsigned version, int (*build)(char *body))
 {
-	ESP_LOGI(TAG, "app.js requested");
+	if (!cache->valid || cache->version != version)
+	{
+		cache->len = build(cache->body);
+		cache->version = version;
+		cache->valid = true;
+		sprintf(cache->etag, "\"%08x-%x\"", g_etag_boot, version);
+		trace_event(TRACE_HTTP_CACHE_REBUILD, version, 0, 0);
+	}
+
+	httpd_resp_set_hdr(req, "ETag", cache->etag);
+	httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+
+	if (req->method == HTTP_GET && http_server_header_has(req, "If-None-Match", cache->etag))
+	{
+		httpd_resp_set_status(req, "304 Not Modified");
+		httpd_resp_send(req, NULL, 0);
+
+		return ESP_OK;
+	}
 
-	httpd_resp_set_type(req, "application/javascript");
-	httpd_resp_send(req, (const char *)app_js_start, app_js_end - app_js_start);
+	httpd_resp_set_type(req, "application/json");
+	httpd_resp_send(req, cache->body, cache->len);
 
 	return ESP_OK;
 }
 
 /**
- * Sends the .ico (icon) file when accessing the web page.
- * @param req HTTP request for which the uri needs to be handled.
- * @return ESP_OK
+ * Renders the DHT sensor readings JSON.
+ * The top level temp/humidity fields are sensor 0, the sensors array lists every sensor.
+ * @return length of the body.
  */
-static esp_err_t http_server_favicon_ico_handler(httpd_req_t *req)
+static int http_server_build_dht_sensor_json(char *dhtSensorJSON)
 {
-	ESP_LOGI(TAG, "favicon.ico requested");
+	dht22_sample_t first = { 0 };
+	int len;
 
-	httpd_resp_set_type(req, "image/x-icon");
-	httpd_resp_send(req, (const char *)favicon_ico_start, favicon_ico_end - favicon_ico_start);
+	DHT22_get_sample(0, &first);
+	len = sprintf(dhtSensorJSON, "{\"temp\":\"%.1f\",\"humidity\":\"%.1f\",\"sensors\":[", first.temperature, first.humidity);
 
-	return ESP_OK;
+	for (int i = 0; i < DHT22_sensor_count(); i++)
+	{
+		const dht22_sensor_t *sensor = DHT22_get_sensor(i);
+		dht22_sample_t sample;
+
+		DHT22_get_sample(i, &sample);
+
+		len += sprintf(dhtSensorJSON + len,
+				"%s{\"gpio\":%d,\"temp\":\"%.1f\",\"humidity\":\"%.1f\",\"temp_filtered\":\"%.1f\",\"humidity_filtered\":\"%.1f\",\"rejected\":%s,\"status\":%d,\"seq\":%u,\"time_ms\":%lld,"
+				"\"period_ms\":%u,\"reads_ok\":%u,\"checksum_errors\":%u,\"timeout_errors\":%u,\"filter_rejects\":%u}",
+				i ? "," : "", sensor->gpio, sample.temperature, sample.humidity, sample.temperature_filtered, sample.humidity_filtered,
+				sample.rejected ? "true" : "false", sample.status, sample.sequence,
+				sample.sequence ? sample.timestamp_us / 1000 : -1LL,
+				DHT22_get_period(i), sensor->diag.ok, sensor->diag.checksum_errors, DHT22_diag_timeouts(&sensor->diag),
+				sensor->filter_rejects);
+	}
+
+	return len + sprintf(dhtSensorJSON + len, "]}");
 }
 
 /**
- * DHT sensor readings JSON handler responds with DHT22 sensor data
+ * DHT sensor readings JSON handler responds with DHT22 sensor data, from the response
+ * cache while no new sample was published.
  * @param req HTTP request for which the uri needs to be handled
  * @return ESP_OK
  */
 static esp_err_t http_server_get_dht_sensor_readings_json_handler(httpd_req_t *req)
 {
-	ESP_LOGI(TAG, "/dhtSensor.json requested");
-
-	char dhtSensorJSON[100];
-
-	sprintf(dhtSensorJSON, "{\"temp\":\"%.1f\",\"humidity\":\"%.1f\"}", getTemperature(), getHumidity());
+	trace_event(TRACE_HTTP_REQUEST, (uintptr_t)"/dhtSensor.json", 0, 0);
 
-	httpd_resp_set_type(req, "application/json");
-	httpd_resp_send(req, dhtSensorJSON, strlen(dhtSensorJSON));
-
-	return ESP_OK;
+	return http_server_send_cached_json(req, &dht_sensor_json_cache, DHT22_get_version(),
+			http_server_build_dht_sensor_json);
 }
 
 /**
- * Receives the .bin file fia the web page and handles the firmware update
- * @param req HTTP request for which the uri needs to be handled.
- * @return ESP_OK, otherwise ESP_FAIL if timeout occurs and the update cannot be started.
+ * Formats the latest sample of a sensor as a "sample" Server-Sent Event.
+ * @return length of the event.
  */
-esp_err_t http_server_OTA_update_handler(httpd_req_t *req)
+static int http_server_sse_format(char *buf, int index)
 {
-	esp_ota_handle_t ota_handle;
+	dht22_sample_t sample;
 
-	char ota_buff[1024];
-	int content_length = req->content_len;
-	int content_received = 0;
-	int recv_len;
-	bool is_req_body_started = false;
-	bool flash_successful = false;
+	DHT22_get_sample(index, &sample);
 
-	const esp_partition_t *update_partition = esp_ota_get_next_update_partition(NULL);
+	return sprintf(buf,
+			"event: sample\ndata: {\"index\":%d,\"gpio\":%d,\"temp\":\"%.1f\",\"humidity\":\"%.1f\",\"temp_filtered\":\"%.1f\","
+			"\"humidity_filtered\":\"%.1f\",\"rejected\":%s,\"status\":%d,\"seq\":%u}\n\n",
+			index, DHT22_get_sensor(index)->gpio, sample.temperature, sample.humidity, sample.temperature_filtered,
+			sample.humidity_filtered, sample.rejected ? "true" : "false", sample.status, sample.sequence);
+}
 
-	do
+/**
+ * Removes a subscriber from the /events list.
+ */
+static void http_server_sse_remove(int sockfd)
+{
+	for (int i = 0; i < HTTP_SSE_MAX_CLIENTS; i++)
 	{
-		// Read the data for the request
-		if ((recv_len = httpd_req_recv(req, ota_buff, MIN(content_length, sizeof(ota_buff)))) < 0)
+		if (sse_clients[i] == sockfd)
 		{
-			// Check if timeout occurred
-			if (recv_len == HTTPD_SOCK_ERR_TIMEOUT)
-			{
-				ESP_LOGI(TAG, "http_server_OTA_update_handler: Socket Timeout");
-				continue; ///> Retry receiving if timeout occurred
-			}
-			ESP_LOGI(TAG, "http_server_OTA_update_handler: OTA other Error %d", recv_len);
-			return ESP_FAIL;
+			sse_clients[i] = -1;
+			atomic_fetch_sub(&sse_client_count, 1);
 		}
-		printf("http_server_OTA_update_handler: OTA RX: %d of %d\r", content_received, content_length);
+	}
+}
 
-		// Is this the first data we are receiving
-		// If so, it will have the information in the header that we need.
-		if (!is_req_body_started)
-		{
-			is_req_body_started = true;
+/**
+ * Sends an event to a subscriber without blocking. If the socket buffer is full the
+ * event is dropped: the next one carries the latest values anyway. A subscriber that
+ * only took part of an event can no longer be framed correctly and is closed.
+ */
+static void http_server_sse_send(int sockfd, const char *buf, int len)
+{
+	int sent = httpd_socket_send(http_server_handle, sockfd, buf, len, MSG_DONTWAIT);
 
-			// Get the location of the .bin file content (remove the web form data)
-			char *body_start_p = strstr(ota_buff, "\r\n\r\n") + 4;
-			int body_part_len = recv_len - (body_start_p - ota_buff);
+	if (sent == len)
+	{
+		return;
+	}
 
-			printf("http_server_OTA_update_handler: OTA file size: %d\r\n", content_length);
+	if (sent == HTTPD_SOCK_ERR_TIMEOUT)
+	{
+		sse_dropped++;
+		return;
+	}
 
-			esp_err_t err = esp_ota_begin(update_partition, OTA_SIZE_UNKNOWN, &ota_handle);
-			if (err != ESP_OK)
-			{
-				printf("http_server_OTA_update_handler: Error with OTA begin, cancelling OTA\r\n");
-				return ESP_FAIL;
-			}
-			else
-			{
-				printf("http_server_OTA_update_handler: Writing to partition subtype %d at offset 0x%x\r\n", update_partition->subtype, update_partition->address);
-			}
+	trace_event(TRACE_SSE_DROPPED, sockfd, 0, 0);
+	http_server_sse_remove(sockfd);
+	httpd_sess_trigger_close(http_server_handle, sockfd);
+}
 
-			// Write this first part of the data
-			esp_ota_write(ota_handle, body_start_p, body_part_len);
-			content_received += body_part_len;
-		}
-		else
-		{
-			// Write OTA data
-			esp_ota_write(ota_handle, ota_buff, recv_len);
-			content_received += recv_len;
-		}
+/**
+ * Pushes the pending samples to all subscribers; runs on the httpd task.
+ */
+static void http_server_sse_push(void *arg)
+{
+	char event[256];
 
-	} while (recv_len > 0 && content_received < content_length);
+	(void)arg;
+	atomic_store(&sse_push_queued, false);
+	unsigned pending = atomic_exchange(&sse_pending, 0);
 
-	if (esp_ota_end(ota_handle) == ESP_OK)
+	for (int index = 0; pending; index++, pending >>= 1)
 	{
-		// Lets update the partition
-		if (esp_ota_set_boot_partition(update_partition) == ESP_OK)
+		if ((pending & 1) == 0)
 		{
-			const esp_partition_t *boot_partition = esp_ota_get_boot_partition();
-			ESP_LOGI(TAG, "http_server_OTA_update_handler: Next boot partition subtype %d at offset 0x%x", boot_partition->subtype, boot_partition->address);
-			flash_successful = true;
+			continue;
 		}
-		else
+
+		int len = http_server_sse_format(event, index);
+
+		for (int i = 0; i < HTTP_SSE_MAX_CLIENTS; i++)
 		{
-			ESP_LOGI(TAG, "http_server_OTA_update_handler: FLASHED ERROR!!!");
+			if (sse_clients[i] >= 0)
+			{
+				http_server_sse_send(sse_clients[i], event, len);
+			}
 		}
 	}
-	else
+}
+
+void http_server_notify_sample(int index)
+{
+	httpd_handle_t handle = http_server_handle;
+
+	if (handle == NULL || atomic_load(&sse_client_count) == 0)
 	{
-		ESP_LOGI(TAG, "http_server_OTA_update_handler: esp_ota_end ERROR!!!");
+		return;
 	}
 
-	// We won't update the global variables throughout the file, so send the message about the status
-	if (flash_successful) { http_server_monitor_send_message(HTTP_MSG_OTA_UPDATE_SUCCESSFUL); } else { http_server_monitor_send_message(HTTP_MSG_OTA_UPDATE_FAILED); }
+	atomic_fetch_or(&sse_pending, 1u << index);
 
-	return ESP_OK;
+	// one queued push at a time, it sends whatever is pending when it runs
+	if (!atomic_exchange(&sse_push_queued, true) && httpd_queue_work(handle, http_server_sse_push, NULL) != ESP_OK)
+	{
+		atomic_store(&sse_push_queued, false);
+	}
 }
 
 /**
- * OTA status handler responds with the firmware update status after the OTA update is started
- * and responds with the compile time/date when the page is first requested
- * @param req HTTP request for which the uri needs to be handled
+ * Server-Sent Events handler: keeps the connection open and registers it as a
+ * subscriber; samples are pushed by http_server_sse_push. Starts with the latest
+ * sample of every sensor.
+ * @param req HTTP request for which the uri needs to be handled.
  * @return ESP_OK
  */
-esp_err_t http_server_OTA_status_handler(httpd_req_t *req)
+static esp_err_t http_server_events_handler(httpd_req_t *req)
 {
-	char otaJSON[100];
+	static const char headers[] = "HTTP/1.1 200 OK\r\n"
+			"Content-Type: text/event-stream\r\n"
+			"Cache-Control: no-cache\r\n"
+			"Connection: keep-alive\r\n\r\n";
+	char event[256];
+	int sockfd = httpd_req_to_sockfd(req);
+	int slot = -1;
 
-	ESP_LOGI(TAG, "OTAstatus requested");
 
-	sprintf(otaJSON, "{\"ota_update_status\":%d,\"compile_time\":\"%s\",\"compile_date\":\"%s\"}", g_fw_update_status, __TIME__, __DATE__);
+	for (int i = 0; i < HTTP_SSE_MAX_CLIENTS && slot < 0; i++)
+	{
+		if (sse_clients[i] < 0)
+		{
+			slot = i;
+		}
+	}
 
-	httpd_resp_set_type(req, "application/json");
-	httpd_resp_send(req, otaJSON, strlen(otaJSON));
+	if (slot < 0)
+	{
+		// the page falls back to polling
+		httpd_resp_set_status(req, "503 Service Unavailable");
+		httpd_resp_send(req, NULL, 0);
+
+		return ESP_OK;
+	}
+
+	// the response never ends, so the headers are written straight to the socket
+	int len = sprintf(event, "retry: %d\n\n", HTTP_SSE_RETRY_MS);
+
+	if (httpd_socket_send(http_server_handle, sockfd, headers, sizeof(headers) - 1, 0) != sizeof(headers) - 1
+			|| httpd_socket_send(http_server_handle, sockfd, event, len, 0) != len)
+	{
+		return ESP_FAIL;
+	}
+
+	for (int index = 0; index < DHT22_sensor_count(); index++)
+	{
+		len = http_server_sse_format(event, index);
+		httpd_socket_send(http_server_handle, sockfd, event, len, 0);
+	}
+
+	sse_clients[slot] = sockfd;
+	trace_event(TRACE_SSE_SUBSCRIBE, sockfd, atomic_fetch_add(&sse_client_count, 1) + 1, 0);
 
 	return ESP_OK;
 }
 
 /**
- * Sets up the default httpd server configuration.
- * @return http server instance handle if successful, NULL otherwise.
+ * Session close callback: forgets /events subscribers and closes the socket.
  */
-static httpd_handle_t http_server_configure(void)
+static void http_server_close_fn(httpd_handle_t hd, int sockfd)
 {
-	// Generate the default configuration
-	httpd_config_t config = HTTPD_DEFAULT_CONFIG();
-
-	// Create HTTP server monitor task
-	xTaskCreatePinnedToCore(&http_server_monitor, "http_server_monitor", HTTP_SERVER_MONITOR_STACK_SIZE, NULL, HTTP_SERVER_MONITOR_PRIORITY, &task_http_server_monitor, HTTP_SERVER_MONITOR_CORE_ID);
+	(void)hd;
+	http_server_sse_remove(sockfd);
+	close(sockfd);
+}
 
-	// Create the message queue
-	http_server_monitor_queue_handle = xQueueCreate(3, sizeof(http_server_queue_message_t));
+/**
+ * Appends a histogram as a JSON array.
+ */
+static int http_server_append_hist(char *buf, const uint32_t *hist, int bins)
+{
+	int len = sprintf(buf, "[");
 
-	// The core that the HTTP server will run on
-	config.core_id = HTTP_SERVER_TASK_CORE_ID;
+	for (int b = 0; b < bins; b++)
+	{
+		len += sprintf(buf + len, "%s%u", b ? "," : "", hist[b]);
+	}
 
-	// Adjust the default priority to 1 less than the wifi application task
-	config.task_priority = HTTP_SERVER_TASK_PRIORITY;
+	return len + sprintf(buf + len, "]");
+}
 
-	// Bump up the stack size (default is 4096)
-	config.stack_size = HTTP_SERVER_TASK_STACK_SIZE;
+/**
+ * DHT diagnostics handler responds with the decode counters of every sensor: timeouts by
+ * protocol phase, checksum errors and histograms of the high pulse widths decoded as
+ * "0" and "1", which show the margin left around the bit threshold.
+ * @param req HTTP request for which the uri needs to be handled
+ * @return ESP_OK
+ */
+static esp_err_t http_server_dht_diagnostics_json_handler(httpd_req_t *req)
+{
+	char chunk[160 + 2 * DHT_HIST_BINS * 11];
+	int len;
 
-	// Increase uri handlers
-  config.max_uri_handlers = 20;
+	trace_event(TRACE_HTTP_REQUEST, (uintptr_t)"/dhtDiagnostics.json", 0, 0);
 
-	// Increase the timeout limits
-	config.recv_wait_timeout = 10;
-	config.send_wait_timeout = 10;
+	httpd_resp_set_type(req, "application/json");
 
-	ESP_LOGI(TAG,
-			"http_server_configure: Starting server on port: '%d' with task priority: '%d'",
-			config.server_port,
-			config.task_priority);
+	len = sprintf(chunk, "{\"threshold_us\":%d,\"bin_us\":%d,\"sensors\":[", DHT_BIT_THRESHOLD_US, DHT_HIST_BIN_US);
+	httpd_resp_send_chunk(req, chunk, len);
 
-	esp_err_t startup_code = httpd_start(&http_server_handle, &config);
-	if (startup_code != ESP_OK)
+	// one chunk per sensor keeps the buffer small whatever the table size
+	for (int i = 0; i < DHT22_sensor_count(); i++)
 	{
-		ESP_LOGI(TAG, "http_server_configure: Starting server error - %s", esp_err_to_name(startup_code));
-		return NULL;
+		const dht22_diag_t *diag = &DHT22_get_sensor(i)->diag;
+
+		len = sprintf(chunk, "%s{\"gpio\":%d,\"ok\":%u,\"checksum_errors\":%u,"
+				"\"timeouts\":{\"preamble\":%u,\"bit_low\":%u,\"bit_high\":%u},\"zero_high_hist\":",
+				i ? "," : "", DHT22_get_sensor(i)->gpio, diag->ok, diag->checksum_errors,
+				diag->timeouts[DHT_PHASE_PREAMBLE], diag->timeouts[DHT_PHASE_BIT_LOW], diag->timeouts[DHT_PHASE_BIT_HIGH]);
+		len += http_server_append_hist(chunk + len, diag->zero_high_hist, DHT_HIST_BINS);
+		len += sprintf(chunk + len, ",\"one_high_hist\":");
+		len += http_server_append_hist(chunk + len, diag->one_high_hist, DHT_HIST_BINS);
+		len += sprintf(chunk + len, "}");
+
+		httpd_resp_send_chunk(req, chunk, len);
 	}
 
-	ESP_LOGI(TAG, "http_server_configure: Registering URI handlers");
+	httpd_resp_send_chunk(req, "]}", 2);
+	httpd_resp_send_chunk(req, NULL, 0);
 
-  // register query handler
-  httpd_uri_t jquery_js = {
-      .uri = "/jquery.min.js",
-      .method = HTTP_GET,
-      .handler = http_server_jquery_handler,
-      .user_ctx = NULL
-  };
-  httpd_register_uri_handler(http_server_handle, &jquery_js);
+	return ESP_OK;
+}
 
-  // register index.html handler
-  httpd_uri_t index_html = {
-      .uri = "/",
-      .method = HTTP_GET,
-      .handler = http_server_index_html_handler,
-      .user_ctx = NULL
-  };
-  httpd_register_uri_handler(http_server_handle, &index_html);
+/**
+ * History handler streams stored readings of one sensor and tier as JSON.
+ * Query parameters: sensor (default 0), tier raw|minute|hour (default raw),
+ * from and to in seconds of uptime (default everything).
+ * Values are fixed point integers, divide by "scale".
+ * @param req HTTP request for which the uri needs to be handled
+ * @return ESP_OK
+ */
+static esp_err_t http_server_history_handler(httpd_req_t *req)
+{
+	char query[96] = "";
+	char param[16];
+	int sensor = 0;
+	sensor_history_tier_e tier = SENSOR_HISTORY_TIER_RAW;
+	uint32_t from_s = 0;
+	uint32_t to_s = UINT32_MAX;
 
-  // register app.css handler
-  httpd_uri_t app_css = {
-      .uri = "/app.css",
-      .method = HTTP_GET,
-      .handler = http_server_app_css_handler,
-      .user_ctx = NULL
-  };
-  httpd_register_uri_handler(http_server_handle, &app_css);
+	trace_event(TRACE_HTTP_REQUEST, (uintptr_t)"/history", 0, 0);
 
-  // register app.js handler
-  httpd_uri_t app_js = {
-      .uri = "/app.js",
-      .method = HTTP_GET,
-      .handler = http_server_app_js_handler,
-      .user_ctx = NULL
-  };
-  httpd_register_uri_handler(http_server_handle, &app_js);
+	if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK)
+	{
+		if (httpd_query_key_value(query, "sensor", param, sizeof(param)) == ESP_OK) sensor = atoi(param);
+		if (httpd_query_key_value(query, "tier", param, sizeof(param)) == ESP_OK) tier = sensor_history_tier_from_name(param);
+		if (httpd_query_key_value(query, "from", param, sizeof(param)) == ESP_OK) from_s = strtoul(param, NULL, 10);
+		if (httpd_query_key_value(query, "to", param, sizeof(param)) == ESP_OK) to_s = strtoul(param, NULL, 10);
+	}
 
-  // register favicon.ico handler
-  httpd_uri_t favicon_ico = {
-      .uri = "/favicon.ico",
-      .method = HTTP_GET,
-      .handler = http_server_favicon_ico_handler,
-      .user_ctx = NULL
-  };
-  httpd_register_uri_handler(http_server_handle, &favicon_ico);
+	if (sensor < 0 || sensor >= DHT22_sensor_count() || tier == SENSOR_HISTORY_TIER_COUNT)
+	{
+		httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Unknown sensor or tier");
+		return ESP_OK;
+	}
 
-  // register OTAupdate handler
-  httpd_uri_t OTA_update = {
-      .uri = "/OTAupdate",
-      .method = HTTP_POST,
-      .handler = http_server_OTA_update_handler,
-      .user_ctx = NULL
-  };
-  httpd_register_uri_handler(http_server_handle, &OTA_update);
+	// Stream the records in small batches so the response never sits in memory
+	sensor_history_record_t records[16];
+	char chunk[sizeof(records) / sizeof(records[0]) * 64 + 128];
+	uint32_t cursor = 0;
+	size_t sent = 0;
+	size_t n;
+	int len;
 
-  // register OTAstatus handler
-  httpd_uri_t OTA_status = {
-      .uri = "/OTAstatus",
-      .method = HTTP_POST,
-      .handler = http_server_OTA_status_handler,
-      .user_ctx = NULL
-  };
-  httpd_register_uri_handler(http_server_handle, &OTA_status);
+	httpd_resp_set_type(req, "application/json");
 
-  // register dhtSensor.json handler
-  httpd_uri_t dht_sensor_json = {
-      .uri = "/dhtSensor.json",
-      .method = HTTP_GET,
-      .handler = http_server_get_dht_sensor_readings_json_handler,
-      .user_ctx = NULL
-  };
-  httpd_register_uri_handler(http_server_handle, &dht_sensor_json);
+	len = sprintf(chunk, "{\"sensor\":%d,\"tier\":\"%s\",\"now\":%u,\"scale\":%d,"
+			"\"fields\":[\"time\",\"temp_min\",\"temp_max\",\"temp_mean\",\"hum_min\",\"hum_max\",\"hum_mean\"],\"records\":[",
+			sensor, sensor_history_tier_name(tier), (uint32_t)(esp_timer_get_time() / 1000000), SENSOR_HISTORY_SCALE);
 
-	return http_server_handle;
-}
+	do
+	{
+		n = sensor_history_read(sensor, tier, from_s, to_s, &cursor, records, sizeof(records) / sizeof(records[0]));
 
-void http_server_start(void)
-{
+		for (size_t i = 0; i < n; i++)
+		{
+			const sensor_history_record_t *r = &records[i];
+
+			len += sprintf(chunk + len, "%s[%u,%d,%d,%d,%u,%u,%u]", (sent + i) ? "," : "",
+					r->time_s, r->temp_min, r->temp_max, r->temp_mean, r->hum_min, r->hum_max, r->hum_mean);
+		}
+		sent += n;
+
+		if (n == 0)
+		{
+			len += sprintf(chunk + len, "]}");
+		}
+
+		if (httpd_resp_send_chunk(req, chunk, len) != ESP_OK)
+		{
+			return ESP_FAIL;
+		}
+		len = 0;
+	} while (n > 0);
+
+	httpd_resp_send_chunk(req, NULL, 0);
+
+	return ESP_OK;
+}
+
+/**
+ * Sends one sector worth of log records straight from memory mapped flash.
+ */
+static bool http_server_sample_log_send_sector(const sample_log_record_t *records, size_t count, void *arg)
+{
+	return httpd_resp_send_chunk((httpd_req_t *)arg, (const char *)records, count * sizeof(sample_log_record_t)) == ESP_OK;
+}
+
+/**
+ * Sample log handler streams the persistent log as packed sample_log_record_t structs, oldest first.
+ * Records whose check byte does not match were torn by a power loss and should be skipped.
+ * @param req HTTP request for which the uri needs to be handled
+ * @return ESP_OK
+ */
+static esp_err_t http_server_sample_log_handler(httpd_req_t *req)
+{
+	trace_event(TRACE_HTTP_REQUEST, (uintptr_t)"/sampleLog", 0, 0);
+
+	sample_log_flush();
+
+	httpd_resp_set_type(req, "application/octet-stream");
+	sample_log_for_each(http_server_sample_log_send_sector, req);
+	httpd_resp_send_chunk(req, NULL, 0);
+
+	return ESP_OK;
+}
+
+/**
+ * Trace handler sends the records still in the trace ring as text, oldest first.
+ * @param req HTTP request for which the uri needs to be handled
+ * @return ESP_OK
+ */
+static esp_err_t http_server_trace_handler(httpd_req_t *req)
+{
+	char chunk[1024];
+	trace_record_t record;
+	uint32_t head = trace_head();
+	uint32_t pos = head > TRACE_BUFFER_RECORDS ? head - TRACE_BUFFER_RECORDS : 0;
+	int len = 0;
+
+	httpd_resp_set_type(req, "text/plain");
+
+	for (; pos != head; pos++)
+	{
+		if (!trace_read(pos, &record))
+		{
+			continue;
+		}
+
+		if (len > (int)sizeof(chunk) - TRACE_LINE_SIZE - 1)
+		{
+			httpd_resp_send_chunk(req, chunk, len);
+			len = 0;
+		}
+		len += trace_format(&record, chunk + len, TRACE_LINE_SIZE);
+		chunk[len++] = '\n';
+	}
+
+	httpd_resp_send_chunk(req, chunk, len);
+	httpd_resp_send_chunk(req, NULL, 0);
+
+	return ESP_OK;
+}
+
+/**
+ * Response buffer that is sent as a chunk whenever it fills up
+ */
+typedef struct http_server_chunk
+{
+	httpd_req_t *req;
+	int len;
+	char buf[1024];
+} http_server_chunk_t;
+
+/**
+ * Appends formatted text to a chunked response.
+ */
+static void http_server_chunk_printf(http_server_chunk_t *c, const char *fmt, ...)
+{
+	va_list args;
+
+	for (int tries = 0; tries < 2; tries++)
+	{
+		va_start(args, fmt);
+		int n = vsnprintf(c->buf + c->len, sizeof(c->buf) - c->len, fmt, args);
+		va_end(args);
+
+		if (c->len + n < (int)sizeof(c->buf))
+		{
+			c->len += n;
+			return;
+		}
+
+		// did not fit: send what is there and retry in the empty buffer
+		httpd_resp_send_chunk(c->req, c->buf, c->len);
+		c->len = 0;
+	}
+}
+
+/**
+ * Appends bytes to a chunked response.
+ * @return false if sending a full buffer failed.
+ */
+static bool http_server_chunk_write(http_server_chunk_t *c, const void *data, size_t len)
+{
+	while (len > 0)
+	{
+		size_t n = MIN(len, sizeof(c->buf) - c->len);
+
+		memcpy(c->buf + c->len, data, n);
+		c->len += n;
+		data = (const uint8_t *)data + n;
+		len -= n;
+
+		if (c->len == (int)sizeof(c->buf))
+		{
+			if (httpd_resp_send_chunk(c->req, c->buf, c->len) != ESP_OK)
+			{
+				return false;
+			}
+			c->len = 0;
+		}
+	}
+
+	return true;
+}
+
+#define HTTP_EXPORT_CSV_HEADER		"seq,boot,time_s,sensor,temp_c,hum_pct\n"
+
+/**
+ * Selection and progress of a /export request. The export is walked twice: once to
+ * count its bytes and pin the records it holds, then to send the requested range.
+ */
+typedef struct http_server_export
+{
+	int sensor;						// -1 for every sensor
+	int boot;						// -1 for every boot
+	uint32_t from_s;				// uptime window within a boot, inclusive
+	uint32_t to_s;
+	uint32_t from_seq;				// log position window, inclusive
+	uint32_t to_seq;
+	bool csv;
+
+	size_t pos;						// bytes of the export produced so far
+	size_t start;					// byte range to send, end exclusive
+	size_t end;
+	uint32_t count;					// matching records seen by the counting pass
+	uint32_t first_seq;
+	uint32_t last_seq;
+	http_server_chunk_t *out;		// NULL while counting
+	bool failed;
+} http_server_export_t;
+
+/**
+ * Produces len bytes of the export, sending the part that lies in the requested range.
+ * @return false once the range is sent or sending failed.
+ */
+static bool http_server_export_emit(http_server_export_t *x, const void *data, size_t len)
+{
+	size_t from = x->pos;
+	size_t to = x->pos + len;
+
+	x->pos = to;
+
+	if (x->out == NULL || to <= x->start)
+	{
+		return true;
+	}
+
+	size_t a = MAX(from, x->start) - from;
+	size_t b = MIN(to, x->end) - from;
+
+	if (a < b && !http_server_chunk_write(x->out, (const uint8_t *)data + a, b - a))
+	{
+		x->failed = true;
+		return false;
+	}
+
+	return to < x->end;
+}
+
+/**
+ * Formats one record as a CSV line, values in degrees Celsius and %RH.
+ * @return length of the line.
+ */
+static int http_server_export_csv_line(const sample_log_record_t *r, char *line)
+{
+	int temp = r->temp < 0 ? -r->temp : r->temp;
+
+	return sprintf(line, "%u,%u,%u,%u,%s%d.%d,%u.%u\n", r->seq, r->boot, r->time_s, r->sensor,
+			r->temp < 0 ? "-" : "", temp / 10, temp % 10, r->hum / 10, r->hum % 10);
+}
+
+/**
+ * sample_log_for_each visitor: produces the matching records of one sector.
+ */
+static bool http_server_export_sector(const sample_log_record_t *records, size_t count, void *arg)
+{
+	http_server_export_t *x = arg;
+	char line[64];
+
+	for (size_t i = 0; i < count; i++)
+	{
+		const sample_log_record_t *r = &records[i];
+
+		if (!sample_log_record_valid(r)
+				|| r->seq < x->from_seq || r->seq > x->to_seq
+				|| (x->sensor >= 0 && r->sensor != x->sensor)
+				|| (x->boot >= 0 && r->boot != x->boot)
+				|| r->time_s < x->from_s || r->time_s > x->to_s)
+		{
+			continue;
+		}
+
+		if (x->out == NULL)
+		{
+			if (x->count++ == 0)
+			{
+				x->first_seq = r->seq;
+			}
+			x->last_seq = r->seq;
+		}
+
+		bool more = x->csv ? http_server_export_emit(x, line, http_server_export_csv_line(r, line))
+				: http_server_export_emit(x, r, sizeof(*r));
+
+		if (!more)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Parses a single byte range, "bytes=a-b", "bytes=a-" or "bytes=-n", against the export size.
+ * @return 1 if start/end (end exclusive) were set, 0 if the header should be ignored,
+ *         -1 if the range cannot be satisfied.
+ */
+static int http_server_parse_range(const char *value, size_t size, size_t *start, size_t *end)
+{
+	char *p;
+
+	if (strncmp(value, "bytes=", 6) != 0 || strchr(value, ',') != NULL)
+	{
+		return 0;
+	}
+	value += 6;
+
+	if (*value == '-')
+	{
+		unsigned long suffix = strtoul(value + 1, &p, 10);
+
+		if (p == value + 1 || *p != '\0')
+		{
+			return 0;
+		}
+		if (suffix == 0)
+		{
+			return -1;
+		}
+		*start = suffix < size ? size - suffix : 0;
+		*end = size;
+	}
+	else
+	{
+		unsigned long first = strtoul(value, &p, 10);
+		unsigned long last = size ? size - 1 : 0;
+
+		if (p == value || *p != '-')
+		{
+			return 0;
+		}
+		value = p + 1;
+		if (*value != '\0')
+		{
+			last = strtoul(value, &p, 10);
+			if (*p != '\0' || last < first)
+			{
+				return 0;
+			}
+		}
+		*start = first;
+		*end = MIN(last + 1, size);
+	}
+
+	return *start < size ? 1 : -1;
+}
+
+/**
+ * Export handler streams the persistent sample log for backups, oldest first, in one of
+ * two formats chosen by the Accept header or a format=csv|bin query parameter:
+ * packed 16 byte sample_log_record_t structs (application/octet-stream, the default),
+ * or CSV with a header line (text/csv).
+ * Query parameters: sensor, boot, from and to in seconds of uptime within a boot,
+ * from_seq and to_seq as log positions; all default to everything.
+ * Range requests are served against the selected records. The ETag names the first and
+ * last record of the selection and X-Export-Seq repeats them, so an interrupted transfer
+ * is resumed with the same query plus to_seq=<last>, Range: bytes=<received>- and
+ * If-Range: <ETag>. If older records were recycled meanwhile the whole export is sent.
+ * @param req HTTP request for which the uri needs to be handled
+ * @return ESP_OK, or ESP_FAIL if the log changed under a range that was promised.
+ */
+static esp_err_t http_server_export_handler(httpd_req_t *req)
+{
+	char query[128] = "";
+	char param[16];
+	char range[48];
+	char if_range[48];
+	char etag[40];
+	char seq[24];
+	char content_range[48];
+	http_server_export_t x = {
+		.sensor = -1,
+		.boot = -1,
+		.to_s = UINT32_MAX,
+		.to_seq = UINT32_MAX,
+		.csv = http_server_header_has(req, "Accept", "text/csv"),
+	};
+
+	trace_event(TRACE_HTTP_REQUEST, (uintptr_t)"/export", 0, 0);
+
+	if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK)
+	{
+		if (httpd_query_key_value(query, "sensor", param, sizeof(param)) == ESP_OK) x.sensor = atoi(param);
+		if (httpd_query_key_value(query, "boot", param, sizeof(param)) == ESP_OK) x.boot = atoi(param);
+		if (httpd_query_key_value(query, "from", param, sizeof(param)) == ESP_OK) x.from_s = strtoul(param, NULL, 10);
+		if (httpd_query_key_value(query, "to", param, sizeof(param)) == ESP_OK) x.to_s = strtoul(param, NULL, 10);
+		if (httpd_query_key_value(query, "from_seq", param, sizeof(param)) == ESP_OK) x.from_seq = strtoul(param, NULL, 10);
+		if (httpd_query_key_value(query, "to_seq", param, sizeof(param)) == ESP_OK) x.to_seq = strtoul(param, NULL, 10);
+		if (httpd_query_key_value(query, "format", param, sizeof(param)) == ESP_OK) x.csv = strcmp(param, "csv") == 0;
+	}
+
+	sample_log_flush();
+
+	// == counting pass: size of the export and the records it holds
+	if (x.csv)
+	{
+		http_server_export_emit(&x, HTTP_EXPORT_CSV_HEADER, strlen(HTTP_EXPORT_CSV_HEADER));
+	}
+	sample_log_for_each(http_server_export_sector, &x);
+
+	size_t size = x.pos;
+
+	if (x.count > 0)
+	{
+		// records appended from now on are not part of this export
+		x.from_seq = x.first_seq;
+		x.to_seq = x.last_seq;
+	}
+	sprintf(etag, "\"%x-%x-%s\"", x.first_seq, x.last_seq, x.csv ? "csv" : "bin");
+	sprintf(seq, "%u-%u", x.first_seq, x.last_seq);
+
+	httpd_resp_set_type(req, x.csv ? "text/csv" : "application/octet-stream");
+	httpd_resp_set_hdr(req, "ETag", etag);
+	httpd_resp_set_hdr(req, "X-Export-Seq", seq);
+	httpd_resp_set_hdr(req, "Accept-Ranges", "bytes");
+	httpd_resp_set_hdr(req, "Vary", "Accept");
+
+	// == range: ignored if the client's copy is of a different selection
+	x.start = 0;
+	x.end = size;
+
+	if (httpd_req_get_hdr_value_str(req, "Range", range, sizeof(range)) == ESP_OK
+			&& (httpd_req_get_hdr_value_str(req, "If-Range", if_range, sizeof(if_range)) != ESP_OK || strcmp(if_range, etag) == 0))
+	{
+		int ranged = http_server_parse_range(range, size, &x.start, &x.end);
+
+		if (ranged < 0)
+		{
+			sprintf(content_range, "bytes */%u", (unsigned)size);
+			httpd_resp_set_status(req, "416 Range Not Satisfiable");
+			httpd_resp_set_hdr(req, "Content-Range", content_range);
+			httpd_resp_send(req, NULL, 0);
+			return ESP_OK;
+		}
+		if (ranged > 0)
+		{
+			sprintf(content_range, "bytes %u-%u/%u", (unsigned)x.start, (unsigned)(x.end - 1), (unsigned)size);
+			httpd_resp_set_status(req, "206 Partial Content");
+			httpd_resp_set_hdr(req, "Content-Range", content_range);
+		}
+	}
+
+	// == sending pass, streamed from memory mapped flash in 1 KB chunks
+	http_server_chunk_t c = { .req = req };
+
+	x.pos = 0;
+	x.out = &c;
+
+	bool more = !x.csv || http_server_export_emit(&x, HTTP_EXPORT_CSV_HEADER, strlen(HTTP_EXPORT_CSV_HEADER));
+
+	if (more && x.start < x.end)
+	{
+		sample_log_for_each(http_server_export_sector, &x);
+	}
+
+	if (x.failed || MIN(x.pos, x.end) < x.end)
+	{
+		// connection lost, or records promised by Content-Range were recycled: let the client see it is short
+		ESP_LOGI(TAG, "http_server_export_handler: export cut short at %u of %u bytes", (unsigned)MIN(x.pos, x.end), (unsigned)x.end);
+		return ESP_FAIL;
+	}
+
+	if (c.len > 0 && httpd_resp_send_chunk(req, c.buf, c.len) != ESP_OK)
+	{
+		return ESP_FAIL;
+	}
+	httpd_resp_send_chunk(req, NULL, 0);
+
+	return ESP_OK;
+}
+
+/**
+ * Export acknowledgement handler: a collector that stored the records of an export posts
+ * /exportAck?seq=<last>, the last position of its X-Export-Seq. In sleep mode only an
+ * acknowledgement of every record counts as a successful upload window.
+ * Answers with {"acked":..,"next":..}: the position after the acknowledged records and the
+ * position the next record gets.
+ * @param req HTTP request for which the uri needs to be handled
+ * @return ESP_OK
+ */
+static esp_err_t http_server_export_ack_handler(httpd_req_t *req)
+{
+	char query[32];
+	char param[16];
+	char json[48];
+
+	if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK
+			|| httpd_query_key_value(query, "seq", param, sizeof(param)) != ESP_OK)
+	{
+		httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "seq required");
+		return ESP_OK;
+	}
+
+	if (!sample_log_ack(strtoul(param, NULL, 10)))
+	{
+		httpd_resp_set_status(req, "409 Conflict");
+	}
+
+	int len = sprintf(json, "{\"acked\":%u,\"next\":%u}", sample_log_acked(), sample_log_next_seq());
+
+	httpd_resp_set_type(req, "application/json");
+	httpd_resp_send(req, json, len);
+
+	return ESP_OK;
+}
+
+/**
+ * Reports the stack high-water mark of a task by name, if it is running.
+ */
+static void http_server_metrics_stack(http_server_chunk_t *c, const char *task_name)
+{
+	TaskHandle_t task = xTaskGetHandle(task_name);
+
+	if (task != NULL)
+	{
+		http_server_chunk_printf(c, "esp_task_stack_free_min_bytes{task=\"%s\"} %u\n", task_name, uxTaskGetStackHighWaterMark(task));
+	}
+}
+
+/**
+ * @return name of the method of a registered URI, for the method label.
+ */
+static const char *http_server_route_method(const http_server_route_metrics_t *m)
+{
+	static const char *const methods[] = { [HTTP_GET] = "GET", [HTTP_POST] = "POST" };
+
+	return m->method < sizeof(methods) / sizeof(methods[0]) && methods[m->method] ? methods[m->method] : "OTHER";
+}
+
+/**
+ * Reports one counter of every registered URI as a metric family: its TYPE line, then a
+ * sample per URI.
+ * @param name metric name.
+ * @param offset offset of the counter in http_server_route_metrics_t.
+ */
+static void http_server_metrics_route_counter(http_server_chunk_t *c, const char *name, size_t offset)
+{
+	http_server_chunk_printf(c, "# TYPE %s counter\n", name);
+
+	for (int i = 0; i < route_metrics_count; i++)
+	{
+		http_server_route_metrics_t *m = &route_metrics[i];
+		atomic_uint *counter = (atomic_uint *)((char *)m + offset);
+
+		http_server_chunk_printf(c, "%s{uri=\"%s\",method=\"%s\"} %u\n", name, m->uri, http_server_route_method(m),
+				atomic_load_explicit(counter, memory_order_relaxed));
+	}
+}
+
+/**
+ * Metrics handler reports request counters and latency histograms per registered URI,
+ * heap and stack usage and sensor counters in the Prometheus text format. The samples
+ * of a metric family follow its TYPE line and no other family comes between them.
+ * @param req HTTP request for which the uri needs to be handled
+ * @return ESP_OK
+ */
+static esp_err_t http_server_metrics_handler(httpd_req_t *req)
+{
+	http_server_chunk_t c = { .req = req };
+
+	httpd_resp_set_type(req, "text/plain; version=0.0.4");
+
+	// == HTTP ==========
+	http_server_metrics_route_counter(&c, "http_requests_total", offsetof(http_server_route_metrics_t, requests));
+	http_server_metrics_route_counter(&c, "http_request_errors_total", offsetof(http_server_route_metrics_t, errors));
+	http_server_metrics_route_counter(&c, "http_requests_shed_total", offsetof(http_server_route_metrics_t, shed));
+
+	http_server_chunk_printf(&c, "# TYPE http_request_duration_ms histogram\n");
+	for (int i = 0; i < route_metrics_count; i++)
+	{
+		http_server_route_metrics_t *m = &route_metrics[i];
+		const char *method = http_server_route_method(m);
+		unsigned cumulative = 0;
+
+		for (int b = 0; b <= HTTP_METRICS_LATENCY_BUCKETS; b++)
+		{
+			char le[12];
+
+			cumulative += atomic_load_explicit(&m->latency_hist[b], memory_order_relaxed);
+			if (b < HTTP_METRICS_LATENCY_BUCKETS) sprintf(le, "%u", latency_buckets_ms[b]);
+			else strcpy(le, "+Inf");
+
+			http_server_chunk_printf(&c, "http_request_duration_ms_bucket{uri=\"%s\",method=\"%s\",le=\"%s\"} %u\n", m->uri, method, le, cumulative);
+		}
+		http_server_chunk_printf(&c, "http_request_duration_ms_sum{uri=\"%s\",method=\"%s\"} %u\n", m->uri, method, atomic_load_explicit(&m->latency_ms_sum, memory_order_relaxed));
+		http_server_chunk_printf(&c, "http_request_duration_ms_count{uri=\"%s\",method=\"%s\"} %u\n", m->uri, method, cumulative);
+	}
+
+	http_server_chunk_printf(&c, "# TYPE http_events_subscribers gauge\nhttp_events_subscribers %d\n", atomic_load(&sse_client_count));
+	http_server_chunk_printf(&c, "# TYPE http_events_dropped_total counter\nhttp_events_dropped_total %u\n", sse_dropped);
+	http_server_chunk_printf(&c, "# TYPE http_monitor_dropped_total counter\nhttp_monitor_dropped_total %u\n", atomic_load(&monitor_dropped));
+
+	// == wifi events ==========
+	uint32_t wifi_merged, wifi_dropped;
+	wifi_app_get_event_counts(&wifi_merged, &wifi_dropped);
+	http_server_chunk_printf(&c, "# TYPE wifi_events_merged_total counter\nwifi_events_merged_total %u\n", wifi_merged);
+	http_server_chunk_printf(&c, "# TYPE wifi_events_dropped_total counter\nwifi_events_dropped_total %u\n", wifi_dropped);
+
+	// == memory ==========
+	http_server_chunk_printf(&c, "# TYPE esp_heap_free_bytes gauge\nesp_heap_free_bytes %u\n", esp_get_free_heap_size());
+	http_server_chunk_printf(&c, "# TYPE esp_heap_free_min_bytes gauge\nesp_heap_free_min_bytes %u\n", esp_get_minimum_free_heap_size());
+	http_server_chunk_printf(&c, "# TYPE esp_heap_largest_free_block_bytes gauge\nesp_heap_largest_free_block_bytes %u\n",
+			heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+
+	http_server_chunk_printf(&c, "# TYPE esp_task_stack_free_min_bytes gauge\n");
+	http_server_metrics_stack(&c, "wifi_app_task");
+	http_server_metrics_stack(&c, "DHT22_task");
+	http_server_metrics_stack(&c, "http_server_monitor");
+	// httpd names the tasks of both servers "httpd"; this is the one found first
+	http_server_metrics_stack(&c, "httpd");
+	http_server_metrics_stack(&c, "trace_drain");
+
+	// == sensors ==========
+	http_server_chunk_printf(&c, "# TYPE dht_reads_total counter\n");
+	for (int i = 0; i < DHT22_sensor_count(); i++)
+	{
+		const dht22_sensor_t *sensor = DHT22_get_sensor(i);
+
+		http_server_chunk_printf(&c, "dht_reads_total{gpio=\"%d\",result=\"ok\"} %u\n", sensor->gpio, sensor->diag.ok);
+		http_server_chunk_printf(&c, "dht_reads_total{gpio=\"%d\",result=\"checksum\"} %u\n", sensor->gpio, sensor->diag.checksum_errors);
+		http_server_chunk_printf(&c, "dht_reads_total{gpio=\"%d\",result=\"timeout\"} %u\n", sensor->gpio,
+				DHT22_diag_timeouts(&sensor->diag));
+	}
+
+	http_server_chunk_printf(&c, "# TYPE dht_filter_rejects_total counter\n");
+	for (int i = 0; i < DHT22_sensor_count(); i++)
+	{
+		const dht22_sensor_t *sensor = DHT22_get_sensor(i);
+
+		http_server_chunk_printf(&c, "dht_filter_rejects_total{gpio=\"%d\"} %u\n", sensor->gpio, sensor->filter_rejects);
+	}
+
+	http_server_chunk_printf(&c, "# TYPE dht_sample_period_ms gauge\n");
+	for (int i = 0; i < DHT22_sensor_count(); i++)
+	{
+		http_server_chunk_printf(&c, "dht_sample_period_ms{gpio=\"%d\"} %u\n", DHT22_get_sensor(i)->gpio, DHT22_get_period(i));
+	}
+
+	httpd_resp_send_chunk(req, c.buf, c.len);
+	httpd_resp_send_chunk(req, NULL, 0);
+
+	return ESP_OK;
+}
+
+/**
+ * State of an upload between the receiving handler and the OTA writer
+ */
+typedef struct http_server_ota_upload
+{
+	const esp_partition_t *partition;
+	size_t image_size;				// uploaded size from X-OTA-Size, 0 if unknown
+	ota_writer_t *writer;			// started with the first image byte
+	ota_inflate_t *inflate;			// NULL unless the image is gzip compressed
+	size_t received;				// image bytes as uploaded, compressed or not
+	esp_err_t err;
+	mbedtls_sha256_context sha;		// of the uploaded bytes
+	bool has_digest;
+	uint8_t digest[32];				// from X-OTA-SHA256
+} http_server_ota_upload_t;
+
+// Resumable upload (/OTAchunk), kept between requests
+static http_server_ota_upload_t g_ota_session;
+static bool g_ota_session_active;
+
+/**
+ * Parses a SHA-256 digest given as 64 hex digits.
+ * @return false if it is not one.
+ */
+static bool http_server_parse_sha256(const char *hex, uint8_t digest[32])
+{
+	if (strlen(hex) != 64)
+	{
+		return false;
+	}
+
+	for (int i = 0; i < 32; i++)
+	{
+		char byte[3] = { hex[2 * i], hex[2 * i + 1], '\0' };
+		char *end;
+
+		digest[i] = strtoul(byte, &end, 16);
+		if (*end != '\0')
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Prepares an upload from the X-OTA-Size and X-OTA-SHA256 request headers.
+ * @return false if X-OTA-SHA256 is present but malformed.
+ */
+static bool http_server_OTA_begin(http_server_ota_upload_t *upload, httpd_req_t *req)
+{
+	char header[80];
+
+	memset(upload, 0, sizeof(*upload));
+	upload->partition = esp_ota_get_next_update_partition(NULL);
+
+	if (httpd_req_get_hdr_value_str(req, "X-OTA-Size", header, sizeof(header)) == ESP_OK)
+	{
+		upload->image_size = strtoul(header, NULL, 10);
+	}
+
+	if (httpd_req_get_hdr_value_str(req, "X-OTA-SHA256", header, sizeof(header)) == ESP_OK)
+	{
+		if (!http_server_parse_sha256(header, upload->digest))
+		{
+			return false;
+		}
+		upload->has_digest = true;
+	}
+
+	mbedtls_sha256_init(&upload->sha);
+	mbedtls_sha256_starts_ret(&upload->sha, 0);
+	trace_event(TRACE_OTA_BEGIN, upload->image_size, upload->partition->address, 0);
+
+	return true;
+}
+
+/**
+ * Hashes image data and passes it to the OTA writer. A gzip compressed image is
+ * recognized by its first byte and decompressed on the way.
+ * @return false if the update failed; upload->err tells why.
+ */
+static bool http_server_OTA_feed(http_server_ota_upload_t *upload, const uint8_t *data, size_t len)
+{
+	if (upload->err != ESP_OK || len == 0)
+	{
+		return upload->err == ESP_OK;
+	}
+
+	if (upload->writer == NULL)
+	{
+		bool gzip = data[0] == OTA_INFLATE_GZIP_MAGIC;
+
+		// only the size of an uncompressed image tells how much flash to erase
+		upload->writer = ota_writer_start(upload->partition, gzip ? 0 : upload->image_size);
+		upload->inflate = gzip && upload->writer ? ota_inflate_start(upload->writer) : NULL;
+		if (upload->writer == NULL || (gzip && upload->inflate == NULL))
+		{
+			ESP_LOGI(TAG, "http_server_OTA_feed: Error with OTA begin, cancelling OTA");
+			upload->err = ESP_FAIL;
+			return false;
+		}
+		if (gzip)
+		{
+			ESP_LOGI(TAG, "http_server_OTA_feed: gzip compressed image");
+		}
+	}
+
+	mbedtls_sha256_update_ret(&upload->sha, data, len);
+	upload->received += len;
+	upload->err = upload->inflate ? ota_inflate_write(upload->inflate, data, len) : ota_writer_write(upload->writer, data, len);
+
+	return upload->err == ESP_OK;
+}
+
+/**
+ * Ends an upload: checks the decompressed stream and the SHA-256 of the upload, ends the
+ * OTA and switches the boot partition if everything matched, and reports the result.
+ * @param complete false if the upload is known to be broken, the update is discarded.
+ * @return true if the new firmware will boot next.
+ */
+static bool http_server_OTA_complete(http_server_ota_upload_t *upload, bool complete)
+{
+	uint8_t digest[32];
+	esp_err_t err = ESP_FAIL;
+	bool flash_successful = false;
+
+	if (upload->inflate && ota_inflate_finish(upload->inflate) != ESP_OK)
+	{
+		complete = false;
+	}
+
+	mbedtls_sha256_finish_ret(&upload->sha, digest);
+	mbedtls_sha256_free(&upload->sha);
+	if (upload->has_digest && memcmp(digest, upload->digest, sizeof(digest)) != 0)
+	{
+		ESP_LOGI(TAG, "http_server_OTA_complete: SHA-256 mismatch, image discarded");
+		complete = false;
+	}
+
+	g_ota_received = upload->received;
+	g_ota_written = upload->writer ? ota_writer_size(upload->writer) : 0;
+	if (upload->writer)
+	{
+		err = ota_writer_finish(upload->writer, complete);
+	}
+
+	trace_event(TRACE_OTA_END, g_ota_written, err, 0);
+	if (err == ESP_OK)
+	{
+		// Lets update the partition
+		if (esp_ota_set_boot_partition(upload->partition) == ESP_OK)
+		{
+			const esp_partition_t *boot_partition = esp_ota_get_boot_partition();
+			ESP_LOGI(TAG, "http_server_OTA_complete: Next boot partition subtype %d at offset 0x%x", boot_partition->subtype, boot_partition->address);
+			flash_successful = true;
+		}
+		else
+		{
+			ESP_LOGI(TAG, "http_server_OTA_complete: FLASHED ERROR!!!");
+		}
+	}
+	else
+	{
+		ESP_LOGI(TAG, "http_server_OTA_complete: esp_ota_end ERROR!!!");
+	}
+
+	g_ota_updates++;
+
+	// We won't update the global variables throughout the file, so send the message about the status
+	if (flash_successful) { http_server_monitor_send_message(HTTP_MSG_OTA_UPDATE_SUCCESSFUL); } else { http_server_monitor_send_message(HTTP_MSG_OTA_UPDATE_FAILED); }
+
+	return flash_successful;
+}
+
+/**
+ * Multipart callback: passes the body of the form's only part, the image, on.
+ */
+static bool http_server_OTA_data(void *arg, int part, const uint8_t *data, size_t len)
+{
+	return part != 1 || http_server_OTA_feed(arg, data, len);
+}
+
+/**
+ * Receives the .bin file fia the web page and handles the firmware update.
+ * The multipart body is parsed as it streams in and the image is written to flash by
+ * the OTA writer task while the next piece is received. Images may be gzip compressed.
+ * The image is only accepted if the closing boundary arrived, its uploaded length
+ * matches the X-OTA-Size header and its SHA-256 the X-OTA-SHA256 header, when sent.
+ * @param req HTTP request for which the uri needs to be handled.
+ * @return ESP_OK, otherwise ESP_FAIL if the update cannot be started.
+ */
+esp_err_t http_server_OTA_update_handler(httpd_req_t *req)
+{
+	char header[128];
+	char boundary[MULTIPART_BOUNDARY_MAX + 1];
+	multipart_parser_t parser;
+	multipart_status_e status = MULTIPART_MORE;
+	http_server_ota_upload_t upload;
+	int content_length = req->content_len;
+	int content_received = 0;
+	int recv_len;
+
+	if (httpd_req_get_hdr_value_str(req, "Content-Type", header, sizeof(header)) != ESP_OK
+			|| !multipart_get_boundary(header, boundary))
+	{
+		ESP_LOGI(TAG, "http_server_OTA_update_handler: not a multipart upload");
+		http_server_monitor_send_message(HTTP_MSG_OTA_UPDATE_FAILED);
+		return ESP_FAIL;
+	}
+
+	uint8_t *ota_buff = malloc(HTTP_OTA_RX_BUFFER_SIZE);
+
+	if (ota_buff == NULL || !http_server_OTA_begin(&upload, req))
+	{
+		ESP_LOGI(TAG, "http_server_OTA_update_handler: cannot start, cancelling OTA");
+		free(ota_buff);
+		http_server_monitor_send_message(HTTP_MSG_OTA_UPDATE_FAILED);
+		return ESP_FAIL;
+	}
+
+	multipart_init(&parser, boundary, http_server_OTA_data, &upload);
+
+	while (content_received < content_length && status == MULTIPART_MORE)
+	{
+		// Read the data for the request
+		if ((recv_len = httpd_req_recv(req, (char *)ota_buff, MIN(content_length - content_received, HTTP_OTA_RX_BUFFER_SIZE))) < 0)
+		{
+			// Check if timeout occurred
+			if (recv_len == HTTPD_SOCK_ERR_TIMEOUT)
+			{
+				ESP_LOGI(TAG, "http_server_OTA_update_handler: Socket Timeout");
+				continue; ///> Retry receiving if timeout occurred
+			}
+			ESP_LOGI(TAG, "http_server_OTA_update_handler: OTA other Error %d", recv_len);
+			break;
+		}
+		if (recv_len == 0)
+		{
+			break;
+		}
+
+		content_received += recv_len;
+		status = multipart_feed(&parser, ota_buff, recv_len);
+		trace_event(TRACE_OTA_PROGRESS, content_received, content_length, upload.writer ? ota_writer_size(upload.writer) : 0);
+	}
+
+	free(ota_buff);
+
+	bool complete = status == MULTIPART_DONE && (upload.image_size == 0 || upload.received == upload.image_size);
+
+	if (!complete)
+	{
+		ESP_LOGI(TAG, "http_server_OTA_update_handler: upload incomplete, %zu of %zu bytes, parser status %d", upload.received, upload.image_size, status);
+	}
+
+	http_server_OTA_complete(&upload, complete);
+
+	return ESP_OK;
+}
+
+/**
+ * Sends the state of the resumable upload: {"active":..,"committed":..,"size":..}.
+ */
+static esp_err_t http_server_OTA_send_session(httpd_req_t *req, const char *status)
+{
+	char json[96];
+	int len = sprintf(json, "{\"active\":%s,\"committed\":%zu,\"size\":%zu}", g_ota_session_active ? "true" : "false",
+			g_ota_session.received, g_ota_session.image_size);
+
+	if (status)
+	{
+		httpd_resp_set_status(req, status);
+	}
+	httpd_resp_set_type(req, "application/json");
+	httpd_resp_send(req, json, len);
+
+	return ESP_OK;
+}
+
+/**
+ * Resumable firmware upload: POST /OTAchunk?offset=N with raw image bytes as the body.
+ * Offset 0 starts a new upload and needs the X-OTA-Size and X-OTA-SHA256 headers; any
+ * other offset must equal the bytes committed so far (409 Conflict otherwise, with the
+ * committed count, as GET /OTAchunk returns it). Data survives a dropped connection, so
+ * the client continues from the committed offset. When the last byte arrives the SHA-256
+ * is checked before the new firmware is made bootable.
+ * @param req HTTP request for which the uri needs to be handled.
+ * @return ESP_OK
+ */
+static esp_err_t http_server_OTA_chunk_receive(httpd_req_t *req)
+{
+	char query[64];
+	char param[16];
+	long offset = -1;
+	int content_length = req->content_len;
+	int content_received = 0;
+	int recv_len;
+
+	if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK
+			&& httpd_query_key_value(query, "offset", param, sizeof(param)) == ESP_OK)
+	{
+		offset = strtol(param, NULL, 10);
+	}
+
+	if (offset == 0)
+	{
+		if (g_ota_session_active)
+		{
+			// a new upload replaces an unfinished one
+			http_server_OTA_complete(&g_ota_session, false);
+			g_ota_session_active = false;
+		}
+		if (!http_server_OTA_begin(&g_ota_session, req) || !g_ota_session.has_digest || g_ota_session.image_size == 0)
+		{
+			mbedtls_sha256_free(&g_ota_session.sha);
+			httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "X-OTA-Size and X-OTA-SHA256 required");
+			return ESP_OK;
+		}
+		g_ota_session_active = true;
+	}
+	else if (!g_ota_session_active || offset != (long)g_ota_session.received)
+	{
+		return http_server_OTA_send_session(req, "409 Conflict");
+	}
+
+	if (g_ota_session.received + content_length > g_ota_session.image_size)
+	{
+		httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Chunk past the end of the image");
+		return ESP_OK;
+	}
+
+	uint8_t *ota_buff = malloc(HTTP_OTA_RX_BUFFER_SIZE);
+
+	if (ota_buff == NULL)
+	{
+		httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+		return ESP_OK;
+	}
+
+	while (content_received < content_length)
+	{
+		if ((recv_len = httpd_req_recv(req, (char *)ota_buff, MIN(content_length - content_received, HTTP_OTA_RX_BUFFER_SIZE))) < 0)
+		{
+			if (recv_len == HTTPD_SOCK_ERR_TIMEOUT)
+			{
+				continue;
+			}
+			// what arrived so far is committed, the client resumes from there
+			ESP_LOGI(TAG, "http_server_OTA_chunk_handler: connection lost at %zu", g_ota_session.received);
+			free(ota_buff);
+			return ESP_FAIL;
+		}
+		if (recv_len == 0)
+		{
+			break;
+		}
+
+		content_received += recv_len;
+		if (!http_server_OTA_feed(&g_ota_session, ota_buff, recv_len))
+		{
+			break;
+		}
+		trace_event(TRACE_OTA_PROGRESS, g_ota_session.received, g_ota_session.image_size, ota_writer_size(g_ota_session.writer));
+	}
+
+	free(ota_buff);
+
+	if (g_ota_session.err != ESP_OK)
+	{
+		http_server_OTA_complete(&g_ota_session, false);
+		g_ota_session_active = false;
+		httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Flash write failed, start again");
+		return ESP_OK;
+	}
+
+	if (g_ota_session.received == g_ota_session.image_size)
+	{
+		g_ota_session_active = false;
+		if (!http_server_OTA_complete(&g_ota_session, true))
+		{
+			httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Image rejected, start again");
+			return ESP_OK;
+		}
+	}
+
+	return http_server_OTA_send_session(req, NULL);
+}
+
+static esp_err_t http_server_OTA_chunk_handler(httpd_req_t *req)
+{
+	if (req->method == HTTP_GET)
+	{
+		return http_server_OTA_send_session(req, NULL);
+	}
+
+	return http_server_OTA_chunk_receive(req);
+}
+
+/**
+ * Renders the firmware update status JSON.
+ * @return length of the body.
+ */
+static int http_server_build_ota_status_json(char *otaJSON)
+{
+	return sprintf(otaJSON, "{\"ota_update_status\":%d,\"compile_time\":\"%s\",\"compile_date\":\"%s\",\"received_bytes\":%zu,\"written_bytes\":%zu}",
+			g_fw_update_status, __TIME__, __DATE__, g_ota_received, g_ota_written);
+}
+
+/**
+ * OTA status handler responds with the firmware update status after the OTA update is started
+ * and responds with the compile time/date when the page is first requested
+ * @param req HTTP request for which the uri needs to be handled
+ * @return ESP_OK
+ */
+esp_err_t http_server_OTA_status_handler(httpd_req_t *req)
+{
+	trace_event(TRACE_HTTP_REQUEST, (uintptr_t)"/OTAstatus", 0, 0);
+
+	// the status and the sizes of the last update are the parts that change
+	return http_server_send_cached_json(req, &ota_status_json_cache, g_ota_updates * 4 + (unsigned)(g_fw_update_status + 1),
+			http_server_build_ota_status_json);
+}
+
+/**
+ * wifiConnect.json handler is invoked after the connect button is pressed and handles
+ * receiving the SSID and password entered by the user
+ * @param req HTTP request for which the uri needs to be handled.
+ * @return ESP_OK
+ */
+static esp_err_t http_server_wifi_connect_json_handler(httpd_req_t *req)
+{
+	char ssid[MAX_SSID_LENGTH + 1];
+	char pass[MAX_PASSWORD_LENGTH + 1];
+
+	trace_event(TRACE_HTTP_REQUEST, (uintptr_t)"/wifiConnect.json", 0, 0);
+
+	// credentials come in headers; longer values than the IEEE limits are rejected, not truncated
+	if (httpd_req_get_hdr_value_str(req, "my-connect-ssid", ssid, sizeof(ssid)) != ESP_OK
+			|| httpd_req_get_hdr_value_str(req, "my-connect-pwd", pass, sizeof(pass)) != ESP_OK)
+	{
+		httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing or too long SSID or password");
+		return ESP_OK;
+	}
+
+	ESP_LOGI(TAG, "http_server_wifi_connect_json_handler: SSID %s", ssid);
+
+	// the wifi application task owns the configuration, the credentials go with the message
+	if (wifi_app_send_connect_message(ssid, pass) != pdTRUE)
+	{
+		httpd_resp_set_status(req, "503 Service Unavailable");
+		httpd_resp_set_hdr(req, "Retry-After", "1");
+		httpd_resp_sendstr(req, "Busy, try again");
+		return ESP_OK;
+	}
+
+	httpd_resp_set_type(req, "application/json");
+	httpd_resp_sendstr(req, "{}");
+
+	return ESP_OK;
+}
+
+/**
+ * wifiConnectStatus handler updates the connection status for the web page.
+ * @param req HTTP request for which the uri needs to be handled.
+ * @return ESP_OK
+ */
+static esp_err_t http_server_wifi_connect_status_json_handler(httpd_req_t *req)
+{
+	char statusJSON[32];
+	int len = sprintf(statusJSON, "{\"wifi_connect_status\":%d}", g_wifi_connect_status);
+
+	trace_event(TRACE_HTTP_REQUEST, (uintptr_t)"/wifiConnectStatus", 0, 0);
+
+	httpd_resp_set_type(req, "application/json");
+	httpd_resp_send(req, statusJSON, len);
+
+	return ESP_OK;
+}
+
+/**
+ * wifiConnectInfo.json handler updates the web page with the connection information:
+ * SSID of the access point, IP address, netmask and gateway of the station.
+ * @param req HTTP request for which the uri needs to be handled.
+ * @return ESP_OK
+ */
+static esp_err_t http_server_get_wifi_connect_info_json_handler(httpd_req_t *req)
+{
+	char ipInfoJSON[200];
+	char ip[IP4ADDR_STRLEN_MAX];
+	char netmask[IP4ADDR_STRLEN_MAX];
+	char gw[IP4ADDR_STRLEN_MAX];
+	wifi_ap_record_t wifi_data;
+	esp_netif_ip_info_t ip_info;
+	int len = sprintf(ipInfoJSON, "{}");
+
+	trace_event(TRACE_HTTP_REQUEST, (uintptr_t)"/wifiConnectInfo.json", 0, 0);
+
+	if (g_wifi_connect_status == HTTP_WIFI_STATUS_CONNECT_SUCCESS
+			&& esp_wifi_sta_get_ap_info(&wifi_data) == ESP_OK
+			&& esp_netif_get_ip_info(esp_netif_sta, &ip_info) == ESP_OK)
+	{
+		esp_ip4addr_ntoa(&ip_info.ip, ip, IP4ADDR_STRLEN_MAX);
+		esp_ip4addr_ntoa(&ip_info.netmask, netmask, IP4ADDR_STRLEN_MAX);
+		esp_ip4addr_ntoa(&ip_info.gw, gw, IP4ADDR_STRLEN_MAX);
+
+		len = snprintf(ipInfoJSON, sizeof(ipInfoJSON), "{\"ip\":\"%s\",\"netmask\":\"%s\",\"gw\":\"%s\",\"ap\":\"%.32s\"}",
+				ip, netmask, gw, (const char *)wifi_data.ssid);
+	}
+
+	httpd_resp_set_type(req, "application/json");
+	httpd_resp_send(req, ipInfoJSON, MIN(len, (int)sizeof(ipInfoJSON) - 1));
+
+	return ESP_OK;
+}
+
+/**
+ * wifiDisconnect.json handler disconnects the station and forgets the saved credentials.
+ * @param req HTTP request for which the uri needs to be handled.
+ * @return ESP_OK
+ */
+static esp_err_t http_server_wifi_disconnect_json_handler(httpd_req_t *req)
+{
+	ESP_LOGI(TAG, "wifiDisconnect.json requested");
+
+	wifi_app_send_message(WIFI_APP_MSG_USER_REQUESTED_STA_DISCONNECT);
+
+	httpd_resp_set_type(req, "application/json");
+	httpd_resp_sendstr(req, "{}");
+
+	return ESP_OK;
+}
+
+/**
+ * Runs the handler of a registered URI and updates its metrics.
+ * @param m the route.
+ * @param req HTTP request.
+ * @return what the handler returned.
+ */
+static esp_err_t http_server_run_metered(http_server_route_metrics_t *m, httpd_req_t *req)
+{
+	int64_t start = esp_timer_get_time();
+	esp_err_t ret = m->handler(req);
+	uint32_t elapsed_ms = (esp_timer_get_time() - start) / 1000;
+	int b = 0;
+
+	while (b < HTTP_METRICS_LATENCY_BUCKETS && elapsed_ms > latency_buckets_ms[b])
+	{
+		b++;
+	}
+
+	atomic_fetch_add_explicit(&m->requests, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&m->latency_hist[b], 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&m->latency_ms_sum, elapsed_ms, memory_order_relaxed);
+	if (ret != ESP_OK)
+	{
+		atomic_fetch_add_explicit(&m->errors, 1, memory_order_relaxed);
+	}
+
+	return ret;
+}
+
+/**
+ * @return IPv4 address of the client that sent the request, 0 if unknown.
+ */
+static uint32_t http_server_client_ip(httpd_req_t *req)
+{
+	struct sockaddr_in6 addr;
+	socklen_t len = sizeof(addr);
+	uint32_t ip = 0;
+
+	if (getpeername(httpd_req_to_sockfd(req), (struct sockaddr *)&addr, &len) != 0)
+	{
+		return 0;
+	}
+
+	if (addr.sin6_family == AF_INET6)
+	{
+		// IPv4 clients of a dual stack socket are IPv4-mapped, in the last 4 bytes
+		memcpy(&ip, &addr.sin6_addr.s6_addr[12], sizeof(ip));
+	}
+	else
+	{
+		ip = ((struct sockaddr_in *)&addr)->sin_addr.s_addr;
+	}
+
+	return ip;
+}
+
+/**
+ * Takes a token from the client's bucket of a rate class. Clients are kept in a small
+ * table; a new one replaces the least recently seen and starts with full buckets.
+ * @param retry_s receives the seconds until the next token, when none is left.
+ * @return true if the request may run.
+ */
+static bool http_server_rate_admit(uint32_t ip, http_server_rate_class_e rate_class, uint32_t *retry_s)
+{
+	uint32_t now_ms = (uint32_t)(esp_timer_get_time() / 1000);
+	http_server_rate_client_t *client = &rate_clients[0];
+
+	for (int i = 0; i < HTTP_RATE_MAX_CLIENTS; i++)
+	{
+		if (rate_clients[i].ip == ip)
+		{
+			client = &rate_clients[i];
+			break;
+		}
+		if (now_ms - rate_clients[i].last_ms > now_ms - client->last_ms || rate_clients[i].ip == 0)
+		{
+			client = &rate_clients[i];
+		}
+	}
+
+	if (client->ip != ip)
+	{
+		client->ip = ip;
+		client->last_ms = now_ms;
+		for (int c = 0; c < HTTP_RATE_CLASS_COUNT; c++)
+		{
+			client->tokens[c] = http_server_rate_limits[c].burst * 1000;
+		}
+	}
+
+	// refill every class; a minute is longer than any bucket takes to fill
+	uint32_t elapsed_ms = MIN(now_ms - client->last_ms, 60000);
+
+	client->last_ms = now_ms;
+	for (int c = 0; c < HTTP_RATE_CLASS_COUNT; c++)
+	{
+		client->tokens[c] = MIN(client->tokens[c] + elapsed_ms * http_server_rate_limits[c].per_s,
+				http_server_rate_limits[c].burst * 1000u);
+	}
+
+	if (client->tokens[rate_class] < 1000)
+	{
+		uint32_t rate = http_server_rate_limits[rate_class].per_s * 1000u;
+
+		*retry_s = MAX((1000 - client->tokens[rate_class] + rate - 1) / rate, 1);
+		return false;
+	}
+
+	client->tokens[rate_class] -= 1000;
+
+	return true;
+}
+
+/**
+ * Length of the host name at the start of a Host header value or an origin's authority,
+ * without the port; IPv6 addresses keep their brackets.
+ */
+static size_t http_server_host_len(const char *authority)
+{
+	if (authority[0] == '[')
+	{
+		const char *end = strchr(authority, ']');
+
+		return end ? (size_t)(end - authority) + 1 : strlen(authority);
+	}
+
+	return strcspn(authority, ":/");
+}
+
+/**
+ * Lets the web page, served by the main server, call the bulk server on the same host:
+ * a request whose Origin names the host it was sent to gets Access-Control-Allow-Origin
+ * back. Pages from other hosts get nothing and the browser keeps their requests out.
+ * Only used on the bulk server task.
+ * @param req HTTP request.
+ */
+static void http_server_bulk_allow_origin(httpd_req_t *req)
+{
+	// response header values are sent after the handler returns, keep this one until then
+	static char origin[80];
+	char host[64];
+
+	if (httpd_req_get_hdr_value_str(req, "Origin", origin, sizeof(origin)) != ESP_OK
+			|| httpd_req_get_hdr_value_str(req, "Host", host, sizeof(host)) != ESP_OK
+			|| strncmp(origin, "http://", 7) != 0)
+	{
+		return;
+	}
+
+	size_t len = http_server_host_len(host);
+
+	if (http_server_host_len(origin + 7) == len && strncasecmp(origin + 7, host, len) == 0)
+	{
+		httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", origin);
+		httpd_resp_set_hdr(req, "Access-Control-Expose-Headers", "Retry-After");
+	}
+}
+
+/**
+ * Answers the CORS preflight of the page's uploads to the bulk server.
+ * @param req HTTP request for which the uri needs to be handled.
+ * @return ESP_OK
+ */
+static esp_err_t http_server_bulk_preflight_handler(httpd_req_t *req)
+{
+	http_server_bulk_allow_origin(req);
+	httpd_resp_set_status(req, "204 No Content");
+	httpd_resp_set_hdr(req, "Access-Control-Allow-Methods", "GET, POST");
+	httpd_resp_set_hdr(req, "Access-Control-Allow-Headers", "Content-Type, X-OTA-Size, X-OTA-SHA256");
+	httpd_resp_set_hdr(req, "Access-Control-Max-Age", "600");
+
+	return httpd_resp_send(req, NULL, 0);
+}
+
+/**
+ * Sends a slow route's request on to the bulk server with 307 Temporary Redirect, so
+ * clients keep using the main server's URLs. The bulk server listens on the port after
+ * the one this request came in on. An unread body closes the connection, as in
+ * http_server_send_rejection.
+ * @param req HTTP request for which the uri needs to be handled.
+ * @return ESP_FAIL to close the connection if the request has a body, otherwise ESP_OK.
+ */
+static esp_err_t http_server_bulk_redirect_handler(httpd_req_t *req)
+{
+	struct sockaddr_in6 addr;
+	socklen_t addr_len = sizeof(addr);
+	char host[64];
+	bool has_body = req->content_len > 0;
+
+	if (httpd_req_get_hdr_value_str(req, "Host", host, sizeof(host)) != ESP_OK
+			|| getsockname(httpd_req_to_sockfd(req), (struct sockaddr *)&addr, &addr_len) != 0)
+	{
+		httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Host required");
+		return has_body ? ESP_FAIL : ESP_OK;
+	}
+
+	// sin6_port and sin_port are at the same offset
+	unsigned port = ntohs(addr.sin6_port) - HTTP_SERVER_PORT + HTTP_BULK_PORT;
+	size_t len = http_server_host_len(host) + strlen(req->uri) + 20;
+	char *location = malloc(len);
+
+	if (location == NULL)
+	{
+		httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+		return has_body ? ESP_FAIL : ESP_OK;
+	}
+
+	snprintf(location, len, "http://%.*s:%u%s", (int)http_server_host_len(host), host, port, req->uri);
+
+	httpd_resp_set_status(req, "307 Temporary Redirect");
+	httpd_resp_set_hdr(req, "Location", location);
+	if (has_body)
+	{
+		httpd_resp_set_hdr(req, "Connection", "close");
+	}
+	httpd_resp_send(req, NULL, 0);
+	free(location);
+
+	return has_body ? ESP_FAIL : ESP_OK;
+}
+
+/**
+ * Entry point of every registered URI: clients over their rate get 429 before any
+ * handler work, then the handler runs here on the task of the server it is registered on.
+ * @param req HTTP request, user_ctx is the route's http_server_route_metrics_t.
+ * @return what the handler returned.
+ */
+static esp_err_t http_server_metered_handler(httpd_req_t *req)
+{
+	http_server_route_metrics_t *m = req->user_ctx;
+	uint32_t retry_s;
+
+	if (m->bulk)
+	{
+		http_server_bulk_allow_origin(req);
+	}
+
+	if (m->rate_class != HTTP_RATE_CLASS_NONE)
+	{
+		uint32_t ip = http_server_client_ip(req);
+
+		xSemaphoreTake(http_server_rate_lock, portMAX_DELAY);
+		bool admitted = http_server_rate_admit(ip, m->rate_class, &retry_s);
+		xSemaphoreGive(http_server_rate_lock);
+
+		if (!admitted)
+		{
+			char retry_after[12];
+
+			atomic_fetch_add_explicit(&m->shed, 1, memory_order_relaxed);
+			trace_event(TRACE_HTTP_SHED, (uintptr_t)m->uri, ip, retry_s);
+
+			sprintf(retry_after, "%u", retry_s);
+			return http_server_send_rejection(req, "429 Too Many Requests", retry_after, NULL);
+		}
+	}
+
+	return http_server_run_metered(m, req);
+}
+
+/**
+ * Registers a URI handler behind http_server_metered_handler so it shows up in /metrics.
+ * @param handle server to register it on.
+ * @param uri handler to register; its user_ctx must be NULL.
+ * @param rate_class token bucket its requests take from, HTTP_RATE_CLASS_NONE for none.
+ */
+static void http_server_register_route(httpd_handle_t handle, const httpd_uri_t *uri, http_server_rate_class_e rate_class)
+{
+	if (route_metrics_count >= HTTP_METRICS_MAX_ROUTES)
+	{
+		httpd_register_uri_handler(handle, uri);
+		return;
+	}
+
+	http_server_route_metrics_t *m = &route_metrics[route_metrics_count++];
+	httpd_uri_t metered = *uri;
+
+	memset(m, 0, sizeof(*m));
+	m->uri = uri->uri;
+	m->method = uri->method;
+	m->handler = uri->handler;
+	m->bulk = handle == http_server_bulk_handle;
+	m->rate_class = rate_class;
+
+	metered.handler = http_server_metered_handler;
+	metered.user_ctx = m;
+	httpd_register_uri_handler(handle, &metered);
+}
+
+/**
+ * Registers a URI handler that runs on the server task, see http_server_register_route.
+ */
+static void http_server_register_metered(const httpd_uri_t *uri, http_server_rate_class_e rate_class)
+{
+	http_server_register_route(http_server_handle, uri, rate_class);
+}
+
+/**
+ * Registers a URI handler that runs on the bulk server task, for handlers that take long,
+ * and redirects its requests to the main server there.
+ */
+static void http_server_register_bulk(const httpd_uri_t *uri)
+{
+	httpd_uri_t redirect = *uri;
+
+	http_server_register_route(http_server_bulk_handle, uri, HTTP_RATE_CLASS_BULK);
+
+	redirect.handler = http_server_bulk_redirect_handler;
+	httpd_register_uri_handler(http_server_handle, &redirect);
+}
+
+/**
+ * Starts the bulk server, a second httpd instance with its own task.
+ * @return ESP_OK, otherwise what httpd_start returned.
+ */
+static esp_err_t http_server_bulk_start(void)
+{
+	httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+
+	config.server_port = HTTP_BULK_PORT;
+	config.ctrl_port = HTTP_BULK_CTRL_PORT;
+	config.core_id = HTTP_BULK_TASK_CORE_ID;
+	config.task_priority = HTTP_BULK_TASK_PRIORITY;
+	config.stack_size = HTTP_BULK_TASK_STACK_SIZE;
+
+	// waiting connections are its queue; one more than it keeps open is closed at once
+	config.max_open_sockets = HTTP_BULK_MAX_SESSIONS;
+	config.uri_match_fn = httpd_uri_match_wildcard;
+	config.recv_wait_timeout = 10;
+	config.send_wait_timeout = 10;
+
+	ESP_LOGI(TAG, "http_server_bulk_start: Starting bulk server on port: '%d'", config.server_port);
+
+	return httpd_start(&http_server_bulk_handle, &config);
+}
+
+/**
+ * Sets up the default httpd server configuration.
+ * @return http server instance handle if successful, NULL otherwise.
+ */
+static httpd_handle_t http_server_configure(void)
+{
+	// Generate the default configuration
+	httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+
+	// Create HTTP server monitor task
+	xTaskCreatePinnedToCore(&http_server_monitor, "http_server_monitor", HTTP_SERVER_MONITOR_STACK_SIZE, NULL, HTTP_SERVER_MONITOR_PRIORITY, &task_http_server_monitor, HTTP_SERVER_MONITOR_CORE_ID);
+
+	// Create the message queue
+	http_server_monitor_queue_handle = xQueueCreate(HTTP_MONITOR_QUEUE_LEN, sizeof(http_server_queue_message_t));
+
+	// Both servers take tokens from the client table; the lock outlives server restarts
+	if (http_server_rate_lock == NULL)
+	{
+		http_server_rate_lock = xSemaphoreCreateMutex();
+	}
+
+	config.server_port = HTTP_SERVER_PORT;
+
+	// The core that the HTTP server will run on
+	config.core_id = HTTP_SERVER_TASK_CORE_ID;
+
+	// Adjust the default priority to 1 less than the wifi application task
+	config.task_priority = HTTP_SERVER_TASK_PRIORITY;
+
+	// Bump up the stack size (default is 4096)
+	config.stack_size = HTTP_SERVER_TASK_STACK_SIZE;
+
+	// Increase uri handlers
+  config.max_uri_handlers = 20;
+
+	// forget /events subscribers when their connection closes
+	config.close_fn = http_server_close_fn;
+
+	// "/*" serves all web page files through one handler and the asset table
+	config.uri_match_fn = httpd_uri_match_wildcard;
+
+	// Increase the timeout limits
+	config.recv_wait_timeout = 10;
+	config.send_wait_timeout = 10;
+
+	ESP_LOGI(TAG,
+			"http_server_configure: Starting server on port: '%d' with task priority: '%d'",
+			config.server_port,
+			config.task_priority);
+
+	for (int i = 0; i < HTTP_SSE_MAX_CLIENTS; i++)
+	{
+		sse_clients[i] = -1;
+	}
+	atomic_store(&sse_client_count, 0);
+	atomic_store(&sse_pending, 0);
+	atomic_store(&sse_push_queued, false);
+
+	g_etag_boot = esp_random();
+	dht_sensor_json_cache.valid = false;
+	ota_status_json_cache.valid = false;
+
+	esp_err_t startup_code = httpd_start(&http_server_handle, &config);
+	if (startup_code != ESP_OK)
+	{
+		ESP_LOGI(TAG, "http_server_configure: Starting server error - %s", esp_err_to_name(startup_code));
+		return NULL;
+	}
+
+	startup_code = http_server_bulk_start();
+	if (startup_code != ESP_OK)
+	{
+		ESP_LOGI(TAG, "http_server_configure: Starting bulk server error - %s", esp_err_to_name(startup_code));
+		httpd_stop(http_server_handle);
+		http_server_handle = NULL;
+		return NULL;
+	}
+
+	ESP_LOGI(TAG, "http_server_configure: Registering URI handlers");
+	route_metrics_count = 0;
+
+  // register OTAupdate handler
+  httpd_uri_t OTA_update = {
+      .uri = "/OTAupdate",
+      .method = HTTP_POST,
+      .handler = http_server_OTA_update_handler,
+      .user_ctx = NULL
+  };
+  http_server_register_bulk(&OTA_update);
+
+  // register OTAchunk handlers, resumable upload
+  httpd_uri_t OTA_chunk = {
+      .uri = "/OTAchunk",
+      .method = HTTP_POST,
+      .handler = http_server_OTA_chunk_handler,
+      .user_ctx = NULL
+  };
+  http_server_register_bulk(&OTA_chunk);
+
+  httpd_uri_t OTA_chunk_state = {
+      .uri = "/OTAchunk",
+      .method = HTTP_GET,
+      .handler = http_server_OTA_chunk_handler,
+      .user_ctx = NULL
+  };
+  http_server_register_metered(&OTA_chunk_state, HTTP_RATE_CLASS_API);
+
+  // register OTAstatus handler
+  httpd_uri_t OTA_status = {
+      .uri = "/OTAstatus",
+      .method = HTTP_POST,
+      .handler = http_server_OTA_status_handler,
+      .user_ctx = NULL
+  };
+  http_server_register_metered(&OTA_status, HTTP_RATE_CLASS_API);
+
+  // register wifiConnect.json handler
+  httpd_uri_t wifi_connect_json = {
+      .uri = "/wifiConnect.json",
+      .method = HTTP_POST,
+      .handler = http_server_wifi_connect_json_handler,
+      .user_ctx = NULL
+  };
+  http_server_register_metered(&wifi_connect_json, HTTP_RATE_CLASS_API);
+
+  // register wifiConnectStatus handler
+  httpd_uri_t wifi_connect_status_json = {
+      .uri = "/wifiConnectStatus",
+      .method = HTTP_POST,
+      .handler = http_server_wifi_connect_status_json_handler,
+      .user_ctx = NULL
+  };
+  http_server_register_metered(&wifi_connect_status_json, HTTP_RATE_CLASS_API);
+
+  // register wifiConnectInfo.json handler
+  httpd_uri_t wifi_connect_info_json = {
+      .uri = "/wifiConnectInfo.json",
+      .method = HTTP_GET,
+      .handler = http_server_get_wifi_connect_info_json_handler,
+      .user_ctx = NULL
+  };
+  http_server_register_metered(&wifi_connect_info_json, HTTP_RATE_CLASS_API);
+
+  // register wifiDisconnect.json handler
+  httpd_uri_t wifi_disconnect_json = {
+      .uri = "/wifiDisconnect.json",
+      .method = HTTP_DELETE,
+      .handler = http_server_wifi_disconnect_json_handler,
+      .user_ctx = NULL
+  };
+  http_server_register_metered(&wifi_disconnect_json, HTTP_RATE_CLASS_API);
+
+  // register dhtSensor.json handler
+  httpd_uri_t dht_sensor_json = {
+      .uri = "/dhtSensor.json",
+      .method = HTTP_GET,
+      .handler = http_server_get_dht_sensor_readings_json_handler,
+      .user_ctx = NULL
+  };
+  http_server_register_metered(&dht_sensor_json, HTTP_RATE_CLASS_API);
+
+  // register dhtDiagnostics.json handler
+  httpd_uri_t dht_diagnostics_json = {
+      .uri = "/dhtDiagnostics.json",
+      .method = HTTP_GET,
+      .handler = http_server_dht_diagnostics_json_handler,
+      .user_ctx = NULL
+  };
+  http_server_register_metered(&dht_diagnostics_json, HTTP_RATE_CLASS_API);
+
+  // register history handler
+  httpd_uri_t history = {
+      .uri = "/history",
+      .method = HTTP_GET,
+      .handler = http_server_history_handler,
+      .user_ctx = NULL
+  };
+  http_server_register_bulk(&history);
+
+  // register sampleLog handler
+  httpd_uri_t sample_log = {
+      .uri = "/sampleLog",
+      .method = HTTP_GET,
+      .handler = http_server_sample_log_handler,
+      .user_ctx = NULL
+  };
+  http_server_register_bulk(&sample_log);
+
+  // register export handler
+  httpd_uri_t export = {
+      .uri = "/export",
+      .method = HTTP_GET,
+      .handler = http_server_export_handler,
+      .user_ctx = NULL
+  };
+  http_server_register_bulk(&export);
+
+  // register exportAck handler
+  httpd_uri_t export_ack = {
+      .uri = "/exportAck",
+      .method = HTTP_POST,
+      .handler = http_server_export_ack_handler,
+      .user_ctx = NULL
+  };
+  http_server_register_metered(&export_ack, HTTP_RATE_CLASS_API);
+
+  // register trace handler
+  httpd_uri_t trace = {
+      .uri = "/trace",
+      .method = HTTP_GET,
+      .handler = http_server_trace_handler,
+      .user_ctx = NULL
+  };
+  http_server_register_metered(&trace, HTTP_RATE_CLASS_API);
+
+  // register metrics handler
+  httpd_uri_t metrics = {
+      .uri = "/metrics",
+      .method = HTTP_GET,
+      .handler = http_server_metrics_handler,
+      .user_ctx = NULL
+  };
+  http_server_register_metered(&metrics, HTTP_RATE_CLASS_API);
+
+  // register events handler
+  httpd_uri_t events = {
+      .uri = "/events",
+      .method = HTTP_GET,
+      .handler = http_server_events_handler,
+      .user_ctx = NULL
+  };
+  http_server_register_metered(&events, HTTP_RATE_CLASS_NONE);
+
+  // the page's uploads to the bulk server are preflighted
+  httpd_uri_t bulk_preflight = {
+      .uri = "/*",
+      .method = HTTP_OPTIONS,
+      .handler = http_server_bulk_preflight_handler,
+      .user_ctx = NULL
+  };
+  httpd_register_uri_handler(http_server_bulk_handle, &bulk_preflight);
+
+  // register the web page files handler last: handlers are matched in registration order
+  httpd_uri_t web_page = {
+      .uri = "/*",
+      .method = HTTP_GET,
+      .handler = http_server_asset_handler,
+      .user_ctx = NULL
+  };
+  http_server_register_metered(&web_page, HTTP_RATE_CLASS_NONE);
+
+	return http_server_handle;
+}
+
+void http_server_start(void)
+{
 	if (http_server_handle == NULL)
 	{
 		http_server_handle = http_server_configure();
@@ -486,6 +2466,13 @@ void http_server_stop(void)
 		http_server_handle = NULL;
 	}
 
+	if (http_server_bulk_handle)
+	{
+		httpd_stop(http_server_bulk_handle);
+		ESP_LOGI(TAG, "http_server_stop: stopping HTTP bulk server");
+		http_server_bulk_handle = NULL;
+	}
+
 	if (task_http_server_monitor)
 	{
 		vTaskDelete(task_http_server_monitor);
@@ -498,11 +2485,21 @@ BaseType_t http_server_monitor_send_message(http_server_message_e msgID)
 {
 	http_server_queue_message_t msg;
 	msg.msgID = msgID;
-	return xQueueSend(http_server_monitor_queue_handle, &msg, portMAX_DELAY);
+
+	// senders include the wifi task and both HTTP server tasks, none of them may stall on the monitor
+	if (http_server_monitor_queue_handle == NULL || xQueueSend(http_server_monitor_queue_handle, &msg, 0) != pdTRUE)
+	{
+		atomic_fetch_add_explicit(&monitor_dropped, 1, memory_order_relaxed);
+		return pdFALSE;
+	}
+
+	return pdTRUE;
 }
 
 void http_server_fw_update_reset_callback(void *arg)
 {
+	(void)arg;
 	ESP_LOGI(TAG, "http_server_fw_update_reset_callback: Timer timed-out, restarting the device");
+	sample_log_flush();
 	esp_restart();
 }
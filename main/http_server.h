@@ -5,6 +5,42 @@
 #define OTA_UPDATE_SUCCESSFUL 1
 #define OTA_UPDATE_FAILED -1
 
+// Server-Sent Events: each subscriber keeps one of the httpd sockets open
+#define HTTP_SSE_MAX_CLIENTS			4
+#define HTTP_SSE_RETRY_MS				5000		// browser reconnect delay sent to subscribers
+
+// Monitor task
+#define HTTP_MONITOR_QUEUE_LEN			8			// messages waiting for the monitor, more are dropped
+
+// Firmware update
+#define HTTP_OTA_RX_BUFFER_SIZE			4096		// receive buffer, the OTA writer holds two more of these
+
+// Main server, serves the web page and the short requests
+#define HTTP_SERVER_PORT				80
+
+// Bulk server: slow handlers (uploads, bulk exports) run on a second httpd instance with its
+// own task, so the main one keeps answering short requests meanwhile. It listens on the port
+// after the main server's, which redirects these routes there. Each server takes its sessions
+// plus 2 of the 16 CONFIG_LWIP_MAX_SOCKETS: 7 + 2 for the main one, 3 + 2 for this one.
+#define HTTP_BULK_PORT					81
+#define HTTP_BULK_CTRL_PORT				32769		// the main server has the default, 32768
+#define HTTP_BULK_MAX_SESSIONS			3			// requests are served in turn, more connections are closed
+
+// Per client rate limits: token buckets refilled at PER_S requests per second up to BURST.
+// The rates can be set from the compiler command line, e.g. for benchmark builds.
+#define HTTP_RATE_MAX_CLIENTS			8			// buckets kept, the least recently seen client is forgotten
+#ifndef HTTP_RATE_API_PER_S
+#define HTTP_RATE_API_PER_S				4			// polled JSON and small GETs
+#define HTTP_RATE_API_BURST				20
+#define HTTP_RATE_BULK_PER_S			2			// uploads and exports, one per firmware chunk
+#define HTTP_RATE_BULK_BURST			10
+#endif
+
+// /metrics
+#define HTTP_METRICS_MAX_ROUTES			20			// same as max_uri_handlers
+#define HTTP_METRICS_LATENCY_BUCKETS_MS	{ 1, 2, 5, 10, 25, 50, 100, 250, 500, 1000, 5000, 30000 }
+#define HTTP_METRICS_LATENCY_BUCKETS	12
+
 /**
  * Connection status for Wifi
  */
@@ -40,7 +76,7 @@ typedef struct http_server_queue_message
 } http_server_queue_message_t;
 
 /**
- * Sends a message to the queue
+ * Sends a message to the queue. Never blocks: if the queue is full the message is dropped and counted.
  * @param msgID message ID from the http_server_message_e enum.
  * @return pdTRUE if an item was successfully sent to the queue, otherwise pdFALSE.
  */
@@ -56,6 +92,14 @@ void http_server_start(void);
  */
 void http_server_stop(void);
 
+/**
+ * Tells the /events subscribers that a sensor has a new sample. Never blocks: the
+ * send runs later on the httpd task, and updates that arrive before it runs are
+ * coalesced into one event per sensor carrying the latest sample.
+ * @param index sensor index.
+ */
+void http_server_notify_sample(int index);
+
 /**
  * Timer callback function which calls esp_restart upon successful firmware update.
  */
@@ -1,6 +1,9 @@
 #include "nvs_flash.h"
 #include "wifi_app.h"
 #include "DHT22.h"
+#include "sample_log.h"
+#include "sleep_mode.h"
+#include "trace.h"
 
 void app_main(void)
 {
@@ -13,6 +16,17 @@ void app_main(void)
 	}
 	ESP_ERROR_CHECK(ret);
 
+	// Start draining the trace to the console
+	trace_init();
+
+#if SLEEP_MODE_ENABLED
+	// Read the sensors, batch and sleep; Wi-Fi only comes up every few wakes
+	sleep_mode_run();
+#endif
+
+	// Open the persistent sample log
+	sample_log_init();
+
 	// Start wifi
 	wifi_app_start();
 
@@ -0,0 +1,231 @@
+#include <string.h>
+
+#include "multipart.h"
+
+bool multipart_get_boundary(const char *content_type, char *boundary)
+{
+	const char *b = strstr(content_type, "boundary=");
+	size_t len;
+
+	if (b == NULL)
+	{
+		return false;
+	}
+
+	b += strlen("boundary=");
+	if (*b == '"')
+	{
+		b++;
+		len = strcspn(b, "\"");
+	}
+	else
+	{
+		len = strcspn(b, "; \t");
+	}
+
+	if (len == 0 || len > MULTIPART_BOUNDARY_MAX)
+	{
+		return false;
+	}
+
+	memcpy(boundary, b, len);
+	boundary[len] = '\0';
+
+	return true;
+}
+
+bool multipart_init(multipart_parser_t *p, const char *boundary, multipart_data_fn on_data, void *arg)
+{
+	size_t len = strlen(boundary);
+
+	memset(p, 0, sizeof(*p));
+	if (len == 0 || len > MULTIPART_BOUNDARY_MAX)
+	{
+		return false;
+	}
+
+	p->delimiter_len = 4 + len;
+	memcpy(p->delimiter, "\r\n--", 4);
+	memcpy(p->delimiter + 4, boundary, len);
+
+	// the first delimiter may start the body without a line break before it
+	p->state = MULTIPART_STATE_PREAMBLE;
+	p->match = 2;
+	p->on_data = on_data;
+	p->arg = arg;
+
+	return true;
+}
+
+/**
+ * Passes body bytes to the callback, if in a part body.
+ */
+static bool multipart_emit(multipart_parser_t *p, const uint8_t *data, size_t len)
+{
+	if (len == 0 || p->state != MULTIPART_STATE_BODY)
+	{
+		return true;
+	}
+
+	return p->on_data(p->arg, p->part, data, len);
+}
+
+/**
+ * Scans for the delimiter in the preamble or a part body, passing body bytes on.
+ * The delimiter starts with '\r', which occurs nowhere else in it, so a mismatch
+ * can only restart matching at the current byte.
+ * @return bytes consumed, or -1 if the callback failed.
+ */
+static long multipart_scan(multipart_parser_t *p, const uint8_t *data, size_t len)
+{
+	size_t i = 0;
+
+	while (i < len)
+	{
+		if (p->match == 0)
+		{
+			// fast path: nothing can match before the next CR
+			const uint8_t *cr = memchr(data + i, '\r', len - i);
+
+			if (cr == NULL)
+			{
+				i = len;
+				break;
+			}
+			i = cr - data;
+		}
+
+		if (data[i] == (uint8_t)p->delimiter[p->match])
+		{
+			p->match++;
+			i++;
+
+			if (p->match == p->delimiter_len)
+			{
+				// body ends where the delimiter started, which may be in an earlier piece
+				size_t in_this = p->delimiter_len <= i ? p->delimiter_len : i;
+
+				if (!multipart_emit(p, data, i - in_this))
+				{
+					return -1;
+				}
+				p->match = 0;
+				p->state = MULTIPART_STATE_AFTER_DELIMITER;
+				p->header_len = 0;
+
+				return i;
+			}
+			continue;
+		}
+
+		if (p->match > 0)
+		{
+			// the matched bytes were body after all; those from earlier pieces are not in data
+			size_t from_earlier = p->match > i ? p->match - i : 0;
+
+			if (from_earlier && !multipart_emit(p, (const uint8_t *)p->delimiter, from_earlier))
+			{
+				return -1;
+			}
+			p->match = 0;
+			continue;
+		}
+
+		i++;
+	}
+
+	// keep back bytes that may be the start of a delimiter
+	size_t held = p->match <= len ? p->match : len;
+
+	if (!multipart_emit(p, data, len - held))
+	{
+		return -1;
+	}
+
+	return len;
+}
+
+multipart_status_e multipart_feed(multipart_parser_t *p, const uint8_t *data, size_t len)
+{
+	size_t i = 0;
+
+	while (i < len && p->state != MULTIPART_STATE_DONE && p->state != MULTIPART_STATE_ERROR)
+	{
+		switch (p->state)
+		{
+			case MULTIPART_STATE_PREAMBLE:
+			case MULTIPART_STATE_BODY:
+			{
+				long n = multipart_scan(p, data + i, len - i);
+
+				if (n < 0)
+				{
+					p->state = MULTIPART_STATE_ERROR;
+					break;
+				}
+				i += n;
+				break;
+			}
+
+			case MULTIPART_STATE_AFTER_DELIMITER:
+				// "--" closes the body, CRLF starts the headers of the next part
+				p->after[p->match++] = data[i++];
+				if (p->match < 2)
+				{
+					break;
+				}
+				p->match = 0;
+				if (p->after[0] == '-' && p->after[1] == '-')
+				{
+					p->state = MULTIPART_STATE_DONE;
+				}
+				else if (p->after[0] == '\r' && p->after[1] == '\n')
+				{
+					// that CRLF is also the first half of the empty line ending the headers,
+					// which a part may not have at all
+					p->state = MULTIPART_STATE_HEADERS;
+					p->match = 2;
+					p->part++;
+				}
+				else
+				{
+					p->state = MULTIPART_STATE_ERROR;
+				}
+				break;
+
+			case MULTIPART_STATE_HEADERS:
+			{
+				// the header block ends with an empty line
+				uint8_t c = data[i++];
+
+				if (c == "\r\n\r\n"[p->match])
+				{
+					p->match++;
+				}
+				else
+				{
+					p->match = (c == '\r') ? 1 : 0;
+				}
+
+				if (p->match == 4)
+				{
+					p->match = 0;
+					p->state = MULTIPART_STATE_BODY;
+				}
+				else if (++p->header_len > MULTIPART_HEADERS_MAX)
+				{
+					p->state = MULTIPART_STATE_ERROR;
+				}
+				break;
+			}
+
+			default:
+				break;
+		}
+	}
+
+	if (p->state == MULTIPART_STATE_DONE) return MULTIPART_DONE;
+	if (p->state == MULTIPART_STATE_ERROR) return MULTIPART_ERROR;
+
+	return MULTIPART_MORE;
+}
@@ -0,0 +1,86 @@
+/*
+
+	Streaming multipart/form-data parser
+
+	Pure code with no ESP-IDF dependencies. Input can be fed in pieces of any
+	size; boundaries and part headers split across pieces are handled.
+
+*/
+
+#ifndef MAIN_MULTIPART_H_
+#define MAIN_MULTIPART_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define MULTIPART_BOUNDARY_MAX			70		// RFC 2046 limit
+#define MULTIPART_HEADERS_MAX			1024	// longest accepted header block of a part
+
+/**
+ * Parser status
+ */
+typedef enum multipart_status
+{
+	MULTIPART_MORE = 0,			// needs more input
+	MULTIPART_DONE,				// closing boundary seen, later input is ignored
+	MULTIPART_ERROR,			// malformed input or the data callback failed
+} multipart_status_e;
+
+/**
+ * Called with the body bytes of a part, in order, possibly in many pieces.
+ * @param part part number, from 1.
+ * @return false to stop parsing with MULTIPART_ERROR.
+ */
+typedef bool (*multipart_data_fn)(void *arg, int part, const uint8_t *data, size_t len);
+
+typedef enum multipart_state
+{
+	MULTIPART_STATE_PREAMBLE = 0,
+	MULTIPART_STATE_AFTER_DELIMITER,
+	MULTIPART_STATE_HEADERS,
+	MULTIPART_STATE_BODY,
+	MULTIPART_STATE_DONE,
+	MULTIPART_STATE_ERROR,
+} multipart_state_e;
+
+/**
+ * Parser state
+ */
+typedef struct multipart_parser
+{
+	char delimiter[MULTIPART_BOUNDARY_MAX + 5];	// "\r\n--" boundary
+	size_t delimiter_len;
+	multipart_state_e state;
+	size_t match;								// delimiter or header end bytes matched so far
+	size_t header_len;
+	char after[2];								// the two bytes following a delimiter
+	int part;
+	multipart_data_fn on_data;
+	void *arg;
+} multipart_parser_t;
+
+/**
+ * Extracts the boundary parameter from a Content-Type header value.
+ * @param content_type e.g. "multipart/form-data; boundary=----abc".
+ * @param boundary receives the boundary, at least MULTIPART_BOUNDARY_MAX + 1 bytes.
+ * @return false if there is no usable boundary.
+ */
+bool multipart_get_boundary(const char *content_type, char *boundary);
+
+/**
+ * Prepares a parser.
+ * @param boundary boundary without the leading "--".
+ * @param on_data receives the part bodies.
+ * @param arg passed to on_data.
+ * @return false if the boundary is empty or too long.
+ */
+bool multipart_init(multipart_parser_t *p, const char *boundary, multipart_data_fn on_data, void *arg);
+
+/**
+ * Parses the next piece of the request body.
+ * @return MULTIPART_MORE, MULTIPART_DONE or MULTIPART_ERROR.
+ */
+multipart_status_e multipart_feed(multipart_parser_t *p, const uint8_t *data, size_t len);
+
+#endif /* MAIN_MULTIPART_H_ */
@@ -0,0 +1,274 @@
+/*
+	Streaming gzip decompression for OTA images
+
+	The gzip header and trailer are parsed here, the deflate data is handed to
+	tinfl from the ROM. Output goes through the 32 KB dictionary, which tinfl
+	uses as a circular window, and from there straight to the OTA writer.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp32/rom/crc.h"
+#include "esp32/rom/miniz.h"
+
+#include "ota_inflate.h"
+
+// Tag used for ESP serial console messages
+static const char TAG[] = "ota_inflate";
+
+// gzip header flags
+#define GZIP_FHCRC		0x02
+#define GZIP_FEXTRA		0x04
+#define GZIP_FNAME		0x08
+#define GZIP_FCOMMENT	0x10
+
+typedef enum ota_inflate_state
+{
+	OTA_INFLATE_HEADER = 0,			// fixed 10 byte header
+	OTA_INFLATE_EXTRA_LEN,
+	OTA_INFLATE_EXTRA,
+	OTA_INFLATE_NAME,
+	OTA_INFLATE_COMMENT,
+	OTA_INFLATE_HCRC,
+	OTA_INFLATE_DEFLATE,
+	OTA_INFLATE_TRAILER,			// CRC-32 and length of the uncompressed data
+	OTA_INFLATE_DONE,
+	OTA_INFLATE_ERROR,
+} ota_inflate_state_e;
+
+struct ota_inflate
+{
+	ota_writer_t *writer;
+	ota_inflate_state_e state;
+	uint8_t field[10];				// header or trailer bytes collected so far
+	size_t field_len;
+	uint8_t flags;
+	size_t skip;					// FEXTRA bytes left
+	uint32_t crc;
+	uint32_t size;
+	size_t dict_ofs;
+	tinfl_decompressor tinfl;
+	uint8_t dict[TINFL_LZ_DICT_SIZE];
+};
+
+ota_inflate_t *ota_inflate_start(ota_writer_t *writer)
+{
+	ota_inflate_t *inflate = malloc(sizeof(*inflate));
+
+	if (inflate == NULL)
+	{
+		ESP_LOGE(TAG, "ota_inflate_start: out of memory");
+		return NULL;
+	}
+
+	inflate->writer = writer;
+	inflate->state = OTA_INFLATE_HEADER;
+	inflate->field_len = 0;
+	inflate->crc = 0;
+	inflate->size = 0;
+	inflate->dict_ofs = 0;
+	tinfl_init(&inflate->tinfl);
+
+	return inflate;
+}
+
+/**
+ * Collects a fixed size field that may arrive in pieces.
+ * @return true once field_len reaches want.
+ */
+static bool ota_inflate_collect(ota_inflate_t *inflate, size_t want, const uint8_t **data, size_t *len)
+{
+	while (inflate->field_len < want && *len > 0)
+	{
+		inflate->field[inflate->field_len++] = **data;
+		(*data)++;
+		(*len)--;
+	}
+
+	return inflate->field_len == want;
+}
+
+/**
+ * Runs the deflate decoder over the input and writes what it produces.
+ * @return ESP_OK, ESP_ERR_INVALID_RESPONSE or the writer's error.
+ */
+static esp_err_t ota_inflate_deflate(ota_inflate_t *inflate, const uint8_t **data, size_t *len)
+{
+	for (;;)
+	{
+		size_t in_bytes = *len;
+		size_t out_bytes = TINFL_LZ_DICT_SIZE - inflate->dict_ofs;
+		tinfl_status status = tinfl_decompress(&inflate->tinfl, *data, &in_bytes, inflate->dict,
+				inflate->dict + inflate->dict_ofs, &out_bytes, TINFL_FLAG_HAS_MORE_INPUT);
+
+		*data += in_bytes;
+		*len -= in_bytes;
+
+		if (out_bytes > 0)
+		{
+			const uint8_t *out = inflate->dict + inflate->dict_ofs;
+			esp_err_t err = ota_writer_write(inflate->writer, out, out_bytes);
+
+			if (err != ESP_OK)
+			{
+				return err;
+			}
+			inflate->crc = crc32_le(inflate->crc, out, out_bytes);
+			inflate->size += out_bytes;
+			inflate->dict_ofs = (inflate->dict_ofs + out_bytes) & (TINFL_LZ_DICT_SIZE - 1);
+		}
+
+		if (status == TINFL_STATUS_DONE)
+		{
+			inflate->state = OTA_INFLATE_TRAILER;
+			inflate->field_len = 0;
+			return ESP_OK;
+		}
+		if (status < 0)
+		{
+			ESP_LOGE(TAG, "ota_inflate_deflate: corrupt deflate data (%d)", status);
+			return ESP_ERR_INVALID_RESPONSE;
+		}
+		if (status == TINFL_STATUS_NEEDS_MORE_INPUT && *len == 0)
+		{
+			return ESP_OK;
+		}
+		// TINFL_STATUS_HAS_MORE_OUTPUT: the window wrapped, go around again
+	}
+}
+
+esp_err_t ota_inflate_write(ota_inflate_t *inflate, const uint8_t *data, size_t len)
+{
+	esp_err_t err = ESP_OK;
+
+	while (len > 0 && err == ESP_OK)
+	{
+		switch (inflate->state)
+		{
+			case OTA_INFLATE_HEADER:
+				if (!ota_inflate_collect(inflate, 10, &data, &len))
+				{
+					break;
+				}
+				if (inflate->field[0] != 0x1f || inflate->field[1] != 0x8b || inflate->field[2] != 8)
+				{
+					ESP_LOGE(TAG, "ota_inflate_write: not a gzip deflate stream");
+					err = ESP_ERR_INVALID_RESPONSE;
+					break;
+				}
+				inflate->flags = inflate->field[3];
+				inflate->field_len = 0;
+				inflate->state = OTA_INFLATE_EXTRA_LEN;
+				break;
+
+			case OTA_INFLATE_EXTRA_LEN:
+				if (!(inflate->flags & GZIP_FEXTRA))
+				{
+					inflate->state = OTA_INFLATE_NAME;
+				}
+				else if (ota_inflate_collect(inflate, 2, &data, &len))
+				{
+					inflate->skip = inflate->field[0] | (inflate->field[1] << 8);
+					inflate->field_len = 0;
+					inflate->state = OTA_INFLATE_EXTRA;
+				}
+				break;
+
+			case OTA_INFLATE_EXTRA:
+			{
+				size_t n = inflate->skip < len ? inflate->skip : len;
+
+				data += n;
+				len -= n;
+				inflate->skip -= n;
+				if (inflate->skip == 0)
+				{
+					inflate->state = OTA_INFLATE_NAME;
+				}
+				break;
+			}
+
+			case OTA_INFLATE_NAME:
+			case OTA_INFLATE_COMMENT:
+			{
+				// zero terminated strings, skipped
+				uint8_t flag = inflate->state == OTA_INFLATE_NAME ? GZIP_FNAME : GZIP_FCOMMENT;
+
+				if (inflate->flags & flag)
+				{
+					const uint8_t *end = memchr(data, 0, len);
+					size_t n = end ? (size_t)(end - data) + 1 : len;
+
+					data += n;
+					len -= n;
+					if (end == NULL)
+					{
+						break;
+					}
+				}
+				inflate->state = inflate->state == OTA_INFLATE_NAME ? OTA_INFLATE_COMMENT : OTA_INFLATE_HCRC;
+				break;
+			}
+
+			case OTA_INFLATE_HCRC:
+				if (!(inflate->flags & GZIP_FHCRC) || ota_inflate_collect(inflate, 2, &data, &len))
+				{
+					inflate->field_len = 0;
+					inflate->state = OTA_INFLATE_DEFLATE;
+				}
+				break;
+
+			case OTA_INFLATE_DEFLATE:
+				err = ota_inflate_deflate(inflate, &data, &len);
+				break;
+
+			case OTA_INFLATE_TRAILER:
+				if (ota_inflate_collect(inflate, 8, &data, &len))
+				{
+					inflate->state = OTA_INFLATE_DONE;
+				}
+				break;
+
+			default:
+				// anything after the trailer is ignored
+				len = 0;
+				break;
+		}
+	}
+
+	if (err != ESP_OK)
+	{
+		inflate->state = OTA_INFLATE_ERROR;
+	}
+
+	return err;
+}
+
+esp_err_t ota_inflate_finish(ota_inflate_t *inflate)
+{
+	esp_err_t err = ESP_OK;
+
+	if (inflate->state != OTA_INFLATE_DONE)
+	{
+		ESP_LOGE(TAG, "ota_inflate_finish: gzip stream truncated");
+		err = ESP_ERR_INVALID_RESPONSE;
+	}
+	else
+	{
+		const uint8_t *t = inflate->field;
+		uint32_t crc = t[0] | (t[1] << 8) | (t[2] << 16) | ((uint32_t)t[3] << 24);
+		uint32_t size = t[4] | (t[5] << 8) | (t[6] << 16) | ((uint32_t)t[7] << 24);
+
+		if (crc != inflate->crc || size != inflate->size)
+		{
+			ESP_LOGE(TAG, "ota_inflate_finish: CRC or length mismatch, %u bytes decompressed", inflate->size);
+			err = ESP_ERR_INVALID_RESPONSE;
+		}
+	}
+
+	free(inflate);
+
+	return err;
+}
@@ -0,0 +1,35 @@
+#ifndef MAIN_OTA_INFLATE_H_
+#define MAIN_OTA_INFLATE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "ota_writer.h"
+
+#define OTA_INFLATE_GZIP_MAGIC			0x1f		// first byte of a gzip stream; images start with 0xE9
+
+typedef struct ota_inflate ota_inflate_t;
+
+/**
+ * Starts decompressing a gzip image into an OTA writer. Uses the deflate
+ * decompressor in ROM with a 32 KB window, the largest deflate can refer back.
+ * @param writer receives the decompressed image.
+ * @return decompressor, or NULL if out of memory.
+ */
+ota_inflate_t *ota_inflate_start(ota_writer_t *writer);
+
+/**
+ * Decompresses the next piece of the gzip stream.
+ * @return ESP_OK, ESP_ERR_INVALID_RESPONSE for a corrupt stream, or the writer's error.
+ */
+esp_err_t ota_inflate_write(ota_inflate_t *inflate, const uint8_t *data, size_t len);
+
+/**
+ * Checks that the stream ended with a matching CRC-32 and length, and frees the decompressor.
+ * @return ESP_OK, or ESP_ERR_INVALID_RESPONSE if the stream was truncated or corrupt.
+ */
+esp_err_t ota_inflate_finish(ota_inflate_t *inflate);
+
+#endif /* MAIN_OTA_INFLATE_H_ */
@@ -0,0 +1,192 @@
+/*
+	Pipelined OTA writer
+
+	The HTTP handler fills one buffer while a separate task programs the previous
+	one to flash, so the upload runs at network speed instead of alternating
+	between receiving and writing.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+
+#include "ota_writer.h"
+#include "tasks_common.h"
+
+// Tag used for ESP serial console messages
+static const char TAG[] = "ota_writer";
+
+/**
+ * A buffer handed between the filling task and the writer task
+ */
+typedef struct ota_writer_buffer
+{
+	uint8_t *data;
+	size_t len;						// 0 tells the writer task to stop
+} ota_writer_buffer_t;
+
+struct ota_writer
+{
+	esp_ota_handle_t handle;
+	QueueHandle_t free_queue;		// buffers ready to be filled
+	QueueHandle_t full_queue;		// buffers waiting for flash
+	TaskHandle_t caller;			// notified when the writer task stops
+	ota_writer_buffer_t fill;		// buffer being filled, data NULL if none
+	size_t total;
+	volatile esp_err_t err;			// first flash write error
+	uint8_t storage[OTA_WRITER_BUFFERS][OTA_WRITER_BUFFER_SIZE];
+};
+
+/**
+ * Writes full buffers to flash and returns them to the free queue.
+ * @param pvParameters the writer.
+ */
+static void ota_writer_task(void *pvParameters)
+{
+	ota_writer_t *w = pvParameters;
+	ota_writer_buffer_t b;
+
+	for (;;)
+	{
+		xQueueReceive(w->full_queue, &b, portMAX_DELAY);
+		if (b.len == 0)
+		{
+			break;
+		}
+
+		// after an error the rest is only drained, the caller sees w->err
+		if (w->err == ESP_OK)
+		{
+			esp_err_t err = esp_ota_write(w->handle, b.data, b.len);
+
+			if (err != ESP_OK)
+			{
+				ESP_LOGE(TAG, "ota_writer_task: esp_ota_write failed - %s", esp_err_to_name(err));
+				w->err = err;
+			}
+		}
+
+		b.len = 0;
+		xQueueSend(w->free_queue, &b, portMAX_DELAY);
+	}
+
+	xTaskNotifyGive(w->caller);
+	vTaskDelete(NULL);
+}
+
+ota_writer_t *ota_writer_start(const esp_partition_t *partition, size_t image_size)
+{
+	ota_writer_t *w = calloc(1, sizeof(*w));
+
+	if (w == NULL)
+	{
+		ESP_LOGE(TAG, "ota_writer_start: out of memory");
+		return NULL;
+	}
+
+	w->free_queue = xQueueCreate(OTA_WRITER_BUFFERS, sizeof(ota_writer_buffer_t));
+	w->full_queue = xQueueCreate(OTA_WRITER_BUFFERS + 1, sizeof(ota_writer_buffer_t));
+	if (w->free_queue == NULL || w->full_queue == NULL)
+	{
+		goto fail;
+	}
+
+	// with the size known only the sectors the image needs are erased
+	esp_err_t err = esp_ota_begin(partition, image_size ? image_size : OTA_SIZE_UNKNOWN, &w->handle);
+	if (err != ESP_OK)
+	{
+		ESP_LOGE(TAG, "ota_writer_start: esp_ota_begin failed - %s", esp_err_to_name(err));
+		goto fail;
+	}
+
+	for (int i = 0; i < OTA_WRITER_BUFFERS; i++)
+	{
+		ota_writer_buffer_t b = { .data = w->storage[i], .len = 0 };
+		xQueueSend(w->free_queue, &b, 0);
+	}
+
+	w->caller = xTaskGetCurrentTaskHandle();
+	if (xTaskCreatePinnedToCore(&ota_writer_task, "ota_writer", OTA_WRITER_TASK_STACK_SIZE, w, OTA_WRITER_TASK_PRIORITY, NULL, OTA_WRITER_TASK_CORE_ID) != pdPASS)
+	{
+		esp_ota_end(w->handle);
+		goto fail;
+	}
+
+	return w;
+
+fail:
+	if (w->free_queue) vQueueDelete(w->free_queue);
+	if (w->full_queue) vQueueDelete(w->full_queue);
+	free(w);
+
+	return NULL;
+}
+
+esp_err_t ota_writer_write(ota_writer_t *w, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+
+	while (len > 0 && w->err == ESP_OK)
+	{
+		if (w->fill.data == NULL)
+		{
+			xQueueReceive(w->free_queue, &w->fill, portMAX_DELAY);
+		}
+
+		size_t n = OTA_WRITER_BUFFER_SIZE - w->fill.len;
+		if (n > len) n = len;
+
+		memcpy(w->fill.data + w->fill.len, p, n);
+		w->fill.len += n;
+		w->total += n;
+		p += n;
+		len -= n;
+
+		if (w->fill.len == OTA_WRITER_BUFFER_SIZE)
+		{
+			xQueueSend(w->full_queue, &w->fill, portMAX_DELAY);
+			w->fill.data = NULL;
+		}
+	}
+
+	return w->err;
+}
+
+size_t ota_writer_size(const ota_writer_t *w)
+{
+	return w->total;
+}
+
+esp_err_t ota_writer_finish(ota_writer_t *w, bool commit)
+{
+	ota_writer_buffer_t stop = { .data = NULL, .len = 0 };
+
+	if (w->fill.data != NULL && w->fill.len > 0)
+	{
+		xQueueSend(w->full_queue, &w->fill, portMAX_DELAY);
+	}
+	xQueueSend(w->full_queue, &stop, portMAX_DELAY);
+	ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+	// esp_ota_end also validates the image and releases the handle
+	esp_err_t err = esp_ota_end(w->handle);
+	if (w->err != ESP_OK)
+	{
+		err = w->err;
+	}
+	else if (!commit && err == ESP_OK)
+	{
+		err = ESP_FAIL;
+	}
+
+	vQueueDelete(w->free_queue);
+	vQueueDelete(w->full_queue);
+	free(w);
+
+	return err;
+}
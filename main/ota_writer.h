@@ -0,0 +1,43 @@
+#ifndef MAIN_OTA_WRITER_H_
+#define MAIN_OTA_WRITER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_partition.h"
+
+#define OTA_WRITER_BUFFER_SIZE			4096		// one flash sector per esp_ota_write
+#define OTA_WRITER_BUFFERS				2			// one being filled while the other is written
+
+typedef struct ota_writer ota_writer_t;
+
+/**
+ * Starts an update: begins the OTA on the partition and starts the task that writes
+ * full buffers to flash while the caller fills the next one.
+ * @param partition update partition.
+ * @param image_size expected image size, so only that much flash is erased; 0 if unknown.
+ * @return writer, or NULL if the update could not be started.
+ */
+ota_writer_t *ota_writer_start(const esp_partition_t *partition, size_t image_size);
+
+/**
+ * Queues image data. Blocks only while every buffer is waiting for flash.
+ * @return ESP_OK, or the error of an earlier flash write.
+ */
+esp_err_t ota_writer_write(ota_writer_t *w, const void *data, size_t len);
+
+/**
+ * @return bytes passed to ota_writer_write so far.
+ */
+size_t ota_writer_size(const ota_writer_t *w);
+
+/**
+ * Writes what is left, waits for the writer task and ends the OTA, then frees the writer.
+ * @param commit false to discard the update (e.g. the upload failed).
+ * @return ESP_OK if the image was written and validated and commit was true.
+ */
+esp_err_t ota_writer_finish(ota_writer_t *w, bool commit);
+
+#endif /* MAIN_OTA_WRITER_H_ */
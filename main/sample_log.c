@@ -0,0 +1,406 @@
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_idf_version.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_system.h"
+
+#include "sample_log.h"
+
+/*
+ * Flash layout
+ *
+ * The partition is a circle of 4 KB sectors. Each sector starts with a 16 byte
+ * header followed by 255 records. Samples are appended to the current sector;
+ * when it is full the next sector is erased and stamped with a higher sequence
+ * number, so every sector is erased in turn and wear is spread evenly.
+ *
+ * At boot the sector with the highest valid header sequence is the current one,
+ * and appending resumes after its last written record. A sector erased by an
+ * interrupted rollover has no valid header and counts as free.
+ *
+ * Only the esp_partition API is used, so the log also runs on the ESP-IDF
+ * Linux target with its emulated partitions.
+ */
+
+// Tag used for ESP serial console messages
+static const char TAG[] = "sample_log";
+
+#define SAMPLE_LOG_MAGIC				0x474F4C53		// "SLOG"
+#define SAMPLE_LOG_RECORDS_PER_PAGE		(SAMPLE_LOG_PAGE_SIZE / sizeof(sample_log_record_t))
+
+// esp_partition_mmap takes its own handle and memory types from ESP-IDF 5.1, the spi_flash ones before
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 1, 0)
+typedef esp_partition_mmap_handle_t sample_log_map_handle_t;
+#define SAMPLE_LOG_MMAP_DATA			ESP_PARTITION_MMAP_DATA
+#else
+typedef spi_flash_mmap_handle_t sample_log_map_handle_t;
+#define SAMPLE_LOG_MMAP_DATA			SPI_FLASH_MMAP_DATA
+#endif
+
+/**
+ * Sector header, occupies the first record slot of every sector
+ */
+typedef struct
+{
+	uint32_t magic;
+	uint32_t seq;				// increases by one per sector rollover
+	uint32_t erase_count;		// erase cycles of this sector
+	uint32_t check;				// ~(magic ^ seq ^ erase_count)
+} sector_header_t;
+
+_Static_assert(sizeof(sample_log_record_t) == 16, "sample_log_record_t must stay 16 bytes");
+_Static_assert(sizeof(sector_header_t) == sizeof(sample_log_record_t), "header must fill one record slot");
+
+static const esp_partition_t *g_partition;
+static const uint8_t *g_map;						// whole partition, memory mapped
+static sample_log_map_handle_t g_map_handle;
+static size_t g_sector_count;
+
+static size_t g_current_sector;
+static uint32_t g_current_seq;
+static size_t g_write_index;						// next free record slot in the current sector
+static uint32_t g_next_record_seq;
+static uint32_t g_acked_seq;						// position after the last record a collector acknowledged
+static uint16_t g_boot;
+
+static sample_log_record_t g_pending[SAMPLE_LOG_RECORDS_PER_PAGE];
+static size_t g_pending_count;
+static uint32_t g_pending_since_s;
+
+static SemaphoreHandle_t g_log_mutex;
+
+static uint8_t crc8(const uint8_t *data, size_t len)
+{
+	uint8_t crc = 0xFF;
+
+	while (len--)
+	{
+		crc ^= *data++;
+		for (int k = 0; k < 8; k++)
+		{
+			crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x31) : (uint8_t)(crc << 1);
+		}
+	}
+
+	return crc;
+}
+
+static uint8_t record_check(const sample_log_record_t *r)
+{
+	sample_log_record_t copy = *r;
+
+	copy.check = 0;
+	return crc8((const uint8_t *)&copy, sizeof(copy));
+}
+
+static bool record_erased(const sample_log_record_t *r)
+{
+	const uint8_t *p = (const uint8_t *)r;
+
+	for (size_t k = 0; k < sizeof(*r); k++)
+	{
+		if (p[k] != 0xFF)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool sample_log_record_valid(const sample_log_record_t *record)
+{
+	return !record_erased(record) && record->check == record_check(record);
+}
+
+static const sector_header_t *sector_header(size_t sector)
+{
+	return (const sector_header_t *)(g_map + sector * SAMPLE_LOG_SECTOR_SIZE);
+}
+
+static const sample_log_record_t *sector_records(size_t sector)
+{
+	return (const sample_log_record_t *)(g_map + sector * SAMPLE_LOG_SECTOR_SIZE) + 1;
+}
+
+static bool header_valid(const sector_header_t *h)
+{
+	return h->magic == SAMPLE_LOG_MAGIC && h->check == ~(h->magic ^ h->seq ^ h->erase_count);
+}
+
+/**
+ * Erases a sector and stamps it as the new current sector.
+ */
+static esp_err_t sector_start(size_t sector, uint32_t seq)
+{
+	const sector_header_t *old = sector_header(sector);
+	sector_header_t h =
+	{
+		.magic = SAMPLE_LOG_MAGIC,
+		.seq = seq,
+		.erase_count = (header_valid(old) ? old->erase_count : 0) + 1,
+	};
+	h.check = ~(h.magic ^ h.seq ^ h.erase_count);
+
+	esp_err_t err = esp_partition_erase_range(g_partition, sector * SAMPLE_LOG_SECTOR_SIZE, SAMPLE_LOG_SECTOR_SIZE);
+	if (err == ESP_OK)
+	{
+		err = esp_partition_write(g_partition, sector * SAMPLE_LOG_SECTOR_SIZE, &h, sizeof(h));
+	}
+
+	g_current_sector = sector;
+	g_current_seq = seq;
+	g_write_index = 0;
+
+	return err;
+}
+
+/**
+ * Writes the pending records at the append position. Must be called with the log mutex held.
+ */
+static void sample_log_flush_locked(void)
+{
+	if (g_pending_count == 0)
+	{
+		return;
+	}
+
+	size_t offset = g_current_sector * SAMPLE_LOG_SECTOR_SIZE + (g_write_index + 1) * sizeof(sample_log_record_t);
+	esp_err_t err = esp_partition_write(g_partition, offset, g_pending, g_pending_count * sizeof(sample_log_record_t));
+	if (err != ESP_OK)
+	{
+		ESP_LOGE(TAG, "sample_log_flush: write at 0x%zx failed - %s", offset, esp_err_to_name(err));
+	}
+
+	g_write_index += g_pending_count;
+	g_pending_count = 0;
+
+	if (g_write_index >= SAMPLE_LOG_RECORDS_PER_SECTOR)
+	{
+		sector_start((g_current_sector + 1) % g_sector_count, g_current_seq + 1);
+	}
+}
+
+esp_err_t sample_log_init(void)
+{
+	const sample_log_record_t *last = NULL;
+
+	g_partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, SAMPLE_LOG_PARTITION_LABEL);
+	if (g_partition == NULL)
+	{
+		ESP_LOGE(TAG, "sample_log_init: no '%s' partition", SAMPLE_LOG_PARTITION_LABEL);
+		return ESP_ERR_NOT_FOUND;
+	}
+
+	esp_err_t err = esp_partition_mmap(g_partition, 0, g_partition->size, SAMPLE_LOG_MMAP_DATA, (const void **)&g_map, &g_map_handle);
+	if (err != ESP_OK)
+	{
+		ESP_LOGE(TAG, "sample_log_init: mmap failed - %s", esp_err_to_name(err));
+		g_partition = NULL;
+		return err;
+	}
+
+	g_log_mutex = xSemaphoreCreateMutex();
+	g_sector_count = g_partition->size / SAMPLE_LOG_SECTOR_SIZE;
+	g_pending_count = 0;
+
+	// == find the current sector: highest valid header sequence ==========
+	bool found = false;
+	for (size_t s = 0; s < g_sector_count; s++)
+	{
+		const sector_header_t *h = sector_header(s);
+		if (header_valid(h) && (!found || (int32_t)(h->seq - g_current_seq) > 0))
+		{
+			found = true;
+			g_current_sector = s;
+			g_current_seq = h->seq;
+		}
+	}
+
+	if (!found)
+	{
+		ESP_LOGI(TAG, "sample_log_init: empty log, formatting sector 0");
+		sector_start(0, 1);
+	}
+
+	// == resume after the last written record slot ==========
+	const sample_log_record_t *records = sector_records(g_current_sector);
+	g_write_index = 0;
+	for (size_t i = 0; i < SAMPLE_LOG_RECORDS_PER_SECTOR; i++)
+	{
+		if (!record_erased(&records[i]))
+		{
+			g_write_index = i + 1;			// torn records are skipped, never rewritten
+			if (sample_log_record_valid(&records[i]))
+			{
+				last = &records[i];
+			}
+		}
+	}
+
+	if (last == NULL)
+	{
+		// the current sector is new, the last record is in the sector before it
+		size_t prev = (g_current_sector + g_sector_count - 1) % g_sector_count;
+		const sample_log_record_t *prev_records = sector_records(prev);
+
+		for (size_t i = 0; header_valid(sector_header(prev)) && i < SAMPLE_LOG_RECORDS_PER_SECTOR; i++)
+		{
+			if (sample_log_record_valid(&prev_records[i]))
+			{
+				last = &prev_records[i];
+			}
+		}
+	}
+
+	g_next_record_seq = last ? last->seq + 1 : 0;
+	g_acked_seq = 0;
+	g_boot = last ? last->boot + 1 : 0;
+
+	// a deep sleep wake continues the boot: its samples are stamped by the RTC clock, which keeps counting
+	if (last && esp_reset_reason() == ESP_RST_DEEPSLEEP)
+	{
+		g_boot = last->boot;
+	}
+
+	if (g_write_index >= SAMPLE_LOG_RECORDS_PER_SECTOR)
+	{
+		sector_start((g_current_sector + 1) % g_sector_count, g_current_seq + 1);
+	}
+
+	ESP_LOGI(TAG, "sample_log_init: %zu sectors, current %zu at slot %zu, next record %u, boot %u",
+			g_sector_count, g_current_sector, g_write_index, g_next_record_seq, g_boot);
+
+	return ESP_OK;
+}
+
+void sample_log_append(int sensor, uint32_t time_s, int16_t temp_tenths, uint16_t hum_tenths)
+{
+	if (g_partition == NULL)
+	{
+		return;
+	}
+
+	xSemaphoreTake(g_log_mutex, portMAX_DELAY);
+
+	sample_log_record_t *r = &g_pending[g_pending_count++];
+	r->seq = g_next_record_seq++;
+	r->time_s = time_s;
+	r->boot = g_boot;
+	r->sensor = sensor;
+	r->temp = temp_tenths;
+	r->hum = hum_tenths;
+	r->check = record_check(r);
+
+	if (g_pending_count == 1)
+	{
+		g_pending_since_s = time_s;
+	}
+
+	// flush when the batch reaches a page boundary, or when it has waited too long
+	size_t end = (g_write_index + g_pending_count + 1) * sizeof(sample_log_record_t);
+	if (end % SAMPLE_LOG_PAGE_SIZE == 0 || time_s - g_pending_since_s >= SAMPLE_LOG_FLUSH_INTERVAL_S)
+	{
+		sample_log_flush_locked();
+	}
+
+	xSemaphoreGive(g_log_mutex);
+}
+
+void sample_log_flush(void)
+{
+	if (g_partition == NULL)
+	{
+		return;
+	}
+
+	xSemaphoreTake(g_log_mutex, portMAX_DELAY);
+	sample_log_flush_locked();
+	xSemaphoreGive(g_log_mutex);
+}
+
+void sample_log_for_each(sample_log_visit_fn visit, void *arg)
+{
+	if (g_partition == NULL)
+	{
+		return;
+	}
+
+	xSemaphoreTake(g_log_mutex, portMAX_DELAY);
+	size_t current = g_current_sector;
+	size_t current_count = g_write_index;
+	xSemaphoreGive(g_log_mutex);
+
+	// oldest sector is the one after the current sector
+	for (size_t n = 1; n <= g_sector_count; n++)
+	{
+		size_t s = (current + n) % g_sector_count;
+		size_t count = (s == current) ? current_count : SAMPLE_LOG_RECORDS_PER_SECTOR;
+
+		if (!header_valid(sector_header(s)) || count == 0)
+		{
+			continue;
+		}
+
+		if (!visit(sector_records(s), count, arg))
+		{
+			break;
+		}
+	}
+}
+
+uint16_t sample_log_boot_id(void)
+{
+	return g_boot;
+}
+
+uint32_t sample_log_next_seq(void)
+{
+	if (g_partition == NULL)
+	{
+		return 0;
+	}
+
+	xSemaphoreTake(g_log_mutex, portMAX_DELAY);
+	uint32_t seq = g_next_record_seq;
+	xSemaphoreGive(g_log_mutex);
+
+	return seq;
+}
+
+bool sample_log_ack(uint32_t seq)
+{
+	bool valid;
+
+	if (g_partition == NULL)
+	{
+		return false;
+	}
+
+	xSemaphoreTake(g_log_mutex, portMAX_DELAY);
+	valid = seq < g_next_record_seq;
+	if (valid && seq + 1 > g_acked_seq)
+	{
+		g_acked_seq = seq + 1;
+	}
+	xSemaphoreGive(g_log_mutex);
+
+	return valid;
+}
+
+uint32_t sample_log_acked(void)
+{
+	if (g_partition == NULL)
+	{
+		return 0;
+	}
+
+	xSemaphoreTake(g_log_mutex, portMAX_DELAY);
+	uint32_t seq = g_acked_seq;
+	xSemaphoreGive(g_log_mutex);
+
+	return seq;
+}
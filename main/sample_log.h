@@ -0,0 +1,91 @@
+#ifndef MAIN_SAMPLE_LOG_H_
+#define MAIN_SAMPLE_LOG_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#define SAMPLE_LOG_PARTITION_LABEL		"samples"	// data partition in partitions.csv
+#define SAMPLE_LOG_SECTOR_SIZE			4096		// flash erase unit
+#define SAMPLE_LOG_PAGE_SIZE			256			// flash program unit, appends are batched to it
+#define SAMPLE_LOG_FLUSH_INTERVAL_S		300			// longest time a sample waits in RAM for its page to fill
+
+/**
+ * One stored sample, 16 bytes. An erased record reads as all 0xFF.
+ */
+typedef struct sample_log_record
+{
+	uint32_t seq;				// position in the log, increasing across sectors and reboots
+	uint32_t time_s;			// uptime in seconds within boot
+	uint16_t boot;				// boot counter, increases by one every time the log is opened, except on a deep sleep wake
+	uint8_t sensor;				// sensor index
+	uint8_t check;				// CRC-8 over the other fields, detects torn writes
+	int16_t temp;				// temperature in tenths of degrees Celsius
+	uint16_t hum;				// relative humidity in tenths of %RH
+} sample_log_record_t;
+
+#define SAMPLE_LOG_RECORDS_PER_SECTOR	(SAMPLE_LOG_SECTOR_SIZE / sizeof(sample_log_record_t) - 1)	// first slot holds the sector header
+
+/**
+ * Called with the records of one sector, oldest sector first.
+ * @param records records in memory mapped flash, check each with sample_log_record_valid.
+ * @param count number of written record slots.
+ * @param arg caller context.
+ * @return false to stop the iteration.
+ */
+typedef bool (*sample_log_visit_fn)(const sample_log_record_t *records, size_t count, void *arg);
+
+/**
+ * Finds and maps the log partition and scans the sector headers to resume appending.
+ * @return ESP_OK, or ESP_ERR_NOT_FOUND if the partition table has no log partition.
+ */
+esp_err_t sample_log_init(void);
+
+/**
+ * Queues a sample for the log. Samples are written to flash a page at a time.
+ */
+void sample_log_append(int sensor, uint32_t time_s, int16_t temp_tenths, uint16_t hum_tenths);
+
+/**
+ * Writes queued samples to flash, e.g. before a restart.
+ */
+void sample_log_flush(void);
+
+/**
+ * Walks the stored records in place, without copying them through RAM.
+ * Records in a sector that is recycled during the walk read as invalid.
+ */
+void sample_log_for_each(sample_log_visit_fn visit, void *arg);
+
+/**
+ * @return true if the record was completely written.
+ */
+bool sample_log_record_valid(const sample_log_record_t *record);
+
+/**
+ * @return boot counter stamped on records of the running firmware.
+ */
+uint16_t sample_log_boot_id(void);
+
+/**
+ * @return log position the next appended sample gets; every record before it is in
+ *         flash or queued for it.
+ */
+uint32_t sample_log_next_seq(void);
+
+/**
+ * Notes that a collector has stored the records up to and including seq, e.g. the last
+ * one of an export. Positions only move forward; one past the last record is ignored.
+ * @return false if seq is not a position of the log.
+ */
+bool sample_log_ack(uint32_t seq);
+
+/**
+ * @return log position after the last record acknowledged since the log was opened,
+ *         0 if there was no acknowledgement.
+ */
+uint32_t sample_log_acked(void);
+
+#endif /* MAIN_SAMPLE_LOG_H_ */
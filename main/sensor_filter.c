@@ -0,0 +1,125 @@
+#include <string.h>
+
+#include "sensor_filter.h"
+
+void sensor_filter_reset(sensor_filter_t *f)
+{
+	memset(f, 0, sizeof(*f));
+}
+
+/**
+ * @return true if the change from the last accepted value is faster than the gate allows.
+ */
+static bool channel_too_fast(const sensor_filter_channel_t *c, int16_t value, uint16_t max_rate, uint32_t dt_ms)
+{
+	if (max_rate == 0)
+	{
+		return false;
+	}
+
+	// cap dt so the product cannot overflow; after 10 minutes anything goes anyway
+	if (dt_ms > 600000)
+	{
+		dt_ms = 600000;
+	}
+
+	int32_t allowed = (int32_t)max_rate * (int32_t)dt_ms / 60000 + SENSOR_FILTER_RATE_SLACK;
+	int32_t delta = value - c->last_accepted;
+
+	return delta > allowed || -delta > allowed;
+}
+
+/**
+ * Median of the window; at most SENSOR_FILTER_MEDIAN_MAX entries, so constant cost.
+ */
+static int16_t channel_median(const sensor_filter_channel_t *c)
+{
+	int16_t sorted[SENSOR_FILTER_MEDIAN_MAX];
+
+	for (int i = 0; i < c->count; i++)
+	{
+		int16_t v = c->window[i];
+		int j = i;
+
+		while (j > 0 && sorted[j - 1] > v)
+		{
+			sorted[j] = sorted[j - 1];
+			j--;
+		}
+		sorted[j] = v;
+	}
+
+	return sorted[c->count / 2];
+}
+
+static int16_t channel_update(sensor_filter_channel_t *c, const sensor_filter_config_t *cfg, int16_t value, bool first)
+{
+	uint8_t len = cfg->median_len;
+
+	if (len < 1) len = 1;
+	if (len > SENSOR_FILTER_MEDIAN_MAX) len = SENSOR_FILTER_MEDIAN_MAX;
+
+	c->last_accepted = value;
+
+	// == rolling median ==========
+	if (first || c->count > len || c->pos >= len)
+	{
+		c->count = 0;
+		c->pos = 0;
+	}
+	c->window[c->pos] = value;
+	c->pos = (c->pos + 1) % len;
+	if (c->count < len)
+	{
+		c->count++;
+	}
+
+	int32_t median_q8 = (int32_t)channel_median(c) << 8;
+
+	// == EWMA in Q8 ==========
+	if (first)
+	{
+		c->ewma_q8 = median_q8;
+	}
+	else
+	{
+		c->ewma_q8 += ((median_q8 - c->ewma_q8) * cfg->ewma_alpha_q8) >> 8;
+	}
+
+	// round to the nearest tenth
+	return (int16_t)((c->ewma_q8 + 128) >> 8);
+}
+
+bool sensor_filter_update(sensor_filter_t *f, const sensor_filter_config_t *cfg, uint32_t time_ms,
+		int16_t temp, uint16_t hum, int16_t *temp_out, uint16_t *hum_out)
+{
+	bool first = !f->primed;
+
+	if (!first)
+	{
+		uint32_t dt_ms = time_ms - f->last_time_ms;
+		bool too_fast = channel_too_fast(&f->temp, temp, cfg->max_temp_rate, dt_ms)
+				|| channel_too_fast(&f->hum, hum, cfg->max_hum_rate, dt_ms);
+
+		if (too_fast && f->rejects < cfg->max_rejects)
+		{
+			f->rejects++;
+			f->rejected_total++;
+			*temp_out = (int16_t)((f->temp.ewma_q8 + 128) >> 8);
+			*hum_out = (uint16_t)((f->hum.ewma_q8 + 128) >> 8);
+			return false;
+		}
+
+		// a step that outlived max_rejects is real: restart the filter at it
+		first = too_fast;
+	}
+
+	f->primed = true;
+	f->rejects = 0;
+	f->last_time_ms = time_ms;
+
+	*temp_out = channel_update(&f->temp, cfg, temp, first);
+	*hum_out = (uint16_t)channel_update(&f->hum, cfg, (int16_t)hum, first);
+
+	return true;
+}
@@ -0,0 +1,84 @@
+/*
+
+	Sensor smoothing and outlier rejection
+
+	Fixed point filter stage between decode and publish. Pure functions with no
+	ESP-IDF dependencies; every update costs a constant amount of work.
+
+*/
+
+#ifndef MAIN_SENSOR_FILTER_H_
+#define MAIN_SENSOR_FILTER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SENSOR_FILTER_MEDIAN_MAX		7		// largest rolling median window
+#define SENSOR_FILTER_MEDIAN_LEN		5		// default window, odd
+#define SENSOR_FILTER_EWMA_ALPHA_Q8		64		// default EWMA weight of a new sample, 64/256 = 0.25
+#define SENSOR_FILTER_MAX_TEMP_RATE		30		// default gate: tenths of a degree per minute (3 C/min)
+#define SENSOR_FILTER_MAX_HUM_RATE		100		// default gate: tenths of %RH per minute (10 %RH/min)
+#define SENSOR_FILTER_RATE_SLACK		5		// change always allowed, covers sensor noise
+#define SENSOR_FILTER_MAX_REJECTS		3		// a step that persists this long is accepted
+
+/**
+ * Filter parameters, shared by the temperature and humidity channels
+ */
+typedef struct sensor_filter_config
+{
+	uint8_t median_len;				// 1 disables the median, at most SENSOR_FILTER_MEDIAN_MAX
+	uint16_t ewma_alpha_q8;			// 256 disables smoothing
+	uint16_t max_temp_rate;			// tenths per minute, 0 disables the gate
+	uint16_t max_hum_rate;			// tenths per minute, 0 disables the gate
+	uint8_t max_rejects;
+} sensor_filter_config_t;
+
+#define SENSOR_FILTER_CONFIG_DEFAULT() { \
+	.median_len = SENSOR_FILTER_MEDIAN_LEN, \
+	.ewma_alpha_q8 = SENSOR_FILTER_EWMA_ALPHA_Q8, \
+	.max_temp_rate = SENSOR_FILTER_MAX_TEMP_RATE, \
+	.max_hum_rate = SENSOR_FILTER_MAX_HUM_RATE, \
+	.max_rejects = SENSOR_FILTER_MAX_REJECTS, \
+}
+
+/**
+ * State of one filtered value
+ */
+typedef struct sensor_filter_channel
+{
+	int16_t window[SENSOR_FILTER_MEDIAN_MAX];
+	uint8_t count;
+	uint8_t pos;
+	int32_t ewma_q8;				// filtered value in tenths, Q8
+	int16_t last_accepted;
+} sensor_filter_channel_t;
+
+/**
+ * Filter state of one sensor
+ */
+typedef struct sensor_filter
+{
+	sensor_filter_channel_t temp;
+	sensor_filter_channel_t hum;
+	uint32_t last_time_ms;
+	uint8_t rejects;				// consecutive rejected samples
+	bool primed;
+	uint32_t rejected_total;
+} sensor_filter_t;
+
+/**
+ * Resets the filter; the next sample is accepted as is.
+ */
+void sensor_filter_reset(sensor_filter_t *f);
+
+/**
+ * Runs one sample through the rate gate, rolling median and EWMA.
+ * @param time_ms capture time, used by the rate gate.
+ * @param temp,hum raw values in tenths.
+ * @param temp_out,hum_out filtered values in tenths; the previous ones if the sample was rejected.
+ * @return false if the rate gate rejected the sample.
+ */
+bool sensor_filter_update(sensor_filter_t *f, const sensor_filter_config_t *cfg, uint32_t time_ms,
+		int16_t temp, uint16_t hum, int16_t *temp_out, uint16_t *hum_out);
+
+#endif /* MAIN_SENSOR_FILTER_H_ */
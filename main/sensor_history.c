@@ -0,0 +1,324 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+
+#include "DHT22.h"
+#include "sensor_history.h"
+
+// Tag used for ESP serial console messages
+static const char TAG[] = "sensor_history";
+
+/**
+ * Compact raw sample, 8 bytes
+ */
+typedef struct
+{
+	uint32_t time_s;
+	int16_t temp;
+	uint16_t hum;
+} raw_record_t;
+
+/**
+ * Compact aggregate, 16 bytes
+ */
+typedef struct
+{
+	uint32_t time_s;
+	int16_t temp_min, temp_max, temp_mean;
+	uint16_t hum_min, hum_max, hum_mean;
+} agg_record_t;
+
+/**
+ * Fixed size ring buffer of records, oldest record at (head - count).
+ * Both record types start with time_s, which only grows from one record to the next.
+ */
+typedef struct
+{
+	void *records;
+	size_t record_size;
+	uint16_t capacity;
+	uint16_t head;				// next slot to write
+	uint16_t count;
+	uint32_t pushed;			// records ever written, the position of the next one
+} ring_t;
+
+/**
+ * Aggregate of the samples in the currently open bucket
+ */
+typedef struct
+{
+	uint32_t start_s;
+	uint32_t count;
+	int32_t temp_sum;
+	int32_t hum_sum;
+	int16_t temp_min, temp_max;
+	uint16_t hum_min, hum_max;
+} bucket_t;
+
+typedef struct
+{
+	ring_t tiers[SENSOR_HISTORY_TIER_COUNT];
+	bucket_t minute;
+	bucket_t hour;
+} sensor_history_t;
+
+static const uint32_t g_bucket_seconds[SENSOR_HISTORY_TIER_COUNT] = { 0, 60, 3600 };
+
+static const char *g_tier_names[SENSOR_HISTORY_TIER_COUNT] = { "raw", "minute", "hour" };
+
+// Per sensor history, allocated by the first sample of a sensor
+static sensor_history_t *g_history[DHT_MAX_SENSORS];
+
+// Protects the rings against concurrent readers on the HTTP server core
+static SemaphoreHandle_t g_history_mutex;
+
+static void *ring_push(ring_t *ring)
+{
+	void *slot = (uint8_t *)ring->records + (size_t)ring->head * ring->record_size;
+
+	ring->head = (ring->head + 1) % ring->capacity;
+	ring->pushed++;
+	if (ring->count < ring->capacity)
+	{
+		ring->count++;
+	}
+
+	return slot;
+}
+
+static const void *ring_get(const ring_t *ring, size_t age_index)
+{
+	// age_index 0 is the oldest record
+	size_t pos = (ring->head + ring->capacity - ring->count + age_index) % ring->capacity;
+
+	return (const uint8_t *)ring->records + pos * ring->record_size;
+}
+
+static uint32_t ring_time(const ring_t *ring, size_t age_index)
+{
+	return *(const uint32_t *)ring_get(ring, age_index);
+}
+
+static bool ring_alloc(ring_t *ring, size_t capacity, size_t record_size)
+{
+	ring->records = calloc(capacity, record_size);
+	ring->record_size = record_size;
+	ring->capacity = capacity;
+	ring->head = 0;
+	ring->count = 0;
+	ring->pushed = 0;
+
+	return ring->records != NULL;
+}
+
+static sensor_history_t *sensor_history_alloc(void)
+{
+	sensor_history_t *h = calloc(1, sizeof(sensor_history_t));
+
+	if (h == NULL
+			|| !ring_alloc(&h->tiers[SENSOR_HISTORY_TIER_RAW], SENSOR_HISTORY_RAW_LEN, sizeof(raw_record_t))
+			|| !ring_alloc(&h->tiers[SENSOR_HISTORY_TIER_MINUTE], SENSOR_HISTORY_MINUTE_LEN, sizeof(agg_record_t))
+			|| !ring_alloc(&h->tiers[SENSOR_HISTORY_TIER_HOUR], SENSOR_HISTORY_HOUR_LEN, sizeof(agg_record_t)))
+	{
+		if (h)
+		{
+			for (int t = 0; t < SENSOR_HISTORY_TIER_COUNT; t++)
+			{
+				free(h->tiers[t].records);
+			}
+			free(h);
+		}
+		return NULL;
+	}
+
+	return h;
+}
+
+static void bucket_add(bucket_t *b, uint32_t start_s, int16_t temp, uint16_t hum)
+{
+	if (b->count == 0)
+	{
+		b->start_s = start_s;
+		b->temp_min = b->temp_max = temp;
+		b->hum_min = b->hum_max = hum;
+	}
+
+	b->count++;
+	b->temp_sum += temp;
+	b->hum_sum += hum;
+	if (temp < b->temp_min) b->temp_min = temp;
+	if (temp > b->temp_max) b->temp_max = temp;
+	if (hum < b->hum_min) b->hum_min = hum;
+	if (hum > b->hum_max) b->hum_max = hum;
+}
+
+static void bucket_close(bucket_t *b, ring_t *ring)
+{
+	agg_record_t *rec = ring_push(ring);
+
+	rec->time_s = b->start_s;
+	rec->temp_min = b->temp_min;
+	rec->temp_max = b->temp_max;
+	rec->temp_mean = b->temp_sum / (int32_t)b->count;
+	rec->hum_min = b->hum_min;
+	rec->hum_max = b->hum_max;
+	rec->hum_mean = b->hum_sum / (int32_t)b->count;
+
+	memset(b, 0, sizeof(*b));
+}
+
+/**
+ * Feeds a sample into the open bucket of an aggregate tier, closing the bucket first
+ * when the sample belongs to a later period.
+ */
+static void tier_aggregate(sensor_history_t *h, sensor_history_tier_e tier, bucket_t *b, uint32_t time_s, int16_t temp, uint16_t hum)
+{
+	uint32_t start_s = time_s - time_s % g_bucket_seconds[tier];
+
+	if (b->count && b->start_s != start_s)
+	{
+		bucket_close(b, &h->tiers[tier]);
+	}
+
+	bucket_add(b, start_s, temp, hum);
+}
+
+void sensor_history_init(void)
+{
+	if (g_history_mutex == NULL)
+	{
+		g_history_mutex = xSemaphoreCreateMutex();
+	}
+}
+
+void sensor_history_add(int sensor, uint32_t time_s, int16_t temp_tenths, uint16_t hum_tenths)
+{
+	if (sensor < 0 || sensor >= DHT_MAX_SENSORS)
+	{
+		return;
+	}
+
+	xSemaphoreTake(g_history_mutex, portMAX_DELAY);
+
+	sensor_history_t *h = g_history[sensor];
+	if (h == NULL)
+	{
+		h = g_history[sensor] = sensor_history_alloc();
+		if (h == NULL)
+		{
+			xSemaphoreGive(g_history_mutex);
+			ESP_LOGE(TAG, "sensor_history_add: no memory for sensor %d", sensor);
+			return;
+		}
+	}
+
+	raw_record_t *raw = ring_push(&h->tiers[SENSOR_HISTORY_TIER_RAW]);
+	raw->time_s = time_s;
+	raw->temp = temp_tenths;
+	raw->hum = hum_tenths;
+
+	tier_aggregate(h, SENSOR_HISTORY_TIER_MINUTE, &h->minute, time_s, temp_tenths, hum_tenths);
+	tier_aggregate(h, SENSOR_HISTORY_TIER_HOUR, &h->hour, time_s, temp_tenths, hum_tenths);
+
+	xSemaphoreGive(g_history_mutex);
+}
+
+size_t sensor_history_read(int sensor, sensor_history_tier_e tier, uint32_t from_s, uint32_t to_s,
+		uint32_t *cursor, sensor_history_record_t *out, size_t max)
+{
+	size_t copied = 0;
+
+	if (sensor < 0 || sensor >= DHT_MAX_SENSORS || tier >= SENSOR_HISTORY_TIER_COUNT)
+	{
+		return 0;
+	}
+
+	xSemaphoreTake(g_history_mutex, portMAX_DELAY);
+
+	const sensor_history_t *h = g_history[sensor];
+	const ring_t *ring = h ? &h->tiers[tier] : NULL;
+
+	if (ring == NULL)
+	{
+		xSemaphoreGive(g_history_mutex);
+		return 0;
+	}
+
+	// continue where the last batch stopped, or at the oldest record if that one is gone
+	uint32_t oldest = ring->pushed - ring->count;
+	size_t i = *cursor > oldest ? *cursor - oldest : 0;
+
+	// times only grow, so the first record in range is found by bisection
+	if (i < ring->count && ring_time(ring, i) < from_s)
+	{
+		size_t hi = ring->count;
+
+		while (i < hi)
+		{
+			size_t mid = i + (hi - i) / 2;
+
+			if (ring_time(ring, mid) < from_s) i = mid + 1; else hi = mid;
+		}
+	}
+
+	for (; i < ring->count && copied < max; i++)
+	{
+		sensor_history_record_t *rec = &out[copied];
+
+		if (ring_time(ring, i) > to_s)
+		{
+			i = ring->count;		// past the range, nothing more to read
+			break;
+		}
+
+		if (tier == SENSOR_HISTORY_TIER_RAW)
+		{
+			const raw_record_t *raw = ring_get(ring, i);
+
+			rec->time_s = raw->time_s;
+			rec->temp_min = rec->temp_max = rec->temp_mean = raw->temp;
+			rec->hum_min = rec->hum_max = rec->hum_mean = raw->hum;
+		}
+		else
+		{
+			const agg_record_t *agg = ring_get(ring, i);
+
+			rec->time_s = agg->time_s;
+			rec->temp_min = agg->temp_min;
+			rec->temp_max = agg->temp_max;
+			rec->temp_mean = agg->temp_mean;
+			rec->hum_min = agg->hum_min;
+			rec->hum_max = agg->hum_max;
+			rec->hum_mean = agg->hum_mean;
+		}
+
+		copied++;
+	}
+
+	*cursor = oldest + i;
+
+	xSemaphoreGive(g_history_mutex);
+
+	return copied;
+}
+
+const char *sensor_history_tier_name(sensor_history_tier_e tier)
+{
+	return tier < SENSOR_HISTORY_TIER_COUNT ? g_tier_names[tier] : "unknown";
+}
+
+sensor_history_tier_e sensor_history_tier_from_name(const char *name)
+{
+	for (int t = 0; t < SENSOR_HISTORY_TIER_COUNT; t++)
+	{
+		if (strcmp(name, g_tier_names[t]) == 0)
+		{
+			return t;
+		}
+	}
+
+	return SENSOR_HISTORY_TIER_COUNT;
+}
@@ -0,0 +1,78 @@
+#ifndef MAIN_SENSOR_HISTORY_H_
+#define MAIN_SENSOR_HISTORY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Ring buffer lengths per sensor
+#define SENSOR_HISTORY_RAW_LEN			450		// 30 minutes at one sample every 4 seconds
+#define SENSOR_HISTORY_MINUTE_LEN		1440	// 24 hours of 1 minute aggregates
+#define SENSOR_HISTORY_HOUR_LEN			168		// 7 days of 1 hour aggregates
+
+// Values are stored as fixed point tenths, the native DHT22 resolution
+#define SENSOR_HISTORY_SCALE			10
+
+/**
+ * Resolution tiers of the history
+ */
+typedef enum sensor_history_tier
+{
+	SENSOR_HISTORY_TIER_RAW = 0,
+	SENSOR_HISTORY_TIER_MINUTE,
+	SENSOR_HISTORY_TIER_HOUR,
+	SENSOR_HISTORY_TIER_COUNT,
+} sensor_history_tier_e;
+
+/**
+ * One history record as returned to readers. Raw samples have min == max == mean.
+ */
+typedef struct sensor_history_record
+{
+	uint32_t time_s;			// uptime in seconds at the sample or at the start of the aggregate
+	int16_t temp_min;			// temperature in tenths of degrees Celsius
+	int16_t temp_max;
+	int16_t temp_mean;
+	uint16_t hum_min;			// relative humidity in tenths of %RH
+	uint16_t hum_max;
+	uint16_t hum_mean;
+} sensor_history_record_t;
+
+/**
+ * Initializes the history lock. Must be called before any other sensor_history function.
+ */
+void sensor_history_init(void);
+
+/**
+ * Adds a validated sample and updates the aggregates. Buffers for a sensor are
+ * allocated by its first sample.
+ * @param sensor sensor index, < DHT_MAX_SENSORS.
+ * @param time_s uptime in seconds when the sample was captured.
+ * @param temp_tenths temperature in tenths of degrees Celsius.
+ * @param hum_tenths relative humidity in tenths of %RH.
+ */
+void sensor_history_add(int sensor, uint32_t time_s, int16_t temp_tenths, uint16_t hum_tenths);
+
+/**
+ * Copies records of one tier, oldest first, whose time lies within [from_s, to_s].
+ * Only completed aggregates are returned.
+ * @param cursor where to continue a range read in batches: 0 before the first batch,
+ *        then left as the previous call set it. Samples added between batches do not
+ *        move it; records overwritten between batches are not returned.
+ * @param out receives at most max records.
+ * @return number of records copied, 0 once the range is done.
+ */
+size_t sensor_history_read(int sensor, sensor_history_tier_e tier, uint32_t from_s, uint32_t to_s,
+		uint32_t *cursor, sensor_history_record_t *out, size_t max);
+
+/**
+ * @return the tier name used by the HTTP API ("raw", "minute", "hour").
+ */
+const char *sensor_history_tier_name(sensor_history_tier_e tier);
+
+/**
+ * Parses a tier name.
+ * @return the tier, or SENSOR_HISTORY_TIER_COUNT if the name is unknown.
+ */
+sensor_history_tier_e sensor_history_tier_from_name(const char *name);
+
+#endif /* MAIN_SENSOR_HISTORY_H_ */
@@ -0,0 +1,167 @@
+#include <math.h>
+#include <sys/time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_netif.h"
+#include "esp_sleep.h"
+#include "esp_wifi.h"
+
+#include "DHT22.h"
+#include "sample_log.h"
+#include "sensor_history.h"
+#include "sleep_mode.h"
+#include "sleep_sched.h"
+#include "wifi_app.h"
+
+// Tag used for ESP serial console messages
+static const char TAG[] = "sleep_mode";
+
+// Schedule and sample buffer, kept in RTC slow memory through deep sleep
+static RTC_DATA_ATTR sleep_sched_t sleep_state;
+
+/**
+ * @return microseconds of the RTC clock. Unlike esp_timer it keeps counting through
+ *         deep sleep, so it orders samples taken in different wakes.
+ */
+static uint64_t sleep_mode_now_us(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/**
+ * Reads every sensor once into the RTC buffer. Failed reads are skipped, the next
+ * wake reads again.
+ */
+static void sleep_mode_read_sensors(uint32_t time_s)
+{
+	static const int gpios[] = DHT_SENSOR_GPIOS;
+
+	for (int k = 0; k < sizeof(gpios) / sizeof(gpios[0]); k++)
+	{
+		int index = DHT22_add_sensor(gpios[k]);
+		float hum, temp;
+
+		if (readDHT(gpios[k], &hum, &temp, NULL) == DHT_OK)
+		{
+			sleep_sample_t sample =
+			{
+				.time_s = time_s,
+				.temp = lroundf(temp * SENSOR_HISTORY_SCALE),
+				.hum = lroundf(hum * SENSOR_HISTORY_SCALE),
+				.sensor = index,
+			};
+			sleep_sched_add(&sleep_state, &sample);
+		}
+	}
+}
+
+/**
+ * Writes the buffered samples to the sample log and empties the buffer.
+ * @return false if there is no log to write them to.
+ */
+static bool sleep_mode_store(void)
+{
+	if (sample_log_init() != ESP_OK)
+	{
+		// nowhere to keep them: leave them buffered, new samples are dropped once it is full
+		return false;
+	}
+
+	for (int i = 0; i < sleep_state.count; i++)
+	{
+		const sleep_sample_t *s = &sleep_state.samples[i];
+		sample_log_append(s->sensor, s->time_s, s->temp, s->hum);
+	}
+	sample_log_flush();
+
+	ESP_LOGI(TAG, "sleep_mode_store: %u samples written to the log", sleep_state.count);
+	sleep_sched_stored(&sleep_state);
+
+	return true;
+}
+
+/**
+ * Keeps Wi-Fi and the HTTP server up so collectors can pull the batch from /export and
+ * acknowledge it with /exportAck: until every record of the log is acknowledged, the
+ * station has been connected for SLEEP_MODE_AWAKE_S, or SLEEP_MODE_CONNECT_TIMEOUT_S
+ * passed without an IP.
+ * @return true if a collector acknowledged every record.
+ */
+static bool sleep_mode_upload_window(void)
+{
+	esp_netif_ip_info_t ip_info;
+	int connected_s = -1;
+	uint32_t next_seq = sample_log_next_seq();
+	bool acked = false;
+
+	wifi_app_start();
+
+	for (int s = 0; ; s++)
+	{
+		vTaskDelay(pdMS_TO_TICKS(1000));
+
+		// the wifi task creates the netif, and connects with the saved credentials
+		if (connected_s < 0 && esp_netif_sta != NULL
+				&& esp_netif_get_ip_info(esp_netif_sta, &ip_info) == ESP_OK && ip_info.ip.addr != 0)
+		{
+			connected_s = s;
+		}
+		acked = sample_log_acked() >= next_seq;
+		if (acked || (connected_s < 0 ? s >= SLEEP_MODE_CONNECT_TIMEOUT_S : s - connected_s >= SLEEP_MODE_AWAKE_S))
+		{
+			break;
+		}
+	}
+
+	ESP_LOGI(TAG, "sleep_mode_upload_window: %s", acked ? "acknowledged" : connected_s < 0 ? "no network" : "not acknowledged");
+	esp_wifi_stop();
+
+	return acked;
+}
+
+void sleep_mode_run(void)
+{
+	uint64_t now_us = sleep_mode_now_us();
+
+	// RTC memory is reloaded by any reset other than a deep sleep wake, which makes the state invalid
+	if (!sleep_sched_valid(&sleep_state, SLEEP_MODE_PERIOD_S, SLEEP_MODE_UPLOAD_EVERY))
+	{
+		ESP_LOGI(TAG, "sleep_mode_run: new schedule, %u s period, upload every %u wakes",
+				SLEEP_MODE_PERIOD_S, SLEEP_MODE_UPLOAD_EVERY);
+		sleep_sched_init(&sleep_state, now_us, SLEEP_MODE_PERIOD_S, SLEEP_MODE_UPLOAD_EVERY);
+	}
+
+	sleep_mode_read_sensors(now_us / 1000000);
+
+	switch (sleep_sched_wake_done(&sleep_state))
+	{
+		case SLEEP_SCHED_UPLOAD:
+		{
+			bool stored = sleep_mode_store();
+
+			sleep_sched_uploaded(&sleep_state, sleep_mode_upload_window() && stored);
+			break;
+		}
+
+		case SLEEP_SCHED_STORE:
+			sleep_mode_store();
+			break;
+
+		default:
+			break;
+	}
+
+	uint64_t sleep_us = sleep_sched_sleep_us(&sleep_state, sleep_mode_now_us());
+
+	ESP_LOGD(TAG, "sleep_mode_run: wake %u, %u buffered, sleeping %llu ms",
+			sleep_state.wakes, sleep_state.count, sleep_us / 1000);
+
+	esp_sleep_enable_timer_wakeup(sleep_us);
+	esp_deep_sleep_start();
+}
@@ -0,0 +1,28 @@
+#ifndef MAIN_SLEEP_MODE_H_
+#define MAIN_SLEEP_MODE_H_
+
+#include "DHT22.h"
+
+// Duty cycled operation for battery powered units: the device wakes on a timer,
+// reads the sensors into RTC memory and sleeps again; Wi-Fi only comes up every
+// SLEEP_MODE_UPLOAD_EVERY wakes so collectors can pull the batch from /export; a
+// window only counts as an upload once a collector acknowledged it with /exportAck.
+#define SLEEP_MODE_ENABLED				0			// 1: duty cycled deep sleep, 0: always on
+#define SLEEP_MODE_PERIOD_S				60			// time between two sensor reads
+#define SLEEP_MODE_UPLOAD_EVERY			30			// wakes between two Wi-Fi windows
+#define SLEEP_MODE_CONNECT_TIMEOUT_S	15			// give up the window if the station gets no IP by then
+#define SLEEP_MODE_AWAKE_S				30			// longest window once the station is connected, ends when acknowledged
+
+#if SLEEP_MODE_PERIOD_S * 1000 < DHT_MIN_INTERVAL_MS
+#error "SLEEP_MODE_PERIOD_S must not be shorter than the sensor's minimum interval"
+#endif
+
+/**
+ * Runs one wake of the duty cycle and enters deep sleep; never returns.
+ * Reads every sensor into the RTC buffer; on a store or upload wake the buffer is
+ * written to the sample log first, and an upload wake starts Wi-Fi and the HTTP
+ * server for a window before sleeping. Call after NVS is initialized.
+ */
+void sleep_mode_run(void);
+
+#endif /* MAIN_SLEEP_MODE_H_ */
@@ -0,0 +1,119 @@
+/*------------------------------------------------------------------------------
+
+	Deep sleep duty cycle scheduler
+
+	Wakes sit on a grid that advances by whole periods, so the active time
+	never adds up to drift. Samples collect in the buffer and reach flash in
+	batches: at an upload wake, or earlier when the buffer would overflow.
+	A failed upload doubles the wakes until the next attempt, so an absent
+	network costs a few radio windows a day rather than one every batch.
+
+---------------------------------------------------------------------------------*/
+
+#include "sleep_sched.h"
+
+#define SLEEP_SCHED_MAGIC		0x534c5031		// "SLP1", change when the layout changes
+
+void sleep_sched_init(sleep_sched_t *s, uint64_t now_us, uint32_t period_s, uint32_t upload_every)
+{
+	s->magic = SLEEP_SCHED_MAGIC;
+	s->period_s = period_s;
+	s->upload_every = upload_every ? upload_every : 1;
+	s->next_wake_us = now_us;
+	s->wakes = 0;
+	s->missed = 0;
+	s->since_upload = 0;
+	s->uploads = 0;
+	s->upload_failures = 0;
+	s->stores = 0;
+	s->backoff = 0;
+	s->wake_samples = 0;
+	s->count = 0;
+}
+
+bool sleep_sched_valid(const sleep_sched_t *s, uint32_t period_s, uint32_t upload_every)
+{
+	return s->magic == SLEEP_SCHED_MAGIC
+			&& s->period_s == period_s
+			&& s->upload_every == (upload_every ? upload_every : 1)
+			&& s->count <= SLEEP_SCHED_CAPACITY
+			&& s->backoff <= SLEEP_SCHED_MAX_BACKOFF;
+}
+
+bool sleep_sched_add(sleep_sched_t *s, const sleep_sample_t *sample)
+{
+	if (s->count >= SLEEP_SCHED_CAPACITY)
+	{
+		return false;
+	}
+
+	s->samples[s->count++] = *sample;
+	s->wake_samples++;
+	return true;
+}
+
+sleep_sched_action_e sleep_sched_wake_done(sleep_sched_t *s)
+{
+	uint16_t wake_samples = s->wake_samples;
+
+	s->wake_samples = 0;
+	s->wakes++;
+	s->since_upload++;
+
+	if (s->since_upload >= s->upload_every << s->backoff)
+	{
+		return SLEEP_SCHED_UPLOAD;
+	}
+
+	// the next wake adds about as many samples as this one
+	if (SLEEP_SCHED_CAPACITY - s->count < (wake_samples ? wake_samples : 1))
+	{
+		s->stores++;
+		return SLEEP_SCHED_STORE;
+	}
+
+	return SLEEP_SCHED_SLEEP;
+}
+
+void sleep_sched_stored(sleep_sched_t *s)
+{
+	s->count = 0;
+}
+
+void sleep_sched_uploaded(sleep_sched_t *s, bool ok)
+{
+	s->since_upload = 0;
+
+	if (ok)
+	{
+		s->uploads++;
+		s->backoff = 0;
+	}
+	else
+	{
+		s->upload_failures++;
+		if (s->backoff < SLEEP_SCHED_MAX_BACKOFF)
+		{
+			s->backoff++;
+		}
+	}
+}
+
+uint64_t sleep_sched_sleep_us(sleep_sched_t *s, uint64_t now_us)
+{
+	uint64_t period_us = (uint64_t)s->period_s * 1000000;
+
+	s->next_wake_us += period_us;
+
+	if (s->next_wake_us < now_us + SLEEP_SCHED_MIN_SLEEP_US)
+	{
+		// whole slots passed while awake: skip them, keeping the phase
+		uint64_t late = now_us + SLEEP_SCHED_MIN_SLEEP_US - s->next_wake_us;
+		uint64_t skip = late / period_us + 1;
+
+		s->next_wake_us += skip * period_us;
+		s->missed += skip;
+	}
+
+	return s->next_wake_us - now_us;
+}
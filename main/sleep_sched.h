@@ -0,0 +1,109 @@
+/*
+
+	Deep sleep duty cycle scheduler
+
+	Pure functions only, like the DHT22 sampling scheduler: time is passed in,
+	so wake planning and batching can be exercised on a host with simulated time
+	(see tools/sleep_sim). The state is meant to live in RTC memory, which keeps
+	its contents through deep sleep.
+
+*/
+
+#ifndef SLEEP_SCHED_H_
+#define SLEEP_SCHED_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SLEEP_SCHED_CAPACITY		192			// samples buffered between flash writes, 12 bytes each
+#define SLEEP_SCHED_MAX_BACKOFF		3			// failed uploads stretch the wait up to 8 x upload_every
+#define SLEEP_SCHED_MIN_SLEEP_US	100000		// shorter sleeps skip to the next slot instead
+
+/**
+ * One buffered sensor reading
+ */
+typedef struct sleep_sample
+{
+	uint32_t time_s;			// RTC clock seconds, keeps counting through deep sleep
+	int16_t temp;				// tenths of a degree Celsius
+	uint16_t hum;				// tenths of %RH
+	uint8_t sensor;				// sensor index
+} sleep_sample_t;
+
+/**
+ * What to do at the end of a wake
+ */
+typedef enum sleep_sched_action
+{
+	SLEEP_SCHED_SLEEP = 0,		// keep the samples buffered and sleep again
+	SLEEP_SCHED_STORE,			// buffer full: write it to the flash log, radio stays off
+	SLEEP_SCHED_UPLOAD,			// write the buffer to the flash log and bring up Wi-Fi
+} sleep_sched_action_e;
+
+/**
+ * Schedule and sample buffer. Times are microseconds of the RTC clock.
+ */
+typedef struct sleep_sched
+{
+	uint32_t magic;				// tells a kept state from RTC memory after power-on
+	uint32_t period_s;			// time between two wakes
+	uint32_t upload_every;		// wakes between two uploads while they succeed
+	uint64_t next_wake_us;		// grid slot of the current wake, then of the planned one
+	uint32_t wakes;
+	uint32_t missed;			// slots skipped because a wake overran the period
+	uint32_t since_upload;		// wakes since the last upload attempt
+	uint32_t uploads;
+	uint32_t upload_failures;
+	uint32_t stores;			// flash writes forced by a full buffer
+	uint8_t backoff;			// failed uploads in a row, capped at SLEEP_SCHED_MAX_BACKOFF
+	uint16_t wake_samples;		// samples added during the current wake
+	uint16_t count;
+	sleep_sample_t samples[SLEEP_SCHED_CAPACITY];
+} sleep_sched_t;
+
+/**
+ * Starts a new schedule with an empty buffer.
+ * @param now_us current time, the grid slot of the running wake.
+ */
+void sleep_sched_init(sleep_sched_t *s, uint64_t now_us, uint32_t period_s, uint32_t upload_every);
+
+/**
+ * @return true if s holds a schedule started by sleep_sched_init, with the same settings.
+ */
+bool sleep_sched_valid(const sleep_sched_t *s, uint32_t period_s, uint32_t upload_every);
+
+/**
+ * Buffers a sample of the current wake.
+ * @return false if the buffer is full; sleep_sched_wake_done stores early enough that
+ *         this only happens with more samples per wake than the buffer holds.
+ */
+bool sleep_sched_add(sleep_sched_t *s, const sleep_sample_t *sample);
+
+/**
+ * Ends the sampling part of a wake.
+ * @return SLEEP_SCHED_UPLOAD once upload_every wakes passed since the last upload, more
+ *         after failed ones; SLEEP_SCHED_STORE if the next wake's samples might not fit;
+ *         otherwise SLEEP_SCHED_SLEEP.
+ */
+sleep_sched_action_e sleep_sched_wake_done(sleep_sched_t *s);
+
+/**
+ * Empties the buffer after its samples were written to flash.
+ */
+void sleep_sched_stored(sleep_sched_t *s);
+
+/**
+ * Records the result of an upload window.
+ * @param ok the network was reached, so the batch could be collected.
+ */
+void sleep_sched_uploaded(sleep_sched_t *s, bool ok);
+
+/**
+ * Plans the next wake on the grid. Slots that are already past, or too close to
+ * sleep for, are skipped and counted as missed, so a long wake never shifts the grid.
+ * @param now_us current time.
+ * @return microseconds to sleep.
+ */
+uint64_t sleep_sched_sleep_us(sleep_sched_t *s, uint64_t now_us);
+
+#endif /* SLEEP_SCHED_H_ */
@@ -21,4 +21,19 @@
 #define DHT22_TASK_PRIORITY					5
 #define DHT22_TASK_CORE_ID					1
 
+// OTA writer task, programs flash while the HTTP server task receives
+#define OTA_WRITER_TASK_STACK_SIZE			3072
+#define OTA_WRITER_TASK_PRIORITY			5
+#define OTA_WRITER_TASK_CORE_ID				1
+
+// HTTP bulk server task, runs slow request handlers off the HTTP server task
+#define HTTP_BULK_TASK_STACK_SIZE			6144
+#define HTTP_BULK_TASK_PRIORITY				3
+#define HTTP_BULK_TASK_CORE_ID				1
+
+// Trace drain task
+#define TRACE_TASK_STACK_SIZE				3072
+#define TRACE_TASK_PRIORITY					1
+#define TRACE_TASK_CORE_ID					0
+
 #endif /* MAIN_TASKS_COMMON_H_ */
@@ -0,0 +1,159 @@
+/*
+	Deferred trace
+
+	Hot paths add fixed size binary records to a ring buffer instead of writing to
+	the UART. A low priority task turns them into console lines at a limited rate,
+	and /trace shows the most recent ones.
+*/
+
+#include <stdio.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "tasks_common.h"
+#include "trace.h"
+
+// Tag used for ESP serial console messages
+static const char TAG[] = "trace";
+
+static trace_record_t trace_ring[TRACE_BUFFER_RECORDS];
+static atomic_uint trace_next;
+
+/**
+ * Event formats; a format starting with "%s" takes a0 as a static string.
+ */
+static const char *const trace_formats[TRACE_EVENT_COUNT] = {
+	[TRACE_HTTP_ASSET]			= "%s gzip %u not-modified %u",
+	[TRACE_HTTP_NOT_FOUND]		= "asset not found",
+	[TRACE_HTTP_REQUEST]		= "%s requested",
+	[TRACE_HTTP_CACHE_REBUILD]	= "JSON cache rebuilt, version %u",
+	[TRACE_HTTP_SHED]			= "%s: client %08x over its rate, retry in %u s",
+	[TRACE_SSE_SUBSCRIBE]		= "events: socket %u subscribed, %u subscribers",
+	[TRACE_SSE_DROPPED]			= "events: socket %u dropped",
+	[TRACE_OTA_BEGIN]			= "OTA: %u bytes to partition at 0x%x",
+	[TRACE_OTA_PROGRESS]		= "OTA RX: %u of %u, %u written",
+	[TRACE_OTA_END]				= "OTA: %u bytes received, result 0x%x",
+	[TRACE_WIFI_EVENT]			= "wifi: %s 0x%x %u",
+	[TRACE_DHT_READ]			= "DHT sensor %u status %d, %u us",
+};
+
+void trace_event(trace_event_e event, uintptr_t a0, uint32_t a1, uint32_t a2)
+{
+	uint32_t pos = atomic_fetch_add_explicit(&trace_next, 1, memory_order_relaxed);
+	trace_record_t *r = &trace_ring[pos % TRACE_BUFFER_RECORDS];
+
+	// readers see 0 until the record is complete
+	atomic_store_explicit(&r->stamp, 0, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	r->time_us = (uint32_t)esp_timer_get_time();
+	r->event = event;
+	r->args[0] = a0;
+	r->args[1] = a1;
+	r->args[2] = a2;
+
+	atomic_store_explicit(&r->stamp, pos + 1, memory_order_release);
+}
+
+uint32_t trace_head(void)
+{
+	return atomic_load_explicit(&trace_next, memory_order_relaxed);
+}
+
+bool trace_read(uint32_t pos, trace_record_t *out)
+{
+	const trace_record_t *r = &trace_ring[pos % TRACE_BUFFER_RECORDS];
+
+	if (atomic_load_explicit(&r->stamp, memory_order_acquire) != pos + 1)
+	{
+		return false;
+	}
+
+	out->time_us = r->time_us;
+	out->event = r->event;
+	out->args[0] = r->args[0];
+	out->args[1] = r->args[1];
+	out->args[2] = r->args[2];
+
+	// a writer that lapped the ring while copying invalidates the copy
+	atomic_thread_fence(memory_order_acquire);
+
+	return atomic_load_explicit(&r->stamp, memory_order_relaxed) == pos + 1;
+}
+
+int trace_format(const trace_record_t *record, char *buf, size_t size)
+{
+	int len = snprintf(buf, size, "%10u ", record->time_us);
+	const char *format = record->event < TRACE_EVENT_COUNT ? trace_formats[record->event] : NULL;
+
+	// nothing more fits after a prefix that filled the buffer
+	if (len >= (int)size)
+	{
+		return (int)size - 1;
+	}
+
+	if (format == NULL)
+	{
+		len += snprintf(buf + len, size - len, "event %u", record->event);
+	}
+	else if (format[0] == '%' && format[1] == 's')
+	{
+		len += snprintf(buf + len, size - len, format, (const char *)record->args[0], (unsigned)record->args[1], (unsigned)record->args[2]);
+	}
+	else
+	{
+		len += snprintf(buf + len, size - len, format, (unsigned)record->args[0], (unsigned)record->args[1], (unsigned)record->args[2]);
+	}
+
+	return len < (int)size ? len : (int)size - 1;
+}
+
+/**
+ * Prints the trace to the console, at most TRACE_DRAIN_LINES per TRACE_DRAIN_PERIOD_MS.
+ * Records overwritten before they were printed are counted and reported.
+ * @param pvParameters parameter which can be passed to the task.
+ */
+static void trace_drain_task(void *pvParameters)
+{
+	uint32_t pos = trace_head();
+	char line[TRACE_LINE_SIZE];
+	trace_record_t record;
+
+	(void)pvParameters;
+
+	for (;;)
+	{
+		vTaskDelay(TRACE_DRAIN_PERIOD_MS / portTICK_RATE_MS);
+
+		uint32_t head = trace_head();
+
+		if (head - pos > TRACE_BUFFER_RECORDS)
+		{
+			ESP_LOGW(TAG, "%u records lost", head - TRACE_BUFFER_RECORDS - pos);
+			pos = head - TRACE_BUFFER_RECORDS;
+		}
+
+		for (int n = 0; n < TRACE_DRAIN_LINES && pos != head; pos++)
+		{
+			if (trace_read(pos, &record))
+			{
+				trace_format(&record, line, sizeof(line));
+				ESP_LOGI(TAG, "%s", line);
+				n++;
+			}
+			else if (trace_head() - pos <= TRACE_BUFFER_RECORDS)
+			{
+				// still being written, print it next time
+				break;
+			}
+		}
+	}
+}
+
+void trace_init(void)
+{
+	xTaskCreatePinnedToCore(&trace_drain_task, "trace_drain", TRACE_TASK_STACK_SIZE, NULL, TRACE_TASK_PRIORITY, NULL, TRACE_TASK_CORE_ID);
+}
@@ -0,0 +1,76 @@
+#ifndef MAIN_TRACE_H_
+#define MAIN_TRACE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define TRACE_BUFFER_RECORDS			256			// ring size, power of two
+#define TRACE_DRAIN_PERIOD_MS			100			// console drain interval
+#define TRACE_DRAIN_LINES				10			// most lines printed per drain interval
+#define TRACE_LINE_SIZE					96
+
+/**
+ * Trace events. Keep in sync with the format table in trace.c.
+ */
+typedef enum trace_event
+{
+	TRACE_HTTP_ASSET = 0,			// a0: path (static string), a1: gzip, a2: 304
+	TRACE_HTTP_NOT_FOUND,
+	TRACE_HTTP_REQUEST,				// a0: URI (static string)
+	TRACE_HTTP_CACHE_REBUILD,		// a0: version
+	TRACE_HTTP_SHED,				// a0: URI (static string), a1: client IPv4 address, a2: Retry-After seconds
+	TRACE_SSE_SUBSCRIBE,			// a0: socket, a1: subscribers
+	TRACE_SSE_DROPPED,				// a0: socket
+	TRACE_OTA_BEGIN,				// a0: content length, a1: partition address
+	TRACE_OTA_PROGRESS,				// a0: bytes received, a1: content length, a2: image bytes written
+	TRACE_OTA_END,					// a0: bytes received, a1: esp_err_t
+	TRACE_DHT_READ,					// a0: sensor, a1: status, a2: read time in us
+	TRACE_WIFI_EVENT,				// a0: event name (static string), a1: disconnect reason or IPv4 address, a2: channel
+	TRACE_EVENT_COUNT,
+} trace_event_e;
+
+/**
+ * One trace record, 24 bytes on the ESP32
+ */
+typedef struct trace_record
+{
+	atomic_uint stamp;				// position + 1 once written, 0 while being written
+	uint32_t time_us;				// low 32 bits of esp_timer_get_time, wraps every ~71 minutes
+	uint32_t event;					// trace_event_e
+	uintptr_t args[3];				// a0 holds a pointer for events with a string argument
+} trace_record_t;
+
+/**
+ * Starts the task that drains the trace to the console.
+ */
+void trace_init(void);
+
+/**
+ * Adds a record. Lock-free and non-blocking, callable from any task.
+ * @param event event ID.
+ * @param a0,a1,a2 event arguments, see trace_event_e; strings must be static.
+ */
+void trace_event(trace_event_e event, uintptr_t a0, uint32_t a1, uint32_t a2);
+
+/**
+ * @return position the next record will be written at; records are at [head - TRACE_BUFFER_RECORDS, head).
+ */
+uint32_t trace_head(void);
+
+/**
+ * Copies a record if it is still in the ring and not being overwritten.
+ * @param pos record position.
+ * @param out receives the record.
+ * @return false if the record was overwritten or not complete yet.
+ */
+bool trace_read(uint32_t pos, trace_record_t *out);
+
+/**
+ * Formats a record as one line of text, without a line break.
+ * @return length of the line.
+ */
+int trace_format(const trace_record_t *record, char *buf, size_t size);
+
+#endif /* MAIN_TRACE_H_ */
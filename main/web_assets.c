@@ -0,0 +1,47 @@
+#include <string.h>
+
+#include "web_assets.h"
+
+/**
+ * Compares a path of a given length (not terminated) with a terminated one, like strcmp.
+ */
+static int path_cmp(const char *path, size_t len, const char *other)
+{
+	int c = strncmp(path, other, len);
+
+	if (c != 0)
+	{
+		return c;
+	}
+
+	return other[len] == '\0' ? 0 : -1;
+}
+
+const web_asset_t *web_assets_find(const char *path)
+{
+	size_t len = strcspn(path, "?#");
+	size_t lo = 0;
+	size_t hi = web_assets_count;
+
+	// binary search: O(log n) string compares however many files the page grows to
+	while (lo < hi)
+	{
+		size_t mid = lo + (hi - lo) / 2;
+		int c = path_cmp(path, len, web_assets[mid].path);
+
+		if (c == 0)
+		{
+			return &web_assets[mid];
+		}
+		if (c < 0)
+		{
+			hi = mid;
+		}
+		else
+		{
+			lo = mid + 1;
+		}
+	}
+
+	return NULL;
+}
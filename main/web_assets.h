@@ -0,0 +1,43 @@
+/*
+
+	Embedded web page files
+
+	The table itself is generated at build time by tools/web_assets.py from the
+	files in main/webpage, sorted by path; adding a file needs no code.
+
+*/
+
+#ifndef MAIN_WEB_ASSETS_H_
+#define MAIN_WEB_ASSETS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * One embedded file with everything needed to send it
+ */
+typedef struct web_asset
+{
+	const char *path;				// URI path, e.g. "/app.js"
+	const char *type;				// Content-Type
+	const uint8_t *data;			// the file as served
+	size_t len;
+	const uint8_t *gz_data;			// gzip compressed copy
+	size_t gz_len;
+	const char *etag;				// strong ETags of both representations
+	const char *gz_etag;
+	const char *cache_control;
+} web_asset_t;
+
+// Generated table, sorted by path (strcmp order)
+extern const web_asset_t web_assets[];
+extern const size_t web_assets_count;
+
+/**
+ * Finds the embedded file for a request path.
+ * @param path URI path; a query string ("?v=...") is ignored.
+ * @return the asset or NULL if there is none.
+ */
+const web_asset_t *web_assets_find(const char *path);
+
+#endif /* MAIN_WEB_ASSETS_H_ */
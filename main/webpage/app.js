@@ -4,6 +4,8 @@
 var seconds 	= null;
 var otaTimerVar =  null;
 var wifiConnectInterval = null;
+var dhtSensorInterval = null;
+var dhtEventSource = null;
 
 /**
  * Initialize functions here.
@@ -11,7 +13,7 @@ var wifiConnectInterval = null;
 $(document).ready(function(){
 	getSSID();
 	getUpdateStatus();
-	startDHTSensorInterval();
+	startDHTSensorEvents();
 	startLocalTimeInterval();
 	getConnectInfo();
 	$("#connect_wifi").on("click", function(){
@@ -34,27 +36,24 @@ function getFileInfo()
 }
 
 /**
- * Handles the firmware update.
+ * Handles the firmware update. The image is sent in chunks to /OTAchunk; after a failed
+ * chunk the upload continues from the offset the device has committed.
  */
 function updateFirmware() 
 {
-    // Form Data
-    var formData = new FormData();
     var fileSelect = document.getElementById("selected_file");
     
     if (fileSelect.files && fileSelect.files.length == 1) 
 	{
         var file = fileSelect.files[0];
-        formData.set("file", file, file.name);
         document.getElementById("ota_update_status").innerHTML = "Uploading " + file.name + ", Firmware Update in Progress...";
 
-        // Http Request
-        var request = new XMLHttpRequest();
-
-        request.upload.addEventListener("progress", updateProgress);
-        request.open('POST', "/OTAupdate");
-        request.responseType = "blob";
-        request.send(formData);
+        var reader = new FileReader();
+        reader.onload = function() {
+            var image = new Uint8Array(reader.result);
+            sendFirmwareChunk(image, sha256Hex(image), 0, 0);
+        };
+        reader.readAsArrayBuffer(file);
     } 
 	else 
 	{
@@ -63,18 +62,141 @@ function updateFirmware()
 }
 
 /**
- * Progress on transfers from the server to the client (downloads).
+ * @return URL of the device's bulk server, which runs uploads on the port after the page's.
  */
-function updateProgress(oEvent) 
+function bulkServerURL()
 {
-    if (oEvent.lengthComputable) 
-	{
-        getUpdateStatus();
-    } 
-	else 
-	{
-        window.alert('total size is unknown')
+    return location.protocol + "//" + location.hostname + ":" + ((parseInt(location.port, 10) || 80) + 1);
+}
+
+/**
+ * Sends one chunk of the firmware image starting at offset, then the next one.
+ * @param image file contents.
+ * @param digest SHA-256 of the file as hex, checked by the device.
+ * @param offset position of the chunk.
+ * @param retries failed attempts in a row.
+ */
+function sendFirmwareChunk(image, digest, offset, retries)
+{
+    var chunkSize = 65536;
+    var request = new XMLHttpRequest();
+
+    request.open('POST', bulkServerURL() + "/OTAchunk?offset=" + offset);
+    request.setRequestHeader("Content-Type", "application/octet-stream");
+    request.setRequestHeader("X-OTA-Size", image.length);
+    request.setRequestHeader("X-OTA-SHA256", digest);
+    request.onload = function() {
+        if (request.status == 200)
+        {
+            var response = JSON.parse(request.responseText);
+
+            document.getElementById("ota_update_status").innerHTML = "Uploaded " + response.committed + " of " + image.length + " bytes...";
+            if (response.committed < image.length)
+            {
+                sendFirmwareChunk(image, digest, response.committed, 0);
+            }
+            else
+            {
+                getUpdateStatus();
+            }
+        }
+        else if (request.status == 409)
+        {
+            // the device has a different offset committed: continue from there
+            var state = JSON.parse(request.responseText);
+            sendFirmwareChunk(image, digest, state.active ? state.committed : 0, retries + 1);
+        }
+        else if (request.status == 429 || request.status == 503)
+        {
+            // over the rate limit or server busy: send the same chunk again when told to
+            var delay = parseInt(request.getResponseHeader("Retry-After"), 10) || 1;
+            setTimeout(function() { sendFirmwareChunk(image, digest, offset, retries); }, delay * 1000);
+        }
+        else
+        {
+            document.getElementById("ota_update_status").innerHTML = "!!! Upload Error !!!";
+        }
+    };
+    request.onerror = function() {
+        resumeFirmwareUpload(image, digest, retries + 1);
+    };
+    request.send(image.subarray(offset, Math.min(offset + chunkSize, image.length)));
+}
+
+/**
+ * Asks the device how much of the image it has committed and continues from there.
+ */
+function resumeFirmwareUpload(image, digest, retries)
+{
+    if (retries > 10)
+    {
+        document.getElementById("ota_update_status").innerHTML = "!!! Upload Error !!!";
+        return;
     }
+
+    setTimeout(function() {
+        $.getJSON('/OTAchunk', function(state) {
+            sendFirmwareChunk(image, digest, state.active ? state.committed : 0, retries);
+        }).fail(function() {
+            resumeFirmwareUpload(image, digest, retries + 1);
+        });
+    }, 2000);
+}
+
+/**
+ * SHA-256 of a byte array as hex; crypto.subtle is not available on plain http pages.
+ */
+function sha256Hex(bytes)
+{
+    var k = [], h = [], w = new Array(64);
+    var isPrime = function(n) { for (var f = 2; f * f <= n; f++) if (n % f == 0) return false; return true; };
+    var frac = function(x) { return ((x - Math.floor(x)) * 4294967296) | 0; };
+
+    for (var n = 2, i = 0; i < 64; n++)
+    {
+        if (isPrime(n))
+        {
+            if (i < 8) h[i] = frac(Math.pow(n, 1 / 2));
+            k[i++] = frac(Math.pow(n, 1 / 3));
+        }
+    }
+
+    // padding: 0x80, zeros, 64-bit big endian bit length
+    var len = bytes.length;
+    var padded = new Uint8Array(((len + 9 + 63) >> 6) << 6);
+    padded.set(bytes);
+    padded[len] = 0x80;
+    var view = new DataView(padded.buffer);
+    view.setUint32(padded.length - 8, Math.floor(len / 536870912));
+    view.setUint32(padded.length - 4, (len << 3) >>> 0);
+
+    var rotr = function(x, n) { return (x >>> n) | (x << (32 - n)); };
+
+    for (var off = 0; off < padded.length; off += 64)
+    {
+        for (var t = 0; t < 64; t++)
+        {
+            if (t < 16) w[t] = view.getUint32(off + 4 * t);
+            else
+            {
+                var s0 = rotr(w[t - 15], 7) ^ rotr(w[t - 15], 18) ^ (w[t - 15] >>> 3);
+                var s1 = rotr(w[t - 2], 17) ^ rotr(w[t - 2], 19) ^ (w[t - 2] >>> 10);
+                w[t] = (w[t - 16] + s0 + w[t - 7] + s1) | 0;
+            }
+        }
+
+        var a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], hh = h[7];
+        for (var t = 0; t < 64; t++)
+        {
+            var t1 = (hh + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + k[t] + w[t]) | 0;
+            var t2 = ((rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c))) | 0;
+            hh = g; g = f; f = e; e = (d + t1) | 0; d = c; c = b; b = a; a = (t1 + t2) | 0;
+        }
+        h[0] = (h[0] + a) | 0; h[1] = (h[1] + b) | 0; h[2] = (h[2] + c) | 0; h[3] = (h[3] + d) | 0;
+        h[4] = (h[4] + e) | 0; h[5] = (h[5] + f) | 0; h[6] = (h[6] + g) | 0; h[7] = (h[7] + hh) | 0;
+    }
+
+    return h.map(function(x) { return ("0000000" + (x >>> 0).toString(16)).slice(-8); }).join("");
 }
 
 /**
@@ -143,7 +265,50 @@ function getDHTSensorValues()
  */
 function startDHTSensorInterval()
 {
-	setInterval(getDHTSensorValues, 5000);    
+	if (dhtSensorInterval == null)
+	{
+		dhtSensorInterval = setInterval(getDHTSensorValues, 5000);
+	}
+}
+
+/**
+ * Clears the DHT22 sensor values interval.
+ */
+function stopDHTSensorInterval()
+{
+	if (dhtSensorInterval != null)
+	{
+		clearInterval(dhtSensorInterval);
+		dhtSensorInterval = null;
+	}
+}
+
+/**
+ * Subscribes to the DHT22 samples pushed by the server on /events. Polling takes
+ * over while the event stream is down (or not supported) and stops when it is back.
+ */
+function startDHTSensorEvents()
+{
+	if (!window.EventSource)
+	{
+		startDHTSensorInterval();
+		return;
+	}
+
+	dhtEventSource = new EventSource('/events');
+	dhtEventSource.addEventListener('sample', function(e) {
+		var data = JSON.parse(e.data);
+
+		stopDHTSensorInterval();
+		if (data["index"] == 0)
+		{
+			$("#temperature_reading").text(data["temp"]);
+			$("#humidity_reading").text(data["humidity"]);
+		}
+	});
+	dhtEventSource.onerror = function() {
+		startDHTSensorInterval();
+	};
 }
 
 /**
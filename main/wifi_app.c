@@ -1,16 +1,22 @@
+#include <stdlib.h>
+#include <string.h>
+
 #include "freertos/FreeRTOS.h"
 #include "freertos/event_groups.h"
 #include "freertos/task.h"
+#include "freertos/timers.h"
 
 #include "esp_err.h"
 #include "esp_log.h"
 #include "esp_wifi.h"
 #include "lwip/netdb.h"
 
+#include "app_nvs.h"
 #include "rgb_led.h"
 #include "tasks_common.h"
 #include "wifi_app.h"
 #include "http_server.h"
+#include "trace.h"
 
 // Tag used for ESP serial console messages
 static const char TAG [] = "wifi_app";
@@ -18,12 +24,84 @@ static const char TAG [] = "wifi_app";
 // Queue handle used to manipulate the main queue of events
 static QueueHandle_t wifi_app_queue_handle;
 
+// Wifi application task, woken by a notification whenever there is something to do
+static TaskHandle_t wifi_app_task_handle;
+
+// Latest station state event, a newer one replaces it while it waits
+static portMUX_TYPE wifi_app_state_lock = portMUX_INITIALIZER_UNLOCKED;
+static wifi_app_queue_message_t g_sta_state;
+static bool g_sta_state_pending;
+
+// Association of the station, from WIFI_EVENT_STA_CONNECTED, passed on with the IP
+static uint8_t g_assoc_bssid[6];
+static uint8_t g_assoc_channel;
+
+// Event counters: state events replaced before they were handled, messages lost to a full queue
+static uint32_t g_events_merged;
+static uint32_t g_events_dropped;
+
 // netif objects for the station and access point
 esp_netif_t* esp_netif_sta = NULL;
 esp_netif_t* esp_netif_ap  = NULL;
 
+// WiFi configuration, only written by the wifi application task
+static wifi_config_t *wifi_config = NULL;
+
+_Static_assert(MAX_SSID_LENGTH == sizeof(((wifi_sta_config_t *)0)->ssid), "connect message SSID must match wifi_sta_config_t");
+_Static_assert(MAX_PASSWORD_LENGTH == sizeof(((wifi_sta_config_t *)0)->password), "connect message password must match wifi_sta_config_t");
+
+// Station connection state, owned by the wifi application task
+static int g_retry_number;
+static bool g_sta_connected;
+static bool g_reconnect_pending;			// connect with new credentials once the old connection is down
+static bool g_creds_from_http;				// save the credentials once they got an IP
+static bool g_user_disconnect;				// stay disconnected, no retries
+
+// Delays the reconnect attempts
+static TimerHandle_t wifi_app_retry_timer;
+
 /**
- * WiFi application event handler
+ * Posts a station state event. Only the latest state matters to the wifi task, so an
+ * event still waiting is replaced rather than queued behind; never blocks.
+ * @param msg state message with its payload.
+ */
+static void wifi_app_post_sta_state(const wifi_app_queue_message_t *msg)
+{
+	portENTER_CRITICAL(&wifi_app_state_lock);
+	if (g_sta_state_pending)
+	{
+		g_events_merged++;
+	}
+	g_sta_state = *msg;
+	g_sta_state_pending = true;
+	portEXIT_CRITICAL(&wifi_app_state_lock);
+
+	xTaskNotifyGive(wifi_app_task_handle);
+}
+
+/**
+ * Takes the pending station state event, if any.
+ * @return true if msg was filled in.
+ */
+static bool wifi_app_take_sta_state(wifi_app_queue_message_t *msg)
+{
+	bool pending;
+
+	portENTER_CRITICAL(&wifi_app_state_lock);
+	pending = g_sta_state_pending;
+	if (pending)
+	{
+		*msg = g_sta_state;
+		g_sta_state_pending = false;
+	}
+	portEXIT_CRITICAL(&wifi_app_state_lock);
+
+	return pending;
+}
+
+/**
+ * WiFi application event handler. Runs on the system event loop task, so it only
+ * traces and posts without blocking: a slow handler would hold up the network stack.
  * @param arg data, aside from event data, that is passed to the handler when it is called
  * @param event_base the base id of the event to register the handler for
  * @param event_id the id to the event to register the handler for
@@ -36,7 +114,7 @@ static void wifi_app_event_handler(void *arg, esp_event_base_t event_base, int32
 		switch (event_id)
 		{
 			case WIFI_EVENT_AP_START:
-				ESP_LOGI(TAG, "WIFI_EVENT_AP_START");
+				trace_event(TRACE_WIFI_EVENT, (uintptr_t)"WIFI_EVENT_AP_START", 0, 0);
 
 				// Send queue message to start http server
 				wifi_app_send_message(WIFI_APP_MSG_START_HTTP_SERVER);
@@ -44,34 +122,46 @@ static void wifi_app_event_handler(void *arg, esp_event_base_t event_base, int32
 				break;
 
 			case WIFI_EVENT_AP_STOP:
-				ESP_LOGI(TAG, "WIFI_EVENT_AP_STOP");
+				trace_event(TRACE_WIFI_EVENT, (uintptr_t)"WIFI_EVENT_AP_STOP", 0, 0);
 
 				break;
 
 			case WIFI_EVENT_STA_START:
-				ESP_LOGI(TAG, "WIFI_EVENT_STA_START");
+				trace_event(TRACE_WIFI_EVENT, (uintptr_t)"WIFI_EVENT_STA_START", 0, 0);
 
 				break;
 
 			case WIFI_EVENT_AP_STACONNECTED:
-				ESP_LOGI(TAG, "WIFI_EVENT_AP_STACONNECTED");
+				trace_event(TRACE_WIFI_EVENT, (uintptr_t)"WIFI_EVENT_AP_STACONNECTED", 0, 0);
 
 				break;
 
 			case WIFI_EVENT_AP_STADISCONNECTED:
-				ESP_LOGI(TAG, "WIFI_EVENT_AP_STADISCONNECTED");
+				trace_event(TRACE_WIFI_EVENT, (uintptr_t)"WIFI_EVENT_AP_STADISCONNECTED", 0, 0);
 
 				break;
 
 			case WIFI_EVENT_STA_CONNECTED:
-				ESP_LOGI(TAG, "WIFI_EVENT_STA_CONNECTED");
+				trace_event(TRACE_WIFI_EVENT, (uintptr_t)"WIFI_EVENT_STA_CONNECTED", 0, 0);
+
+				// passed on with the IP, which always follows the association
+				portENTER_CRITICAL(&wifi_app_state_lock);
+				memcpy(g_assoc_bssid, ((wifi_event_sta_connected_t *)event_data)->bssid, sizeof(g_assoc_bssid));
+				g_assoc_channel = ((wifi_event_sta_connected_t *)event_data)->channel;
+				portEXIT_CRITICAL(&wifi_app_state_lock);
 
 				break;
 
 			case WIFI_EVENT_STA_DISCONNECTED:
-				ESP_LOGI(TAG, "WIFI_EVENT_STA_DISCONNECTED");
+			{
+				wifi_app_queue_message_t msg = { .msgID = WIFI_APP_MSG_STA_DISCONNECTED };
+
+				msg.data.disconnected.reason = ((wifi_event_sta_disconnected_t *)event_data)->reason;
+				trace_event(TRACE_WIFI_EVENT, (uintptr_t)"WIFI_EVENT_STA_DISCONNECTED", msg.data.disconnected.reason, 0);
+				wifi_app_post_sta_state(&msg);
 
 				break;
+			}
 		}
 	}
 	else if (event_base == IP_EVENT)
@@ -79,11 +169,20 @@ static void wifi_app_event_handler(void *arg, esp_event_base_t event_base, int32
 		switch (event_id)
 		{
 			case IP_EVENT_STA_GOT_IP:
-				ESP_LOGI(TAG, "IP_EVENT_STA_GOT_IP");
+			{
+				wifi_app_queue_message_t msg = { .msgID = WIFI_APP_MSG_STA_CONNECTED_GOT_IP };
 
-				wifi_app_send_message(WIFI_APP_MSG_STA_CONNECTED_GOT_IP);
+				msg.data.got_ip.ip_info = ((ip_event_got_ip_t *)event_data)->ip_info;
+				portENTER_CRITICAL(&wifi_app_state_lock);
+				memcpy(msg.data.got_ip.bssid, g_assoc_bssid, sizeof(g_assoc_bssid));
+				msg.data.got_ip.channel = g_assoc_channel;
+				portEXIT_CRITICAL(&wifi_app_state_lock);
+
+				trace_event(TRACE_WIFI_EVENT, (uintptr_t)"IP_EVENT_STA_GOT_IP", msg.data.got_ip.ip_info.ip.addr, msg.data.got_ip.channel);
+				wifi_app_post_sta_state(&msg);
 
 				break;
+			}
 		}
 	}
 }
@@ -157,6 +256,95 @@ static void wifi_app_soft_ap_config(void)
 	ESP_ERROR_CHECK(esp_wifi_set_ps(WIFI_STA_POWER_SAVE));						///> Power save set to "NONE"
 }
 
+/**
+ * Retry timer callback: starts the next connection attempt.
+ */
+static void wifi_app_retry_timer_cb(TimerHandle_t timer)
+{
+	esp_wifi_connect();
+}
+
+/**
+ * Connects the station with the credentials in wifi_config. With a cached BSSID and
+ * channel only that channel is probed, which skips the scan of all channels.
+ */
+static void wifi_app_connect_sta(void)
+{
+	wifi_config->sta.scan_method = wifi_config->sta.bssid_set ? WIFI_FAST_SCAN : WIFI_ALL_CHANNEL_SCAN;
+	wifi_config->sta.sort_method = WIFI_CONNECT_AP_BY_SIGNAL;
+
+	ESP_ERROR_CHECK(esp_wifi_set_config(ESP_IF_WIFI_STA, wifi_config));
+	esp_wifi_connect();
+}
+
+/**
+ * Handles a lost or failed station connection: retries with a doubling delay, reports
+ * the failure to the HTTP server after MAX_CONNECTION_RETRIES, then keeps retrying
+ * every WIFI_STA_RETRY_MAX_MS until it connects or the user disconnects.
+ */
+static void wifi_app_sta_disconnected(void)
+{
+	g_sta_connected = false;
+
+	if (g_reconnect_pending)
+	{
+		g_reconnect_pending = false;
+		wifi_app_connect_sta();
+		return;
+	}
+
+	if (g_user_disconnect)
+	{
+		return;
+	}
+
+	if (g_retry_number == MAX_CONNECTION_RETRIES)
+	{
+		// report once, then keep trying slowly: the access point may just be rebooting
+		ESP_LOGI(TAG, "wifi_app_sta_disconnected: no connection after %d retries", g_retry_number);
+		http_server_monitor_send_message(HTTP_MSG_WIFI_CONNECT_FAIL);
+	}
+
+	// the cached access point may have moved channel or gone: scan everything from now on
+	if (wifi_config->sta.bssid_set)
+	{
+		wifi_config->sta.bssid_set = false;
+		wifi_config->sta.channel = 0;
+		wifi_config->sta.scan_method = WIFI_ALL_CHANNEL_SCAN;
+		esp_wifi_set_config(ESP_IF_WIFI_STA, wifi_config);
+	}
+
+	uint32_t delay_ms = WIFI_STA_RETRY_MAX_MS;
+
+	if (g_retry_number < MAX_CONNECTION_RETRIES && (WIFI_STA_RETRY_BASE_MS << g_retry_number) < WIFI_STA_RETRY_MAX_MS)
+	{
+		delay_ms = WIFI_STA_RETRY_BASE_MS << g_retry_number;
+	}
+
+	g_retry_number++;
+	ESP_LOGI(TAG, "wifi_app_sta_disconnected: retry %d in %u ms", g_retry_number, delay_ms);
+	xTimerChangePeriod(wifi_app_retry_timer, pdMS_TO_TICKS(delay_ms), portMAX_DELAY);
+}
+
+/**
+ * Waits for the next message: queued commands first, in the order they were sent,
+ * then the latest station state.
+ * @return true, once msg is filled in.
+ */
+static bool wifi_app_receive_message(wifi_app_queue_message_t *msg)
+{
+	for (;;)
+	{
+		if (xQueueReceive(wifi_app_queue_handle, msg, 0) || wifi_app_take_sta_state(msg))
+		{
+			return true;
+		}
+
+		// producers notify after posting, so nothing posted since the checks is missed
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+	}
+}
+
 /**
  * Main task for the WiFi application
  * @param pvParameters parameter which can be passed to the task
@@ -177,9 +365,16 @@ static void wifi_app_task(void *pvParameters)
 	// Start WiFi
 	ESP_ERROR_CHECK(esp_wifi_start());
 
+	// Fast connect to the network saved by the last successful connection
+	if (app_nvs_load_sta_creds(&wifi_config->sta))
+	{
+		ESP_LOGI(TAG, "Connecting to saved network %s, channel %d", wifi_config->sta.ssid, wifi_config->sta.channel);
+		wifi_app_connect_sta();
+	}
+
 	for (;;)
 	{
-		if (xQueueReceive(wifi_app_queue_handle, &msg, portMAX_DELAY))
+		if (wifi_app_receive_message(&msg))
 		{
 			switch (msg.msgID)
 			{
@@ -194,10 +389,66 @@ static void wifi_app_task(void *pvParameters)
 				case WIFI_APP_MSG_CONNECTING_FROM_HTTP_SERVER:
 					ESP_LOGI(TAG, "WIFI_APP_MSG_CONNECTING_FROM_HTTP_SERVER");
 
+					// new credentials, scan all channels for them
+					xTimerStop(wifi_app_retry_timer, portMAX_DELAY);
+					memcpy(wifi_config->sta.ssid, msg.data.connect.ssid, sizeof(msg.data.connect.ssid));
+					memcpy(wifi_config->sta.password, msg.data.connect.password, sizeof(msg.data.connect.password));
+					g_retry_number = 0;
+					g_creds_from_http = true;
+					g_user_disconnect = false;
+					wifi_config->sta.bssid_set = false;
+					wifi_config->sta.channel = 0;
+
+					http_server_monitor_send_message(HTTP_MSG_WIFI_CONNECT_INIT);
+					if (g_sta_connected)
+					{
+						g_reconnect_pending = true;
+						esp_wifi_disconnect();
+					}
+					else
+					{
+						wifi_app_connect_sta();
+					}
+
 					break;
 
 				case WIFI_APP_MSG_STA_CONNECTED_GOT_IP:
-					ESP_LOGI(TAG, "WIFI_APP_MSG_STA_CONNECTED_GOT_IP");
+					ESP_LOGI(TAG, "WIFI_APP_MSG_STA_CONNECTED_GOT_IP: " IPSTR ", channel %d",
+							IP2STR(&msg.data.got_ip.ip_info.ip), msg.data.got_ip.channel);
+
+					g_retry_number = 0;
+					g_sta_connected = true;
+
+					if (g_creds_from_http)
+					{
+						app_nvs_save_sta_creds(&wifi_config->sta);
+						g_creds_from_http = false;
+					}
+
+					// next boot connects straight to this access point
+					app_nvs_save_sta_ap(msg.data.got_ip.bssid, msg.data.got_ip.channel);
+					http_server_monitor_send_message(HTTP_MSG_WIFI_CONNECT_SUCCESS);
+
+					break;
+
+				case WIFI_APP_MSG_STA_DISCONNECTED:
+					ESP_LOGI(TAG, "WIFI_APP_MSG_STA_DISCONNECTED, reason %d", msg.data.disconnected.reason);
+
+					wifi_app_sta_disconnected();
+
+					break;
+
+				case WIFI_APP_MSG_USER_REQUESTED_STA_DISCONNECT:
+					ESP_LOGI(TAG, "WIFI_APP_MSG_USER_REQUESTED_STA_DISCONNECT");
+
+					g_user_disconnect = true;
+					g_creds_from_http = false;
+					g_reconnect_pending = false;
+					xTimerStop(wifi_app_retry_timer, portMAX_DELAY);
+
+					app_nvs_clear_sta_creds();
+					esp_wifi_disconnect();
+					http_server_monitor_send_message(HTTP_MSG_WIFI_USER_DISCONNECT);
 
 					break;
 
@@ -209,12 +460,46 @@ static void wifi_app_task(void *pvParameters)
 }
 
 
+/**
+ * Queues a message for the wifi application task without blocking.
+ * @return pdTRUE if queued, pdFALSE if the queue was full and the message was dropped.
+ */
+static BaseType_t wifi_app_queue_message(const wifi_app_queue_message_t *msg)
+{
+	if (xQueueSend(wifi_app_queue_handle, msg, 0) != pdTRUE)
+	{
+		portENTER_CRITICAL(&wifi_app_state_lock);
+		g_events_dropped++;
+		portEXIT_CRITICAL(&wifi_app_state_lock);
+		return pdFALSE;
+	}
+
+	xTaskNotifyGive(wifi_app_task_handle);
+
+	return pdTRUE;
+}
+
 BaseType_t wifi_app_send_message(wifi_app_message_e msgID)
 {
-	wifi_app_queue_message_t msg;
-	msg.msgID = msgID;
+	wifi_app_queue_message_t msg = { .msgID = msgID };
+
+	return wifi_app_queue_message(&msg);
+}
+
+BaseType_t wifi_app_send_connect_message(const char *ssid, const char *password)
+{
+	wifi_app_queue_message_t msg = { .msgID = WIFI_APP_MSG_CONNECTING_FROM_HTTP_SERVER };
+
+	strncpy((char *)msg.data.connect.ssid, ssid, sizeof(msg.data.connect.ssid));
+	strncpy((char *)msg.data.connect.password, password, sizeof(msg.data.connect.password));
 
-	return xQueueSend(wifi_app_queue_handle, &msg, portMAX_DELAY);
+	return wifi_app_queue_message(&msg);
+}
+
+void wifi_app_get_event_counts(uint32_t *merged, uint32_t *dropped)
+{
+	*merged = g_events_merged;
+	*dropped = g_events_dropped;
 }
 
 void wifi_app_start(void)
@@ -224,11 +509,17 @@ void wifi_app_start(void)
 	// Disable default wifi loggin messages
 	esp_log_level_set("wifi",  ESP_LOG_NONE);
 
+	// Allocate memory for the wifi configuration
+	wifi_config = (wifi_config_t*)calloc(1, sizeof(wifi_config_t));
+
+	// One-shot timer for the reconnect backoff, started with the delay
+	wifi_app_retry_timer = xTimerCreate("wifi_retry", pdMS_TO_TICKS(WIFI_STA_RETRY_BASE_MS), pdFALSE, NULL, wifi_app_retry_timer_cb);
+
 	// Create message queue
-	wifi_app_queue_handle = xQueueCreate(3, sizeof(wifi_app_queue_message_t));
+	wifi_app_queue_handle = xQueueCreate(WIFI_APP_QUEUE_LEN, sizeof(wifi_app_queue_message_t));
 
 	// Start wifi app
-	xTaskCreatePinnedToCore(&wifi_app_task, "wifi_app_task", WIFI_APP_TASK_STACK_SIZE, NULL, WIFI_APP_TASK_PRIORITY, NULL, WIFI_APP_TASK_CORE_ID);
+	xTaskCreatePinnedToCore(&wifi_app_task, "wifi_app_task", WIFI_APP_TASK_STACK_SIZE, NULL, WIFI_APP_TASK_PRIORITY, &wifi_app_task_handle, WIFI_APP_TASK_CORE_ID);
 
 	// rgb indication
 	rgb_send_status_message(RGB_STATUS_MSG_START_WIFI_APP);
@@ -2,6 +2,7 @@
 #define MAIN_WIFI_APP_H_
 
 #include "esp_netif.h"
+#include "esp_wifi.h"
 
 #define WIFI_AP_SSID 				"ESP_32_AP"		// AP name
 #define WIFI_AP_PASSWORD 			"esp password"	// AP password
@@ -16,7 +17,10 @@
 #define WIFI_STA_POWER_SAVE			WIFI_PS_NONE	// no power save option
 #define MAX_SSID_LENGTH				32				// IEEE standard maximum
 #define MAX_PASSWORD_LENGTH			64				// IEEE standard maximum
-#define MAX_CONNECTION_RETRIES		5				// Retry number on disconnect
+#define MAX_CONNECTION_RETRIES		5				// fast retries before the failure is reported, slow ones follow
+#define WIFI_APP_QUEUE_LEN			8				// commands waiting for the task, more are dropped
+#define WIFI_STA_RETRY_BASE_MS		250				// delay before the first retry, doubled on every further one
+#define WIFI_STA_RETRY_MAX_MS		8000			// longest delay between retries
 
 // netif object for the Station and Access Point
 extern esp_netif_t* esp_netif_sta;
@@ -30,6 +34,8 @@ typedef enum wifi_app_message
 	WIFI_APP_MSG_START_HTTP_SERVER = 0,
 	WIFI_APP_MSG_CONNECTING_FROM_HTTP_SERVER,
 	WIFI_APP_MSG_STA_CONNECTED_GOT_IP,
+	WIFI_APP_MSG_STA_DISCONNECTED,
+	WIFI_APP_MSG_USER_REQUESTED_STA_DISCONNECT,
 } wifi_app_message_e;
 
 /**
@@ -38,16 +44,49 @@ typedef enum wifi_app_message
 typedef struct wifi_app_queue_message
 {
 	wifi_app_message_e msgID;
+	union
+	{
+		struct
+		{
+			esp_netif_ip_info_t ip_info;
+			uint8_t bssid[6];						// access point the station associated with
+			uint8_t channel;
+		} got_ip;									// WIFI_APP_MSG_STA_CONNECTED_GOT_IP
+		struct
+		{
+			uint8_t reason;							// wifi_err_reason_t
+		} disconnected;								// WIFI_APP_MSG_STA_DISCONNECTED
+		struct
+		{
+			uint8_t ssid[MAX_SSID_LENGTH];			// zero padded, not terminated at full length
+			uint8_t password[MAX_PASSWORD_LENGTH];
+		} connect;									// WIFI_APP_MSG_CONNECTING_FROM_HTTP_SERVER
+	} data;
 } wifi_app_queue_message_t;
 
 /**
- * Sends a message to the queue
+ * Sends a message to the queue. Never blocks: if the queue is full the message is dropped and counted.
  * @param msgID message ID from the wifi_app_message_e enum.
  * @return pdTRUE if an item was successfully sent to the queue, otherwise pdFALSE.
- * @note Expand the parameter list based on your requirements e.g. how you've expanded the wifi_app_queue_message_t.
  */
 BaseType_t wifi_app_send_message(wifi_app_message_e msgID);
 
+/**
+ * Gets the event counters of the wifi application task.
+ * @param merged receives the station state events replaced by a newer one before they were handled.
+ * @param dropped receives the messages lost to a full queue.
+ */
+void wifi_app_get_event_counts(uint32_t *merged, uint32_t *dropped);
+
+/**
+ * Asks the wifi application task to connect the station to another network. Only that
+ * task writes the wifi configuration, so the credentials travel in the message.
+ * @param ssid network name, up to MAX_SSID_LENGTH characters.
+ * @param password up to MAX_PASSWORD_LENGTH characters.
+ * @return pdTRUE if the message was queued, pdFALSE if the queue was full.
+ */
+BaseType_t wifi_app_send_connect_message(const char *ssid, const char *password);
+
 /**
  * Starts the WiFi RTOS task
  */
@@ -0,0 +1,390 @@
+/*------------------------------------------------------------------------------
+
+	DHT22 decoder replay benchmark
+
+	Host program that feeds DHT22_decode() recorded and synthesized pulse-width
+	traces and reports decode throughput, the checksum/timeout error split and
+	the timing margin left around DHT_BIT_THRESHOLD_US.
+
+	Build and run from the repository root:
+
+		gcc -O2 -Wall -Imain -o dht22_bench tools/dht22_bench/dht22_bench.c main/DHT22_decode.c
+		./dht22_bench [-n traces_per_case] [-s seed] [tools/dht22_bench/traces.txt]
+
+	Recorded traces are text, one trace per line: the expected result (ok,
+	checksum or timeout) followed by the pulse widths in microseconds, all
+	separated by whitespace or commas. Lines starting with # are ignored.
+
+	The exit code is non-zero when a trace with a deterministic expected
+	result decodes differently, so the tool doubles as a regression check.
+
+---------------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "DHT22_decode.h"
+
+#define MAX_TRACE_PULSES	(DHT_FRAME_PULSES + 8)
+#define MAX_LINE			2048
+#define EXPECT_ANY			1		// outcome depends on the random draw, only counted
+
+typedef struct
+{
+	uint16_t pulses[MAX_TRACE_PULSES];
+	size_t count;
+	int expected;					// DHT_OK, DHT_CHECKSUM_ERROR, DHT_TIMEOUT_ERROR or EXPECT_ANY
+	uint8_t data[DHT_FRAME_BYTES];	// expected frame when expected == DHT_OK
+	int has_data;
+} trace_t;
+
+typedef struct
+{
+	const char *name;
+	unsigned long total;
+	unsigned long ok;
+	unsigned long checksum;
+	unsigned long timeout;
+	unsigned long mismatches;		// deterministic traces that decoded differently
+	unsigned zero_bits;
+	unsigned one_bits;
+	int min_zero_margin_us;			// threshold - widest "0" high pulse
+	int min_one_margin_us;			// narrowest "1" high pulse - threshold
+	double sum_zero_margin_us;
+	double sum_one_margin_us;
+} case_stats_t;
+
+static uint32_t rng_state = 0x2545F491;
+
+static uint32_t rng_next(void)
+{
+	// xorshift32: deterministic for a given seed on every host
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}
+
+static int rng_range(int lo, int hi)
+{
+	return lo + (int)(rng_next() % (uint32_t)(hi - lo + 1));
+}
+
+static uint16_t clamp_width(int us)
+{
+	return (uint16_t)(us < 1 ? 1 : (us > 0xFFFF ? 0xFFFF : us));
+}
+
+/**
+ * Builds a random valid frame: plausible humidity/temperature and a correct checksum.
+ */
+static void random_frame(uint8_t data[DHT_FRAME_BYTES])
+{
+	int rh = rng_range(0, 1000);
+	int t = rng_range(-400, 800);
+	int t_abs = t < 0 ? -t : t;
+
+	data[0] = (uint8_t)(rh >> 8);
+	data[1] = (uint8_t)(rh & 0xFF);
+	data[2] = (uint8_t)((t_abs >> 8) | (t < 0 ? 0x80 : 0));
+	data[3] = (uint8_t)(t_abs & 0xFF);
+	data[4] = (uint8_t)((data[0] + data[1] + data[2] + data[3]) & 0xFF);
+}
+
+/**
+ * Synthesizes the pulse trace of a frame with nominal datasheet timings plus uniform jitter.
+ */
+static void synth_trace(trace_t *t, const uint8_t data[DHT_FRAME_BYTES], int jitter_us)
+{
+	size_t n = 0;
+
+	t->pulses[n++] = clamp_width(80 + rng_range(-jitter_us, jitter_us));
+	t->pulses[n++] = clamp_width(80 + rng_range(-jitter_us, jitter_us));
+
+	for (int k = 0; k < DHT_FRAME_BITS; k++)
+	{
+		int bit = (data[k / 8] >> (7 - (k % 8))) & 1;
+
+		t->pulses[n++] = clamp_width(50 + rng_range(-jitter_us, jitter_us));
+		t->pulses[n++] = clamp_width((bit ? 70 : 27) + rng_range(-jitter_us, jitter_us));
+	}
+
+	t->count = n;
+	memcpy(t->data, data, DHT_FRAME_BYTES);
+	t->has_data = 1;
+}
+
+static void make_clean(trace_t *t)
+{
+	uint8_t data[DHT_FRAME_BYTES];
+	random_frame(data);
+	synth_trace(t, data, 0);
+	t->expected = DHT_OK;
+}
+
+static void make_jitter_in_spec(trace_t *t)
+{
+	uint8_t data[DHT_FRAME_BYTES];
+	random_frame(data);
+	synth_trace(t, data, 8);
+	t->expected = DHT_OK;
+}
+
+static void make_jitter_heavy(trace_t *t)
+{
+	uint8_t data[DHT_FRAME_BYTES];
+	random_frame(data);
+	synth_trace(t, data, 20);
+	t->expected = EXPECT_ANY;
+}
+
+static void make_stretched(trace_t *t)
+{
+	uint8_t data[DHT_FRAME_BYTES];
+	random_frame(data);
+	synth_trace(t, data, 2);
+
+	// one pulse held well past its limit, e.g. by a slow pull-up on long wiring
+	size_t k = (size_t)rng_range(0, (int)t->count - 1);
+	t->pulses[k] = clamp_width(DHT_RESPONSE_TIMEOUT_US + rng_range(1, 200));
+	t->expected = DHT_TIMEOUT_ERROR;
+}
+
+static void make_missing_edges(trace_t *t)
+{
+	uint8_t data[DHT_FRAME_BYTES];
+	random_frame(data);
+	synth_trace(t, data, 2);
+
+	// the receiver merges the two levels around a lost edge into one pulse
+	int lost = rng_range(1, 3);
+	for (int i = 0; i < lost && t->count > 2; i++)
+	{
+		size_t k = (size_t)rng_range(0, (int)t->count - 2);
+		t->pulses[k] = clamp_width(t->pulses[k] + t->pulses[k + 1]);
+		memmove(&t->pulses[k + 1], &t->pulses[k + 2], (t->count - k - 2) * sizeof(t->pulses[0]));
+		t->count--;
+	}
+	t->expected = DHT_TIMEOUT_ERROR;
+}
+
+static void make_bad_checksum(trace_t *t)
+{
+	uint8_t data[DHT_FRAME_BYTES];
+	random_frame(data);
+	data[4] ^= (uint8_t)(1 << rng_range(0, 7));
+	synth_trace(t, data, 4);
+	t->expected = DHT_CHECKSUM_ERROR;
+}
+
+/**
+ * Adds one decode result to the per-case statistics.
+ */
+static void account(case_stats_t *s, const trace_t *t, int ret, const uint8_t data[DHT_FRAME_BYTES])
+{
+	s->total++;
+
+	if (ret == DHT_OK) s->ok++;
+	else if (ret == DHT_CHECKSUM_ERROR) s->checksum++;
+	else s->timeout++;
+
+	if (t->expected != EXPECT_ANY)
+	{
+		int wrong = ret != t->expected;
+		if (!wrong && ret == DHT_OK && t->has_data)
+			wrong = memcmp(data, t->data, DHT_FRAME_BYTES) != 0;
+		if (wrong)
+			s->mismatches++;
+	}
+
+	if (ret != DHT_OK || t->count < DHT_FRAME_PULSES)
+		return;
+
+	// timing margin around the decision threshold for every decoded bit
+	for (int k = 0; k < DHT_FRAME_BITS; k++)
+	{
+		int high = t->pulses[3 + 2 * k];
+
+		if (high > DHT_BIT_THRESHOLD_US)
+		{
+			int margin = high - DHT_BIT_THRESHOLD_US;
+			if (s->one_bits == 0 || margin < s->min_one_margin_us) s->min_one_margin_us = margin;
+			s->sum_one_margin_us += margin;
+			s->one_bits++;
+		}
+		else
+		{
+			int margin = DHT_BIT_THRESHOLD_US - high;
+			if (s->zero_bits == 0 || margin < s->min_zero_margin_us) s->min_zero_margin_us = margin;
+			s->sum_zero_margin_us += margin;
+			s->zero_bits++;
+		}
+	}
+}
+
+static void print_stats(const case_stats_t *s)
+{
+	printf("%-18s %7lu %7lu %9lu %8lu %10lu",
+			s->name, s->total, s->ok, s->checksum, s->timeout, s->mismatches);
+
+	if (s->zero_bits && s->one_bits)
+	{
+		printf("   0:%3d/%5.1f  1:%3d/%5.1f\n",
+				s->min_zero_margin_us, s->sum_zero_margin_us / s->zero_bits,
+				s->min_one_margin_us, s->sum_one_margin_us / s->one_bits);
+	}
+	else
+	{
+		printf("   -\n");
+	}
+}
+
+static int parse_expected(const char *word)
+{
+	if (strcmp(word, "ok") == 0) return DHT_OK;
+	if (strcmp(word, "checksum") == 0) return DHT_CHECKSUM_ERROR;
+	if (strcmp(word, "timeout") == 0) return DHT_TIMEOUT_ERROR;
+	return EXPECT_ANY;
+}
+
+/**
+ * Replays every trace in a recorded trace file.
+ * @return number of traces read, or -1 if the file cannot be opened.
+ */
+static long replay_file(const char *path, case_stats_t *s)
+{
+	FILE *f = fopen(path, "r");
+	char line[MAX_LINE];
+	long traces = 0;
+
+	if (f == NULL)
+		return -1;
+
+	while (fgets(line, sizeof(line), f))
+	{
+		trace_t t;
+		uint8_t data[DHT_FRAME_BYTES];
+		char *tok = strtok(line, " \t,\r\n");
+
+		if (tok == NULL || tok[0] == '#')
+			continue;
+
+		memset(&t, 0, sizeof(t));
+		t.expected = parse_expected(tok);
+
+		while ((tok = strtok(NULL, " \t,\r\n")) != NULL && t.count < MAX_TRACE_PULSES)
+			t.pulses[t.count++] = clamp_width(atoi(tok));
+
+		account(s, &t, DHT22_decode(t.pulses, t.count, data), data);
+		traces++;
+	}
+
+	fclose(f);
+	return traces;
+}
+
+static double now_seconds(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Measures raw decode cost over a pool of pre-generated in-spec traces.
+ */
+static void run_throughput(unsigned long iterations)
+{
+	enum { POOL = 256 };
+	static trace_t pool[POOL];
+	uint8_t data[DHT_FRAME_BYTES];
+	volatile int sink = 0;
+
+	for (int i = 0; i < POOL; i++)
+		make_jitter_in_spec(&pool[i]);
+
+	double start = now_seconds();
+	for (unsigned long i = 0; i < iterations; i++)
+	{
+		const trace_t *t = &pool[i % POOL];
+		sink += DHT22_decode(t->pulses, t->count, data) + data[0];
+	}
+	double elapsed = now_seconds() - start;
+
+	(void)sink;
+	printf("\nthroughput: %lu frames in %.3f s = %.0f frames/s, %.1f ns/frame\n",
+			iterations, elapsed, iterations / elapsed, elapsed * 1e9 / iterations);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long per_case = 10000;
+	const char *trace_file = NULL;
+	unsigned long mismatches = 0;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) per_case = strtoul(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) rng_state = (uint32_t)strtoul(argv[++i], NULL, 0) | 1;
+		else trace_file = argv[i];
+	}
+
+	struct
+	{
+		const char *name;
+		void (*make)(trace_t *t);
+	} cases[] = {
+		{ "clean",				make_clean },
+		{ "jitter +-8us",		make_jitter_in_spec },
+		{ "jitter +-20us",		make_jitter_heavy },
+		{ "stretched pulse",	make_stretched },
+		{ "missing edges",		make_missing_edges },
+		{ "bad checksum",		make_bad_checksum },
+	};
+
+	printf("%-18s %7s %7s %9s %8s %10s   %s\n",
+			"case", "traces", "ok", "checksum", "timeout", "mismatch", "margin us min/mean");
+
+	if (trace_file)
+	{
+		case_stats_t s = { .name = "recorded" };
+		if (replay_file(trace_file, &s) < 0)
+		{
+			fprintf(stderr, "cannot open %s\n", trace_file);
+			return 2;
+		}
+		print_stats(&s);
+		mismatches += s.mismatches;
+	}
+
+	for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++)
+	{
+		case_stats_t s = { .name = cases[c].name };
+
+		for (unsigned long i = 0; i < per_case; i++)
+		{
+			trace_t t;
+			uint8_t data[DHT_FRAME_BYTES];
+
+			memset(&t, 0, sizeof(t));
+			cases[c].make(&t);
+			account(&s, &t, DHT22_decode(t.pulses, t.count, data), data);
+		}
+
+		print_stats(&s);
+		mismatches += s.mismatches;
+	}
+
+	run_throughput(per_case * 100);
+
+	if (mismatches)
+	{
+		printf("\nFAIL: %lu traces decoded differently than expected\n", mismatches);
+		return 1;
+	}
+
+	printf("\nPASS\n");
+	return 0;
+}
@@ -0,0 +1,355 @@
+/*------------------------------------------------------------------------------
+
+	DHT22 sampling scheduler simulator
+
+	Host program that runs the scheduler in main/DHT22_sched.c through hours
+	of simulated time, with the same loop as the DHT22 task: pick the sensor
+	due first, sleep whole ticks until then, read it, plan the next read.
+	Readings alternate between fast changes and calm stretches, reads fail at
+	random and one sensor is unplugged for a while, and the period limits are
+	changed twice during the run, as DHT22_set_period_limits does. The device
+	clock starts an hour before it wraps.
+
+	Build and run from the repository root:
+
+		gcc -O2 -Wall -Imain -o dht22_sched_sim tools/dht22_sched_sim/dht22_sched_sim.c main/DHT22_sched.c
+		./dht22_sched_sim [-H hours] [-s sensors] [-f fail_pct] [-r read_ms] [-j jitter_ms]
+		                  [-l min_ms,max_ms] [-o unplug_start_h,unplug_h]
+
+	The run is split in three: default limits, the -l limits, then limits
+	below the sensor's minimum interval. The exit code is non-zero when a read
+	starts before it is due or later than the task's latency allows (the grid
+	drifted), when a sensor is read sooner than DHT_MIN_INTERVAL_MS after its
+	previous read, when a failed read is not retried early, or when the period
+	leaves the limits or, in a part of two hours or more, does not reach both.
+
+---------------------------------------------------------------------------------*/
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "DHT22.h"
+#include "DHT22_sched.h"
+
+#define TICK_MS				10			// CONFIG_FREERTOS_HZ=100
+#define CLOCK_START_MS		(0xFFFFFFFFu - 3600000u)	// device clock at the start, wraps after an hour
+
+#define FAST_MIN			10			// readings ramp this long...
+#define CALM_MIN			40			// ...then hold still this long
+#define RAMP_TENTHS_PER_S	2			// 0.2 C/s while ramping
+
+/**
+ * What the checks know about a sensor, kept apart from the scheduler state.
+ */
+typedef struct sim_sensor
+{
+	uint64_t anchor_ms;			// a grid slot: slots are anchor_ms + n * period_ms
+	uint32_t period_ms;
+	uint64_t prev_start_ms;
+	uint64_t prev_end_ms;
+	bool has_prev;
+	bool prev_ok;
+	int fails;					// consecutive failed reads
+	unsigned long reads, errors, retries;
+} sim_sensor_t;
+
+static dht22_sched_t scheds[DHT_MAX_SENSORS];
+static sim_sensor_t sims[DHT_MAX_SENSORS];
+static unsigned long failures;
+static uint32_t rng_state = 0x2545F491;
+
+static uint32_t rng(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}
+
+static void fail(const char *what, int sensor, uint64_t t_ms)
+{
+	if (failures++ < 10)
+	{
+		fprintf(stderr, "FAIL at %.3f s, sensor %d: %s\n", t_ms / 1e3, sensor, what);
+	}
+}
+
+/**
+ * @return the first grid slot of a sensor after t_ms.
+ */
+static uint64_t next_slot(const sim_sensor_t *sim, uint64_t t_ms)
+{
+	if (sim->anchor_ms > t_ms)
+	{
+		return sim->anchor_ms;
+	}
+
+	return sim->anchor_ms + ((t_ms - sim->anchor_ms) / sim->period_ms + 1) * sim->period_ms;
+}
+
+/**
+ * @return when the next read of a sensor is due, from the read before it.
+ */
+static uint64_t expected_start(const sim_sensor_t *sim)
+{
+	uint64_t slot = next_slot(sim, sim->prev_end_ms);
+	uint64_t earliest = sim->prev_start_ms + DHT_MIN_INTERVAL_MS;
+
+	if (!sim->prev_ok && sim->fails <= DHT_RETRY_MAX && earliest < slot)
+	{
+		return earliest;
+	}
+
+	return slot > earliest ? slot : earliest;
+}
+
+/**
+ * Readings of a sensor: a triangle ramp during the fast part of each cycle,
+ * steady with a rare one-tenth step during the calm part.
+ */
+static void reading(int sensor, uint64_t t_ms, int16_t *temp, uint16_t *hum)
+{
+	uint64_t cycle_ms = (uint64_t)(FAST_MIN + CALM_MIN) * 60000;
+	uint64_t in_cycle = (t_ms + (uint64_t)sensor * 7 * 60000) % cycle_ms;
+
+	*temp = 200 + sensor * 15;
+	*hum = 500;
+
+	if (in_cycle < (uint64_t)FAST_MIN * 60000)
+	{
+		int ramp = (int)(in_cycle * RAMP_TENTHS_PER_S / 1000 % 200);
+
+		*temp += ramp < 100 ? ramp : 200 - ramp;
+	}
+	else if (rng() % 20 == 0)
+	{
+		*temp += 1;
+	}
+}
+
+static void set_limits(int sensors, uint32_t min_ms, uint32_t max_ms)
+{
+	for (int k = 0; k < sensors; k++)
+	{
+		sim_sensor_t *sim = &sims[k];
+
+		// the pending slot keeps its place, the slots after it follow the new period
+		if (sim->has_prev)
+		{
+			sim->anchor_ms = next_slot(sim, sim->prev_end_ms);
+		}
+		DHT22_sched_set_limits(&scheds[k], min_ms, max_ms);
+		sim->period_ms = scheds[k].period_ms;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	int hours = 24;
+	int sensors = 3;
+	int fail_pct = 10;
+	int read_ms = 6;					// start signal and a 5 ms frame
+	int jitter_ms = 3;					// the task wakes this much late at most
+	uint32_t mid_min_ms = 5000, mid_max_ms = 20000;
+	double unplug_start_h = 2, unplug_h = 0.1;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (i + 1 < argc && strcmp(argv[i], "-H") == 0) hours = atoi(argv[++i]);
+		else if (i + 1 < argc && strcmp(argv[i], "-s") == 0) sensors = atoi(argv[++i]);
+		else if (i + 1 < argc && strcmp(argv[i], "-f") == 0) fail_pct = atoi(argv[++i]);
+		else if (i + 1 < argc && strcmp(argv[i], "-r") == 0) read_ms = atoi(argv[++i]);
+		else if (i + 1 < argc && strcmp(argv[i], "-j") == 0) jitter_ms = atoi(argv[++i]);
+		else if (i + 1 < argc && strcmp(argv[i], "-l") == 0) sscanf(argv[++i], "%u,%u", &mid_min_ms, &mid_max_ms);
+		else if (i + 1 < argc && strcmp(argv[i], "-o") == 0) sscanf(argv[++i], "%lf,%lf", &unplug_start_h, &unplug_h);
+		else
+		{
+			fprintf(stderr, "usage: %s [-H hours] [-s sensors] [-f fail_pct] [-r read_ms] [-j jitter_ms] "
+					"[-l min_ms,max_ms] [-o unplug_start_h,unplug_h]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	if (hours < 1 || sensors < 1 || sensors > DHT_MAX_SENSORS || read_ms < 1 || jitter_ms < 0)
+	{
+		fprintf(stderr, "hours must be >= 1, sensors within 1..%d, read_ms >= 1 and jitter_ms >= 0\n",
+				DHT_MAX_SENSORS);
+		return 2;
+	}
+
+	const uint32_t limits[3][2] = {
+		{ DHT_MIN_PERIOD_MS, DHT_MAX_PERIOD_MS },
+		{ mid_min_ms, mid_max_ms },
+		{ 0, 0 },						// raised to DHT_MIN_INTERVAL_MS: a fixed period
+	};
+	uint64_t end_ms = (uint64_t)hours * 3600000;
+	uint64_t part_ms = end_ms / 3;
+	uint64_t unplug_from_ms = (uint64_t)(unplug_start_h * 3600e3);
+	uint64_t unplug_to_ms = unplug_from_ms + (uint64_t)(unplug_h * 3600e3);
+	int max_read_ms = read_ms + 2 + DHT_RMT_RX_TIMEOUT_MS;
+	// late wake, one extra tick after waking a tick early, every other sensor read first
+	uint64_t slack_ms = 2 * TICK_MS + jitter_ms + (uint64_t)sensors * max_read_ms;
+	uint64_t worst_late_ms = 0;
+	uint32_t part_min[3], part_max[3];
+	int part = 0;
+	uint64_t now_ms = 0;
+
+	for (int k = 0; k < sensors; k++)
+	{
+		uint32_t offset_ms = k * DHT_SAMPLE_PERIOD_MS / sensors;
+
+		DHT22_sched_init(&scheds[k], CLOCK_START_MS, offset_ms, DHT_SAMPLE_PERIOD_MS,
+				limits[0][0], limits[0][1], DHT_MIN_INTERVAL_MS);
+		sims[k] = (sim_sensor_t) { .anchor_ms = offset_ms, .period_ms = scheds[k].period_ms };
+	}
+	part_min[0] = part_max[0] = scheds[0].period_ms;
+
+	while (now_ms < end_ms)
+	{
+		// == applyPendingSettings =================================
+		if (part < 2 && now_ms >= (part + 1) * part_ms)
+		{
+			part++;
+			set_limits(sensors, limits[part][0], limits[part][1]);
+			part_min[part] = part_max[part] = scheds[0].period_ms;
+		}
+
+		uint32_t clock_ms = (uint32_t)(CLOCK_START_MS + now_ms);
+		int32_t due_ms = DHT_SAMPLE_PERIOD_MS;
+		int next = -1;
+
+		for (int k = 0; k < sensors; k++)
+		{
+			int32_t due = DHT22_sched_due_in(&scheds[k], clock_ms);
+
+			if (next < 0 || due < due_ms)
+			{
+				next = k;
+				due_ms = due;
+			}
+		}
+
+		if (due_ms > 0)
+		{
+			// ulTaskNotifyTake: whole ticks counted from a tick boundary, then scheduling latency
+			uint64_t ticks = (due_ms + TICK_MS - 1) / TICK_MS;
+			uint64_t wake_ms = now_ms + ticks * TICK_MS - rng() % TICK_MS + rng() % (jitter_ms + 1);
+			uint64_t change_ms = (part + 1) * part_ms;
+
+			// a limits change notifies the task
+			if (part < 2 && wake_ms > change_ms)
+			{
+				wake_ms = change_ms;
+			}
+			now_ms = wake_ms > now_ms ? wake_ms : now_ms + 1;
+			continue;
+		}
+
+		// == read ====================================================
+		dht22_sched_t *s = &scheds[next];
+		sim_sensor_t *sim = &sims[next];
+		bool unplugged = next == 0 && now_ms >= unplug_from_ms && now_ms < unplug_to_ms;
+		int status = DHT_OK;
+		int16_t temp = 0;
+		uint16_t hum = 0;
+		uint64_t start_ms = now_ms;
+		uint64_t expected_ms = sim->has_prev ? expected_start(sim) : sim->anchor_ms;
+
+		if (unplugged || (int)(rng() % 100) < fail_pct)
+		{
+			status = unplugged || rng() % 2 ? DHT_TIMEOUT_ERROR : DHT_CHECKSUM_ERROR;
+		}
+		else
+		{
+			reading(next, start_ms, &temp, &hum);
+		}
+		now_ms += read_ms + rng() % 3 + (status == DHT_TIMEOUT_ERROR ? DHT_RMT_RX_TIMEOUT_MS : 0);
+
+		if (start_ms < expected_ms)
+		{
+			fail("read started before it was due", next, start_ms);
+		}
+		else if (start_ms - expected_ms > slack_ms)
+		{
+			fail("read started late: the grid drifted or a retry was missed", next, start_ms);
+		}
+		if (start_ms - expected_ms > worst_late_ms)
+		{
+			worst_late_ms = start_ms - expected_ms;
+		}
+		if (sim->has_prev && start_ms - sim->prev_start_ms < DHT_MIN_INTERVAL_MS)
+		{
+			fail("read sooner than the minimum interval", next, start_ms);
+		}
+		if (sim->has_prev && !sim->prev_ok && sim->fails <= DHT_RETRY_MAX)
+		{
+			sim->retries++;
+		}
+
+		uint32_t old_period = s->period_ms;
+
+		DHT22_sched_done(s, (uint32_t)(CLOCK_START_MS + start_ms), (uint32_t)(CLOCK_START_MS + now_ms),
+				status, temp, hum);
+
+		// a new period starts a new grid at this read
+		if (s->period_ms != old_period)
+		{
+			if (status != DHT_OK)
+			{
+				fail("period changed on a failed read", next, start_ms);
+			}
+			sim->anchor_ms = start_ms;
+			sim->period_ms = s->period_ms;
+		}
+		if (s->period_ms < s->min_period_ms || s->period_ms > s->max_period_ms
+				|| s->min_period_ms < DHT_MIN_INTERVAL_MS)
+		{
+			fail("period outside the limits", next, start_ms);
+		}
+		if (s->period_ms < part_min[part]) part_min[part] = s->period_ms;
+		if (s->period_ms > part_max[part]) part_max[part] = s->period_ms;
+
+		sim->prev_start_ms = start_ms;
+		sim->prev_end_ms = now_ms;
+		sim->has_prev = true;
+		sim->prev_ok = status == DHT_OK;
+		sim->fails = sim->prev_ok ? 0 : sim->fails + 1;
+		sim->reads++;
+		sim->errors += !sim->prev_ok;
+	}
+
+	printf("simulated %d h: %d sensor(s), %d%% failed reads, sensor 0 unplugged %.1f h from %.1f h\n",
+			hours, sensors, fail_pct, unplug_h, unplug_start_h);
+	for (int k = 0; k < sensors; k++)
+	{
+		printf("sensor %d: reads %lu, failed %lu, early retries %lu\n",
+				k, sims[k].reads, sims[k].errors, sims[k].retries);
+	}
+	for (int p = 0; p < 3; p++)
+	{
+		dht22_sched_t limited = { .min_interval_ms = DHT_MIN_INTERVAL_MS };
+
+		DHT22_sched_set_limits(&limited, limits[p][0], limits[p][1]);
+		printf("limits %u..%u ms: period seen %u..%u ms\n",
+				limited.min_period_ms, limited.max_period_ms, part_min[p], part_max[p]);
+
+		// long enough to ramp down from the maximum and climb back in a calm stretch
+		if (part_ms >= 2 * 3600000ull
+				&& (part_min[p] != limited.min_period_ms || part_max[p] != limited.max_period_ms))
+		{
+			fail("period did not adapt across the whole range", -1, (p + 1) * part_ms);
+		}
+	}
+	printf("latest read %llu ms after its deadline (allowed %llu ms)\n",
+			(unsigned long long)worst_late_ms, (unsigned long long)slack_ms);
+
+	if (failures)
+	{
+		printf("%lu check(s) failed\n", failures);
+		return 1;
+	}
+
+	return 0;
+}
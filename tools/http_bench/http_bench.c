@@ -0,0 +1,658 @@
+/*------------------------------------------------------------------------------
+
+	HTTP endpoint load test
+
+	Host program that drives the device's HTTP routes one endpoint at a time,
+	each at a fixed concurrency over keep-alive connections, and reports
+	throughput, p50/p99/max latency and the body bytes the server sent.
+
+	Build and run from the repository root (POSIX, no other dependencies):
+
+		gcc -O2 -Wall -pthread -o http_bench tools/http_bench/http_bench.c -lm
+		./http_bench [-c connections] [-n requests] [-w warmup] [-r repeats]
+				[-o results.txt] [-b baseline.txt] [-t tolerance_pct]
+				192.168.0.1[:80] [tools/http_bench/endpoints.txt]
+
+	Every endpoint gets warmup requests that are not measured, then is run
+	repeats times with n requests each; the reported figures are the medians
+	of the runs, which keeps them steady enough to compare between releases.
+	-o saves the results, -b compares against saved results and the exit code
+	is non-zero when an endpoint lost more than tolerance_pct (default 20) of
+	its throughput or its p50 latency grew by more than that.
+
+	Without a device, run the handlers on the host with http_host.c next to
+	this file and benchmark 127.0.0.1:8080; its header has the build command.
+
+	The device sheds requests over its per client rate (HTTP_RATE_*_PER_S in
+	http_server.h) with 429; they are counted apart from errors. To measure
+	the handlers rather than the shedding, benchmark a build with higher rates.
+	The default httpd configuration has 7 sockets; keep -c below that.
+	Uploads and exports run on the bulk server, on the port after the main
+	one, which keeps HTTP_BULK_MAX_SESSIONS (3) sockets; benchmark it with
+	bulk_endpoints.txt and -c 2.
+
+	Endpoint lists are text, one endpoint per line: method, path, then
+	optional request headers, separated by tabs. Lines starting with # are
+	ignored.
+
+---------------------------------------------------------------------------------*/
+
+#include <errno.h>
+#include <math.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#define MAX_ENDPOINTS		64
+#define MAX_LINE			1024
+#define MAX_CONNECTIONS		64
+#define MAX_REPEATS			15
+#define RECV_TIMEOUT_S		10
+#define POST_BODY			"ota_update_status"
+
+typedef struct
+{
+	char method[8];
+	char path[256];
+	char headers[512];				// extra request header lines, each ending in \r\n
+} endpoint_t;
+
+typedef struct
+{
+	double rps;
+	double p50_ms;
+	double p99_ms;
+	double max_ms;
+	unsigned long ok;
+	unsigned long shed;				// 429 and 503 answers
+	unsigned long errors;			// connection failures and other statuses
+	unsigned long long bytes;		// response body bytes
+} result_t;
+
+/**
+ * One measured run of an endpoint, shared by its connection threads
+ */
+typedef struct
+{
+	const endpoint_t *ep;
+	unsigned long warmup;
+	unsigned long requests;
+	atomic_ulong next;				// next request number, warmup ones first
+	atomic_ulong ok;
+	atomic_ulong shed;
+	atomic_ulong errors;
+	atomic_ullong bytes;
+	double *latency_ms;				// per measured request, negative when it failed
+} run_t;
+
+/**
+ * Keep-alive connection with a receive buffer
+ */
+typedef struct
+{
+	int fd;
+	char buf[16384];
+	size_t pos;
+	size_t len;
+} conn_t;
+
+static struct addrinfo *server_addr;
+static char host_header[128];
+
+static double now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static int conn_open(conn_t *c)
+{
+	int one = 1;
+	struct timeval tv = { .tv_sec = RECV_TIMEOUT_S };
+
+	c->fd = socket(server_addr->ai_family, SOCK_STREAM, 0);
+	c->pos = c->len = 0;
+	if (c->fd < 0)
+		return -1;
+
+	setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	setsockopt(c->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(c->fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	if (connect(c->fd, server_addr->ai_addr, server_addr->ai_addrlen) < 0)
+	{
+		close(c->fd);
+		c->fd = -1;
+		return -1;
+	}
+
+	return 0;
+}
+
+static void conn_close(conn_t *c)
+{
+	if (c->fd >= 0)
+		close(c->fd);
+	c->fd = -1;
+}
+
+/**
+ * Makes sure at least one unread byte is buffered.
+ * @return 0, or -1 on EOF or error.
+ */
+static int conn_fill(conn_t *c)
+{
+	if (c->pos < c->len)
+		return 0;
+
+	ssize_t n = recv(c->fd, c->buf, sizeof(c->buf), 0);
+	if (n <= 0)
+		return -1;
+
+	c->pos = 0;
+	c->len = n;
+	return 0;
+}
+
+/**
+ * Reads one line without its CRLF.
+ * @return length, or -1 on EOF, error or a line longer than size.
+ */
+static int conn_read_line(conn_t *c, char *line, size_t size)
+{
+	size_t n = 0;
+
+	for (;;)
+	{
+		if (conn_fill(c) < 0)
+			return -1;
+
+		char ch = c->buf[c->pos++];
+		if (ch == '\n')
+			break;
+		if (n + 1 >= size)
+			return -1;
+		line[n++] = ch;
+	}
+
+	if (n > 0 && line[n - 1] == '\r')
+		n--;
+	line[n] = '\0';
+	return n;
+}
+
+/**
+ * Reads and discards len body bytes.
+ */
+static int conn_skip(conn_t *c, unsigned long long len)
+{
+	while (len > 0)
+	{
+		if (conn_fill(c) < 0)
+			return -1;
+
+		size_t n = c->len - c->pos;
+		if (n > len)
+			n = len;
+		c->pos += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/**
+ * Sends one request and reads the whole response.
+ * @param status receives the HTTP status.
+ * @param body receives the number of body bytes.
+ * @return 0, or -1 if the connection failed; the connection is then closed.
+ */
+static int http_request(conn_t *c, const endpoint_t *ep, int *status, unsigned long long *body)
+{
+	char request[2048];
+	char line[MAX_LINE];
+	int post = strcmp(ep->method, "POST") == 0;
+	long long content_length = -1;
+	int chunked = 0;
+	int keep_alive = 1;
+
+	int len = snprintf(request, sizeof(request), "%s %s HTTP/1.1\r\nHost: %s\r\n%sContent-Length: %zu\r\n\r\n%s",
+			ep->method, ep->path, host_header, ep->headers, post ? strlen(POST_BODY) : 0, post ? POST_BODY : "");
+
+	if (c->fd < 0 && conn_open(c) < 0)
+		return -1;
+
+	if (send(c->fd, request, len, MSG_NOSIGNAL) != len || conn_read_line(c, line, sizeof(line)) < 0)
+	{
+		conn_close(c);
+		return -1;
+	}
+
+	if (sscanf(line, "HTTP/%*d.%*d %d", status) != 1)
+	{
+		conn_close(c);
+		return -1;
+	}
+
+	// == headers
+	for (;;)
+	{
+		int n = conn_read_line(c, line, sizeof(line));
+
+		if (n < 0)
+		{
+			conn_close(c);
+			return -1;
+		}
+		if (n == 0)
+			break;
+
+		if (strncasecmp(line, "Content-Length:", 15) == 0)
+			content_length = strtoll(line + 15, NULL, 10);
+		else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0 && strstr(line, "chunked"))
+			chunked = 1;
+		else if (strncasecmp(line, "Connection:", 11) == 0 && strstr(line, "close"))
+			keep_alive = 0;
+	}
+
+	// == body
+	*body = 0;
+
+	if (*status == 204 || *status == 304)
+	{
+		// no body
+	}
+	else if (chunked)
+	{
+		for (;;)
+		{
+			if (conn_read_line(c, line, sizeof(line)) < 0)
+			{
+				conn_close(c);
+				return -1;
+			}
+
+			unsigned long long size = strtoull(line, NULL, 16);
+			if (size == 0)
+				break;
+
+			if (conn_skip(c, size) < 0 || conn_read_line(c, line, sizeof(line)) != 0)
+			{
+				conn_close(c);
+				return -1;
+			}
+			*body += size;
+		}
+
+		// trailers end with an empty line
+		int n;
+		while ((n = conn_read_line(c, line, sizeof(line))) > 0)
+			;
+		if (n < 0)
+		{
+			conn_close(c);
+			return -1;
+		}
+	}
+	else if (content_length >= 0)
+	{
+		if (conn_skip(c, content_length) < 0)
+		{
+			conn_close(c);
+			return -1;
+		}
+		*body = content_length;
+	}
+	else
+	{
+		// delimited by the end of the connection
+		while (conn_fill(c) == 0)
+		{
+			*body += c->len - c->pos;
+			c->pos = c->len;
+		}
+		keep_alive = 0;
+	}
+
+	if (!keep_alive)
+		conn_close(c);
+
+	return 0;
+}
+
+static void *connection_thread(void *arg)
+{
+	run_t *run = arg;
+	conn_t *c = malloc(sizeof(conn_t));
+
+	c->fd = -1;
+
+	for (;;)
+	{
+		unsigned long i = atomic_fetch_add(&run->next, 1);
+		if (i >= run->warmup + run->requests)
+			break;
+
+		int status = 0;
+		unsigned long long body = 0;
+		int reused = c->fd >= 0;
+		double start = now_ms();
+		int rc = http_request(c, run->ep, &status, &body);
+
+		// the server may have closed an idle keep-alive connection: one fresh try
+		if (rc < 0 && reused)
+		{
+			start = now_ms();
+			rc = http_request(c, run->ep, &status, &body);
+		}
+
+		double elapsed = now_ms() - start;
+
+		if (i < run->warmup)
+			continue;
+
+		i -= run->warmup;
+		run->latency_ms[i] = rc < 0 ? -1 : elapsed;
+
+		if (rc < 0)
+			atomic_fetch_add(&run->errors, 1);
+		else if (status == 429 || status == 503)
+			atomic_fetch_add(&run->shed, 1);
+		else if (status >= 200 && status < 400)
+			atomic_fetch_add(&run->ok, 1);
+		else
+			atomic_fetch_add(&run->errors, 1);
+
+		if (rc == 0)
+			atomic_fetch_add(&run->bytes, body);
+	}
+
+	conn_close(c);
+	free(c);
+	return NULL;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+/**
+ * Nearest-rank percentile of sorted values.
+ */
+static double percentile(const double *sorted, size_t n, double p)
+{
+	if (n == 0)
+		return NAN;
+
+	size_t rank = (size_t)ceil(p * n);
+	return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+static double median(double *values, int n)
+{
+	qsort(values, n, sizeof(double), compare_double);
+	return values[n / 2];
+}
+
+/**
+ * Runs one endpoint once: warmup requests, then n measured ones over the connections.
+ */
+static void run_endpoint(const endpoint_t *ep, int connections, unsigned long warmup, unsigned long requests, result_t *r)
+{
+	pthread_t threads[MAX_CONNECTIONS];
+	run_t run = { .ep = ep, .warmup = warmup, .requests = requests };
+
+	run.latency_ms = calloc(requests, sizeof(double));
+
+	double start = now_ms();
+	for (int i = 0; i < connections; i++)
+		pthread_create(&threads[i], NULL, connection_thread, &run);
+	for (int i = 0; i < connections; i++)
+		pthread_join(threads[i], NULL);
+	double elapsed = now_ms() - start;
+
+	// warmup is part of the wall time, scale it out
+	elapsed *= (double)requests / (requests + warmup);
+
+	size_t valid = 0;
+	for (size_t i = 0; i < requests; i++)
+		if (run.latency_ms[i] >= 0)
+			run.latency_ms[valid++] = run.latency_ms[i];
+	qsort(run.latency_ms, valid, sizeof(double), compare_double);
+
+	r->ok = run.ok;
+	r->shed = run.shed;
+	r->errors = run.errors;
+	r->bytes = run.bytes;
+	r->rps = (run.ok + run.shed) / (elapsed / 1e3);
+	r->p50_ms = percentile(run.latency_ms, valid, 0.50);
+	r->p99_ms = percentile(run.latency_ms, valid, 0.99);
+	r->max_ms = valid ? run.latency_ms[valid - 1] : NAN;
+
+	free(run.latency_ms);
+}
+
+static int parse_endpoint(char *line, endpoint_t *ep)
+{
+	char *save;
+	char *tok;
+
+	line[strcspn(line, "\r\n")] = '\0';
+	if (line[0] == '#' || line[strspn(line, " \t")] == '\0')
+		return 0;
+
+	memset(ep, 0, sizeof(*ep));
+
+	if ((tok = strtok_r(line, " \t", &save)) == NULL)
+		return 0;
+	snprintf(ep->method, sizeof(ep->method), "%s", tok);
+
+	if ((tok = strtok_r(NULL, " \t", &save)) == NULL)
+		return 0;
+	snprintf(ep->path, sizeof(ep->path), "%s", tok);
+
+	// headers are separated by tabs, they contain spaces themselves
+	while ((tok = strtok_r(NULL, "\t", &save)) != NULL)
+	{
+		tok += strspn(tok, " ");
+		if (*tok == '\0')
+			continue;
+		size_t used = strlen(ep->headers);
+		snprintf(ep->headers + used, sizeof(ep->headers) - used, "%s\r\n", tok);
+	}
+
+	return 1;
+}
+
+static int load_endpoints(const char *file, endpoint_t *eps)
+{
+	FILE *f = fopen(file, "r");
+	char line[MAX_LINE];
+	int n = 0;
+
+	if (f == NULL)
+		return -1;
+
+	while (n < MAX_ENDPOINTS && fgets(line, sizeof(line), f))
+		n += parse_endpoint(line, &eps[n]);
+
+	fclose(f);
+	return n;
+}
+
+/**
+ * Looks an endpoint up in a results file written with -o.
+ * @return 1 if found.
+ */
+static int find_baseline(const char *file, const endpoint_t *ep, result_t *base)
+{
+	FILE *f = fopen(file, "r");
+	char line[MAX_LINE];
+	char method[8];
+	char path[256];
+	int found = 0;
+
+	if (f == NULL)
+		return 0;
+
+	while (!found && fgets(line, sizeof(line), f))
+	{
+		if (line[0] == '#')
+			continue;
+		if (sscanf(line, "%7s %255s %lf %lf %lf", method, path, &base->rps, &base->p50_ms, &base->p99_ms) == 5
+				&& strcmp(method, ep->method) == 0 && strcmp(path, ep->path) == 0)
+			found = 1;
+	}
+
+	fclose(f);
+	return found;
+}
+
+int main(int argc, char **argv)
+{
+	int connections = 4;
+	unsigned long requests = 200;
+	unsigned long warmup = 20;
+	int repeats = 3;
+	double tolerance = 20;
+	const char *target = NULL;
+	const char *endpoint_file = "tools/http_bench/endpoints.txt";
+	const char *results_file = NULL;
+	const char *baseline_file = NULL;
+	static endpoint_t eps[MAX_ENDPOINTS];
+	int regressions = 0;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) connections = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) requests = strtoul(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) warmup = strtoul(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) repeats = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) results_file = argv[++i];
+		else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) baseline_file = argv[++i];
+		else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) tolerance = atof(argv[++i]);
+		else if (target == NULL) target = argv[i];
+		else endpoint_file = argv[i];
+	}
+
+	if (target == NULL || connections < 1 || connections > MAX_CONNECTIONS || requests == 0
+			|| repeats < 1 || repeats > MAX_REPEATS)
+	{
+		fprintf(stderr, "usage: %s [-c connections] [-n requests] [-w warmup] [-r repeats] "
+				"[-o results] [-b baseline] [-t tolerance_pct] host[:port] [endpoints]\n", argv[0]);
+		return 2;
+	}
+
+	// == resolve the device
+	char host[128];
+	const char *port = "80";
+	struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+
+	snprintf(host, sizeof(host), "%s", target);
+	snprintf(host_header, sizeof(host_header), "%s", target);
+	char *colon = strrchr(host, ':');
+	if (colon)
+	{
+		*colon = '\0';
+		port = colon + 1;
+	}
+
+	int err = getaddrinfo(host, port, &hints, &server_addr);
+	if (err)
+	{
+		fprintf(stderr, "%s: %s\n", target, gai_strerror(err));
+		return 2;
+	}
+
+	int count = load_endpoints(endpoint_file, eps);
+	if (count <= 0)
+	{
+		fprintf(stderr, "no endpoints in %s\n", endpoint_file);
+		return 2;
+	}
+
+	FILE *out = results_file ? fopen(results_file, "w") : NULL;
+	if (out)
+		fprintf(out, "# method path req/s p50_ms p99_ms, %d connections, %lu requests, median of %d runs\n",
+				connections, requests, repeats);
+
+	printf("%d connections, %lu requests per run, %lu warmup, median of %d runs\n\n",
+			connections, requests, warmup, repeats);
+	printf("%-5s %-36s %6s %6s %6s %9s %8s %8s %8s %10s\n",
+			"", "endpoint", "ok", "shed", "errors", "req/s", "p50 ms", "p99 ms", "max ms", "bytes/req");
+
+	for (int e = 0; e < count; e++)
+	{
+		result_t runs[MAX_REPEATS];
+		double rps[MAX_REPEATS], p50[MAX_REPEATS], p99[MAX_REPEATS], max[MAX_REPEATS];
+		result_t r = { 0 };
+
+		for (int k = 0; k < repeats; k++)
+		{
+			run_endpoint(&eps[e], connections, warmup, requests, &runs[k]);
+			rps[k] = runs[k].rps;
+			p50[k] = runs[k].p50_ms;
+			p99[k] = runs[k].p99_ms;
+			max[k] = runs[k].max_ms;
+			r.ok += runs[k].ok;
+			r.shed += runs[k].shed;
+			r.errors += runs[k].errors;
+			r.bytes += runs[k].bytes;
+		}
+
+		r.rps = median(rps, repeats);
+		r.p50_ms = median(p50, repeats);
+		r.p99_ms = median(p99, repeats);
+		r.max_ms = median(max, repeats);
+
+		printf("%-5s %-36.36s %6lu %6lu %6lu %9.1f %8.2f %8.2f %8.2f %10.0f\n",
+				eps[e].method, eps[e].path, r.ok, r.shed, r.errors, r.rps, r.p50_ms, r.p99_ms, r.max_ms,
+				r.ok + r.shed ? (double)r.bytes / (r.ok + r.shed) : 0.0);
+
+		if (out)
+			fprintf(out, "%s %s %.1f %.2f %.2f\n", eps[e].method, eps[e].path, r.rps, r.p50_ms, r.p99_ms);
+
+		result_t base;
+		if (baseline_file && find_baseline(baseline_file, &eps[e], &base))
+		{
+			double rps_change = (r.rps / base.rps - 1) * 100;
+			double p50_change = (r.p50_ms / base.p50_ms - 1) * 100;
+
+			if (-rps_change > tolerance || p50_change > tolerance)
+			{
+				printf("      REGRESSION: req/s %+.0f%%, p50 %+.0f%%, p99 %+.0f%%\n",
+						rps_change, p50_change, (r.p99_ms / base.p99_ms - 1) * 100);
+				regressions++;
+			}
+		}
+	}
+
+	if (out)
+		fclose(out);
+	freeaddrinfo(server_addr);
+
+	if (regressions)
+	{
+		printf("\nFAIL: %d endpoints regressed by more than %.0f%%\n", regressions, tolerance);
+		return 1;
+	}
+
+	if (baseline_file)
+		printf("\nPASS\n");
+	return 0;
+}
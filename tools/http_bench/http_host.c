@@ -0,0 +1,308 @@
+/*------------------------------------------------------------------------------
+
+	HTTP server on the host
+
+	Host program that runs main/http_server.c and the modules its handlers
+	read from (sensor history, sample log, trace, web assets, OTA writer) on
+	the POSIX stand-ins in tools/idf_shim, so http_bench can measure the
+	endpoints without flashing a device. Simulated sensors feed a new sample
+	every DHT_SAMPLE_PERIOD_MS, and the history and flash log start with
+	hours of samples, so /history and /export return full answers.
+
+	The Wi-Fi, DHT22 and gzip OTA modules talk to hardware and are replaced
+	below: connecting to a network always succeeds, a firmware upload has to
+	be an uncompressed image, and a restart is only logged. The figures are
+	those of the host CPU; compare them between builds, not with the device.
+
+	Build and run from the repository root, with rates high enough that the
+	benchmark does not measure the 429 shedding:
+
+		python3 tools/web_assets.py build/host_www $(find main/webpage -type f)
+		(cd build/host_www && ld -r -b binary -o ../web_assets_bin.o $(ls | grep -v '\.c$'))
+		gcc -O2 -Wall -Wextra -Wl,-z,noexecstack -Itools/idf_shim -Imain \
+			-DHTTP_RATE_API_PER_S=60000 -DHTTP_RATE_API_BURST=60000 \
+			-DHTTP_RATE_BULK_PER_S=60000 -DHTTP_RATE_BULK_BURST=60000 \
+			-o http_host tools/http_bench/http_host.c main/http_server.c main/DHT22_decode.c main/multipart.c \
+			main/ota_writer.c main/sample_log.c main/sensor_history.c main/trace.c main/web_assets.c \
+			build/host_www/web_assets_table.c build/web_assets_bin.o tools/idf_shim/esp_http_server.c \
+			tools/idf_shim/esp_ota_ops.c tools/idf_shim/esp_partition.c tools/idf_shim/esp_timer.c \
+			tools/idf_shim/freertos.c tools/idf_shim/mbedtls/sha256.c -pthread
+		./http_host [-p port] [-s sensors] [-H history_hours] &
+		./http_bench 127.0.0.1:8080
+		./http_bench -c 2 127.0.0.1:8081 tools/http_bench/bulk_endpoints.txt
+
+	The main server listens on -p (default 8080) and the bulk server, which
+	runs uploads and exports, on the port after it.
+
+	Set IDF_SHIM_LOG=1 to see the firmware's log lines.
+
+---------------------------------------------------------------------------------*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "esp_log.h"
+#include "esp_netif.h"
+#include "esp_partition.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "freertos/FreeRTOS.h"
+#include "lwip/sockets.h"
+
+#include "http_server.h"
+#include "ota_inflate.h"
+#include "wifi_app.h"
+#include "DHT22.h"
+#include "sample_log.h"
+#include "sensor_history.h"
+
+#define SAMPLES_PARTITION_SIZE		0xF0000		// "samples" in partitions.csv
+
+static const char TAG[] = "http_host";
+
+esp_netif_t *esp_netif_sta;
+esp_netif_t *esp_netif_ap;
+
+static pthread_mutex_t sensor_lock = PTHREAD_MUTEX_INITIALIZER;
+static dht22_sensor_t sensors[DHT_MAX_SENSORS];
+static dht22_sample_t samples[DHT_MAX_SENSORS];
+static int sensor_count = 1;
+static unsigned sensor_version;
+
+// == DHT22 =====================================================
+
+int DHT22_sensor_count(void)
+{
+	return sensor_count;
+}
+
+uint32_t DHT22_get_period(int index)
+{
+	return index >= 0 && index < sensor_count ? DHT_SAMPLE_PERIOD_MS : 0;
+}
+
+unsigned DHT22_get_version(void)
+{
+	return __atomic_load_n(&sensor_version, __ATOMIC_ACQUIRE);
+}
+
+const dht22_sensor_t *DHT22_get_sensor(int index)
+{
+	return index >= 0 && index < sensor_count ? &sensors[index] : NULL;
+}
+
+bool DHT22_get_sample(int index, dht22_sample_t *sample)
+{
+	if (index < 0 || index >= sensor_count)
+	{
+		return false;
+	}
+
+	pthread_mutex_lock(&sensor_lock);
+	*sample = samples[index];
+	pthread_mutex_unlock(&sensor_lock);
+
+	return true;
+}
+
+/**
+ * Reading of a simulated sensor: slow drifts, different for every sensor.
+ */
+static void simulated_reading(int sensor, uint32_t time_s, int16_t *temp_tenths, uint16_t *hum_tenths)
+{
+	*temp_tenths = 200 + sensor * 15 + (time_s / 60 + sensor * 7) % 40;
+	*hum_tenths = 450 + (time_s / 45 + sensor * 11) % 80;
+}
+
+/**
+ * Publishes a new sample of every sensor, as the DHT22 task does after a read.
+ */
+static void sensors_read(void)
+{
+	int64_t now = esp_timer_get_time();
+
+	for (int i = 0; i < sensor_count; i++)
+	{
+		int16_t temp;
+		uint16_t hum;
+
+		simulated_reading(i, now / 1000000, &temp, &hum);
+
+		pthread_mutex_lock(&sensor_lock);
+		samples[i].temperature = samples[i].temperature_filtered = (float)temp / SENSOR_HISTORY_SCALE;
+		samples[i].humidity = samples[i].humidity_filtered = (float)hum / SENSOR_HISTORY_SCALE;
+		samples[i].timestamp_us = now;
+		samples[i].sequence++;
+		samples[i].status = DHT_OK;
+		sensors[i].diag.ok++;
+		pthread_mutex_unlock(&sensor_lock);
+		__atomic_fetch_add(&sensor_version, 1, __ATOMIC_RELEASE);
+
+		http_server_notify_sample(i);
+		sensor_history_add(i, now / 1000000, temp, hum);
+		sample_log_append(i, now / 1000000, temp, hum);
+	}
+}
+
+// == Wi-Fi =====================================================
+
+BaseType_t wifi_app_send_message(wifi_app_message_e msgID)
+{
+	if (msgID == WIFI_APP_MSG_USER_REQUESTED_STA_DISCONNECT)
+	{
+		http_server_monitor_send_message(HTTP_MSG_WIFI_USER_DISCONNECT);
+	}
+
+	return pdTRUE;
+}
+
+BaseType_t wifi_app_send_connect_message(const char *ssid, const char *password)
+{
+	(void)password;
+	ESP_LOGI(TAG, "connecting to %s", ssid);
+	http_server_monitor_send_message(HTTP_MSG_WIFI_CONNECT_INIT);
+	http_server_monitor_send_message(HTTP_MSG_WIFI_CONNECT_SUCCESS);
+
+	return pdTRUE;
+}
+
+void wifi_app_get_event_counts(uint32_t *merged, uint32_t *dropped)
+{
+	*merged = 0;
+	*dropped = 0;
+}
+
+esp_err_t esp_wifi_sta_get_ap_info(wifi_ap_record_t *ap_info)
+{
+	memset(ap_info, 0, sizeof(*ap_info));
+	strcpy((char *)ap_info->ssid, "host");
+	ap_info->primary = 1;
+	ap_info->rssi = -50;
+
+	return ESP_OK;
+}
+
+esp_err_t esp_netif_get_ip_info(esp_netif_t *esp_netif, esp_netif_ip_info_t *ip_info)
+{
+	(void)esp_netif;
+	ip_info->ip.addr = htonl(0x7F000001);
+	ip_info->netmask.addr = htonl(0xFF000000);
+	ip_info->gw.addr = htonl(0x7F000001);
+
+	return ESP_OK;
+}
+
+// == System ====================================================
+
+ota_inflate_t *ota_inflate_start(ota_writer_t *writer)
+{
+	(void)writer;
+	ESP_LOGW(TAG, "gzip images need the ROM decompressor, upload an uncompressed image");
+	return NULL;
+}
+
+esp_err_t ota_inflate_write(ota_inflate_t *inflate, const uint8_t *data, size_t len)
+{
+	(void)inflate;
+	(void)data;
+	(void)len;
+	return ESP_ERR_INVALID_RESPONSE;
+}
+
+esp_err_t ota_inflate_finish(ota_inflate_t *inflate)
+{
+	(void)inflate;
+	return ESP_ERR_INVALID_RESPONSE;
+}
+
+esp_reset_reason_t esp_reset_reason(void)
+{
+	return ESP_RST_POWERON;
+}
+
+void esp_restart(void)
+{
+	ESP_LOGI(TAG, "restart requested, the host keeps serving");
+}
+
+/**
+ * Fills the history and the flash log with samples from the hours before now.
+ */
+static void prefill(uint32_t now_s)
+{
+	uint32_t period_s = DHT_SAMPLE_PERIOD_MS / 1000;
+
+	for (uint32_t t = period_s; t < now_s; t += period_s)
+	{
+		for (int i = 0; i < sensor_count; i++)
+		{
+			int16_t temp;
+			uint16_t hum;
+
+			simulated_reading(i, t, &temp, &hum);
+			sensor_history_add(i, t, temp, hum);
+			sample_log_append(i, t, temp, hum);
+		}
+	}
+	sample_log_flush();
+}
+
+int main(int argc, char **argv)
+{
+	const char *port = "8080";
+	int hours = 24;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (i + 1 < argc && strcmp(argv[i], "-p") == 0) port = argv[++i];
+		else if (i + 1 < argc && strcmp(argv[i], "-s") == 0) sensor_count = atoi(argv[++i]);
+		else if (i + 1 < argc && strcmp(argv[i], "-H") == 0) hours = atoi(argv[++i]);
+		else
+		{
+			fprintf(stderr, "usage: %s [-p port] [-s sensors] [-H history_hours]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	if (sensor_count < 1 || sensor_count > DHT_MAX_SENSORS || hours < 0)
+	{
+		fprintf(stderr, "sensors must be within 1..%d and hours >= 0\n", DHT_MAX_SENSORS);
+		return 2;
+	}
+
+	for (int i = 0; i < sensor_count; i++)
+	{
+		sensors[i].gpio = DHT_GPIO + i;
+	}
+
+	// both servers move by the same offset: the bulk server is on the port after -p
+	char offset[12];
+
+	snprintf(offset, sizeof(offset), "%d", atoi(port) - HTTP_SERVER_PORT);
+	setenv("IDF_SHIM_HTTPD_PORT_OFFSET", offset, 1);
+	idf_shim_flash_create(SAMPLE_LOG_PARTITION_LABEL, SAMPLES_PARTITION_SIZE);
+	if (sample_log_init() != ESP_OK)
+	{
+		fprintf(stderr, "sample_log_init failed\n");
+		return 1;
+	}
+	sensor_history_init();
+
+	// the simulated device has been up for the prefilled hours
+	idf_shim_timer_set_uptime((int64_t)hours * 3600 * 1000000 + 5000000);
+	prefill(esp_timer_get_time() / 1000000);
+
+	http_server_start();
+
+	for (;;)
+	{
+		sensors_read();
+		usleep(DHT_SAMPLE_PERIOD_MS * 1000);
+	}
+
+	return 0;
+}
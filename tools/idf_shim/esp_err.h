@@ -0,0 +1,28 @@
+/*
+	Host shim of the ESP-IDF headers the tools/ programs compile main/ sources against.
+	Only what those sources use is declared.
+*/
+
+#ifndef IDF_SHIM_ESP_ERR_H_
+#define IDF_SHIM_ESP_ERR_H_
+
+typedef int esp_err_t;
+
+#define ESP_OK					0
+#define ESP_FAIL				-1
+#define ESP_ERR_NO_MEM			0x101
+#define ESP_ERR_INVALID_ARG		0x102
+#define ESP_ERR_INVALID_STATE	0x103
+#define ESP_ERR_INVALID_SIZE	0x104
+#define ESP_ERR_NOT_FOUND		0x105
+#define ESP_ERR_TIMEOUT			0x107
+#define ESP_ERR_INVALID_RESPONSE	0x108
+
+static inline const char *esp_err_to_name(esp_err_t err)
+{
+	return err == ESP_OK ? "ESP_OK" : "ESP_ERR";
+}
+
+#define ESP_ERROR_CHECK(x)		do { esp_err_t err_ = (x); (void)err_; } while (0)
+
+#endif /* IDF_SHIM_ESP_ERR_H_ */
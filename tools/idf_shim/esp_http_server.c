@@ -0,0 +1,1033 @@
+/*------------------------------------------------------------------------------
+
+	esp_http_server on POSIX sockets
+
+	The parts of the ESP-IDF HTTP server the firmware uses, with the same
+	behaviour where it shows in measurements: one thread serves every socket
+	and runs every handler, sessions beyond max_open_sockets are refused,
+	a handler returning an error closes its connection, and an unread request
+	body is purged HTTPD_PURGE_BUF_LEN bytes per recv afterwards. Responses go
+	out with one send per call, and Nagle is off, so the figures measure the
+	handlers rather than delayed ACKs.
+
+	The listening port is config.server_port plus the IDF_SHIM_HTTPD_PORT_OFFSET
+	environment variable, if it is set, so several servers can move together
+	to ports that need no privileges.
+
+---------------------------------------------------------------------------------*/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "esp_http_server.h"
+#include "esp_log.h"
+
+#define HTTPD_MAX_REQ_HDRS		32			// header lines kept per request
+#define HTTPD_RESP_HDR_SIZE		1024		// status line and headers of a response
+
+static const char TAG[] = "httpd";
+
+/**
+ * One open connection
+ */
+struct sock_db
+{
+	int fd;											// -1 if the slot is free
+	size_t len;
+	char buf[HTTPD_MAX_URI_LEN + HTTPD_MAX_REQ_HDR_LEN + 32];	// received and not yet consumed
+};
+
+/**
+ * Server side state of the request being handled
+ */
+struct httpd_req_aux
+{
+	struct sock_db *sd;
+	char hdr_block[sizeof(((struct sock_db *)0)->buf) + 1];	// the request head, fields terminated
+	const char *hdr_fields[HTTPD_MAX_REQ_HDRS];
+	const char *hdr_values[HTTPD_MAX_REQ_HDRS];
+	int hdr_count;									// 0 once the response started, as in httpd
+	size_t remaining;								// body bytes the handler has not read
+	const char *status;
+	const char *content_type;
+	const char **resp_fields;
+	const char **resp_values;
+	int resp_hdr_count;
+	bool first_chunk_sent;
+};
+
+/**
+ * Work for the server thread; no function means closing the session of close_fd
+ */
+struct httpd_work
+{
+	httpd_work_fn_t fn;
+	void *arg;
+	int close_fd;
+};
+
+struct httpd_data
+{
+	httpd_config_t config;
+	int listen_fd;
+	int ctrl_fd[2];									// pipe carrying struct httpd_work
+	pthread_t thread;
+	atomic_bool stop;
+	httpd_uri_t *handlers;
+	int handler_count;
+	struct sock_db *socks;
+	httpd_req_t req;								// one request at a time, like httpd
+	struct httpd_req_aux aux;
+};
+
+/**
+ * Sends a list of buffers completely.
+ * @return false if the connection failed or timed out.
+ */
+static bool httpd_send_iov(int fd, struct iovec *iov, int count)
+{
+	while (count > 0)
+	{
+		struct msghdr msg = { .msg_iov = iov, .msg_iovlen = count };
+		ssize_t sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
+
+		if (sent < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			return false;
+		}
+
+		while (count > 0 && (size_t)sent >= iov->iov_len)
+		{
+			sent -= iov->iov_len;
+			iov++;
+			count--;
+		}
+		if (count > 0)
+		{
+			iov->iov_base = (char *)iov->iov_base + sent;
+			iov->iov_len -= sent;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Formats the status line and headers of the response.
+ * @param length Content-Length, or -1 for a chunked response.
+ * @return length of the head, 0 if it does not fit.
+ */
+static size_t httpd_format_head(struct httpd_req_aux *ra, char *head, ssize_t length)
+{
+	size_t len = snprintf(head, HTTPD_RESP_HDR_SIZE, "HTTP/1.1 %s\r\nContent-Type: %s\r\n", ra->status, ra->content_type);
+
+	if (length < 0)
+	{
+		len += snprintf(head + len, len < HTTPD_RESP_HDR_SIZE ? HTTPD_RESP_HDR_SIZE - len : 0, "Transfer-Encoding: chunked\r\n");
+	}
+	else
+	{
+		len += snprintf(head + len, len < HTTPD_RESP_HDR_SIZE ? HTTPD_RESP_HDR_SIZE - len : 0, "Content-Length: %zd\r\n", length);
+	}
+
+	for (int i = 0; i < ra->resp_hdr_count; i++)
+	{
+		len += snprintf(head + len, len < HTTPD_RESP_HDR_SIZE ? HTTPD_RESP_HDR_SIZE - len : 0, "%s: %s\r\n",
+				ra->resp_fields[i], ra->resp_values[i]);
+	}
+	len += snprintf(head + len, len < HTTPD_RESP_HDR_SIZE ? HTTPD_RESP_HDR_SIZE - len : 0, "\r\n");
+
+	return len < HTTPD_RESP_HDR_SIZE ? len : 0;
+}
+
+esp_err_t httpd_resp_set_status(httpd_req_t *r, const char *status)
+{
+	((struct httpd_req_aux *)r->aux)->status = status;
+	return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_type(httpd_req_t *r, const char *type)
+{
+	((struct httpd_req_aux *)r->aux)->content_type = type;
+	return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_hdr(httpd_req_t *r, const char *field, const char *value)
+{
+	struct httpd_req_aux *ra = r->aux;
+	struct httpd_data *hd = r->handle;
+
+	if (ra->resp_hdr_count >= hd->config.max_resp_headers)
+	{
+		return ESP_ERR_HTTPD_RESP_HDR;
+	}
+
+	ra->resp_fields[ra->resp_hdr_count] = field;
+	ra->resp_values[ra->resp_hdr_count] = value;
+	ra->resp_hdr_count++;
+
+	return ESP_OK;
+}
+
+esp_err_t httpd_resp_send(httpd_req_t *r, const char *buf, ssize_t buf_len)
+{
+	struct httpd_req_aux *ra = r->aux;
+	char head[HTTPD_RESP_HDR_SIZE];
+
+	if (buf_len == HTTPD_RESP_USE_STRLEN)
+	{
+		buf_len = buf ? strlen(buf) : 0;
+	}
+
+	size_t head_len = httpd_format_head(ra, head, buf_len);
+	struct iovec iov[2] = { { head, head_len }, { (void *)buf, buf ? buf_len : 0 } };
+
+	// request headers are no longer available
+	ra->hdr_count = 0;
+
+	if (head_len == 0)
+	{
+		return ESP_ERR_HTTPD_RESP_HDR;
+	}
+
+	return httpd_send_iov(ra->sd->fd, iov, 2) ? ESP_OK : ESP_ERR_HTTPD_RESP_SEND;
+}
+
+esp_err_t httpd_resp_send_chunk(httpd_req_t *r, const char *buf, ssize_t buf_len)
+{
+	struct httpd_req_aux *ra = r->aux;
+	char head[HTTPD_RESP_HDR_SIZE];
+	char size[20];
+	struct iovec iov[4];
+	int n = 0;
+
+	if (buf_len == HTTPD_RESP_USE_STRLEN)
+	{
+		buf_len = buf ? strlen(buf) : 0;
+	}
+
+	ra->hdr_count = 0;
+
+	if (!ra->first_chunk_sent)
+	{
+		size_t head_len = httpd_format_head(ra, head, -1);
+
+		if (head_len == 0)
+		{
+			return ESP_ERR_HTTPD_RESP_HDR;
+		}
+		iov[n++] = (struct iovec){ head, head_len };
+		ra->first_chunk_sent = true;
+	}
+
+	// a chunk of length 0, with or without a buffer, ends the response
+	iov[n++] = (struct iovec){ size, snprintf(size, sizeof(size), "%zx\r\n", buf_len) };
+	if (buf && buf_len > 0)
+	{
+		iov[n++] = (struct iovec){ (void *)buf, buf_len };
+	}
+	iov[n++] = (struct iovec){ "\r\n", 2 };
+
+	return httpd_send_iov(ra->sd->fd, iov, n) ? ESP_OK : ESP_ERR_HTTPD_RESP_SEND;
+}
+
+esp_err_t httpd_resp_send_err(httpd_req_t *req, httpd_err_code_t error, const char *usr_msg)
+{
+	const char *status;
+	const char *msg;
+
+	switch (error)
+	{
+		case HTTPD_400_BAD_REQUEST:
+			status = "400 Bad Request";
+			msg = "Bad request syntax";
+			break;
+		case HTTPD_404_NOT_FOUND:
+			status = "404 Not Found";
+			msg = "This URI does not exist";
+			break;
+		case HTTPD_405_METHOD_NOT_ALLOWED:
+			status = "405 Method Not Allowed";
+			msg = "Request method for this URI is not handled by server";
+			break;
+		case HTTPD_408_REQ_TIMEOUT:
+			status = "408 Request Timeout";
+			msg = "Server closed this connection";
+			break;
+		case HTTPD_414_URI_TOO_LONG:
+			status = "414 URI Too Long";
+			msg = "URI is too long";
+			break;
+		case HTTPD_431_REQ_HDR_FIELDS_TOO_LARGE:
+			status = "431 Request Header Fields Too Large";
+			msg = "Header fields are too long";
+			break;
+		case HTTPD_501_METHOD_NOT_IMPLEMENTED:
+			status = "501 Method Not Implemented";
+			msg = "Server does not support this method";
+			break;
+		default:
+			status = "500 Internal Server Error";
+			msg = "Server has encountered an unexpected error";
+			break;
+	}
+
+	httpd_resp_set_status(req, status);
+	httpd_resp_set_type(req, "text/html");
+
+	return httpd_resp_send(req, usr_msg ? usr_msg : msg, HTTPD_RESP_USE_STRLEN);
+}
+
+int httpd_socket_send(httpd_handle_t hd, int sockfd, const char *buf, size_t buf_len, int flags)
+{
+	(void)hd;
+
+	ssize_t sent = send(sockfd, buf, buf_len, flags | MSG_NOSIGNAL);
+
+	if (sent < 0)
+	{
+		return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? HTTPD_SOCK_ERR_TIMEOUT : HTTPD_SOCK_ERR_FAIL;
+	}
+
+	return sent;
+}
+
+int httpd_req_to_sockfd(httpd_req_t *r)
+{
+	return ((struct httpd_req_aux *)r->aux)->sd->fd;
+}
+
+int httpd_req_recv(httpd_req_t *r, char *buf, size_t buf_len)
+{
+	struct httpd_req_aux *ra = r->aux;
+	struct sock_db *sd = ra->sd;
+	ssize_t n;
+
+	if (buf_len > ra->remaining)
+	{
+		buf_len = ra->remaining;
+	}
+	if (buf_len == 0)
+	{
+		return 0;
+	}
+
+	if (sd->len > 0)
+	{
+		// body bytes that came with the head
+		n = buf_len < sd->len ? buf_len : sd->len;
+		memcpy(buf, sd->buf, n);
+		memmove(sd->buf, sd->buf + n, sd->len - n);
+		sd->len -= n;
+	}
+	else if ((n = recv(sd->fd, buf, buf_len, 0)) < 0)
+	{
+		return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? HTTPD_SOCK_ERR_TIMEOUT : HTTPD_SOCK_ERR_FAIL;
+	}
+
+	ra->remaining -= n;
+
+	return n;
+}
+
+/**
+ * Copies a string into a buffer, truncating it if needed.
+ * @return ESP_ERR_HTTPD_RESULT_TRUNC if it did not fit.
+ */
+static esp_err_t httpd_copy(char *dst, size_t size, const char *src, size_t len)
+{
+	if (size == 0)
+	{
+		return ESP_ERR_HTTPD_RESULT_TRUNC;
+	}
+
+	size_t n = len < size - 1 ? len : size - 1;
+
+	memcpy(dst, src, n);
+	dst[n] = '\0';
+
+	return n < len ? ESP_ERR_HTTPD_RESULT_TRUNC : ESP_OK;
+}
+
+esp_err_t httpd_req_get_url_query_str(httpd_req_t *r, char *buf, size_t buf_len)
+{
+	const char *query = strchr(r->uri, '?');
+
+	if (query == NULL)
+	{
+		return ESP_ERR_NOT_FOUND;
+	}
+	query++;
+
+	return httpd_copy(buf, buf_len, query, strcspn(query, "#"));
+}
+
+esp_err_t httpd_query_key_value(const char *qry, const char *key, char *val, size_t val_size)
+{
+	size_t key_len = strlen(key);
+
+	while (qry && *qry)
+	{
+		size_t pair_len = strcspn(qry, "&");
+
+		if (pair_len > key_len && strncmp(qry, key, key_len) == 0 && qry[key_len] == '=')
+		{
+			return httpd_copy(val, val_size, qry + key_len + 1, pair_len - key_len - 1);
+		}
+
+		qry = qry[pair_len] ? qry + pair_len + 1 : NULL;
+	}
+
+	return ESP_ERR_NOT_FOUND;
+}
+
+static const char *httpd_find_hdr(httpd_req_t *r, const char *field)
+{
+	struct httpd_req_aux *ra = r->aux;
+
+	for (int i = 0; i < ra->hdr_count; i++)
+	{
+		if (strcasecmp(ra->hdr_fields[i], field) == 0)
+		{
+			return ra->hdr_values[i];
+		}
+	}
+
+	return NULL;
+}
+
+size_t httpd_req_get_hdr_value_len(httpd_req_t *r, const char *field)
+{
+	const char *value = httpd_find_hdr(r, field);
+
+	return value ? strlen(value) : 0;
+}
+
+esp_err_t httpd_req_get_hdr_value_str(httpd_req_t *r, const char *field, char *val, size_t val_size)
+{
+	const char *value = httpd_find_hdr(r, field);
+
+	if (value == NULL)
+	{
+		return ESP_ERR_NOT_FOUND;
+	}
+
+	return httpd_copy(val, val_size, value, strlen(value));
+}
+
+bool httpd_uri_match_wildcard(const char *uri_template, const char *uri_to_match, size_t match_upto)
+{
+	size_t len = strlen(uri_template);
+	bool asterisk = false;
+	bool quest = false;
+
+	// a trailing '*' matches any rest, a trailing '?' makes the character before it optional
+	while (len > 0)
+	{
+		if (uri_template[len - 1] == '*' && !asterisk)
+		{
+			asterisk = true;
+		}
+		else if (uri_template[len - 1] == '?' && !quest)
+		{
+			quest = true;
+		}
+		else
+		{
+			break;
+		}
+		len--;
+	}
+
+	if (quest)
+	{
+		if (len == 0)
+		{
+			return false;
+		}
+
+		// len - 1 mandatory characters, then the optional one
+		len--;
+		if (match_upto < len || strncmp(uri_template, uri_to_match, len) != 0
+				|| (match_upto > len && uri_to_match[len] != uri_template[len]))
+		{
+			return false;
+		}
+
+		return asterisk || match_upto <= len + 1;
+	}
+
+	if (match_upto < len || (!asterisk && match_upto != len))
+	{
+		return false;
+	}
+
+	return strncmp(uri_template, uri_to_match, len) == 0;
+}
+
+esp_err_t httpd_register_uri_handler(httpd_handle_t handle, const httpd_uri_t *uri_handler)
+{
+	struct httpd_data *hd = handle;
+
+	for (int i = 0; i < hd->handler_count; i++)
+	{
+		if (hd->handlers[i].method == uri_handler->method && strcmp(hd->handlers[i].uri, uri_handler->uri) == 0)
+		{
+			return ESP_ERR_HTTPD_HANDLER_EXISTS;
+		}
+	}
+
+	if (hd->handler_count >= hd->config.max_uri_handlers)
+	{
+		ESP_LOGW(TAG, "no slot left for %s", uri_handler->uri);
+		return ESP_ERR_HTTPD_HANDLERS_FULL;
+	}
+
+	hd->handlers[hd->handler_count] = *uri_handler;
+	hd->handlers[hd->handler_count].uri = strdup(uri_handler->uri);
+	hd->handler_count++;
+
+	return ESP_OK;
+}
+
+esp_err_t httpd_queue_work(httpd_handle_t handle, httpd_work_fn_t work, void *arg)
+{
+	struct httpd_data *hd = handle;
+	struct httpd_work w = { .fn = work, .arg = arg, .close_fd = -1 };
+
+	// pipe writes this small are atomic, so any thread may queue
+	return write(hd->ctrl_fd[1], &w, sizeof(w)) == sizeof(w) ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t httpd_sess_trigger_close(httpd_handle_t handle, int sockfd)
+{
+	struct httpd_data *hd = handle;
+	struct httpd_work w = { .fn = NULL, .close_fd = sockfd };
+
+	return write(hd->ctrl_fd[1], &w, sizeof(w)) == sizeof(w) ? ESP_OK : ESP_FAIL;
+}
+
+static void httpd_sess_close(struct httpd_data *hd, struct sock_db *sd)
+{
+	int fd = sd->fd;
+
+	sd->fd = -1;
+	sd->len = 0;
+
+	if (hd->config.close_fn)
+	{
+		hd->config.close_fn(hd, fd);
+	}
+	else
+	{
+		close(fd);
+	}
+}
+
+/**
+ * Prepares the request state for the next request on a session.
+ */
+static httpd_req_t *httpd_req_init(struct httpd_data *hd, struct sock_db *sd)
+{
+	httpd_req_t *r = &hd->req;
+	struct httpd_req_aux *ra = &hd->aux;
+
+	((char *)r->uri)[0] = '\0';
+	r->handle = hd;
+	r->method = -1;
+	r->content_len = 0;
+	r->aux = ra;
+	r->user_ctx = NULL;
+
+	ra->sd = sd;
+	ra->hdr_count = 0;
+	ra->remaining = 0;
+	ra->status = "200 OK";
+	ra->content_type = "text/html";
+	ra->resp_hdr_count = 0;
+	ra->first_chunk_sent = false;
+
+	return r;
+}
+
+/**
+ * Parses a request head and takes it out of the session buffer.
+ * @param head_len length of the head up to and including the empty line.
+ * @param err receives the status to answer with if the request cannot be handled.
+ * @return false if it cannot.
+ */
+static bool httpd_parse_head(httpd_req_t *r, size_t head_len, httpd_err_code_t *err)
+{
+	static const char *const methods[] = { [HTTP_DELETE] = "DELETE", [HTTP_GET] = "GET", [HTTP_HEAD] = "HEAD",
+			[HTTP_POST] = "POST", [HTTP_PUT] = "PUT", [HTTP_CONNECT] = "CONNECT", [HTTP_OPTIONS] = "OPTIONS" };
+	struct httpd_req_aux *ra = r->aux;
+	struct sock_db *sd = ra->sd;
+	char *line, *next, *save;
+
+	memcpy(ra->hdr_block, sd->buf, head_len);
+	ra->hdr_block[head_len - 4] = '\0';
+	memmove(sd->buf, sd->buf + head_len, sd->len - head_len);
+	sd->len -= head_len;
+
+	*err = HTTPD_400_BAD_REQUEST;
+
+	// request line: method, URI, version
+	line = ra->hdr_block;
+	next = strstr(line, "\r\n");
+	if (next)
+	{
+		*next = '\0';
+		next += 2;
+	}
+
+	char *method = strtok_r(line, " ", &save);
+	char *uri = strtok_r(NULL, " ", &save);
+	char *version = strtok_r(NULL, " ", &save);
+
+	if (method == NULL || uri == NULL || version == NULL || strncmp(version, "HTTP/1.", 7) != 0)
+	{
+		return false;
+	}
+
+	for (int m = 0; m < (int)(sizeof(methods) / sizeof(methods[0])); m++)
+	{
+		if (strcmp(method, methods[m]) == 0)
+		{
+			r->method = m;
+		}
+	}
+	if (r->method < 0)
+	{
+		*err = HTTPD_501_METHOD_NOT_IMPLEMENTED;
+		return false;
+	}
+
+	if (httpd_copy((char *)r->uri, sizeof(r->uri), uri, strlen(uri)) != ESP_OK)
+	{
+		*err = HTTPD_414_URI_TOO_LONG;
+		return false;
+	}
+
+	if (next && head_len - (next - ra->hdr_block) > HTTPD_MAX_REQ_HDR_LEN)
+	{
+		*err = HTTPD_431_REQ_HDR_FIELDS_TOO_LARGE;
+		return false;
+	}
+
+	// header lines
+	for (line = next; line && *line; line = next)
+	{
+		next = strstr(line, "\r\n");
+		if (next)
+		{
+			*next = '\0';
+			next += 2;
+		}
+
+		char *colon = strchr(line, ':');
+
+		if (colon == NULL)
+		{
+			return false;
+		}
+		if (ra->hdr_count == HTTPD_MAX_REQ_HDRS)
+		{
+			*err = HTTPD_431_REQ_HDR_FIELDS_TOO_LARGE;
+			return false;
+		}
+
+		*colon++ = '\0';
+		colon += strspn(colon, " \t");
+		ra->hdr_fields[ra->hdr_count] = line;
+		ra->hdr_values[ra->hdr_count] = colon;
+		ra->hdr_count++;
+
+		if (strcasecmp(line, "Content-Length") == 0)
+		{
+			char *end;
+
+			r->content_len = strtoul(colon, &end, 10);
+			if (end == colon || *end != '\0')
+			{
+				return false;
+			}
+		}
+	}
+
+	ra->remaining = r->content_len;
+
+	return true;
+}
+
+/**
+ * Finds the handler of a request and runs it.
+ * @return what the handler returned; ESP_FAIL after a 404 or 405, which close the connection.
+ */
+static esp_err_t httpd_dispatch(struct httpd_data *hd, httpd_req_t *r)
+{
+	size_t len = strcspn(r->uri, "?");
+	bool other_method = false;
+
+	for (int i = 0; i < hd->handler_count; i++)
+	{
+		const httpd_uri_t *h = &hd->handlers[i];
+		bool match = hd->config.uri_match_fn ? hd->config.uri_match_fn(h->uri, r->uri, len)
+				: strlen(h->uri) == len && strncmp(h->uri, r->uri, len) == 0;
+
+		if (!match)
+		{
+			continue;
+		}
+		if ((int)h->method != r->method)
+		{
+			other_method = true;
+			continue;
+		}
+
+		r->user_ctx = h->user_ctx;
+		return h->handler(r);
+	}
+
+	httpd_resp_send_err(r, other_method ? HTTPD_405_METHOD_NOT_ALLOWED : HTTPD_404_NOT_FOUND, NULL);
+
+	return ESP_FAIL;
+}
+
+/**
+ * Handles one request whose head is in the session buffer.
+ * @return false if the session has to be closed.
+ */
+static bool httpd_handle_request(struct httpd_data *hd, struct sock_db *sd, size_t head_len)
+{
+	httpd_req_t *r = httpd_req_init(hd, sd);
+	struct httpd_req_aux *ra = r->aux;
+	httpd_err_code_t err;
+	char purge[HTTPD_PURGE_BUF_LEN];
+
+	if (!httpd_parse_head(r, head_len, &err))
+	{
+		httpd_resp_send_err(r, err, NULL);
+		return false;
+	}
+
+	if (httpd_dispatch(hd, r) != ESP_OK)
+	{
+		return false;
+	}
+
+	// drop the body the handler left unread, as httpd does
+	while (ra->remaining > 0)
+	{
+		if (httpd_req_recv(r, purge, sizeof(purge)) <= 0)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Serves a session that has data to read: receives a request head and handles it,
+ * then any further requests the client already sent.
+ */
+static void httpd_serve(struct httpd_data *hd, struct sock_db *sd)
+{
+	char *end;
+
+	do
+	{
+		while ((end = memmem(sd->buf, sd->len, "\r\n\r\n", 4)) == NULL)
+		{
+			if (sd->len == sizeof(sd->buf))
+			{
+				httpd_resp_send_err(httpd_req_init(hd, sd), HTTPD_431_REQ_HDR_FIELDS_TOO_LARGE, NULL);
+				httpd_sess_close(hd, sd);
+				return;
+			}
+
+			ssize_t n = recv(sd->fd, sd->buf + sd->len, sizeof(sd->buf) - sd->len, 0);
+
+			if (n <= 0)
+			{
+				// a head that stopped arriving is answered with 408, a closed connection is just closed
+				if (n < 0 && sd->len > 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+				{
+					httpd_resp_send_err(httpd_req_init(hd, sd), HTTPD_408_REQ_TIMEOUT, NULL);
+				}
+				httpd_sess_close(hd, sd);
+				return;
+			}
+			sd->len += n;
+		}
+
+		if (!httpd_handle_request(hd, sd, end + 4 - sd->buf))
+		{
+			httpd_sess_close(hd, sd);
+			return;
+		}
+	} while (sd->len > 0 && memmem(sd->buf, sd->len, "\r\n\r\n", 4) != NULL);
+}
+
+static void httpd_accept(struct httpd_data *hd)
+{
+	int fd = accept(hd->listen_fd, NULL, NULL);
+	struct sock_db *sd = NULL;
+
+	if (fd < 0)
+	{
+		return;
+	}
+
+	for (int i = 0; i < hd->config.max_open_sockets && sd == NULL; i++)
+	{
+		if (hd->socks[i].fd < 0)
+		{
+			sd = &hd->socks[i];
+		}
+	}
+
+	if (sd == NULL)
+	{
+		ESP_LOGW(TAG, "no free session, connection closed");
+		close(fd);
+		return;
+	}
+
+	struct timeval recv_timeout = { .tv_sec = hd->config.recv_wait_timeout };
+	struct timeval send_timeout = { .tv_sec = hd->config.send_wait_timeout };
+	int one = 1;
+
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &recv_timeout, sizeof(recv_timeout));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &send_timeout, sizeof(send_timeout));
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	sd->fd = fd;
+	sd->len = 0;
+}
+
+/**
+ * Runs the work queued by other threads, and closes the sessions they asked to.
+ */
+static void httpd_run_work(struct httpd_data *hd)
+{
+	struct httpd_work w;
+
+	while (read(hd->ctrl_fd[0], &w, sizeof(w)) == sizeof(w))
+	{
+		if (w.fn)
+		{
+			w.fn(w.arg);
+			continue;
+		}
+
+		for (int i = 0; i < hd->config.max_open_sockets; i++)
+		{
+			if (w.close_fd >= 0 && hd->socks[i].fd == w.close_fd)
+			{
+				httpd_sess_close(hd, &hd->socks[i]);
+			}
+		}
+	}
+}
+
+static void *httpd_thread(void *arg)
+{
+	struct httpd_data *hd = arg;
+
+	while (!atomic_load(&hd->stop))
+	{
+		fd_set read_set;
+		int max_fd = hd->listen_fd > hd->ctrl_fd[0] ? hd->listen_fd : hd->ctrl_fd[0];
+
+		FD_ZERO(&read_set);
+		FD_SET(hd->listen_fd, &read_set);
+		FD_SET(hd->ctrl_fd[0], &read_set);
+		for (int i = 0; i < hd->config.max_open_sockets; i++)
+		{
+			if (hd->socks[i].fd >= 0)
+			{
+				FD_SET(hd->socks[i].fd, &read_set);
+				max_fd = hd->socks[i].fd > max_fd ? hd->socks[i].fd : max_fd;
+			}
+		}
+
+		if (select(max_fd + 1, &read_set, NULL, NULL, NULL) < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			ESP_LOGE(TAG, "select failed: %s", strerror(errno));
+			break;
+		}
+
+		if (FD_ISSET(hd->ctrl_fd[0], &read_set))
+		{
+			httpd_run_work(hd);
+		}
+
+		for (int i = 0; i < hd->config.max_open_sockets; i++)
+		{
+			if (hd->socks[i].fd >= 0 && FD_ISSET(hd->socks[i].fd, &read_set))
+			{
+				httpd_serve(hd, &hd->socks[i]);
+			}
+		}
+
+		if (FD_ISSET(hd->listen_fd, &read_set))
+		{
+			httpd_accept(hd);
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Opens the listening socket, dual stack like httpd with IPv6 enabled.
+ * @return the socket, -1 on failure.
+ */
+static int httpd_listen(uint16_t port, int backlog)
+{
+	struct sockaddr_in6 addr = { .sin6_family = AF_INET6, .sin6_addr = IN6ADDR_ANY_INIT, .sin6_port = htons(port) };
+	int fd = socket(AF_INET6, SOCK_STREAM, 0);
+	int one = 1;
+	int zero = 0;
+
+	if (fd < 0)
+	{
+		return -1;
+	}
+
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
+
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, backlog) != 0)
+	{
+		ESP_LOGE(TAG, "cannot listen on port %u: %s", port, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static void httpd_free(struct httpd_data *hd)
+{
+	for (int i = 0; i < hd->handler_count; i++)
+	{
+		free((char *)hd->handlers[i].uri);
+	}
+	free(hd->handlers);
+	free(hd->socks);
+	free(hd->aux.resp_fields);
+	free(hd->aux.resp_values);
+	free(hd);
+}
+
+esp_err_t httpd_start(httpd_handle_t *handle, const httpd_config_t *config)
+{
+	struct httpd_data *hd = calloc(1, sizeof(*hd));
+	const char *offset = getenv("IDF_SHIM_HTTPD_PORT_OFFSET");
+
+	if (hd == NULL)
+	{
+		return ESP_ERR_HTTPD_ALLOC_MEM;
+	}
+
+	hd->config = *config;
+	if (offset)
+	{
+		hd->config.server_port += atoi(offset);
+	}
+
+	hd->handlers = calloc(hd->config.max_uri_handlers, sizeof(*hd->handlers));
+	hd->socks = calloc(hd->config.max_open_sockets, sizeof(*hd->socks));
+	hd->aux.resp_fields = calloc(hd->config.max_resp_headers, sizeof(*hd->aux.resp_fields));
+	hd->aux.resp_values = calloc(hd->config.max_resp_headers, sizeof(*hd->aux.resp_values));
+	if (hd->handlers == NULL || hd->socks == NULL || hd->aux.resp_fields == NULL || hd->aux.resp_values == NULL)
+	{
+		httpd_free(hd);
+		return ESP_ERR_HTTPD_ALLOC_MEM;
+	}
+	for (int i = 0; i < hd->config.max_open_sockets; i++)
+	{
+		hd->socks[i].fd = -1;
+	}
+
+	hd->listen_fd = httpd_listen(hd->config.server_port, hd->config.backlog_conn);
+	if (hd->listen_fd < 0)
+	{
+		httpd_free(hd);
+		return ESP_FAIL;
+	}
+
+	if (pipe(hd->ctrl_fd) != 0)
+	{
+		close(hd->listen_fd);
+		httpd_free(hd);
+		return ESP_FAIL;
+	}
+	fcntl(hd->ctrl_fd[0], F_SETFL, O_NONBLOCK);
+	fcntl(hd->ctrl_fd[1], F_SETFL, O_NONBLOCK);
+
+	if (pthread_create(&hd->thread, NULL, httpd_thread, hd) != 0)
+	{
+		close(hd->listen_fd);
+		close(hd->ctrl_fd[0]);
+		close(hd->ctrl_fd[1]);
+		httpd_free(hd);
+		return ESP_ERR_HTTPD_TASK;
+	}
+
+	ESP_LOGI(TAG, "listening on port %u", hd->config.server_port);
+	*handle = hd;
+
+	return ESP_OK;
+}
+
+esp_err_t httpd_stop(httpd_handle_t handle)
+{
+	struct httpd_data *hd = handle;
+	struct httpd_work wake = { .fn = NULL, .close_fd = -1 };
+
+	atomic_store(&hd->stop, true);
+	if (write(hd->ctrl_fd[1], &wake, sizeof(wake)) != sizeof(wake))
+	{
+		// the pipe is full, so the thread wakes anyway
+	}
+	pthread_join(hd->thread, NULL);
+
+	for (int i = 0; i < hd->config.max_open_sockets; i++)
+	{
+		if (hd->socks[i].fd >= 0)
+		{
+			httpd_sess_close(hd, &hd->socks[i]);
+		}
+	}
+	close(hd->listen_fd);
+	close(hd->ctrl_fd[0]);
+	close(hd->ctrl_fd[1]);
+	httpd_free(hd);
+
+	return ESP_OK;
+}
@@ -0,0 +1,8 @@
+#ifndef IDF_SHIM_ESP_IDF_VERSION_H_
+#define IDF_SHIM_ESP_IDF_VERSION_H_
+
+// the version the firmware is built with
+#define ESP_IDF_VERSION_VAL(major, minor, patch)	(((major) << 16) | ((minor) << 8) | (patch))
+#define ESP_IDF_VERSION								ESP_IDF_VERSION_VAL(4, 4, 0)
+
+#endif /* IDF_SHIM_ESP_IDF_VERSION_H_ */
@@ -0,0 +1,33 @@
+#ifndef IDF_SHIM_ESP_LOG_H_
+#define IDF_SHIM_ESP_LOG_H_
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/**
+ * Prints a log line to stderr when IDF_SHIM_LOG is set in the environment.
+ * Formats are checked like those of esp_log_write.
+ */
+static inline __attribute__((format(printf, 3, 4))) void idf_shim_log(char level, const char *tag, const char *fmt, ...)
+{
+	va_list ap;
+
+	if (getenv("IDF_SHIM_LOG") == NULL)
+	{
+		return;
+	}
+
+	fprintf(stderr, "%c (%s) ", level, tag);
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fputc('\n', stderr);
+}
+
+#define ESP_LOGE(tag, ...)		idf_shim_log('E', tag, __VA_ARGS__)
+#define ESP_LOGW(tag, ...)		idf_shim_log('W', tag, __VA_ARGS__)
+#define ESP_LOGI(tag, ...)		idf_shim_log('I', tag, __VA_ARGS__)
+#define ESP_LOGD(tag, ...)		idf_shim_log('D', tag, __VA_ARGS__)
+
+#endif /* IDF_SHIM_ESP_LOG_H_ */
@@ -0,0 +1,38 @@
+#ifndef IDF_SHIM_ESP_NETIF_H_
+#define IDF_SHIM_ESP_NETIF_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "esp_err.h"
+
+#define IP4ADDR_STRLEN_MAX		16
+
+typedef struct esp_netif_obj esp_netif_t;
+
+typedef struct
+{
+	uint32_t addr;				// network byte order
+} esp_ip4_addr_t;
+
+typedef struct
+{
+	esp_ip4_addr_t ip;
+	esp_ip4_addr_t netmask;
+	esp_ip4_addr_t gw;
+} esp_netif_ip_info_t;
+
+/**
+ * Defined by the host program, which decides what the interface reports.
+ */
+esp_err_t esp_netif_get_ip_info(esp_netif_t *esp_netif, esp_netif_ip_info_t *ip_info);
+
+static inline char *esp_ip4addr_ntoa(const esp_ip4_addr_t *addr, char *buf, int buflen)
+{
+	const uint8_t *b = (const uint8_t *)&addr->addr;
+
+	snprintf(buf, buflen, "%u.%u.%u.%u", b[0], b[1], b[2], b[3]);
+	return buf;
+}
+
+#endif /* IDF_SHIM_ESP_NETIF_H_ */
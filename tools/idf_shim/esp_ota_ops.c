@@ -0,0 +1,105 @@
+/*------------------------------------------------------------------------------
+
+	OTA update stand-in
+
+	Two app slots at the offsets of partitions.csv. An update is checked the
+	way the firmware relies on: writes stay within the slot, and the image
+	must begin with the app image magic byte; the data itself is dropped.
+
+---------------------------------------------------------------------------------*/
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_ota_ops.h"
+
+#define APP_IMAGE_MAGIC		0xE9
+
+static const esp_partition_t g_slots[2] =
+{
+	{ .type = ESP_PARTITION_TYPE_APP, .subtype = 0x10, .address = 0x110000, .size = 0x100000, .label = "ota_0" },
+	{ .type = ESP_PARTITION_TYPE_APP, .subtype = 0x11, .address = 0x210000, .size = 0x100000, .label = "ota_1" },
+};
+
+static const esp_partition_t *g_boot = &g_slots[0];
+
+// The update in progress
+static esp_ota_handle_t g_handle;
+static const esp_partition_t *g_partition;
+static size_t g_written;
+static bool g_magic_ok;
+
+const esp_partition_t *esp_ota_get_next_update_partition(const esp_partition_t *start_from)
+{
+	(void)start_from;
+
+	return g_boot == &g_slots[0] ? &g_slots[1] : &g_slots[0];
+}
+
+const esp_partition_t *esp_ota_get_boot_partition(void)
+{
+	return g_boot;
+}
+
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t *partition)
+{
+	if (partition != &g_slots[0] && partition != &g_slots[1])
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	g_boot = partition;
+
+	return ESP_OK;
+}
+
+esp_err_t esp_ota_begin(const esp_partition_t *partition, size_t image_size, esp_ota_handle_t *out_handle)
+{
+	if (partition == NULL || partition == g_boot)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	if (image_size != OTA_SIZE_UNKNOWN && image_size > partition->size)
+	{
+		return ESP_ERR_INVALID_SIZE;
+	}
+
+	g_partition = partition;
+	g_written = 0;
+	g_magic_ok = false;
+	*out_handle = ++g_handle;
+
+	return ESP_OK;
+}
+
+esp_err_t esp_ota_write(esp_ota_handle_t handle, const void *data, size_t size)
+{
+	if (handle != g_handle || g_partition == NULL)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	if (g_written + size > g_partition->size)
+	{
+		return ESP_ERR_INVALID_SIZE;
+	}
+
+	if (g_written == 0 && size > 0)
+	{
+		g_magic_ok = ((const uint8_t *)data)[0] == APP_IMAGE_MAGIC;
+	}
+	g_written += size;
+
+	return ESP_OK;
+}
+
+esp_err_t esp_ota_end(esp_ota_handle_t handle)
+{
+	if (handle != g_handle || g_partition == NULL)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	g_partition = NULL;
+
+	return g_written > 0 && g_magic_ok ? ESP_OK : ESP_ERR_OTA_VALIDATE_FAILED;
+}
@@ -0,0 +1,27 @@
+#ifndef IDF_SHIM_ESP_OTA_OPS_H_
+#define IDF_SHIM_ESP_OTA_OPS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_partition.h"
+
+#define OTA_SIZE_UNKNOWN				0xffffffff
+#define ESP_ERR_OTA_VALIDATE_FAILED		0x1503
+
+typedef uint32_t esp_ota_handle_t;
+
+// Two app slots as in partitions.csv; images are checked and counted, not kept
+const esp_partition_t *esp_ota_get_next_update_partition(const esp_partition_t *start_from);
+const esp_partition_t *esp_ota_get_boot_partition(void);
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t *partition);
+esp_err_t esp_ota_begin(const esp_partition_t *partition, size_t image_size, esp_ota_handle_t *out_handle);
+esp_err_t esp_ota_write(esp_ota_handle_t handle, const void *data, size_t size);
+
+/**
+ * Ends an update; the image must start with the app image magic byte, 0xE9.
+ */
+esp_err_t esp_ota_end(esp_ota_handle_t handle);
+
+#endif /* IDF_SHIM_ESP_OTA_OPS_H_ */
@@ -0,0 +1,168 @@
+/*------------------------------------------------------------------------------
+
+	Emulated flash partition
+
+	One RAM backed data partition behind the esp_partition API, with the NOR
+	flash rules the firmware relies on, and hooks that tear a write the way a
+	power failure does. It outlives a simulated reboot: only the code under
+	test re-initializes.
+
+---------------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_partition.h"
+
+static esp_partition_t g_partition;
+static uint8_t *g_flash;
+static unsigned *g_erases;
+static unsigned g_overwrites;
+
+static bool g_tear_armed;
+static bool g_torn;
+static size_t g_tear_offset;
+static size_t g_tear_bytes;
+
+void idf_shim_flash_create(const char *label, size_t size)
+{
+	free(g_flash);
+	free(g_erases);
+
+	g_flash = malloc(size);
+	g_erases = calloc(size / IDF_SHIM_FLASH_SECTOR_SIZE, sizeof(*g_erases));
+	memset(g_flash, 0xFF, size);
+
+	memset(&g_partition, 0, sizeof(g_partition));
+	g_partition.type = ESP_PARTITION_TYPE_DATA;
+	g_partition.subtype = 0x40;
+	g_partition.size = size;
+	strncpy(g_partition.label, label, sizeof(g_partition.label) - 1);
+
+	g_overwrites = 0;
+	g_tear_armed = false;
+	g_torn = false;
+}
+
+void idf_shim_flash_tear(size_t offset, size_t bytes)
+{
+	g_tear_armed = true;
+	g_torn = false;
+	g_tear_offset = offset;
+	g_tear_bytes = bytes;
+}
+
+bool idf_shim_flash_torn(void)
+{
+	bool torn = g_torn;
+
+	g_torn = false;
+	return torn;
+}
+
+unsigned idf_shim_flash_overwrites(void)
+{
+	return g_overwrites;
+}
+
+unsigned idf_shim_flash_erases(size_t sector)
+{
+	return g_erases[sector];
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label)
+{
+	if (g_flash == NULL || type != g_partition.type
+			|| (subtype != ESP_PARTITION_SUBTYPE_ANY && subtype != g_partition.subtype)
+			|| (label && strcmp(label, g_partition.label) != 0))
+	{
+		return NULL;
+	}
+
+	return &g_partition;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t offset, void *dst, size_t size)
+{
+	if (offset + size > partition->size)
+	{
+		return ESP_ERR_INVALID_SIZE;
+	}
+
+	memcpy(dst, g_flash + offset, size);
+	return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t offset, const void *src, size_t size)
+{
+	const uint8_t *p = src;
+
+	if (offset + size > partition->size)
+	{
+		return ESP_ERR_INVALID_SIZE;
+	}
+
+	if (g_tear_armed && offset == g_tear_offset)
+	{
+		g_tear_armed = false;
+		g_torn = true;
+		if (size > g_tear_bytes)
+		{
+			size = g_tear_bytes;
+		}
+	}
+
+	for (size_t k = 0; k < size; k++)
+	{
+		if (p[k] & ~g_flash[offset + k])
+		{
+			g_overwrites++;
+			break;
+		}
+	}
+
+	// programming only clears bits
+	for (size_t k = 0; k < size; k++)
+	{
+		g_flash[offset + k] &= p[k];
+	}
+
+	return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size)
+{
+	if (offset % IDF_SHIM_FLASH_SECTOR_SIZE || size % IDF_SHIM_FLASH_SECTOR_SIZE || offset + size > partition->size)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	memset(g_flash + offset, 0xFF, size);
+	for (size_t s = offset / IDF_SHIM_FLASH_SECTOR_SIZE; s < (offset + size) / IDF_SHIM_FLASH_SECTOR_SIZE; s++)
+	{
+		g_erases[s]++;
+	}
+
+	return ESP_OK;
+}
+
+esp_err_t esp_partition_mmap(const esp_partition_t *partition, size_t offset, size_t size,
+		spi_flash_mmap_memory_t memory, const void **out_ptr, spi_flash_mmap_handle_t *out_handle)
+{
+	(void)memory;
+
+	if (offset + size > partition->size)
+	{
+		return ESP_ERR_INVALID_SIZE;
+	}
+
+	// the map sees every later write and erase, like the flash cache does
+	*out_ptr = g_flash + offset;
+	*out_handle = 1;
+	return ESP_OK;
+}
+
+void spi_flash_munmap(spi_flash_mmap_handle_t handle)
+{
+	(void)handle;
+}
@@ -0,0 +1,76 @@
+#ifndef IDF_SHIM_ESP_PARTITION_H_
+#define IDF_SHIM_ESP_PARTITION_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+typedef enum
+{
+	ESP_PARTITION_TYPE_APP = 0x00,
+	ESP_PARTITION_TYPE_DATA = 0x01,
+} esp_partition_type_t;
+
+typedef int esp_partition_subtype_t;
+
+#define ESP_PARTITION_SUBTYPE_ANY		0xff
+
+typedef struct
+{
+	esp_partition_type_t type;
+	esp_partition_subtype_t subtype;
+	uint32_t address;
+	uint32_t size;
+	char label[17];
+} esp_partition_t;
+
+// ESP-IDF 4.4 memory map types
+typedef uint32_t spi_flash_mmap_handle_t;
+typedef enum { SPI_FLASH_MMAP_DATA, SPI_FLASH_MMAP_INST } spi_flash_mmap_memory_t;
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label);
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t offset, void *dst, size_t size);
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t offset, const void *src, size_t size);
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size);
+esp_err_t esp_partition_mmap(const esp_partition_t *partition, size_t offset, size_t size,
+		spi_flash_mmap_memory_t memory, const void **out_ptr, spi_flash_mmap_handle_t *out_handle);
+void spi_flash_munmap(spi_flash_mmap_handle_t handle);
+
+// == host only: the emulated flash =============================
+
+#define IDF_SHIM_FLASH_SECTOR_SIZE		4096
+
+/**
+ * Creates the one emulated data partition, erased. NOR flash rules apply: erases are
+ * sector aligned and set every bit, writes can only clear bits.
+ * @param label partition label.
+ * @param size partition size, a multiple of IDF_SHIM_FLASH_SECTOR_SIZE.
+ */
+void idf_shim_flash_create(const char *label, size_t size);
+
+/**
+ * Tears the next write that starts at offset: only its first bytes reach the flash,
+ * as if power failed while it was programmed.
+ * @param offset partition offset of the write to tear.
+ * @param bytes number of bytes that get written, may be 0.
+ */
+void idf_shim_flash_tear(size_t offset, size_t bytes);
+
+/**
+ * @return true once the armed tear happened, then disarms it.
+ */
+bool idf_shim_flash_torn(void);
+
+/**
+ * @return number of writes that tried to set a cleared bit, which flash cannot do.
+ */
+unsigned idf_shim_flash_overwrites(void);
+
+/**
+ * @return erase count of a sector.
+ */
+unsigned idf_shim_flash_erases(size_t sector);
+
+#endif /* IDF_SHIM_ESP_PARTITION_H_ */
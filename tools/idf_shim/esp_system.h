@@ -0,0 +1,43 @@
+#ifndef IDF_SHIM_ESP_SYSTEM_H_
+#define IDF_SHIM_ESP_SYSTEM_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "esp_err.h"
+
+typedef enum
+{
+	ESP_RST_UNKNOWN,
+	ESP_RST_POWERON,
+	ESP_RST_SW,
+	ESP_RST_DEEPSLEEP,
+} esp_reset_reason_t;
+
+/**
+ * Defined by the host program, which decides how the simulated device was reset.
+ */
+esp_reset_reason_t esp_reset_reason(void);
+
+/**
+ * Defined by the host program, which decides what a restart does.
+ */
+void esp_restart(void);
+
+static inline uint32_t esp_random(void)
+{
+	return (uint32_t)random() ^ (uint32_t)random() << 16;
+}
+
+// The host has no heap accounting; the figures read 0
+static inline uint32_t esp_get_free_heap_size(void)
+{
+	return 0;
+}
+
+static inline uint32_t esp_get_minimum_free_heap_size(void)
+{
+	return 0;
+}
+
+#endif /* IDF_SHIM_ESP_SYSTEM_H_ */
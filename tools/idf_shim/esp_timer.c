@@ -0,0 +1,85 @@
+/*------------------------------------------------------------------------------
+
+	esp_timer on the host monotonic clock
+
+---------------------------------------------------------------------------------*/
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "esp_timer.h"
+
+struct idf_shim_timer
+{
+	esp_timer_create_args_t args;
+	uint64_t timeout_us;
+};
+
+static int64_t g_offset_us;
+static pthread_once_t g_start_once = PTHREAD_ONCE_INIT;
+
+static int64_t monotonic_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void timer_start_clock(void)
+{
+	g_offset_us = -monotonic_us();
+}
+
+int64_t esp_timer_get_time(void)
+{
+	pthread_once(&g_start_once, timer_start_clock);
+	return monotonic_us() + g_offset_us;
+}
+
+void idf_shim_timer_set_uptime(int64_t uptime_us)
+{
+	pthread_once(&g_start_once, timer_start_clock);
+	g_offset_us = uptime_us - monotonic_us();
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *args, esp_timer_handle_t *out_handle)
+{
+	struct idf_shim_timer *timer = calloc(1, sizeof(*timer));
+
+	if (timer == NULL)
+	{
+		return ESP_ERR_NO_MEM;
+	}
+
+	timer->args = *args;
+	*out_handle = timer;
+
+	return ESP_OK;
+}
+
+static void *timer_thread(void *arg)
+{
+	struct idf_shim_timer *timer = arg;
+
+	usleep(timer->timeout_us);
+	timer->args.callback(timer->args.arg);
+
+	return NULL;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+	pthread_t thread;
+
+	timer->timeout_us = timeout_us;
+	if (pthread_create(&thread, NULL, timer_thread, timer) != 0)
+	{
+		return ESP_ERR_NO_MEM;
+	}
+	pthread_detach(thread);
+
+	return ESP_OK;
+}
@@ -0,0 +1,45 @@
+#ifndef IDF_SHIM_ESP_TIMER_H_
+#define IDF_SHIM_ESP_TIMER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+typedef struct idf_shim_timer *esp_timer_handle_t;
+typedef void (*esp_timer_cb_t)(void *arg);
+
+typedef enum
+{
+	ESP_TIMER_TASK,
+} esp_timer_dispatch_t;
+
+typedef struct
+{
+	esp_timer_cb_t callback;
+	void *arg;
+	esp_timer_dispatch_t dispatch_method;
+	const char *name;
+	bool skip_unhandled_events;
+} esp_timer_create_args_t;
+
+/**
+ * @return microseconds since the program started, plus the uptime set by idf_shim_timer_set_uptime.
+ */
+int64_t esp_timer_get_time(void);
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *args, esp_timer_handle_t *out_handle);
+
+/**
+ * Runs the callback once on its own thread after timeout_us.
+ */
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us);
+
+// == host only =================================================
+
+/**
+ * Sets the current uptime, as if the device had been running that long.
+ */
+void idf_shim_timer_set_uptime(int64_t uptime_us);
+
+#endif /* IDF_SHIM_ESP_TIMER_H_ */
@@ -0,0 +1,34 @@
+#ifndef IDF_SHIM_ESP_WIFI_H_
+#define IDF_SHIM_ESP_WIFI_H_
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+typedef enum
+{
+	WIFI_BW_HT20 = 1,
+	WIFI_BW_HT40,
+} wifi_bandwidth_t;
+
+typedef enum
+{
+	WIFI_PS_NONE,
+	WIFI_PS_MIN_MODEM,
+	WIFI_PS_MAX_MODEM,
+} wifi_ps_type_t;
+
+typedef struct
+{
+	uint8_t bssid[6];
+	uint8_t ssid[33];
+	uint8_t primary;
+	int8_t rssi;
+} wifi_ap_record_t;
+
+/**
+ * Defined by the host program, which decides what the station is associated with.
+ */
+esp_err_t esp_wifi_sta_get_ap_info(wifi_ap_record_t *ap_info);
+
+#endif /* IDF_SHIM_ESP_WIFI_H_ */
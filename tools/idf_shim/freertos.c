@@ -0,0 +1,277 @@
+/*------------------------------------------------------------------------------
+
+	FreeRTOS tasks and queues on POSIX threads
+
+	Enough of the task, queue and notification API for the main/ sources that
+	hand work between tasks. Ticks are milliseconds.
+
+---------------------------------------------------------------------------------*/
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+
+struct idf_shim_task
+{
+	pthread_t thread;
+	TaskFunction_t fn;
+	void *arg;
+	pthread_mutex_t lock;
+	pthread_cond_t notified;
+	uint32_t notify_count;
+};
+
+struct idf_shim_queue
+{
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	UBaseType_t length;
+	UBaseType_t item_size;
+	UBaseType_t count;
+	UBaseType_t head;				// oldest item
+	uint8_t *items;
+};
+
+// Task of the calling thread, created on first use for threads not started as tasks
+static __thread struct idf_shim_task *current_task;
+
+/**
+ * Initializes a condition variable that waits on the monotonic clock.
+ */
+static void cond_init(pthread_cond_t *cond)
+{
+	pthread_condattr_t attr;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(cond, &attr);
+	pthread_condattr_destroy(&attr);
+}
+
+/**
+ * @return the absolute monotonic time ticks from now.
+ */
+static struct timespec deadline(TickType_t ticks)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	ts.tv_sec += ticks / 1000;
+	ts.tv_nsec += (long)(ticks % 1000) * 1000000;
+	if (ts.tv_nsec >= 1000000000)
+	{
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+
+	return ts;
+}
+
+/**
+ * Waits on a condition until it is signalled or the deadline passes; portMAX_DELAY waits forever.
+ * @return false on timeout.
+ */
+static bool cond_wait(pthread_cond_t *cond, pthread_mutex_t *lock, TickType_t ticks, const struct timespec *until)
+{
+	if (ticks == portMAX_DELAY)
+	{
+		pthread_cond_wait(cond, lock);
+		return true;
+	}
+
+	return pthread_cond_timedwait(cond, lock, until) != ETIMEDOUT;
+}
+
+static struct idf_shim_task *task_new(TaskFunction_t fn, void *arg)
+{
+	struct idf_shim_task *task = calloc(1, sizeof(*task));
+
+	if (task)
+	{
+		task->fn = fn;
+		task->arg = arg;
+		pthread_mutex_init(&task->lock, NULL);
+		cond_init(&task->notified);
+	}
+
+	return task;
+}
+
+static void *task_main(void *arg)
+{
+	current_task = arg;
+	current_task->fn(current_task->arg);
+
+	// FreeRTOS tasks must not return; treat it as deleting itself
+	return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *arg,
+		UBaseType_t priority, TaskHandle_t *created, BaseType_t core_id)
+{
+	struct idf_shim_task *task = task_new(fn, arg);
+
+	// threads have no name, fixed stack or core, and share the host scheduler's priorities
+	(void)name;
+	(void)stack_depth;
+	(void)priority;
+	(void)core_id;
+
+	if (task == NULL || pthread_create(&task->thread, NULL, task_main, task) != 0)
+	{
+		free(task);
+		return pdFALSE;
+	}
+	pthread_detach(task->thread);
+
+	if (created)
+	{
+		*created = task;
+	}
+
+	return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+	if (task == NULL || task == current_task)
+	{
+		pthread_exit(NULL);
+	}
+
+	pthread_cancel(task->thread);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+	usleep((useconds_t)ticks * 1000);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+	if (current_task == NULL)
+	{
+		current_task = task_new(NULL, NULL);
+		current_task->thread = pthread_self();
+	}
+
+	return current_task;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+	pthread_mutex_lock(&task->lock);
+	task->notify_count++;
+	pthread_cond_signal(&task->notified);
+	pthread_mutex_unlock(&task->lock);
+
+	return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks)
+{
+	struct idf_shim_task *task = xTaskGetCurrentTaskHandle();
+	struct timespec until = deadline(ticks);
+	uint32_t count;
+
+	pthread_mutex_lock(&task->lock);
+	while (task->notify_count == 0 && ticks != 0 && cond_wait(&task->notified, &task->lock, ticks, &until))
+	{
+	}
+	count = task->notify_count;
+	if (count)
+	{
+		task->notify_count = clear_on_exit ? 0 : count - 1;
+	}
+	pthread_mutex_unlock(&task->lock);
+
+	return count;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+	struct idf_shim_queue *queue = calloc(1, sizeof(*queue));
+
+	if (queue == NULL || (queue->items = malloc((size_t)length * item_size)) == NULL)
+	{
+		free(queue);
+		return NULL;
+	}
+
+	pthread_mutex_init(&queue->lock, NULL);
+	cond_init(&queue->changed);
+	queue->length = length;
+	queue->item_size = item_size;
+
+	return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+	pthread_mutex_destroy(&queue->lock);
+	pthread_cond_destroy(&queue->changed);
+	free(queue->items);
+	free(queue);
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks)
+{
+	struct timespec until = deadline(ticks);
+	BaseType_t ret = pdFALSE;
+
+	pthread_mutex_lock(&queue->lock);
+	while (queue->count == queue->length && ticks != 0 && cond_wait(&queue->changed, &queue->lock, ticks, &until))
+	{
+	}
+	if (queue->count < queue->length)
+	{
+		memcpy(queue->items + (size_t)((queue->head + queue->count) % queue->length) * queue->item_size, item, queue->item_size);
+		queue->count++;
+		pthread_cond_broadcast(&queue->changed);
+		ret = pdTRUE;
+	}
+	pthread_mutex_unlock(&queue->lock);
+
+	return ret;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks)
+{
+	struct timespec until = deadline(ticks);
+	BaseType_t ret = pdFALSE;
+
+	pthread_mutex_lock(&queue->lock);
+	while (queue->count == 0 && ticks != 0 && cond_wait(&queue->changed, &queue->lock, ticks, &until))
+	{
+	}
+	if (queue->count > 0)
+	{
+		memcpy(item, queue->items + (size_t)queue->head * queue->item_size, queue->item_size);
+		queue->head = (queue->head + 1) % queue->length;
+		queue->count--;
+		pthread_cond_broadcast(&queue->changed);
+		ret = pdTRUE;
+	}
+	pthread_mutex_unlock(&queue->lock);
+
+	return ret;
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue)
+{
+	UBaseType_t spaces;
+
+	pthread_mutex_lock(&queue->lock);
+	spaces = queue->length - queue->count;
+	pthread_mutex_unlock(&queue->lock);
+
+	return spaces;
+}
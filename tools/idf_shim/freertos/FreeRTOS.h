@@ -0,0 +1,18 @@
+#ifndef IDF_SHIM_FREERTOS_H_
+#define IDF_SHIM_FREERTOS_H_
+
+#include <stdint.h>
+
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdFALSE					0
+#define pdTRUE					1
+#define pdPASS					pdTRUE
+#define portMAX_DELAY			((TickType_t)0xFFFFFFFF)
+#define portTICK_PERIOD_MS		1
+#define portTICK_RATE_MS		portTICK_PERIOD_MS
+#define pdMS_TO_TICKS(ms)		((TickType_t)(ms))
+
+#endif /* IDF_SHIM_FREERTOS_H_ */
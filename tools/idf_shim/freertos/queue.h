@@ -0,0 +1,16 @@
+#ifndef IDF_SHIM_QUEUE_H_
+#define IDF_SHIM_QUEUE_H_
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// Queues of fixed size items, copied in and out as in FreeRTOS
+typedef struct idf_shim_queue *QueueHandle_t;
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size);
+void vQueueDelete(QueueHandle_t queue);
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks);
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks);
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue);
+
+#endif /* IDF_SHIM_QUEUE_H_ */
@@ -0,0 +1,40 @@
+#ifndef IDF_SHIM_SEMPHR_H_
+#define IDF_SHIM_SEMPHR_H_
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+// Mutexes map to pthread mutexes; a zero timeout tries, any other waits forever
+typedef pthread_mutex_t *SemaphoreHandle_t;
+
+static inline SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+	pthread_mutex_t *m = malloc(sizeof(*m));
+
+	if (m)
+	{
+		pthread_mutex_init(m, NULL);
+	}
+	return m;
+}
+
+static inline BaseType_t xSemaphoreTake(SemaphoreHandle_t m, TickType_t ticks)
+{
+	if (ticks == 0)
+	{
+		return pthread_mutex_trylock(m) == 0 ? pdTRUE : pdFALSE;
+	}
+	pthread_mutex_lock(m);
+	return pdTRUE;
+}
+
+static inline BaseType_t xSemaphoreGive(SemaphoreHandle_t m)
+{
+	pthread_mutex_unlock(m);
+	return pdTRUE;
+}
+
+#endif /* IDF_SHIM_SEMPHR_H_ */
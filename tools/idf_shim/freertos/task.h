@@ -0,0 +1,39 @@
+#ifndef IDF_SHIM_TASK_H_
+#define IDF_SHIM_TASK_H_
+
+#include "freertos/FreeRTOS.h"
+
+// Tasks map to threads; priorities and cores are ignored
+typedef struct idf_shim_task *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *arg);
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *arg,
+		UBaseType_t priority, TaskHandle_t *created, BaseType_t core_id);
+
+/**
+ * Ends a task; NULL ends the calling one.
+ */
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+
+/**
+ * Stack use is not measured on the host, so no task is found by name.
+ * @return NULL
+ */
+static inline TaskHandle_t xTaskGetHandle(const char *name)
+{
+	(void)name;
+	return NULL;
+}
+
+static inline UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task)
+{
+	(void)task;
+	return 0;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks);
+
+#endif /* IDF_SHIM_TASK_H_ */
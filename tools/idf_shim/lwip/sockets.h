@@ -0,0 +1,10 @@
+#ifndef IDF_SHIM_LWIP_SOCKETS_H_
+#define IDF_SHIM_LWIP_SOCKETS_H_
+
+// lwIP implements the BSD socket API, the host has the real one
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#endif /* IDF_SHIM_LWIP_SOCKETS_H_ */
@@ -0,0 +1,21 @@
+#ifndef IDF_SHIM_MBEDTLS_SHA256_H_
+#define IDF_SHIM_MBEDTLS_SHA256_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// SHA-256 with the mbedTLS 2 API of ESP-IDF 4.4; SHA-224 is not supported
+typedef struct
+{
+	uint32_t state[8];
+	uint64_t total;					// bytes hashed
+	uint8_t buffer[64];
+} mbedtls_sha256_context;
+
+void mbedtls_sha256_init(mbedtls_sha256_context *ctx);
+void mbedtls_sha256_free(mbedtls_sha256_context *ctx);
+int mbedtls_sha256_starts_ret(mbedtls_sha256_context *ctx, int is224);
+int mbedtls_sha256_update_ret(mbedtls_sha256_context *ctx, const unsigned char *input, size_t ilen);
+int mbedtls_sha256_finish_ret(mbedtls_sha256_context *ctx, unsigned char output[32]);
+
+#endif /* IDF_SHIM_MBEDTLS_SHA256_H_ */
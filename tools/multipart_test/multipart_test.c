@@ -0,0 +1,462 @@
+/*------------------------------------------------------------------------------
+
+	Multipart parser split test
+
+	Host program that feeds generated multipart/form-data bodies through the
+	streaming parser in main/multipart.c, cut into pieces at random points as
+	httpd_req_recv would hand them over, and compares the part bodies that
+	come out with the ones that went in. One body set is random binary data;
+	the other fills the parts with every proper prefix of the delimiter
+	("\r", "\r\n", "\r\n-", ... "\r\n--<boundary minus its last byte>"),
+	including one right before the real delimiter, and is also cut at every
+	single position and fed one byte at a time.
+
+	Build and run from the repository root:
+
+		gcc -O2 -Wall -Imain -o multipart_test tools/multipart_test/multipart_test.c main/multipart.c
+		./multipart_test [-n bodies] [-s seed]
+
+	The exit code is non-zero when a part body differs, the parser stops
+	before the closing delimiter, or a malformed body is accepted.
+
+---------------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "multipart.h"
+
+#define MAX_PARTS			4
+#define MAX_PART_LEN		8192
+#define MAX_BODY_LEN		(MAX_PARTS * (MAX_PART_LEN + 256) + 256)
+
+#define CHECK(cond, ...) \
+	do { if (!(cond)) { failures++; printf("FAIL %s:%d: ", __func__, __LINE__); printf(__VA_ARGS__); printf("\n"); } } while (0)
+
+static unsigned failures;
+static uint32_t rng_state = 0x2545F491;
+
+static uint32_t rng_next(void)
+{
+	// xorshift32: deterministic for a given seed on every host
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}
+
+static size_t rng_range(size_t lo, size_t hi)
+{
+	return lo + rng_next() % (uint32_t)(hi - lo + 1);
+}
+
+/**
+ * A multipart body and the part bodies it carries
+ */
+typedef struct
+{
+	const char *boundary;
+	uint8_t parts[MAX_PARTS][MAX_PART_LEN];
+	size_t part_len[MAX_PARTS];
+	int part_count;
+	uint8_t body[MAX_BODY_LEN];
+	size_t body_len;
+} test_body_t;
+
+/**
+ * What the parser handed to the data callback
+ */
+typedef struct
+{
+	uint8_t parts[MAX_PARTS][MAX_PART_LEN];
+	size_t part_len[MAX_PARTS];
+	int last_part;
+	bool overflow;
+	bool out_of_order;
+} received_t;
+
+static test_body_t body;
+static received_t received;
+
+static void append(const void *data, size_t len)
+{
+	memcpy(body.body + body.body_len, data, len);
+	body.body_len += len;
+}
+
+static void append_str(const char *s)
+{
+	append(s, strlen(s));
+}
+
+/**
+ * Lays out the parts as a browser would: optional preamble, then every part with
+ * its headers, the closing delimiter and an epilogue the parser has to ignore.
+ * RFC 2046 allows parts without headers, so those are laid out too.
+ */
+static void build_body(bool preamble, bool headers)
+{
+	body.body_len = 0;
+
+	if (preamble)
+	{
+		append_str("This is the preamble, ignored.\r\n");
+	}
+
+	for (int i = 0; i < body.part_count; i++)
+	{
+		if (i > 0)
+		{
+			append_str("\r\n");
+		}
+		append_str("--");
+		append_str(body.boundary);
+		append_str("\r\n");
+		if (headers)
+		{
+			append_str("Content-Disposition: form-data; name=\"file\"; filename=\"elis.bin\"\r\n"
+					"Content-Type: application/octet-stream\r\n");
+		}
+		append_str("\r\n");
+		append(body.parts[i], body.part_len[i]);
+	}
+
+	append_str("\r\n--");
+	append_str(body.boundary);
+	append_str("--\r\nepilogue \r\n--");
+	append_str(body.boundary);
+	append_str("\r\n");
+}
+
+static bool collect(void *arg, int part, const uint8_t *data, size_t len)
+{
+	received_t *r = arg;
+
+	if (part < r->last_part || part < 1 || part > MAX_PARTS)
+	{
+		r->out_of_order = true;
+		return true;
+	}
+	r->last_part = part;
+
+	if (r->part_len[part - 1] + len > MAX_PART_LEN)
+	{
+		r->overflow = true;
+		return true;
+	}
+
+	memcpy(r->parts[part - 1] + r->part_len[part - 1], data, len);
+	r->part_len[part - 1] += len;
+
+	return true;
+}
+
+/**
+ * Feeds the body in pieces ending at the given offsets and compares the parts.
+ * @param cuts ascending offsets inside the body, the last piece ends at the body end.
+ * @return false on a mismatch, after reporting it.
+ */
+static bool run(const size_t *cuts, size_t cut_count, const char *what)
+{
+	multipart_parser_t parser;
+	multipart_status_e status = MULTIPART_MORE;
+	size_t from = 0;
+	unsigned before = failures;
+
+	memset(&received, 0, sizeof(received));
+	multipart_init(&parser, body.boundary, collect, &received);
+
+	for (size_t k = 0; k <= cut_count && status == MULTIPART_MORE; k++)
+	{
+		size_t to = k < cut_count ? cuts[k] : body.body_len;
+
+		status = multipart_feed(&parser, body.body + from, to - from);
+		from = to;
+	}
+
+	CHECK(status == MULTIPART_DONE, "%s: status %d at offset %zu of %zu", what, status, from, body.body_len);
+	CHECK(!received.overflow && !received.out_of_order, "%s: part data overflowed or came out of order", what);
+	CHECK(parser.part == body.part_count, "%s: %d parts, expected %d", what, parser.part, body.part_count);
+
+	for (int i = 0; i < body.part_count && failures == before; i++)
+	{
+		size_t n = received.part_len[i] < body.part_len[i] ? received.part_len[i] : body.part_len[i];
+		size_t diff = 0;
+
+		while (diff < n && received.parts[i][diff] == body.parts[i][diff])
+		{
+			diff++;
+		}
+		CHECK(received.part_len[i] == body.part_len[i] && diff == n,
+				"%s: part %d has %zu bytes, expected %zu, first difference at %zu",
+				what, i + 1, received.part_len[i], body.part_len[i], diff);
+	}
+
+	return failures == before;
+}
+
+/**
+ * Cuts the body into random pieces, mostly small ones around the size of a header.
+ */
+static bool run_random_split(const char *what)
+{
+	static size_t cuts[MAX_BODY_LEN];
+	size_t count = 0;
+	size_t max_piece = rng_range(0, 3) == 0 ? 4096 : rng_range(1, 80);
+
+	for (size_t at = rng_range(1, max_piece); at < body.body_len; at += rng_range(1, max_piece))
+	{
+		cuts[count++] = at;
+	}
+
+	return run(cuts, count, what);
+}
+
+/**
+ * Changes the last byte of every delimiter that turned up in the random part data;
+ * a real client picks a boundary that does not occur in the parts.
+ */
+static void break_delimiters(void)
+{
+	char delimiter[MULTIPART_BOUNDARY_MAX + 5];
+	size_t delimiter_len = snprintf(delimiter, sizeof(delimiter), "\r\n--%s", body.boundary);
+
+	for (int i = 0; i < body.part_count; i++)
+	{
+		for (size_t j = 0; j + delimiter_len <= body.part_len[i]; j++)
+		{
+			if (memcmp(body.parts[i] + j, delimiter, delimiter_len) == 0)
+			{
+				body.parts[i][j + delimiter_len - 1] ^= 1;
+			}
+		}
+	}
+}
+
+/**
+ * Random binary parts, full of CR, LF and '-' so near-delimiters are frequent,
+ * each body cut at random points.
+ */
+static void test_random_split(unsigned bodies)
+{
+	static const char *const boundaries[] = {
+		"----WebKitFormBoundary7MA4YWxkTrZu0gW", "x", "--", "---------------------------735323031399963166993862150",
+	};
+	unsigned mismatched = 0;
+
+	for (unsigned n = 0; n < bodies && mismatched < 5; n++)
+	{
+		body.boundary = boundaries[n % (sizeof(boundaries) / sizeof(boundaries[0]))];
+		body.part_count = (int)rng_range(1, MAX_PARTS);
+
+		for (int i = 0; i < body.part_count; i++)
+		{
+			static const uint8_t alphabet[] = { '\r', '\n', '-', 'x', 0x00, 0xE9, '7' };
+
+			body.part_len[i] = rng_range(0, 9) == 0 ? 0 : rng_range(1, MAX_PART_LEN);
+			for (size_t j = 0; j < body.part_len[i]; j++)
+			{
+				uint32_t r = rng_next();
+
+				body.parts[i][j] = (r & 1) ? alphabet[(r >> 1) % sizeof(alphabet)] : (uint8_t)(r >> 8);
+			}
+		}
+
+		break_delimiters();
+		build_body(n & 1, n % 5 != 0);
+		if (!run_random_split("random split"))
+		{
+			mismatched++;
+		}
+	}
+}
+
+/**
+ * Parts made of every proper prefix of the delimiter, each followed by a byte that
+ * breaks it; the last part ends with one so the real delimiter follows a false start.
+ */
+static void build_prefix_body(const char *boundary)
+{
+	char delimiter[MULTIPART_BOUNDARY_MAX + 5];
+	size_t delimiter_len = snprintf(delimiter, sizeof(delimiter), "\r\n--%s", boundary);
+	static const char breakers[] = "x\r-";
+
+	body.boundary = boundary;
+	body.part_count = 2;
+
+	for (int i = 0; i < body.part_count; i++)
+	{
+		size_t len = 0;
+
+		for (size_t prefix = 1; prefix < delimiter_len; prefix++)
+		{
+			memcpy(body.parts[i] + len, delimiter, prefix);
+			len += prefix;
+			char breaker = breakers[(prefix + i) % (sizeof(breakers) - 1)];
+
+			// CR never continues a delimiter prefix
+			body.parts[i][len++] = breaker == delimiter[prefix] ? '\r' : breaker;
+		}
+
+		// ends with a false start right before the real delimiter
+		memcpy(body.parts[i] + len, delimiter, delimiter_len - 1);
+		len += delimiter_len - 1;
+		body.part_len[i] = len;
+	}
+
+	build_body(false, true);
+}
+
+/**
+ * The delimiter prefix body cut at every single position, one byte at a time and
+ * at random points.
+ */
+static void test_boundary_prefix(unsigned bodies)
+{
+	static const char *const boundaries[] = { "----WebKitFormBoundaryQ2xd", "b" };
+	static size_t cuts[MAX_BODY_LEN];
+
+	for (size_t b = 0; b < sizeof(boundaries) / sizeof(boundaries[0]); b++)
+	{
+		build_prefix_body(boundaries[b]);
+
+		for (size_t at = 1; at < body.body_len; at++)
+		{
+			if (!run(&at, 1, "prefix body, one cut"))
+			{
+				printf("  cut at offset %zu of %zu\n", at, body.body_len);
+				break;
+			}
+		}
+
+		for (size_t at = 1; at < body.body_len; at++)
+		{
+			cuts[at - 1] = at;
+		}
+		run(cuts, body.body_len - 1, "prefix body, byte by byte");
+
+		for (unsigned n = 0; n < bodies; n++)
+		{
+			if (!run_random_split("prefix body, random split"))
+			{
+				break;
+			}
+		}
+	}
+}
+
+/**
+ * A stray CR right before the line break that ends the headers still ends them.
+ */
+static void test_stray_cr_header(void)
+{
+	body.boundary = "B";
+	body.part_count = 1;
+	memcpy(body.parts[0], "data", 4);
+	body.part_len[0] = 4;
+	body.body_len = 0;
+	append_str("--B\r\nX-Note: stray\r\r\n\r\ndata\r\n--B--");
+
+	run(NULL, 0, "stray CR in the headers");
+}
+
+static bool fail_data(void *arg, int part, const uint8_t *data, size_t len)
+{
+	(void)arg;
+	(void)part;
+	(void)data;
+	(void)len;
+
+	return false;
+}
+
+/**
+ * Malformed bodies and a failing callback end in MULTIPART_ERROR, never MULTIPART_DONE.
+ */
+static void test_errors(void)
+{
+	static const char *const malformed[] = {
+		"--B\r\nContent-Type: text/plain\r\n\r\ndata\r\n--Bxx",		// neither "--" nor CRLF after a delimiter
+		"--Bxx",
+	};
+	multipart_parser_t parser;
+	received_t r;
+
+	for (size_t k = 0; k < sizeof(malformed) / sizeof(malformed[0]); k++)
+	{
+		memset(&r, 0, sizeof(r));
+		multipart_init(&parser, "B", collect, &r);
+		CHECK(multipart_feed(&parser, (const uint8_t *)malformed[k], strlen(malformed[k])) == MULTIPART_ERROR,
+				"malformed body %zu was not rejected", k);
+	}
+
+	// part headers that never end
+	static char long_headers[MULTIPART_HEADERS_MAX + 64];
+
+	memset(long_headers, 'h', sizeof(long_headers));
+	memcpy(long_headers, "--B\r\n", 5);
+	multipart_init(&parser, "B", collect, &r);
+	CHECK(multipart_feed(&parser, (const uint8_t *)long_headers, sizeof(long_headers)) == MULTIPART_ERROR,
+			"a header block over %d bytes was accepted", MULTIPART_HEADERS_MAX);
+
+	const char *ok = "--B\r\n\r\ndata\r\n--B--";
+
+	multipart_init(&parser, "B", fail_data, NULL);
+	CHECK(multipart_feed(&parser, (const uint8_t *)ok, strlen(ok)) == MULTIPART_ERROR, "a failing callback did not stop the parser");
+
+	char long_boundary[MULTIPART_BOUNDARY_MAX + 2];
+
+	memset(long_boundary, 'b', sizeof(long_boundary) - 1);
+	long_boundary[sizeof(long_boundary) - 1] = '\0';
+	CHECK(!multipart_init(&parser, long_boundary, collect, &r), "a boundary over %d bytes was accepted", MULTIPART_BOUNDARY_MAX);
+	CHECK(!multipart_init(&parser, "", collect, &r), "an empty boundary was accepted");
+}
+
+/**
+ * Boundary parameter of the Content-Type header, bare and quoted.
+ */
+static void test_get_boundary(void)
+{
+	char boundary[MULTIPART_BOUNDARY_MAX + 1];
+
+	CHECK(multipart_get_boundary("multipart/form-data; boundary=----abc", boundary) && strcmp(boundary, "----abc") == 0,
+			"bare boundary read as \"%s\"", boundary);
+	CHECK(multipart_get_boundary("multipart/form-data; boundary=\"a b;c\"; charset=utf-8", boundary)
+			&& strcmp(boundary, "a b;c") == 0, "quoted boundary read as \"%s\"", boundary);
+	CHECK(multipart_get_boundary("multipart/form-data; boundary=xyz; charset=utf-8", boundary) && strcmp(boundary, "xyz") == 0,
+			"boundary before another parameter read as \"%s\"", boundary);
+	CHECK(!multipart_get_boundary("multipart/form-data", boundary), "a missing boundary was found");
+	CHECK(!multipart_get_boundary("multipart/form-data; boundary=", boundary), "an empty boundary was found");
+}
+
+int main(int argc, char **argv)
+{
+	unsigned bodies = 2000;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) bodies = strtoul(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) rng_state = (uint32_t)strtoul(argv[++i], NULL, 0) | 1;
+		else
+		{
+			fprintf(stderr, "usage: %s [-n bodies] [-s seed]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	test_random_split(bodies);
+	test_boundary_prefix(bodies / 10);
+	test_stray_cr_header();
+	test_errors();
+	test_get_boundary();
+
+	if (failures)
+	{
+		printf("%u check(s) failed\n", failures);
+		return 1;
+	}
+
+	printf("multipart: all checks passed\n");
+	return 0;
+}
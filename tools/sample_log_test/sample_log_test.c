@@ -0,0 +1,265 @@
+/*------------------------------------------------------------------------------
+
+	Sample log power-fail test
+
+	Host program that runs main/sample_log.c on an emulated flash partition
+	(tools/idf_shim) and reboots it at the awkward moments: with samples still
+	in RAM, after the ring wrapped, in the middle of a record batch and in the
+	middle of a sector rollover. After every reboot the header scan has to find
+	the append position again, keep every complete record readable in order
+	and never program a slot twice.
+
+	Build and run from the repository root:
+
+		gcc -O2 -Wall -Itools/idf_shim -Imain -o sample_log_test tools/sample_log_test/sample_log_test.c \
+			main/sample_log.c tools/idf_shim/esp_partition.c -pthread
+		./sample_log_test
+
+	The exit code is non-zero when a check fails.
+
+---------------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_partition.h"
+#include "esp_system.h"
+#include "sample_log.h"
+
+#define TEST_SECTORS		8
+#define MAX_RECORDS			(TEST_SECTORS * SAMPLE_LOG_RECORDS_PER_SECTOR)
+
+#define CHECK(cond, ...) \
+	do { if (!(cond)) { failures++; printf("FAIL %s:%d: ", __func__, __LINE__); printf(__VA_ARGS__); printf("\n"); } } while (0)
+
+static unsigned failures;
+static esp_reset_reason_t reset_reason = ESP_RST_POWERON;
+static uint32_t next_time_s;
+
+esp_reset_reason_t esp_reset_reason(void)
+{
+	return reset_reason;
+}
+
+typedef struct
+{
+	sample_log_record_t records[MAX_RECORDS];
+	size_t count;				// valid records
+	size_t slots;				// written slots, torn ones included
+} collected_t;
+
+static collected_t seen;
+
+static bool collect_visit(const sample_log_record_t *records, size_t count, void *arg)
+{
+	collected_t *c = arg;
+
+	for (size_t i = 0; i < count; i++)
+	{
+		c->slots++;
+		if (sample_log_record_valid(&records[i]) && c->count < MAX_RECORDS)
+		{
+			c->records[c->count++] = records[i];
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Reads the whole log and checks the records come oldest first.
+ */
+static const collected_t *collect(void)
+{
+	memset(&seen, 0, sizeof(seen));
+	sample_log_for_each(collect_visit, &seen);
+
+	for (size_t i = 1; i < seen.count; i++)
+	{
+		if (seen.records[i].seq <= seen.records[i - 1].seq)
+		{
+			CHECK(false, "record %zu has seq %u after %u", i, seen.records[i].seq, seen.records[i - 1].seq);
+			break;
+		}
+	}
+
+	return &seen;
+}
+
+static void reboot(esp_reset_reason_t reason)
+{
+	reset_reason = reason;
+	CHECK(sample_log_init() == ESP_OK, "sample_log_init failed");
+}
+
+static void append(size_t n)
+{
+	for (size_t i = 0; i < n; i++, next_time_s++)
+	{
+		sample_log_append(next_time_s % 3, next_time_s, (int16_t)(next_time_s * 7), (uint16_t)(next_time_s * 3));
+	}
+}
+
+static void fresh_flash(void)
+{
+	idf_shim_flash_create(SAMPLE_LOG_PARTITION_LABEL, TEST_SECTORS * SAMPLE_LOG_SECTOR_SIZE);
+	next_time_s = 0;
+	reboot(ESP_RST_POWERON);
+}
+
+/**
+ * Records survive a reboot, queued ones are lost, and numbering and boot ids continue.
+ */
+static void test_reboot(void)
+{
+	fresh_flash();
+	CHECK(sample_log_boot_id() == 0, "boot id %u on an empty log", sample_log_boot_id());
+	CHECK(collect()->count == 0, "empty log has %zu records", seen.count);
+
+	append(20);
+	sample_log_flush();
+	append(3);									// still queued when power goes
+
+	reboot(ESP_RST_POWERON);
+	CHECK(sample_log_boot_id() == 1, "boot id %u after one reboot", sample_log_boot_id());
+	CHECK(collect()->count == 20, "%zu records after reboot, expected 20", seen.count);
+	CHECK(seen.count && seen.records[seen.count - 1].seq == 19, "last seq %u", seen.records[seen.count - 1].seq);
+
+	append(5);
+	sample_log_flush();
+	collect();
+	CHECK(seen.count == 25 && seen.records[20].seq == 20 && seen.records[20].boot == 1,
+			"records after reboot continue at seq 20 with boot 1");
+
+	reboot(ESP_RST_DEEPSLEEP);
+	CHECK(sample_log_boot_id() == 1, "a deep sleep wake changed the boot id to %u", sample_log_boot_id());
+	CHECK(idf_shim_flash_overwrites() == 0, "%u writes hit programmed flash", idf_shim_flash_overwrites());
+}
+
+/**
+ * After the ring wrapped, the scan still finds the newest sector and erases stay even.
+ */
+static void test_wrap(void)
+{
+	size_t total = 3 * MAX_RECORDS + 100;
+
+	fresh_flash();
+	append(total);
+	sample_log_flush();
+
+	reboot(ESP_RST_POWERON);
+	collect();
+	CHECK(seen.count > (TEST_SECTORS - 2) * SAMPLE_LOG_RECORDS_PER_SECTOR, "only %zu records kept", seen.count);
+	CHECK(seen.count && seen.records[seen.count - 1].seq == total - 1, "newest seq %u, expected %zu",
+			seen.records[seen.count - 1].seq, total - 1);
+	CHECK(seen.count && seen.records[seen.count - 1].seq - seen.records[0].seq == seen.count - 1,
+			"records missing between seq %u and %u", seen.records[0].seq, seen.records[seen.count - 1].seq);
+
+	unsigned min = ~0u, max = 0;
+	for (size_t s = 0; s < TEST_SECTORS; s++)
+	{
+		unsigned e = idf_shim_flash_erases(s);
+		min = e < min ? e : min;
+		max = e > max ? e : max;
+	}
+	CHECK(max - min <= 1, "erase counts spread from %u to %u", min, max);
+
+	append(10);
+	sample_log_flush();
+	CHECK(collect()->records[seen.count - 1].seq == total + 9, "append after the wrap lost its place");
+	CHECK(idf_shim_flash_overwrites() == 0, "%u writes hit programmed flash", idf_shim_flash_overwrites());
+}
+
+/**
+ * Power fails while a batch of records is programmed: the records before the tear
+ * stay, the torn slot is skipped, and appending resumes after it.
+ */
+static void test_torn_record(void)
+{
+	// the first batch fills the rest of the first page, right after the sector header
+	size_t batch = SAMPLE_LOG_PAGE_SIZE / sizeof(sample_log_record_t) - 1;
+
+	for (size_t torn_bytes = 1; torn_bytes < sizeof(sample_log_record_t); torn_bytes += 5)
+	{
+		fresh_flash();
+		idf_shim_flash_tear(sizeof(sample_log_record_t), 5 * sizeof(sample_log_record_t) + torn_bytes);
+		append(batch);
+		CHECK(idf_shim_flash_torn(), "the batch write was not torn");
+
+		reboot(ESP_RST_POWERON);
+		collect();
+		CHECK(seen.count == 5, "%zu records survived a write torn in the sixth", seen.count);
+		CHECK(seen.slots == 6, "%zu slots in use, expected 5 records and the torn one", seen.slots);
+
+		append(3);
+		sample_log_flush();
+		collect();
+		CHECK(seen.count == 8 && seen.records[5].seq == 5, "appending after a torn record: %zu records", seen.count);
+		CHECK(idf_shim_flash_overwrites() == 0, "torn slot was programmed again");
+	}
+}
+
+/**
+ * Reboot right after a clean rollover: the new sector has its header and no records,
+ * so numbering continues from the last record of the sector before it.
+ */
+static void test_reboot_after_rollover(void)
+{
+	fresh_flash();
+	append(SAMPLE_LOG_RECORDS_PER_SECTOR);
+
+	reboot(ESP_RST_POWERON);
+	append(1);
+	sample_log_flush();
+	collect();
+	CHECK(seen.count == SAMPLE_LOG_RECORDS_PER_SECTOR + 1 && seen.records[seen.count - 1].seq == SAMPLE_LOG_RECORDS_PER_SECTOR,
+			"first record of the new sector has seq %u", seen.records[seen.count - 1].seq);
+	CHECK(seen.records[seen.count - 1].boot == 1, "boot id %u after the reboot", seen.records[seen.count - 1].boot);
+}
+
+/**
+ * Power fails while the next sector is started: erased without a header, or with a
+ * partial one. The sector counts as free and the rollover is redone at boot.
+ */
+static void test_torn_rollover(void)
+{
+	static const size_t header_bytes[] = { 0, 4, 8, 15 };
+
+	for (size_t k = 0; k < sizeof(header_bytes) / sizeof(header_bytes[0]); k++)
+	{
+		fresh_flash();
+		idf_shim_flash_tear(SAMPLE_LOG_SECTOR_SIZE, header_bytes[k]);
+		append(SAMPLE_LOG_RECORDS_PER_SECTOR);		// the last one fills sector 0 and starts sector 1
+		CHECK(idf_shim_flash_torn(), "the header write was not torn");
+
+		reboot(ESP_RST_POWERON);
+		collect();
+		CHECK(seen.count == SAMPLE_LOG_RECORDS_PER_SECTOR, "%zu records after a torn rollover", seen.count);
+
+		append(20);
+		sample_log_flush();
+		collect();
+		CHECK(seen.count == SAMPLE_LOG_RECORDS_PER_SECTOR + 20
+				&& seen.records[seen.count - 1].seq == SAMPLE_LOG_RECORDS_PER_SECTOR + 19,
+				"rollover redone with %zu header bytes: %zu records", header_bytes[k], seen.count);
+		CHECK(idf_shim_flash_overwrites() == 0, "%u writes hit programmed flash", idf_shim_flash_overwrites());
+	}
+}
+
+int main(void)
+{
+	test_reboot();
+	test_wrap();
+	test_torn_record();
+	test_reboot_after_rollover();
+	test_torn_rollover();
+
+	if (failures)
+	{
+		printf("%u check(s) failed\n", failures);
+		return 1;
+	}
+
+	printf("sample log: all checks passed\n");
+	return 0;
+}
@@ -0,0 +1,241 @@
+/*------------------------------------------------------------------------------
+
+	Deep sleep duty cycle simulator
+
+	Host program that runs the scheduler in main/sleep_sched.c through days of
+	simulated time: timer wakes, sensor reads, flash stores and Wi-Fi windows
+	that succeed or fail with the network. It reports what the schedule does
+	and the energy it costs next to the always-on mode.
+
+	Build and run from the repository root:
+
+		gcc -O2 -Wall -Imain -o sleep_sim tools/sleep_sim/sleep_sim.c main/sleep_sched.c
+		./sleep_sim [-d days] [-p period_s] [-n upload_every] [-s sensors]
+		            [-a wake_ms] [-w window_s] [-o outage_start_h,outage_h] [-f fail_pct]
+
+	Defaults come from main/sleep_mode.h. The exit code is non-zero when a
+	sample is lost, duplicated or reordered on its way to the flash log, when
+	a wake leaves the grid, or when uploads stop coming while the network is
+	up, so the tool doubles as a regression check.
+
+---------------------------------------------------------------------------------*/
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sleep_mode.h"
+#include "sleep_sched.h"
+
+// Current draw at 3.3 V, typical ESP32 module figures
+#define SLEEP_UA			10.0		// deep sleep, RTC timer running
+#define ACTIVE_MA			40.0		// CPU running, radio off
+#define RADIO_MA			130.0		// Wi-Fi on, no power save; also the always-on mode
+#define SUPPLY_V			3.3
+
+#define CONNECT_S			3			// association and DHCP when the network is up
+#define BATTERY_MAH			2000.0
+
+static sleep_sched_t sched;				// RTC memory of the simulated device
+static uint32_t next_sample_id;			// stands in for the reading, checks order in the log
+static uint32_t log_next_id;			// id the flash log expects next
+static unsigned long failures;
+static uint32_t rng_state = 0x2545F491;
+
+static uint32_t rng(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}
+
+static void fail(const char *what, double t_s)
+{
+	if (failures++ < 10)
+	{
+		fprintf(stderr, "FAIL at %.0f s: %s\n", t_s, what);
+	}
+}
+
+/**
+ * Stands in for sleep_mode_store: the buffer must hold every sample read since the
+ * last store, in order.
+ */
+static void store(double t_s)
+{
+	for (int i = 0; i < sched.count; i++)
+	{
+		// the reading carries its id in the temperature field
+		uint32_t id = (uint16_t)sched.samples[i].temp | (uint32_t)sched.samples[i].hum << 16;
+
+		if (id != log_next_id)
+		{
+			fail("sample missing, duplicated or out of order in the log", t_s);
+			log_next_id = id;
+		}
+		log_next_id++;
+	}
+	sleep_sched_stored(&sched);
+}
+
+int main(int argc, char **argv)
+{
+	int days = 7;
+	uint32_t period_s = SLEEP_MODE_PERIOD_S;
+	uint32_t upload_every = SLEEP_MODE_UPLOAD_EVERY;
+	int sensors = 1;
+	double wake_ms = 250;				// boot from deep sleep, sensor reads, back to sleep
+	int window_s = SLEEP_MODE_AWAKE_S;
+	double outage_start_h = 24, outage_h = 0;
+	int fail_pct = 0;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (i + 1 < argc && strcmp(argv[i], "-d") == 0) days = atoi(argv[++i]);
+		else if (i + 1 < argc && strcmp(argv[i], "-p") == 0) period_s = atoi(argv[++i]);
+		else if (i + 1 < argc && strcmp(argv[i], "-n") == 0) upload_every = atoi(argv[++i]);
+		else if (i + 1 < argc && strcmp(argv[i], "-s") == 0) sensors = atoi(argv[++i]);
+		else if (i + 1 < argc && strcmp(argv[i], "-a") == 0) wake_ms = atof(argv[++i]);
+		else if (i + 1 < argc && strcmp(argv[i], "-w") == 0) window_s = atoi(argv[++i]);
+		else if (i + 1 < argc && strcmp(argv[i], "-o") == 0) sscanf(argv[++i], "%lf,%lf", &outage_start_h, &outage_h);
+		else if (i + 1 < argc && strcmp(argv[i], "-f") == 0) fail_pct = atoi(argv[++i]);
+		else
+		{
+			fprintf(stderr, "usage: %s [-d days] [-p period_s] [-n upload_every] [-s sensors] "
+					"[-a wake_ms] [-w window_s] [-o outage_start_h,outage_h] [-f fail_pct]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	if (period_s == 0 || sensors < 1 || sensors > SLEEP_SCHED_CAPACITY)
+	{
+		fprintf(stderr, "period must be > 0 and sensors within 1..%d\n", SLEEP_SCHED_CAPACITY);
+		return 2;
+	}
+
+	uint64_t start_us = 5000000;		// RTC clock at the first wake: power-on and boot
+	uint64_t end_us = start_us + (uint64_t)days * 86400 * 1000000;
+	uint64_t now_us = start_us;
+	uint64_t outage_from_us = start_us + (uint64_t)(outage_start_h * 3600e6);
+	uint64_t outage_to_us = outage_from_us + (uint64_t)(outage_h * 3600e6);
+	uint64_t max_upload_gap_us = (uint64_t)(upload_every << SLEEP_SCHED_MAX_BACKOFF) * period_s * 1000000
+			+ (uint64_t)(window_s + SLEEP_MODE_CONNECT_TIMEOUT_S) * 1000000 + (uint64_t)wake_ms * 1000;
+	uint64_t last_upload_us = start_us;
+	uint64_t worst_gap_us = 0;
+	double active_s = 0, radio_s = 0, sleep_s = 0;
+	unsigned long samples = 0, windows = 0;
+
+	sleep_sched_init(&sched, now_us, period_s, upload_every);
+
+	while (now_us < end_us)
+	{
+		if ((now_us - start_us) % ((uint64_t)period_s * 1000000) != 0)
+		{
+			fail("wake off the grid", now_us / 1e6);
+		}
+		if (!sleep_sched_valid(&sched, period_s, upload_every))
+		{
+			fail("state no longer valid", now_us / 1e6);
+		}
+
+		// == sampling part of the wake ==========================
+		for (int k = 0; k < sensors; k++)
+		{
+			sleep_sample_t sample = { .time_s = now_us / 1000000, .sensor = k };
+
+			sample.temp = (int16_t)(next_sample_id & 0xFFFF);
+			sample.hum = next_sample_id >> 16;
+			if (!sleep_sched_add(&sched, &sample))
+			{
+				fail("buffer overflow", now_us / 1e6);
+				continue;
+			}
+			next_sample_id++;
+			samples++;
+		}
+
+		uint64_t awake_us = (uint64_t)(wake_ms * 1000);
+
+		switch (sleep_sched_wake_done(&sched))
+		{
+			case SLEEP_SCHED_UPLOAD:
+			{
+				bool outage = now_us >= outage_from_us && now_us < outage_to_us;
+				bool ok = !outage && (int)(rng() % 100) >= fail_pct;
+				uint64_t window_us = (uint64_t)(ok ? CONNECT_S + window_s : SLEEP_MODE_CONNECT_TIMEOUT_S) * 1000000;
+
+				store(now_us / 1e6);
+				sleep_sched_uploaded(&sched, ok);
+				windows++;
+				radio_s += window_us / 1e6;
+				awake_us += window_us;
+
+				if (!outage && now_us - last_upload_us > worst_gap_us)
+				{
+					worst_gap_us = now_us - last_upload_us;
+				}
+				if (!outage && now_us - last_upload_us > max_upload_gap_us)
+				{
+					fail("no upload attempt for longer than the backoff allows", now_us / 1e6);
+				}
+				last_upload_us = now_us;
+				break;
+			}
+
+			case SLEEP_SCHED_STORE:
+				store(now_us / 1e6);
+				break;
+
+			default:
+				break;
+		}
+
+		active_s += awake_us / 1e6;
+		now_us += awake_us;
+
+		uint64_t sleep_us = sleep_sched_sleep_us(&sched, now_us);
+
+		if (sleep_us < SLEEP_SCHED_MIN_SLEEP_US)
+		{
+			fail("sleep shorter than the minimum", now_us / 1e6);
+		}
+		sleep_s += sleep_us / 1e6;
+		now_us += sleep_us;
+	}
+
+	// the last batch reaches flash at the next store, count it as delivered
+	store(now_us / 1e6);
+
+	if (log_next_id != next_sample_id)
+	{
+		fail("samples left behind", now_us / 1e6);
+	}
+
+	double total_s = active_s + sleep_s;
+	double cpu_s = active_s - radio_s;
+	double mah = (cpu_s * ACTIVE_MA + radio_s * RADIO_MA + sleep_s * SLEEP_UA / 1000) / 3600;
+	double avg_ma = mah * 3600 / total_s;
+	double mj_per_sample = mah * 3.6 * SUPPLY_V * 1000 / (samples ? samples : 1);
+	double on_mj_per_sample = RADIO_MA * SUPPLY_V * period_s / sensors;
+
+	printf("simulated %d days: period %u s, upload every %u wakes, %d sensor(s)\n", days, period_s, upload_every, sensors);
+	printf("wakes %u, samples %lu, missed slots %u\n", sched.wakes, samples, sched.missed);
+	printf("windows %lu: uploads %u, failed %u; flash stores forced by a full buffer %u\n",
+			windows, sched.uploads, sched.upload_failures, sched.stores);
+	printf("longest time between windows with the network up: %.1f min\n", worst_gap_us / 60e6);
+	printf("awake %.2f%% of the time, radio on %.2f%%\n", 100 * active_s / total_s, 100 * radio_s / total_s);
+	printf("average current %.3f mA, %.1f mJ per sample (always on: %.1f mA, %.0f mJ per sample)\n",
+			avg_ma, mj_per_sample, RADIO_MA, on_mj_per_sample);
+	printf("battery life on %.0f mAh: %.0f days (always on: %.1f days)\n",
+			BATTERY_MAH, BATTERY_MAH / avg_ma / 24, BATTERY_MAH / RADIO_MA / 24);
+
+	if (failures)
+	{
+		printf("%lu check(s) failed\n", failures);
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,149 @@
+#!/usr/bin/env python
+#
+# Prepares the embedded web page files at build time.
+#
+# For every input file this writes, into the output directory:
+#   <name>       the file as served; references from index.html to the other
+#                assets get a ?v=<hash> suffix so browsers can cache them forever
+#   <name>.gz    gzip compressed copy, deterministic (no timestamp)
+# and web_assets_table.c, the table main/web_assets.c looks paths up in: path,
+# MIME type, both embedded copies with their lengths and strong ETags, and the
+# Cache-Control policy. The table is sorted by path so lookups can bisect it.
+#
+# usage: web_assets.py <output dir> <input files...>
+
+import gzip
+import hashlib
+import io
+import os
+import re
+import sys
+
+
+MIME_TYPES = {
+    '.css': 'text/css',
+    '.gif': 'image/gif',
+    '.htm': 'text/html',
+    '.html': 'text/html',
+    '.ico': 'image/x-icon',
+    '.jpg': 'image/jpeg',
+    '.js': 'application/javascript',
+    '.json': 'application/json',
+    '.png': 'image/png',
+    '.svg': 'image/svg+xml',
+    '.txt': 'text/plain',
+    '.woff2': 'font/woff2',
+}
+
+# index.html is revalidated on every load (cheap with the ETag); files it references
+# carry a content hash in the URL so they never change; anything else, e.g. the
+# favicon the browser asks for by itself, is kept for a day
+CACHE_REVALIDATE = 'no-cache'
+CACHE_IMMUTABLE = 'public, max-age=31536000, immutable'
+CACHE_DEFAULT = 'public, max-age=86400'
+
+
+def symbol_name(name):
+    # same mangling as target_add_binary_data
+    return '_binary_' + re.sub(r'[^A-Za-z0-9]', '_', name)
+
+
+def gzip_bytes(data):
+    out = io.BytesIO()
+    with gzip.GzipFile(filename='', mode='wb', fileobj=out, compresslevel=9, mtime=0) as f:
+        f.write(data)
+    return out.getvalue()
+
+
+def content_hash(data):
+    return hashlib.sha256(data).hexdigest()[:16]
+
+
+def write_if_changed(path, data):
+    # keep timestamps of unchanged outputs so dependent objects are not rebuilt
+    if os.path.exists(path):
+        with open(path, 'rb') as f:
+            if f.read() == data:
+                return
+    with open(path, 'wb') as f:
+        f.write(data)
+
+
+def main():
+    if len(sys.argv) < 3:
+        sys.exit('usage: web_assets.py <output dir> <input files...>')
+
+    out_dir = sys.argv[1]
+    inputs = sys.argv[2:]
+    os.makedirs(out_dir, exist_ok=True)
+
+    files = {}
+    for path in inputs:
+        with open(path, 'rb') as f:
+            files[os.path.basename(path)] = f.read()
+
+    # index.html is revalidated on every load, so it carries the versions of the rest
+    hashes = {name: content_hash(data) for name, data in files.items() if name != 'index.html'}
+    versioned = set()
+    if 'index.html' in files:
+        html = files['index.html']
+        for name, digest in hashes.items():
+            pattern = re.compile(rb'''(["'])/?''' + re.escape(name.encode()) + rb'''\1''')
+            html, n = pattern.subn(lambda m: m.group(1) + name.encode() + b'?v=' + digest.encode() + m.group(1), html)
+            if n:
+                versioned.add(name)
+        files['index.html'] = html
+
+    externs = []
+    entries = []
+    for name in sorted(files):
+        data = files[name]
+        compressed = gzip_bytes(data)
+        digest = content_hash(data)
+
+        write_if_changed(os.path.join(out_dir, name), data)
+        write_if_changed(os.path.join(out_dir, name + '.gz'), compressed)
+
+        sym = symbol_name(name)
+        gz_sym = symbol_name(name + '.gz')
+        externs.append('extern const uint8_t {0}_start[] asm("{0}_start");'.format(sym))
+        externs.append('extern const uint8_t {0}_start[] asm("{0}_start");'.format(gz_sym))
+
+        if name == 'index.html':
+            cache = CACHE_REVALIDATE
+        elif name in versioned:
+            cache = CACHE_IMMUTABLE
+        else:
+            cache = CACHE_DEFAULT
+
+        mime = MIME_TYPES.get(os.path.splitext(name)[1].lower(), 'application/octet-stream')
+        entry = ('\t{{ "{{path}}", "{}", {}_start, {}, {}_start, {}, "\\"{}\\"", "\\"{}-gz\\"", "{}" }},'
+                 .format(mime, sym, len(data), gz_sym, len(compressed), digest, digest, cache))
+        entries.append(('/' + name, entry))
+        if name == 'index.html':
+            entries.append(('/', entry))
+
+    # strcmp order, which is byte order for these ASCII paths
+    entries.sort(key=lambda e: e[0].encode())
+
+    table = [
+        '// Generated by tools/web_assets.py, do not edit',
+        '#include "web_assets.h"',
+        '',
+    ]
+    table += externs
+    table += [
+        '',
+        'const web_asset_t web_assets[] = {',
+    ]
+    table += [entry.replace('{path}', path) for path, entry in entries]
+    table += [
+        '};',
+        '',
+        'const size_t web_assets_count = sizeof(web_assets) / sizeof(web_assets[0]);',
+    ]
+    write_if_changed(os.path.join(out_dir, 'web_assets_table.c'), ('\n'.join(table) + '\n').encode())
+
+
+if __name__ == '__main__':
+    main()